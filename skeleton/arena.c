@@ -0,0 +1,160 @@
+/***************************************************************************
+ *  Title: Arena
+ * -------------------------------------------------------------------------
+ *    Purpose: Bump allocation of memory that is released all at once
+ *    File: arena.c
+ ***************************************************************************/
+/***************************************************************************
+ *  Everything a command line needs while it runs, from its expanded
+ *  commands to its foreground job, is allocated from an arena that is
+ *  reset once the line is done. An arena is a list of chunks, and an
+ *  allocation just moves a pointer through the newest chunk. What has
+ *  to outlive the line is copied to the heap by its owner.
+ ***************************************************************************/
+#define __ARENA_IMPL__
+
+/************System include***********************************************/
+#include <stdlib.h>
+#include <string.h>
+
+/************Private include**********************************************/
+#include "arena.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/* the size of the first chunk of an arena */
+#define CHUNKSIZE  8192
+/* allocations are rounded up to a multiple of this */
+#define ALIGNMENT  16
+
+typedef struct arenachunk_t
+{
+  struct arenachunk_t* next;
+  size_t size;
+  /* the memory handed out, which follows the header */
+  char data[] __attribute__((aligned(ALIGNMENT)));
+} arenachunkT;
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+/* starts a new chunk */
+static void
+newchunk(arenaT*, size_t);
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+
+/*
+ * ArenaAlloc
+ *
+ * arguments:
+ *   arenaT *arena: the arena
+ *   size_t size: the number of bytes needed
+ *
+ * returns: void*: the memory, valid until the arena is reset
+ */
+void*
+ArenaAlloc(arenaT* arena, size_t size)
+{
+  char* p;
+
+  size = (size + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1);
+  if ((size_t)(arena->end - arena->next) < size)
+    newchunk(arena, size);
+  p = arena->next;
+  arena->next += size;
+  return p;
+} /* ArenaAlloc */
+
+
+/*
+ * ArenaStrdup
+ *
+ * arguments:
+ *   arenaT *arena: the arena
+ *   const char *s: the string to copy
+ *
+ * returns: char*: the copy, valid until the arena is reset
+ */
+char*
+ArenaStrdup(arenaT* arena, const char* s)
+{
+  size_t len = strlen(s);
+
+  return memcpy(ArenaAlloc(arena, len + 1), s, len + 1);
+} /* ArenaStrdup */
+
+
+/*
+ * ArenaReset
+ *
+ * arguments:
+ *   arenaT *arena: the arena
+ *
+ * returns: none
+ *
+ * Rewinds the newest chunk. Older chunks are only there if a use of
+ * the arena did not fit into one, so all of them are merged into one
+ * that will fit next time.
+ */
+void
+ArenaReset(arenaT* arena)
+{
+  arenachunkT* chunk;
+  arenachunkT* next;
+  size_t total = 0;
+
+  if (arena->chunks == NULL)
+    return;
+  if (arena->chunks->next != NULL)
+    {
+      for (chunk = arena->chunks; chunk != NULL; chunk = next)
+        {
+          next = chunk->next;
+          total += chunk->size;
+          free(chunk);
+        }
+      arena->chunks = NULL;
+      newchunk(arena, total);
+    }
+  arena->next = arena->chunks->data;
+} /* ArenaReset */
+
+
+/*
+ * newchunk
+ *
+ * arguments:
+ *   arenaT *arena: the arena
+ *   size_t size: the room needed, a multiple of ALIGNMENT
+ *
+ * returns: none
+ *
+ * Adds a chunk with room for at least size bytes, and twice as large
+ * as the last one, to the front of the arena. The rest of the last
+ * chunk is not used anymore.
+ */
+static void
+newchunk(arenaT* arena, size_t size)
+{
+  arenachunkT* chunk;
+  size_t chunksize = CHUNKSIZE;
+
+  if (arena->chunks != NULL)
+    chunksize = 2 * arena->chunks->size;
+  if (chunksize < size)
+    chunksize = size;
+  chunk = (arenachunkT *)malloc(sizeof(arenachunkT) + chunksize);
+  chunk->next = arena->chunks;
+  chunk->size = chunksize;
+  arena->chunks = chunk;
+  arena->next = chunk->data;
+  arena->end = chunk->data + chunksize;
+} /* newchunk */
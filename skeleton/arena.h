@@ -0,0 +1,85 @@
+/***************************************************************************
+ *  Title: Arena
+ * -------------------------------------------------------------------------
+ *    Purpose: Bump allocation of memory that is released all at once
+ *    File: arena.h
+ ***************************************************************************/
+
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/************System include***********************************************/
+#include <stddef.h>
+
+/************Private include**********************************************/
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#undef EXTERN
+#ifdef __ARENA_IMPL__
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+/* an arena; one that is all zeros is empty and ready to use */
+typedef struct arena_t
+{
+  struct arenachunk_t* chunks;  /* the newest chunk first */
+  char* next;                   /* the free room in the newest chunk */
+  char* end;
+} arenaT;
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: Allocate from an arena
+ * ---------------------------------------------------------------------
+ *    Purpose: Hands out memory that stays valid until the arena is
+ *    reset, aligned for any type. Only takes a new chunk from malloc
+ *    when the current one is full.
+ *    Input: the arena and the number of bytes
+ *    Output: the memory
+ ***********************************************************************/
+EXTERN void*
+ArenaAlloc(arenaT*, size_t);
+
+/***********************************************************************
+ *  Title: Copy a string into an arena
+ * ---------------------------------------------------------------------
+ *    Purpose: Like strdup, with the copy in the arena.
+ *    Input: the arena and the string
+ *    Output: the copy
+ ***********************************************************************/
+EXTERN char*
+ArenaStrdup(arenaT*, const char*);
+
+/***********************************************************************
+ *  Title: Reset an arena
+ * ---------------------------------------------------------------------
+ *    Purpose: Releases everything allocated from the arena. The memory
+ *    is kept for the next use; if it took more than one chunk, they are
+ *    replaced by a single one as large as all of them, so that an arena
+ *    that is used the same way over and over stops calling malloc.
+ *    Input: the arena
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+ArenaReset(arenaT*);
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __ARENA_H__ */
@@ -0,0 +1,213 @@
+/***************************************************************************
+ *  Title: Scanner benchmark
+ * -------------------------------------------------------------------------
+ *    Purpose: Measures how fast long command lines are scanned,
+ *    tokenized and parsed with each ScanMeta implementation, and how
+ *    fast text is searched with ScanCount and ScanFind
+ *    File: scanbench.c
+ ***************************************************************************/
+
+/************System include***********************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/************Private include**********************************************/
+#include "interpreter.h"
+#include "scan.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/* bytes scanned per measurement */
+#define TOTALBYTES (256 << 20)
+
+/* the size of the text searched by ScanCount and ScanFind */
+#define TEXTBYTES (1 << 20)
+
+/************Global Variables*********************************************/
+
+static const char* kNames[] = { "auto", "scalar", "sse2", "avx2" };
+
+/************Function Prototypes******************************************/
+
+/**************Implementation***********************************************/
+
+/*
+ * now
+ *
+ * returns: double: monotonic time in seconds
+ */
+static double
+now()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+} /* now */
+
+/*
+ * makeline
+ *
+ * arguments:
+ *   size_t len: the length of the line
+ *   int stage: how many arguments go into a pipeline stage, 0 for all
+ *
+ * returns: char*: a generated command line of roughly that length
+ *
+ * Builds a line like the ones our scripts generate: a command with
+ * many file arguments, some of them quoted, and a pipe at the end.
+ * With stages, the arguments are spread over a long pipeline whose
+ * stages are joined by |, && and ;.
+ */
+static char*
+makeline(size_t len, int stage)
+{
+  static const char* kOps[] = { " |", " &&", " ;" };
+  char* line = malloc(len + 64);
+  size_t used = 0;
+  int i = 0;
+
+  used += sprintf(line, "/usr/bin/process --verbose");
+  while (used < len - 32)
+    {
+      if (i % 16 == 15)
+        used += sprintf(line + used, " \"data dir/file_%05d.txt\"", i);
+      else
+        used += sprintf(line + used, " data/file_%05d.txt", i);
+      i++;
+      if (stage > 0 && i % stage == 0)
+        used += sprintf(line + used, "%s grep", kOps[i / stage % 3]);
+    }
+  sprintf(line + used, " | wc -l");
+  return line;
+} /* makeline */
+
+/*
+ * searchbench
+ *
+ * returns: double: something computed from the results
+ *
+ * Prints bytes/second of ScanCount counting the newlines of a text of
+ * generated lines, and of ScanFind looking for a string that is not in
+ * it, for every implementation the CPU supports.
+ */
+static double
+searchbench()
+{
+  char* text = malloc(TEXTBYTES);
+  size_t used = 0, len, n, rounds = TOTALBYTES / TEXTBYTES;
+  double t, sink = 0;
+  char* line;
+  int impl;
+
+  while (used < TEXTBYTES)
+    {
+      line = makeline(64 + used % 192, 0);
+      len = strlen(line);
+      if (used + len + 1 > TEXTBYTES)
+        len = TEXTBYTES - used - 1;
+      memcpy(text + used, line, len);
+      text[used + len] = '\n';
+      used += len + 1;
+      free(line);
+    }
+
+  printf("\n%-8s %14s %14s\n", "impl", "count MB/s", "find MB/s");
+  for (impl = SCAN_SCALAR; impl <= SCAN_AVX2; impl++)
+    {
+      if (!ScanUse(impl))
+        continue;
+      t = now();
+      for (n = 0; n < rounds; n++)
+        sink += ScanCount(text, TEXTBYTES, '\n');
+      t = now() - t;
+      printf("%-8s %14.0f", kNames[impl], rounds * TEXTBYTES / t / 1e6);
+
+      t = now();
+      for (n = 0; n < rounds; n++)
+        sink += (ScanFind(text, TEXTBYTES, "file_99999", 10) != NULL);
+      t = now() - t;
+      printf(" %14.0f\n", rounds * TEXTBYTES / t / 1e6);
+    }
+  free(text);
+  return sink;
+} /* searchbench */
+
+/*
+ * main
+ *
+ * Prints bytes/second of ScanMeta alone, of getCommand and of ParseLine
+ * on a line with many stages, for every implementation the CPU
+ * supports, at a few line lengths, and then those of searchbench.
+ */
+int
+main(int argc, char* argv[])
+{
+  size_t lens[] = { 256, 4096, 65536 };
+  uint64_t* masks;
+  commandT* cmd;
+  parseT* parsed;
+  char* line;
+  char* staged;
+  size_t len, n, i, rounds;
+  double t, sink = 0;
+  int impl, l;
+
+  printf("%-8s %8s %14s %14s %14s\n", "impl", "length", "scan MB/s",
+         "tokenize MB/s", "parse MB/s");
+  for (l = 0; l < sizeof(lens) / sizeof(lens[0]); l++)
+    {
+      line = makeline(lens[l], 0);
+      staged = makeline(lens[l], 8);
+      len = strlen(line);
+      masks = malloc(sizeof(uint64_t) * ((len + 63) / 64));
+      rounds = TOTALBYTES / len;
+      for (impl = SCAN_SCALAR; impl <= SCAN_AVX2; impl++)
+        {
+          if (!ScanUse(impl))
+            continue;
+          t = now();
+          for (n = 0; n < rounds; n++)
+            {
+              ScanMeta(line, len, masks);
+              sink += masks[n % ((len + 63) / 64)];
+            }
+          t = now() - t;
+          printf("%-8s %8zu %14.0f", kNames[impl], len, rounds * len / t / 1e6);
+
+          t = now();
+          for (n = 0; n < rounds / 8; n++)
+            {
+              cmd = getCommand(line, NULL);
+              for (i = 0; i < cmd->argc; i++)
+                sink += cmd->argv[i][0];
+              freeCommand(cmd);
+            }
+          t = now() - t;
+          printf(" %14.0f", rounds / 8 * len / t / 1e6);
+
+          t = now();
+          for (n = 0; n < rounds / 8; n++)
+            {
+              parsed = ParseLine(staged, NULL);
+              sink += parsed->root->type;
+              FreeParse(parsed);
+            }
+          t = now() - t;
+          printf(" %14.0f\n", rounds / 8 * strlen(staged) / t / 1e6);
+        }
+      free(masks);
+      free(staged);
+      free(line);
+    }
+  sink += searchbench();
+  // keep the loops from being optimized away
+  return sink == 0.5;
+} /* main */
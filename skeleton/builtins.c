@@ -0,0 +1,1080 @@
+/***************************************************************************
+ *  Title: Builtins
+ * -------------------------------------------------------------------------
+ *    Purpose: Commands that run inside the shell without touching it
+ *    File: builtins.c
+ ***************************************************************************/
+/***************************************************************************
+ *  Scripts spend most of their time in small commands such as echo,
+ *  printf and test, for which starting a process costs far more than
+ *  running them. These builtins only read their arguments and the file
+ *  system and write to stdout and stderr, so they run in the shell, or
+ *  in a thread as a stage of a pipeline, just like the commands they
+ *  replace. They print through stdio, to the stream StageStdout gives
+ *  them, and flush before they return, so that their exit status tells
+ *  whether the output could be written.
+ ***************************************************************************/
+#define __BUILTINS_IMPL__
+
+/************System include***********************************************/
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/************Private include**********************************************/
+#include "builtins.h"
+#include "io.h"
+#include "stage.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/* the longest conversion printf builds: %, five flags, a width and a
+ * precision of up to ten digits each, ll and the conversion */
+#define MAXSPEC 32
+
+/* the state of test while it parses its arguments */
+typedef struct testparser_t
+{
+  char** args;
+  int nargs;
+  int pos;
+  bool error;
+} testparserT;
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+/* decodes the escape after a backslash */
+static const char*
+unescape(const char*, int*, bool);
+/* prints a string, decoding escapes */
+static bool
+putescaped(FILE*, const char*, bool);
+/* flushes the output, telling whether everything was written */
+static int
+flushout(FILE*);
+/* prints the format of printf once */
+static bool
+printformat(FILE*, const char*, char***, int*, int*);
+/* takes the next argument of printf */
+static const char*
+nextarg(char***, int*);
+/* converts an argument of printf to a number */
+static long long
+printfnum(const char*, int*);
+/* evaluates -o */
+static bool
+testor(testparserT*);
+/* evaluates -a */
+static bool
+testand(testparserT*);
+/* evaluates ! */
+static bool
+testnot(testparserT*);
+/* evaluates a primary */
+static bool
+testprimary(testparserT*);
+/* tells whether a word is a unary operator of test */
+static bool
+isunary(const char*);
+/* tells whether a word is a binary operator of test */
+static bool
+isbinary(const char*);
+/* evaluates a unary operator */
+static bool
+testunary(testparserT*, const char*, const char*);
+/* evaluates a binary operator */
+static bool
+testbinary(testparserT*, const char*, const char*, const char*);
+/* converts an operand of test to a number */
+static long long
+testnum(testparserT*, const char*);
+/* evaluates test with up to four arguments the way POSIX asks */
+static bool
+testposix(testparserT*, int);
+
+/**************Implementation***********************************************/
+
+
+/*
+ * RunEchoCmd
+ *
+ * arguments:
+ *   commandT *cmd: the command
+ *
+ * returns: int: its exit status
+ *
+ * Options are only taken as such if they consist of n, e and E alone,
+ * as in bash; -e turns on escapes, and \c ends the output right there.
+ */
+int
+RunEchoCmd(commandT* cmd)
+{
+  FILE* stream = StageStdout();
+  bool newline = TRUE;
+  bool escapes = FALSE;
+  char* opt;
+  int i;
+
+  for (i = 1; i < cmd->argc && cmd->argv[i][0] == '-' &&
+         cmd->argv[i][1] != '\0'; i++)
+    {
+      for (opt = cmd->argv[i] + 1; *opt == 'n' || *opt == 'e' || *opt == 'E';
+           opt++)
+        ;
+      if (*opt != '\0')
+        break;
+      for (opt = cmd->argv[i] + 1; *opt != '\0'; opt++)
+        {
+          if (*opt == 'n')
+            newline = FALSE;
+          else
+            escapes = (*opt == 'e');
+        }
+    }
+  for (; i < cmd->argc; i++)
+    {
+      if (!escapes)
+        fputs(cmd->argv[i], stream);
+      else if (!putescaped(stream, cmd->argv[i], TRUE))
+        return flushout(stream);
+      if (i + 1 < cmd->argc)
+        putc(' ', stream);
+    }
+  if (newline)
+    putc('\n', stream);
+  return flushout(stream);
+} /* RunEchoCmd */
+
+
+/*
+ * RunPrintfCmd
+ *
+ * arguments:
+ *   commandT *cmd: the command
+ *
+ * returns: int: its exit status
+ *
+ * Supports the conversions of printf(1): d i o u x X c s b e E f F g G
+ * a A and %%, with flags, widths and precisions, which may be *. An
+ * argument that is missing is taken as empty or 0; an argument that
+ * is not a number is complained about, and converted as far as it is
+ * one.
+ */
+int
+RunPrintfCmd(commandT* cmd)
+{
+  FILE* stream = StageStdout();
+  char** args = cmd->argv + 2;
+  int nargs = cmd->argc - 2;
+  int left, status = 0;
+
+  if (cmd->argc < 2)
+    {
+      fprintf(stderr, "%s: printf: usage: printf format [arguments]\n",
+              SHELLNAME);
+      return 2;
+    }
+  // the format is used again as long as it uses up arguments
+  do
+    {
+      left = nargs;
+      if (!printformat(stream, cmd->argv[1], &args, &nargs, &status))
+        break;
+    }
+  while (nargs > 0 && nargs < left && status < 2);
+  if (flushout(stream) != 0 && status == 0)
+    status = 1;
+  return status < 2 ? status : 1;
+} /* RunPrintfCmd */
+
+
+/*
+ * RunTestCmd
+ *
+ * arguments:
+ *   commandT *cmd: the command
+ *
+ * returns: int: 0 if the expression is true, 1 if it is false, 2 after
+ *               an error
+ *
+ * Up to four arguments are taken apart the way POSIX prescribes, so
+ * that operands that look like operators work; longer expressions are
+ * parsed with the usual precedence of ! over -a over -o. As [, the last
+ * argument must be ].
+ */
+int
+RunTestCmd(commandT* cmd)
+{
+  testparserT tp;
+  bool result;
+
+  tp.args = cmd->argv + 1;
+  tp.nargs = cmd->argc - 1;
+  tp.pos = 0;
+  tp.error = FALSE;
+  if (strcmp(cmd->argv[0], "[") == 0)
+    {
+      if (tp.nargs == 0 || strcmp(tp.args[tp.nargs - 1], "]") != 0)
+        {
+          fprintf(stderr, "%s: [: missing `]'\n", SHELLNAME);
+          return 2;
+        }
+      tp.nargs--;
+    }
+  if (tp.nargs <= 4)
+    result = testposix(&tp, tp.nargs);
+  else
+    result = testor(&tp);
+  if (!tp.error && tp.pos < tp.nargs)
+    {
+      fprintf(stderr, "%s: test: %s: unexpected argument\n", SHELLNAME,
+              tp.args[tp.pos]);
+      tp.error = TRUE;
+    }
+  if (tp.error)
+    return 2;
+  return result ? 0 : 1;
+} /* RunTestCmd */
+
+
+/*
+ * RunTrueCmd
+ *
+ * arguments:
+ *   commandT *cmd: the command
+ *
+ * returns: int: 0
+ */
+int
+RunTrueCmd(commandT* cmd)
+{
+  return 0;
+} /* RunTrueCmd */
+
+
+/*
+ * RunFalseCmd
+ *
+ * arguments:
+ *   commandT *cmd: the command
+ *
+ * returns: int: 1
+ */
+int
+RunFalseCmd(commandT* cmd)
+{
+  return 1;
+} /* RunFalseCmd */
+
+
+/*
+ * RunPwdCmd
+ *
+ * arguments:
+ *   commandT *cmd: the command
+ *
+ * returns: int: its exit status
+ *
+ * tsh does not keep track of the logical directory, so -L and -P both
+ * print the physical one.
+ */
+int
+RunPwdCmd(commandT* cmd)
+{
+  char dir[PATH_MAX];
+
+  if (getcwd(dir, sizeof(dir)) == NULL)
+    {
+      PrintPError("pwd");
+      return 1;
+    }
+  fprintf(StageStdout(), "%s\n", dir);
+  return flushout(StageStdout());
+} /* RunPwdCmd */
+
+
+/*
+ * BuiltinOptions
+ *
+ * arguments:
+ *   commandT *cmd: the command
+ *   const char *opts: the options it knows, each one a letter, followed
+ *                     by # if it takes a number, or by ! if it has to
+ *                     be given; of several ! options, one is enough
+ *   long *values: one for each letter of opts, set to -1 if it is not
+ *                 given, to its number, or to 1; may be NULL
+ *
+ * returns: int: the index of the first operand, or -1 if the options
+ *               are not all known
+ *
+ * Options come before the operands, as POSIX asks. GNU tools take them
+ * anywhere, so an operand that looks like an option is refused as
+ * well, and the command is left to the real tool.
+ */
+int
+BuiltinOptions(commandT* cmd, const char* opts, long* values)
+{
+  bool required = (strchr(opts, '!') != NULL), given = FALSE;
+  bool ended = FALSE;
+  const char* opt;
+  const char* num;
+  const char* p;
+  char* end;
+  long value;
+  int i, k;
+
+  for (k = 0, p = opts; values != NULL && *p != '\0'; p++)
+    if (isalpha((unsigned char)*p))
+      values[k++] = -1;
+  for (i = 1; i < cmd->argc && !ended; i++)
+    {
+      opt = cmd->argv[i];
+      if (opt[0] != '-' || opt[1] == '\0')
+        break;
+      ended = (strcmp(opt, "--") == 0);
+      for (opt++; *opt != '\0' && !ended; opt++)
+        {
+          if (!isalpha((unsigned char)*opt) ||
+              (p = strchr(opts, *opt)) == NULL)
+            return -1;
+          value = 1;
+          if (p[1] == '#')
+            {
+              num = (opt[1] != '\0' ? opt + 1 :
+                     i + 1 < cmd->argc ? cmd->argv[++i] : "");
+              errno = 0;
+              value = strtol(num, &end, 10);
+              if (!isdigit((unsigned char)num[0]) || *end != '\0' ||
+                  errno != 0)
+                return -1;
+              opt = end - 1;
+            }
+          given |= (p[1] == '!');
+          if (values != NULL)
+            {
+              for (k = 0; p > opts; p--)
+                k += (isalpha((unsigned char)p[-1]) != 0);
+              values[k] = value;
+            }
+        }
+    }
+  for (k = i; k < cmd->argc && !ended; k++)
+    if (cmd->argv[k][0] == '-' && cmd->argv[k][1] != '\0')
+      return -1;
+  return (required && !given ? -1 : i);
+} /* BuiltinOptions */
+
+
+/*
+ * unescape
+ *
+ * arguments:
+ *   const char *s: what follows a backslash
+ *   int *ch: set to the character it stands for, or -1 for \c
+ *   bool zero: whether octal escapes start with \0, as in echo, or
+ *              with any octal digit, as in a printf format
+ *
+ * returns: const char*: what follows the escape
+ *
+ * A backslash that does not start an escape stands for itself.
+ */
+static const char*
+unescape(const char* s, int* ch, bool zero)
+{
+  int i, v = 0;
+
+  switch (*s)
+    {
+    case 'a': *ch = '\a'; return s + 1;
+    case 'b': *ch = '\b'; return s + 1;
+    case 'e': *ch = '\033'; return s + 1;
+    case 'f': *ch = '\f'; return s + 1;
+    case 'n': *ch = '\n'; return s + 1;
+    case 'r': *ch = '\r'; return s + 1;
+    case 't': *ch = '\t'; return s + 1;
+    case 'v': *ch = '\v'; return s + 1;
+    case '\\': *ch = '\\'; return s + 1;
+    case 'c': *ch = -1; return s + 1;
+    case 'x':
+      for (i = 0; i < 2 && isxdigit((unsigned char)s[i + 1]); i++)
+        v = v * 16 + (isdigit((unsigned char)s[i + 1]) ? s[i + 1] - '0' :
+                      tolower((unsigned char)s[i + 1]) - 'a' + 10);
+      if (i == 0)
+        break;
+      *ch = v;
+      return s + 1 + i;
+    default:
+      if (zero ? *s != '0' : (*s < '0' || *s > '7'))
+        break;
+      if (zero)
+        s++;
+      for (i = 0; i < 3 && *s >= '0' && *s <= '7'; i++, s++)
+        v = v * 8 + *s - '0';
+      *ch = v & 0xff;
+      return s;
+    }
+  *ch = '\\';
+  return s;
+} /* unescape */
+
+
+/*
+ * putescaped
+ *
+ * arguments:
+ *   FILE *stream: where to print
+ *   const char *s: the string
+ *   bool zero: as for unescape
+ *
+ * returns: bool: FALSE if it ended with \c, after which nothing more
+ *                is printed
+ */
+static bool
+putescaped(FILE* stream, const char* s, bool zero)
+{
+  const char* bs;
+  int ch;
+
+  while ((bs = strchr(s, '\\')) != NULL)
+    {
+      fwrite(s, 1, bs - s, stream);
+      s = unescape(bs + 1, &ch, zero);
+      if (ch < 0)
+        return FALSE;
+      putc(ch, stream);
+    }
+  fputs(s, stream);
+  return TRUE;
+} /* putescaped */
+
+
+/*
+ * flushout
+ *
+ * arguments:
+ *   FILE *stream: stdout, or the stream of a pipeline stage
+ *
+ * returns: int: 0 if all output was written, 1 otherwise
+ *
+ * The error is reset, so that it does not stick to the shell's stdout
+ * once the builtin is done.
+ */
+static int
+flushout(FILE* stream)
+{
+  int status = 0;
+
+  if (fflush(stream) != 0 || ferror(stream))
+    {
+      status = 1;
+      clearerr(stream);
+    }
+  return status;
+} /* flushout */
+
+
+/*
+ * printformat
+ *
+ * arguments:
+ *   FILE *stream: where to print
+ *   const char *fmt: the format
+ *   char ***args: the arguments that are left, advanced past those used
+ *   int *nargs: their number, updated likewise
+ *   int *status: set to 1 if an argument is not a number, and to 2 if
+ *                the format is invalid
+ *
+ * returns: bool: FALSE if the output was ended with \c or by an error
+ *
+ * Each conversion is handed to the printf of the C library with a
+ * specification rebuilt from the parts that were recognized, so that a
+ * format cannot make it read arguments that are not there.
+ */
+static bool
+printformat(FILE* stream, const char* fmt, char*** args, int* nargs,
+            int* status)
+{
+  char spec[MAXSPEC];
+  char* out;
+  const char* arg;
+  char* end;
+  long long n;
+  double d;
+  int ch, star[2], nstars, i;
+
+  while (*fmt != '\0')
+    {
+      if (*fmt == '\\')
+        {
+          fmt = unescape(fmt + 1, &ch, FALSE);
+          if (ch < 0)
+            return FALSE;
+          putc(ch, stream);
+          continue;
+        }
+      if (*fmt != '%')
+        {
+          putc(*fmt++, stream);
+          continue;
+        }
+      if (fmt[1] == '%')
+        {
+          putc('%', stream);
+          fmt += 2;
+          continue;
+        }
+
+      out = spec;
+      *out++ = *fmt++;
+      nstars = 0;
+      for (i = 0; *fmt != '\0' && strchr("-+ #0", *fmt) != NULL; fmt++)
+        if (i++ < 5)
+          *out++ = *fmt;
+      // a width and a precision, either of which may come from an argument
+      for (i = 0; i < 2; i++)
+        {
+          if (i == 1)
+            {
+              if (*fmt != '.')
+                break;
+              *out++ = *fmt++;
+            }
+          if (*fmt == '*')
+            {
+              *out++ = *fmt++;
+              arg = nextarg(args, nargs);
+              star[nstars++] = (arg != NULL ? (int)printfnum(arg, status) : 0);
+              continue;
+            }
+          for (ch = 0; isdigit((unsigned char)*fmt); fmt++)
+            if (ch++ < 10)
+              *out++ = *fmt;
+        }
+      while (*fmt != '\0' && strchr("hlLqjzt", *fmt) != NULL)
+        fmt++;
+      if (*fmt == '\0' || strchr("diouxXcsbeEfFgGaA", *fmt) == NULL)
+        {
+          fprintf(stderr, "%s: printf: `%c': invalid format character\n",
+                  SHELLNAME, *fmt != '\0' ? *fmt : '%');
+          *status = 2;
+          return FALSE;
+        }
+      arg = nextarg(args, nargs);
+      ch = *fmt++;
+      if (strchr("diouxX", ch) != NULL)
+        {
+          *out++ = 'l';
+          *out++ = 'l';
+        }
+      *out++ = (ch == 'b' ? 's' : ch);
+      *out = '\0';
+
+      switch (ch)
+        {
+        case 'd':
+        case 'i':
+        case 'o':
+        case 'u':
+        case 'x':
+        case 'X':
+          n = (arg != NULL ? printfnum(arg, status) : 0);
+          if (nstars == 2)
+            fprintf(stream, spec, star[0], star[1], n);
+          else if (nstars == 1)
+            fprintf(stream, spec, star[0], n);
+          else
+            fprintf(stream, spec, n);
+          break;
+        case 'c':
+          ch = (arg != NULL ? (unsigned char)arg[0] : '\0');
+          if (nstars == 2)
+            fprintf(stream, spec, star[0], star[1], ch);
+          else if (nstars == 1)
+            fprintf(stream, spec, star[0], ch);
+          else
+            fprintf(stream, spec, ch);
+          break;
+        case 's':
+          if (arg == NULL)
+            arg = "";
+          if (nstars == 2)
+            fprintf(stream, spec, star[0], star[1], arg);
+          else if (nstars == 1)
+            fprintf(stream, spec, star[0], arg);
+          else
+            fprintf(stream, spec, arg);
+          break;
+        case 'b':
+          if (arg != NULL && !putescaped(stream, arg, TRUE))
+            return FALSE;
+          break;
+        default:
+          d = 0;
+          if (arg != NULL)
+            {
+              d = strtod(arg, &end);
+              if (*end != '\0' || end == arg)
+                {
+                  fprintf(stderr, "%s: printf: %s: invalid number\n",
+                          SHELLNAME, arg);
+                  *status = 1;
+                }
+            }
+          if (nstars == 2)
+            fprintf(stream, spec, star[0], star[1], d);
+          else if (nstars == 1)
+            fprintf(stream, spec, star[0], d);
+          else
+            fprintf(stream, spec, d);
+        }
+    }
+  return TRUE;
+} /* printformat */
+
+
+/*
+ * nextarg
+ *
+ * arguments:
+ *   char ***args: the arguments that are left, advanced past the one
+ *                 taken
+ *   int *nargs: their number, updated likewise
+ *
+ * returns: const char*: the argument, or NULL if there is none left
+ */
+static const char*
+nextarg(char*** args, int* nargs)
+{
+  if (*nargs == 0)
+    return NULL;
+  (*nargs)--;
+  return *(*args)++;
+} /* nextarg */
+
+
+/*
+ * printfnum
+ *
+ * arguments:
+ *   const char *arg: an argument of printf
+ *   int *status: set to 1 if it is not a number
+ *
+ * returns: long long: its value
+ *
+ * A leading quote makes the value that of the character after it, as
+ * in printf(1).
+ */
+static long long
+printfnum(const char* arg, int* status)
+{
+  long long n;
+  char* end;
+
+  if (arg[0] == '\'' || arg[0] == '"')
+    return (unsigned char)arg[1];
+  errno = 0;
+  if (arg[0] == '-')
+    n = strtoll(arg, &end, 0);
+  else
+    n = (long long)strtoull(arg, &end, 0);
+  if (*end != '\0' || (end == arg && *arg != '\0') || errno == ERANGE)
+    {
+      fprintf(stderr, "%s: printf: %s: invalid number\n", SHELLNAME, arg);
+      *status = 1;
+    }
+  return n;
+} /* printfnum */
+
+
+/*
+ * testposix
+ *
+ * arguments:
+ *   testparserT *tp: the parser, at the first argument to evaluate
+ *   int n: how many arguments there are, at most four
+ *
+ * returns: bool: the value of the expression
+ *
+ * With up to four arguments, what they mean follows from how many
+ * there are, so that test "$x" = ! works whatever $x is.
+ */
+static bool
+testposix(testparserT* tp, int n)
+{
+  char** a = tp->args + tp->pos;
+  bool result;
+
+  switch (n)
+    {
+    case 0:
+      return FALSE;
+    case 1:
+      tp->pos++;
+      return a[0][0] != '\0';
+    case 2:
+      if (strcmp(a[0], "!") == 0)
+        {
+          tp->pos++;
+          return !testposix(tp, 1);
+        }
+      if (isunary(a[0]))
+        {
+          tp->pos += 2;
+          return testunary(tp, a[0], a[1]);
+        }
+      break;
+    case 3:
+      if (isbinary(a[1]))
+        {
+          tp->pos += 3;
+          return testbinary(tp, a[0], a[1], a[2]);
+        }
+      if (strcmp(a[0], "!") == 0)
+        {
+          tp->pos++;
+          return !testposix(tp, 2);
+        }
+      if (strcmp(a[0], "(") == 0 && strcmp(a[2], ")") == 0)
+        {
+          tp->pos += 3;
+          return a[1][0] != '\0';
+        }
+      break;
+    case 4:
+      if (strcmp(a[0], "!") == 0)
+        {
+          tp->pos++;
+          return !testposix(tp, 3);
+        }
+      if (strcmp(a[0], "(") == 0 && strcmp(a[3], ")") == 0)
+        {
+          tp->pos++;
+          result = testposix(tp, 2);
+          tp->pos++;
+          return result;
+        }
+      break;
+    }
+  return testor(tp);
+} /* testposix */
+
+
+/*
+ * testor
+ *
+ * arguments:
+ *   testparserT *tp: the parser
+ *
+ * returns: bool: the value of the expression
+ *
+ * All operands are evaluated, as they only look at the file system.
+ */
+static bool
+testor(testparserT* tp)
+{
+  bool result = testand(tp);
+
+  while (tp->pos < tp->nargs && strcmp(tp->args[tp->pos], "-o") == 0)
+    {
+      tp->pos++;
+      result = testand(tp) || result;
+    }
+  return result;
+} /* testor */
+
+
+/*
+ * testand
+ *
+ * arguments:
+ *   testparserT *tp: the parser
+ *
+ * returns: bool: the value of the expression
+ */
+static bool
+testand(testparserT* tp)
+{
+  bool result = testnot(tp);
+
+  while (tp->pos < tp->nargs && strcmp(tp->args[tp->pos], "-a") == 0)
+    {
+      tp->pos++;
+      result = testnot(tp) && result;
+    }
+  return result;
+} /* testand */
+
+
+/*
+ * testnot
+ *
+ * arguments:
+ *   testparserT *tp: the parser
+ *
+ * returns: bool: the value of the expression
+ */
+static bool
+testnot(testparserT* tp)
+{
+  if (tp->pos < tp->nargs && strcmp(tp->args[tp->pos], "!") == 0)
+    {
+      tp->pos++;
+      return !testnot(tp);
+    }
+  return testprimary(tp);
+} /* testnot */
+
+
+/*
+ * testprimary
+ *
+ * arguments:
+ *   testparserT *tp: the parser
+ *
+ * returns: bool: the value of the expression
+ *
+ * A binary operator is looked for first, so that an operand may look
+ * like a unary operator or a parenthesis.
+ */
+static bool
+testprimary(testparserT* tp)
+{
+  char** a = tp->args + tp->pos;
+  int left = tp->nargs - tp->pos;
+  bool result;
+
+  if (left <= 0)
+    {
+      if (!tp->error)
+        fprintf(stderr, "%s: test: argument expected\n", SHELLNAME);
+      tp->error = TRUE;
+      return FALSE;
+    }
+  if (left >= 3 && isbinary(a[1]))
+    {
+      tp->pos += 3;
+      return testbinary(tp, a[0], a[1], a[2]);
+    }
+  if (strcmp(a[0], "(") == 0)
+    {
+      tp->pos++;
+      result = testor(tp);
+      if (tp->pos >= tp->nargs || strcmp(tp->args[tp->pos], ")") != 0)
+        {
+          if (!tp->error)
+            fprintf(stderr, "%s: test: `)' expected\n", SHELLNAME);
+          tp->error = TRUE;
+          return FALSE;
+        }
+      tp->pos++;
+      return result;
+    }
+  if (left >= 2 && isunary(a[0]))
+    {
+      tp->pos += 2;
+      return testunary(tp, a[0], a[1]);
+    }
+  tp->pos++;
+  return a[0][0] != '\0';
+} /* testprimary */
+
+
+/*
+ * isunary
+ *
+ * arguments:
+ *   const char *op: a word
+ *
+ * returns: bool: whether it is a unary operator
+ */
+static bool
+isunary(const char* op)
+{
+  return op[0] == '-' && op[1] != '\0' && op[2] == '\0' &&
+    strchr("bcdefghknprstuwxzGLOS", op[1]) != NULL;
+} /* isunary */
+
+
+/*
+ * isbinary
+ *
+ * arguments:
+ *   const char *op: a word
+ *
+ * returns: bool: whether it is a binary operator
+ */
+static bool
+isbinary(const char* op)
+{
+  static const char* ops[] = { "=", "==", "!=", "<", ">", "-eq", "-ne",
+                               "-lt", "-le", "-gt", "-ge", "-nt", "-ot",
+                               "-ef" };
+  size_t i;
+
+  for (i = 0; i < sizeof(ops) / sizeof(ops[0]); i++)
+    if (strcmp(op, ops[i]) == 0)
+      return TRUE;
+  return FALSE;
+} /* isbinary */
+
+
+/*
+ * testunary
+ *
+ * arguments:
+ *   testparserT *tp: the parser
+ *   const char *op: the operator
+ *   const char *arg: its operand
+ *
+ * returns: bool: its value
+ *
+ * -r, -w and -x check the effective ids, like the test of bash.
+ */
+static bool
+testunary(testparserT* tp, const char* op, const char* arg)
+{
+  struct stat st;
+
+  switch (op[1])
+    {
+    case 'z':
+      return arg[0] == '\0';
+    case 'n':
+      return arg[0] != '\0';
+    case 't':
+      return isatty((int)testnum(tp, arg));
+    case 'r':
+      return faccessat(AT_FDCWD, arg, R_OK, AT_EACCESS) == 0;
+    case 'w':
+      return faccessat(AT_FDCWD, arg, W_OK, AT_EACCESS) == 0;
+    case 'x':
+      return faccessat(AT_FDCWD, arg, X_OK, AT_EACCESS) == 0;
+    case 'h':
+    case 'L':
+      return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+    }
+  if (stat(arg, &st) < 0)
+    return FALSE;
+  switch (op[1])
+    {
+    case 'b': return S_ISBLK(st.st_mode);
+    case 'c': return S_ISCHR(st.st_mode);
+    case 'd': return S_ISDIR(st.st_mode);
+    case 'f': return S_ISREG(st.st_mode);
+    case 'p': return S_ISFIFO(st.st_mode);
+    case 'S': return S_ISSOCK(st.st_mode);
+    case 's': return st.st_size > 0;
+    case 'g': return (st.st_mode & S_ISGID) != 0;
+    case 'u': return (st.st_mode & S_ISUID) != 0;
+    case 'k': return (st.st_mode & S_ISVTX) != 0;
+    case 'O': return st.st_uid == geteuid();
+    case 'G': return st.st_gid == getegid();
+    default: return TRUE;
+    }
+} /* testunary */
+
+
+/*
+ * testbinary
+ *
+ * arguments:
+ *   testparserT *tp: the parser
+ *   const char *a: the left operand
+ *   const char *op: the operator
+ *   const char *b: the right operand
+ *
+ * returns: bool: its value
+ *
+ * < and > compare strings in the order of the current locale.
+ */
+static bool
+testbinary(testparserT* tp, const char* a, const char* op, const char* b)
+{
+  struct stat sa, sb;
+  bool hasa, hasb;
+  long long x, y;
+
+  if (op[0] != '-')
+    {
+      if (op[0] == '<')
+        return strcoll(a, b) < 0;
+      if (op[0] == '>')
+        return strcoll(a, b) > 0;
+      return (strcmp(a, b) == 0) == (op[0] == '=');
+    }
+  if (strcmp(op, "-nt") == 0 || strcmp(op, "-ot") == 0 ||
+      strcmp(op, "-ef") == 0)
+    {
+      hasa = (stat(a, &sa) == 0);
+      hasb = (stat(b, &sb) == 0);
+      if (op[1] == 'e')
+        return hasa && hasb && sa.st_dev == sb.st_dev &&
+          sa.st_ino == sb.st_ino;
+      // a file that exists is newer than one that does not
+      if (!hasa || !hasb)
+        return op[1] == 'n' ? hasa : hasb;
+      if (sa.st_mtim.tv_sec != sb.st_mtim.tv_sec)
+        return (sa.st_mtim.tv_sec > sb.st_mtim.tv_sec) == (op[1] == 'n');
+      if (sa.st_mtim.tv_nsec == sb.st_mtim.tv_nsec)
+        return FALSE;
+      return (sa.st_mtim.tv_nsec > sb.st_mtim.tv_nsec) == (op[1] == 'n');
+    }
+  x = testnum(tp, a);
+  y = testnum(tp, b);
+  if (strcmp(op, "-eq") == 0)
+    return x == y;
+  if (strcmp(op, "-ne") == 0)
+    return x != y;
+  if (strcmp(op, "-lt") == 0)
+    return x < y;
+  if (strcmp(op, "-le") == 0)
+    return x <= y;
+  if (strcmp(op, "-gt") == 0)
+    return x > y;
+  return x >= y;
+} /* testbinary */
+
+
+/*
+ * testnum
+ *
+ * arguments:
+ *   testparserT *tp: the parser, whose error is set if arg is not a
+ *                    number
+ *   const char *arg: an operand
+ *
+ * returns: long long: its value
+ *
+ * Blanks around the number are allowed, as in bash.
+ */
+static long long
+testnum(testparserT* tp, const char* arg)
+{
+  long long n;
+  char* end;
+
+  errno = 0;
+  n = strtoll(arg, &end, 10);
+  while (isspace((unsigned char)*end))
+    end++;
+  if (*end != '\0' || end == arg || errno == ERANGE)
+    {
+      if (!tp->error)
+        fprintf(stderr, "%s: test: %s: integer expression expected\n",
+                SHELLNAME, arg);
+      tp->error = TRUE;
+    }
+  return n;
+} /* testnum */
@@ -0,0 +1,111 @@
+/***************************************************************************
+ *  Title: Builtins
+ * -------------------------------------------------------------------------
+ *    Purpose: Commands that run inside the shell without touching it
+ *    File: builtins.h
+ ***************************************************************************/
+
+#ifndef __BUILTINS_H__
+#define __BUILTINS_H__
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/************System include***********************************************/
+
+/************Private include**********************************************/
+#include "interpreter.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#undef EXTERN
+#ifdef __BUILTINS_IMPL__
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: echo
+ * ---------------------------------------------------------------------
+ *    Purpose: Prints its arguments like the echo of bash, with -n, -e
+ *    and -E.
+ *    Input: the command
+ *    Output: its exit status, 1 if stdout could not be written
+ ***********************************************************************/
+EXTERN int
+RunEchoCmd(commandT*);
+
+/***********************************************************************
+ *  Title: printf
+ * ---------------------------------------------------------------------
+ *    Purpose: Prints its arguments under the control of a format, which
+ *    is reused until they are used up, like printf(1).
+ *    Input: the command
+ *    Output: its exit status, 1 if an argument is not a number, 2 if
+ *    the format is missing
+ ***********************************************************************/
+EXTERN int
+RunPrintfCmd(commandT*);
+
+/***********************************************************************
+ *  Title: test and [
+ * ---------------------------------------------------------------------
+ *    Purpose: Evaluates a conditional expression like test(1).
+ *    Input: the command
+ *    Output: 0 if it is true, 1 if it is false, 2 if it is malformed
+ ***********************************************************************/
+EXTERN int
+RunTestCmd(commandT*);
+
+/***********************************************************************
+ *  Title: true and false
+ * ---------------------------------------------------------------------
+ *    Purpose: Do nothing, successfully or not.
+ *    Input: the command
+ *    Output: 0 and 1
+ ***********************************************************************/
+EXTERN int
+RunTrueCmd(commandT*);
+
+EXTERN int
+RunFalseCmd(commandT*);
+
+/***********************************************************************
+ *  Title: pwd
+ * ---------------------------------------------------------------------
+ *    Purpose: Prints the current directory.
+ *    Input: the command
+ *    Output: its exit status
+ ***********************************************************************/
+EXTERN int
+RunPwdCmd(commandT*);
+
+/***********************************************************************
+ *  Title: Options of a builtin
+ * ---------------------------------------------------------------------
+ *    Purpose: Checks that a builtin that stands in for a tool knows all
+ *    the options it was given, and collects them.
+ *    Input: the command, the options the builtin knows and where to
+ *    store their values
+ *    Output: the index of the first operand, or -1 if the tool has to
+ *    run instead
+ ***********************************************************************/
+EXTERN int
+BuiltinOptions(commandT*, const char*, long*);
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __BUILTINS_H__ */
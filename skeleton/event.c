@@ -0,0 +1,421 @@
+/***************************************************************************
+ *  Title: Event loop
+ * -------------------------------------------------------------------------
+ *    Purpose: Waits for input, signals and timers in one place
+ *    File: event.c
+ ***************************************************************************/
+#define __EVENT_IMPL__
+
+/************System include***********************************************/
+#include <errno.h>
+#include <stdint.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+
+/************Private include**********************************************/
+#include "event.h"
+#include "io.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/* the low half of an epoll_event's data is the EVENT_* bit, the high
+ * half the descriptor of an EventWatch()ed one */
+#define EVENT_FD     8
+#define MAXEVENTS    64
+
+/* a descriptor added with EventWatch */
+typedef struct watch_t
+{
+  void (*ready)(void*);
+  void* arg;
+} watchT;
+
+/************Global Variables*********************************************/
+
+/* the epoll set and the descriptors in it */
+static int epfd = -1;
+static int sigfd = -1;
+static int timerfd = -1;
+/* FALSE if stdin cannot be polled, e.g. because it is a regular file;
+ * it is only added once input is wanted */
+static bool stdinwatched = FALSE;
+static bool stdintried = FALSE;
+/* called for every signal read from sigfd */
+static void (*handler)(int) = NULL;
+/* the callbacks of watched descriptors, indexed by descriptor */
+static watchT* watches = NULL;
+static int nwatches = 0;
+
+/************Function Prototypes******************************************/
+/* creates the epoll set and the signalfd */
+static void
+setup();
+/* adds a descriptor to the epoll set */
+static bool
+watch(int, int, int);
+/* calls the callback of a watched descriptor */
+static void
+fdready(int);
+/* handles all pending signals */
+static void
+readsignals();
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+
+/*
+ * EventInit
+ *
+ * arguments:
+ *   void (*sig)(int): called with the number of every signal received
+ *
+ * returns: none
+ *
+ * Blocks the signals tsh handles, so that they queue up until they are
+ * read from a signalfd instead of interrupting the shell. The epoll set
+ * with the signalfd is only created when something has to be waited
+ * for, stdin is only added once input is wanted, and the timerfd once
+ * the timer is armed, so a shell that runs a few builtins and exits
+ * never creates them. Children get an empty signal mask when they are
+ * started. SIGPIPE is ignored, so that a builtin that writes to a pipe
+ * nobody reads gets EPIPE instead of killing the shell; children and
+ * subshells get it back.
+ */
+void
+EventInit(void (*sig)(int))
+{
+  sigset_t mask;
+
+  handler = sig;
+  signal(SIGPIPE, SIG_IGN);
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGINT);
+  sigaddset(&mask, SIGTSTP);
+  sigaddset(&mask, SIGCHLD);
+  if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0)
+    PrintPError("sigprocmask");
+} /* EventInit */
+
+
+/*
+ * EventFork
+ *
+ * arguments: none
+ *
+ * returns: none
+ *
+ * Closes the parent's epoll set, signalfd and timerfd in a forked
+ * child and sets up new ones with the same handler. Closing them does
+ * not change what the parent watches.
+ */
+void
+EventFork()
+{
+  if (epfd >= 0)
+    close(epfd);
+  if (sigfd >= 0)
+    close(sigfd);
+  if (timerfd >= 0)
+    close(timerfd);
+  epfd = sigfd = timerfd = -1;
+  stdinwatched = stdintried = FALSE;
+  if (nwatches > 0)
+    memset(watches, 0, sizeof(watchT) * nwatches);
+  EventInit(handler);
+} /* EventFork */
+
+
+/*
+ * EventWait
+ *
+ * arguments:
+ *   int want: EVENT_INPUT and/or EVENT_TIMER
+ *
+ * returns: int: the EVENT_* bits that happened
+ *
+ * Sleeps in epoll_wait until a signal, a watched descriptor or one of
+ * the wanted events arrives. Signals and watched descriptors are always
+ * handled, even if only input was wanted, so a job that finishes is
+ * noticed right away. stdin is
+ * watched one-shot and only armed while input is wanted, so that
+ * pending input does not wake up a shell that is waiting for a job.
+ */
+int
+EventWait(int want)
+{
+  struct epoll_event events[MAXEVENTS];
+  struct epoll_event ev;
+  uint64_t expirations;
+  int i, n;
+  int happened = 0;
+
+  if (epfd < 0)
+    setup();
+  if ((want & EVENT_INPUT) && !stdintried)
+    {
+      stdintried = TRUE;
+      stdinwatched = watch(STDIN_FILENO, EVENT_INPUT, EPOLLONESHOT);
+    }
+  if (want & EVENT_INPUT)
+    {
+      if (!stdinwatched)
+        return EVENT_INPUT;
+      memset(&ev, 0, sizeof(ev));
+      ev.events = EPOLLIN | EPOLLONESHOT;
+      ev.data.u64 = EVENT_INPUT;
+      epoll_ctl(epfd, EPOLL_CTL_MOD, STDIN_FILENO, &ev);
+    }
+
+  while (happened == 0)
+    {
+      n = epoll_wait(epfd, events, MAXEVENTS, -1);
+      if (n < 0)
+        {
+          if (errno != EINTR)
+            {
+              PrintPError("epoll_wait");
+              return 0;
+            }
+          continue;
+        }
+      for (i = 0; i < n; i++)
+        {
+          switch ((uint32_t)events[i].data.u64)
+            {
+            case EVENT_SIGNAL:
+              readsignals();
+              happened |= EVENT_SIGNAL;
+              break;
+            case EVENT_TIMER:
+              if (read(timerfd, &expirations, sizeof(expirations)) > 0)
+                happened |= (want & EVENT_TIMER);
+              break;
+            case EVENT_INPUT:
+              happened |= (want & EVENT_INPUT);
+              break;
+            case EVENT_FD:
+              fdready(events[i].data.u64 >> 32);
+              happened |= EVENT_SIGNAL;
+              break;
+            }
+        }
+    }
+  return happened;
+} /* EventWait */
+
+
+/*
+ * EventTimer
+ *
+ * arguments:
+ *   const struct timespec *after: when the timer should fire, or NULL
+ *
+ * returns: none
+ *
+ * Arms the timer once, or disarms it.
+ */
+void
+EventTimer(const struct timespec* after)
+{
+  struct itimerspec its;
+
+  if (timerfd < 0)
+    {
+      if (after == NULL)
+        return;
+      if (epfd < 0)
+        setup();
+      if ((timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0)
+        {
+          PrintPError("timerfd_create");
+          return;
+        }
+      watch(timerfd, EVENT_TIMER, EPOLLIN);
+    }
+  memset(&its, 0, sizeof(its));
+  if (after != NULL)
+    its.it_value = *after;
+  // a zero it_value would disarm the timer instead of firing now
+  if (after != NULL && its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0)
+    its.it_value.tv_nsec = 1;
+  timerfd_settime(timerfd, 0, &its, NULL);
+} /* EventTimer */
+
+
+/*
+ * EventWatch
+ *
+ * arguments:
+ *   int fd: the descriptor to watch for readability
+ *   void (*ready)(void*): called from EventWait when fd is readable
+ *   void *arg: passed to ready
+ *
+ * returns: bool: whether the descriptor could be watched
+ *
+ * Adds a descriptor to the epoll set. The callback keeps being called
+ * for as long as the descriptor stays readable and watched.
+ */
+bool
+EventWatch(int fd, void (*ready)(void*), void* arg)
+{
+  struct epoll_event ev;
+  int n;
+
+  if (epfd < 0)
+    setup();
+  if (fd >= nwatches)
+    {
+      n = nwatches > 0 ? nwatches : 64;
+      while (n <= fd)
+        n *= 2;
+      watches = (watchT *)realloc(watches, sizeof(watchT) * n);
+      memset(watches + nwatches, 0, sizeof(watchT) * (n - nwatches));
+      nwatches = n;
+    }
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.u64 = EVENT_FD | ((uint64_t)fd << 32);
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+    return FALSE;
+  watches[fd].ready = ready;
+  watches[fd].arg = arg;
+  return TRUE;
+} /* EventWatch */
+
+
+/*
+ * EventUnwatch
+ *
+ * arguments:
+ *   int fd: a descriptor added with EventWatch
+ *
+ * returns: none
+ *
+ * Removes a descriptor from the epoll set. Events of it that were
+ * already returned by epoll_wait are dropped.
+ */
+void
+EventUnwatch(int fd)
+{
+  if (fd < 0 || fd >= nwatches || watches[fd].ready == NULL || epfd < 0)
+    return;
+  epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+  watches[fd].ready = NULL;
+  watches[fd].arg = NULL;
+} /* EventUnwatch */
+
+
+/*
+ * setup
+ *
+ * arguments: none
+ *
+ * returns: none
+ *
+ * Creates the epoll set with a signalfd for those of the signals tsh
+ * handles that are still blocked; a shell without job control has
+ * unblocked SIGINT and SIGTSTP again by now.
+ */
+static void
+setup()
+{
+  sigset_t blocked;
+  sigset_t mask;
+
+  sigprocmask(SIG_BLOCK, NULL, &blocked);
+  sigemptyset(&mask);
+  if (sigismember(&blocked, SIGINT))
+    sigaddset(&mask, SIGINT);
+  if (sigismember(&blocked, SIGTSTP))
+    sigaddset(&mask, SIGTSTP);
+  sigaddset(&mask, SIGCHLD);
+
+  if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+    PrintPError("epoll_create1");
+  if ((sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) < 0)
+    PrintPError("signalfd");
+  watch(sigfd, EVENT_SIGNAL, EPOLLIN);
+} /* setup */
+
+
+/*
+ * watch
+ *
+ * arguments:
+ *   int fd: the descriptor
+ *   int what: the EVENT_* bit it stands for
+ *   int events: the epoll events to watch for
+ *
+ * returns: bool: whether the descriptor could be added
+ *
+ * Adds a descriptor to the epoll set.
+ */
+static bool
+watch(int fd, int what, int events)
+{
+  struct epoll_event ev;
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = events;
+  ev.data.u64 = what;
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+    {
+      // regular files cannot be polled, but they never block either
+      if (errno != EPERM)
+        PrintPError("epoll_ctl");
+      return FALSE;
+    }
+  return TRUE;
+} /* watch */
+
+
+/*
+ * readsignals
+ *
+ * arguments: none
+ *
+ * returns: none
+ *
+ * Drains the signalfd, calling the handler for each signal.
+ */
+static void
+readsignals()
+{
+  struct signalfd_siginfo info;
+
+  while (read(sigfd, &info, sizeof(info)) == sizeof(info))
+    {
+      if (handler != NULL)
+        handler(info.ssi_signo);
+    }
+} /* readsignals */
+
+
+/*
+ * fdready
+ *
+ * arguments:
+ *   int fd: a descriptor epoll_wait reported as readable
+ *
+ * returns: none
+ *
+ * Calls the callback of a watched descriptor, unless the descriptor
+ * was unwatched by an earlier callback of the same epoll_wait.
+ */
+static void
+fdready(int fd)
+{
+  if (fd < nwatches && watches[fd].ready != NULL)
+    watches[fd].ready(watches[fd].arg);
+} /* fdready */
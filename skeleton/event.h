@@ -0,0 +1,116 @@
+/***************************************************************************
+ *  Title: Event loop
+ * -------------------------------------------------------------------------
+ *    Purpose: Waits for input, signals and timers in one place
+ *    File: event.h
+ ***************************************************************************/
+
+#ifndef __EVENT_H__
+#define __EVENT_H__
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/************System include***********************************************/
+#include <time.h>
+
+/************Private include**********************************************/
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#undef EXTERN
+#ifdef __EVENT_IMPL__
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+/* what EventWait waited for and what happened */
+#define EVENT_SIGNAL 1
+#define EVENT_INPUT  2
+#define EVENT_TIMER  4
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: Set up the event loop
+ * ---------------------------------------------------------------------
+ *    Purpose: Blocks SIGINT, SIGTSTP and SIGCHLD, which are routed,
+ *    with stdin and a timer, through one epoll set once it is needed.
+ *    Signals are only ever handled inside EventWait, by calling the
+ *    given handler.
+ *    Input: the signal handler
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+EventInit(void (*)(int));
+
+/***********************************************************************
+ *  Title: Set up the event loop of a forked shell
+ * ---------------------------------------------------------------------
+ *    Purpose: A forked child shares the epoll set of its parent; this
+ *    gives it its own, with none of the parent's descriptors watched.
+ *    Input: void
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+EventFork();
+
+/***********************************************************************
+ *  Title: Wait for events
+ * ---------------------------------------------------------------------
+ *    Purpose: Blocks until a signal arrives, a watched descriptor becomes
+ *    readable or one of the requested events happens. All pending
+ *    signals and watched descriptors are handled before returning;
+ *    both are reported as EVENT_SIGNAL.
+ *    Input: EVENT_INPUT and/or EVENT_TIMER to also wait for those
+ *    Output: the EVENT_* bits that happened
+ ***********************************************************************/
+EXTERN int
+EventWait(int);
+
+/***********************************************************************
+ *  Title: Watch a descriptor
+ * ---------------------------------------------------------------------
+ *    Purpose: Makes EventWait call the given function whenever the
+ *    descriptor is readable, until it is unwatched again.
+ *    Input: the descriptor, the callback and its argument
+ *    Output: TRUE if the descriptor is watched
+ ***********************************************************************/
+EXTERN bool
+EventWatch(int, void (*)(void*), void*);
+
+/***********************************************************************
+ *  Title: Stop watching a descriptor
+ * ---------------------------------------------------------------------
+ *    Purpose: Undoes EventWatch; call it before closing the descriptor.
+ *    Input: the descriptor
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+EventUnwatch(int);
+
+/***********************************************************************
+ *  Title: Arm the timer
+ * ---------------------------------------------------------------------
+ *    Purpose: Makes EventWait report EVENT_TIMER once the given time
+ *    has passed; NULL disarms the timer.
+ *    Input: a relative time or NULL
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+EventTimer(const struct timespec*);
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __EVENT_H__ */
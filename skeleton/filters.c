@@ -0,0 +1,1080 @@
+/***************************************************************************
+ *  Title: Filters
+ * -------------------------------------------------------------------------
+ *    Purpose: cat, wc, fgrep, head and tail inside the shell
+ *    File: filters.c
+ ***************************************************************************/
+/***************************************************************************
+ *  Most of our pipelines are made of cat, grep -F, wc, head and tail,
+ *  which take longer to start than to run on the few lines they get.
+ *  These builtins stand in for them with the options that are commonly
+ *  used; BuiltinOptions refuses any other option, and the real tool
+ *  runs instead. They read and write their descriptors directly rather
+ *  than through stdio, by way of StageRead and StageWrite, so that in a
+ *  pipeline they can run as threads that pass data on through rings.
+ *  cat has the kernel move the data with copy_file_range(2) or
+ *  splice(2). wc and fgrep scan whole buffers at a time with ScanCount
+ *  and ScanFind, and only look at single lines where they find
+ *  something. head stops reading once it has its lines and gives back
+ *  what it read of a file beyond them, so that the next command reads
+ *  on from there. tail maps a file and finds its last lines from the
+ *  end, without reading the rest.
+ ***************************************************************************/
+#define __FILTERS_IMPL__
+#define _GNU_SOURCE
+
+/************System include***********************************************/
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/************Private include**********************************************/
+#include "builtins.h"
+#include "filters.h"
+#include "scan.h"
+#include "stage.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/* how much is read, and written, at a time */
+#define BUFSIZE (64 << 10)
+
+/* how much cat asks the kernel to move at a time */
+#define COPYCHUNK (1 << 30)
+
+/* how copyfd moves the data */
+#define COPY_RANGE  0  /* copy_file_range, between regular files */
+#define COPY_SPLICE 1  /* splice, to or from a pipe */
+#define COPY_RW     2  /* read and write */
+
+/* output collected into large writes */
+typedef struct output_t
+{
+  int fd;
+  size_t used;
+  bool failed;
+  char buf[BUFSIZE];
+} outputT;
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+/* opens an operand, - being stdin */
+static int
+openarg(const char*, const char*, outputT*);
+/* closes an operand */
+static void
+closearg(int);
+/* prints what went wrong with an operand */
+static void
+complain(const char*, const char*, outputT*);
+/* the same, in the words head and tail use */
+static void
+complainof(const char*, const char*, const char*, outputT*);
+/* writes all of a buffer */
+static bool
+writeall(int, const char*, size_t);
+/* adds to the output */
+static void
+put(outputT*, const char*, size_t);
+/* writes out what was added to the output */
+static bool
+flush(outputT*);
+/* copies a descriptor to another */
+static int
+copyfd(int, int);
+/* counts the lines and bytes of a descriptor */
+static bool
+countfd(int, bool, unsigned long*, unsigned long*);
+/* finds the first occurrence of any of the strings */
+static const char*
+findany(const char*, size_t, char**, size_t*, int);
+/* prints or counts the lines of a buffer that fgrep selects */
+static long
+grepbuf(const char*, size_t, char**, size_t*, int, bool, bool,
+        const char*, outputT*);
+/* prints or counts the lines of a descriptor that fgrep selects */
+static long
+grepfd(int, const char*, bool, char**, size_t*, int, bool, bool, outputT*);
+/* prints the first lines of a descriptor */
+static bool
+headfd(int, long, outputT*);
+/* prints the last lines of a descriptor */
+static bool
+tailfd(int, long, outputT*);
+/* finds the start of the last lines of a buffer */
+static const char*
+lastlines(const char*, size_t, long);
+
+/**************Implementation***********************************************/
+
+
+/*
+ * RunCatCmd
+ *
+ * arguments:
+ *   commandT *cmd: the command
+ *
+ * returns: int: 0, or 1 if an operand could not be read or the output
+ *               could not be written
+ *
+ * -u is the default anyway. A file that is also the output is refused,
+ * as copying it would never end.
+ */
+int
+RunCatCmd(commandT* cmd)
+{
+  int first = BuiltinOptions(cmd, CAT_OPTIONS, NULL);
+  int nfiles = cmd->argc - first;
+  const char* name;
+  struct stat in, out;
+  bool tofile;
+  int i, fd, status = 0;
+
+  fflush(stdout);
+  tofile = (StageStat(StageOut(), &out) == 0 && S_ISREG(out.st_mode));
+  for (i = 0; i < nfiles || (nfiles == 0 && i == 0); i++)
+    {
+      name = (nfiles > 0 ? cmd->argv[first + i] : "-");
+      if ((fd = openarg(cmd->argv[0], name, NULL)) < 0)
+        {
+          status = 1;
+          continue;
+        }
+      if (tofile && StageStat(fd, &in) == 0 && in.st_size > 0 &&
+          in.st_dev == out.st_dev && in.st_ino == out.st_ino)
+        {
+          fprintf(stderr, "%s: %s: input file is output file\n",
+                  cmd->argv[0], name);
+          status = 1;
+        }
+      else
+        switch (copyfd(fd, StageOut()))
+          {
+          case 1:
+            complain(cmd->argv[0], name, NULL);
+            status = 1;
+            break;
+          case 2:
+            complain(cmd->argv[0], "write error", NULL);
+            closearg(fd);
+            return 1;
+          }
+      closearg(fd);
+    }
+  return status;
+} /* RunCatCmd */
+
+
+/*
+ * RunWcCmd
+ *
+ * arguments:
+ *   commandT *cmd: the command
+ *
+ * returns: int: 0, or 1 if an operand could not be read
+ *
+ * Prints the counts in columns as wide as GNU wc would make them: just
+ * wide enough for the total size of the files, at least 7 wide if one
+ * of them is not a regular file, and not padded at all for a single
+ * count of a single file.
+ */
+int
+RunWcCmd(commandT* cmd)
+{
+  long opts[2];
+  int first = BuiltinOptions(cmd, WC_OPTIONS, opts);
+  int nfiles = cmd->argc - first;
+  bool lines = (opts[0] > 0), bytes = (opts[1] > 0);
+  unsigned long nlines, nbytes, tlines = 0, tbytes = 0, total = 0;
+  int i, fd, width = 1, minwidth = 1, status = 0;
+  outputT out;
+  struct stat st;
+  const char* name;
+  char line[64];
+
+  fflush(stdout);
+  out.fd = StageOut();
+  out.used = 0;
+  out.failed = FALSE;
+  if (nfiles > 1 || !(lines ^ bytes))
+    {
+      for (i = 0; i < nfiles || (nfiles == 0 && i == 0); i++)
+        {
+          name = (nfiles > 0 ? cmd->argv[first + i] : "-");
+          if ((strcmp(name, "-") == 0 ? StageStat(StageIn(), &st) :
+               stat(name, &st)) < 0)
+            {
+              if (i == 0)
+                break;
+            }
+          else if (S_ISREG(st.st_mode))
+            total += st.st_size;
+          else
+            minwidth = 7;
+        }
+      for (; total >= 10; total /= 10)
+        width++;
+      if (width < minwidth)
+        width = minwidth;
+    }
+
+  for (i = 0; i < nfiles || (nfiles == 0 && i == 0); i++)
+    {
+      name = (nfiles > 0 ? cmd->argv[first + i] : "-");
+      if ((fd = openarg(cmd->argv[0], name, &out)) < 0)
+        {
+          status = 1;
+          continue;
+        }
+      if (!countfd(fd, lines, &nlines, &nbytes))
+        {
+          complain(cmd->argv[0], name, &out);
+          status = 1;
+          closearg(fd);
+          continue;
+        }
+      closearg(fd);
+      tlines += nlines;
+      tbytes += nbytes;
+      if (lines && bytes)
+        snprintf(line, sizeof(line), "%*lu %*lu", width, nlines, width,
+                 nbytes);
+      else
+        snprintf(line, sizeof(line), "%*lu", width, lines ? nlines : nbytes);
+      put(&out, line, strlen(line));
+      if (nfiles > 0)
+        {
+          put(&out, " ", 1);
+          put(&out, name, strlen(name));
+        }
+      put(&out, "\n", 1);
+    }
+  if (nfiles > 1)
+    {
+      if (lines && bytes)
+        snprintf(line, sizeof(line), "%*lu %*lu total\n", width, tlines,
+                 width, tbytes);
+      else
+        snprintf(line, sizeof(line), "%*lu total\n", width,
+                 lines ? tlines : tbytes);
+      put(&out, line, strlen(line));
+    }
+  if (!flush(&out))
+    {
+      complain(cmd->argv[0], "write error", NULL);
+      status = 1;
+    }
+  return status;
+} /* RunWcCmd */
+
+
+/*
+ * RunGrepCmd
+ *
+ * arguments:
+ *   commandT *cmd: the command
+ *
+ * returns: int: 0 if a line was selected, 1 if none was, 2 if there
+ *               was an error
+ *
+ * The pattern is a list of strings separated by newlines, and a line
+ * is selected if it contains any of them. With more than one file,
+ * each line is preceded by the name of its file. Like GNU grep, it
+ * does not print the lines of a file with a NUL in it, only that it
+ * matches.
+ */
+int
+RunGrepCmd(commandT* cmd)
+{
+  long opts[3];
+  int first = BuiltinOptions(cmd, strcmp(cmd->argv[0], "grep") == 0 ?
+                             GREP_OPTIONS : FGREP_OPTIONS, opts);
+  bool grep = (strcmp(cmd->argv[0], "grep") == 0);
+  bool count = (opts[grep] > 0), invert = (opts[grep + 1] > 0);
+  int nfiles, npats, i, fd, status = 1;
+  const char* pattern;
+  const char* name;
+  char** pats;
+  size_t* lens;
+  outputT out;
+  long found;
+  char* nl;
+  char line[32];
+
+  fflush(stdout);
+  if (first >= cmd->argc)
+    {
+      fprintf(stderr, "Usage: grep [OPTION]... PATTERNS [FILE]...\n");
+      return 2;
+    }
+  pattern = cmd->argv[first++];
+  nfiles = cmd->argc - first;
+  npats = 1;
+  for (nl = strchr(pattern, '\n'); nl != NULL; nl = strchr(nl + 1, '\n'))
+    npats++;
+  pats = (char**)malloc(sizeof(char*) * npats);
+  lens = (size_t*)malloc(sizeof(size_t) * npats);
+  for (i = 0; i < npats; i++)
+    {
+      pats[i] = (char*)pattern;
+      nl = strchr(pattern, '\n');
+      lens[i] = (nl != NULL ? nl - pattern : strlen(pattern));
+      pattern += lens[i] + 1;
+    }
+
+  out.fd = StageOut();
+  out.used = 0;
+  out.failed = FALSE;
+  for (i = 0; i < nfiles || (nfiles == 0 && i == 0); i++)
+    {
+      name = (nfiles > 0 ? cmd->argv[first + i] : "-");
+      if ((fd = openarg("grep", name, &out)) < 0)
+        {
+          status = 2;
+          continue;
+        }
+      if (strcmp(name, "-") == 0)
+        name = "(standard input)";
+      found = grepfd(fd, name, nfiles > 1, pats, lens, npats,
+                     invert, count, &out);
+      closearg(fd);
+      if (found < 0)
+        status = 2;
+      else if (found > 0 && status == 1)
+        status = 0;
+      if (count && found >= 0)
+        {
+          if (nfiles > 1)
+            {
+              put(&out, name, strlen(name));
+              put(&out, ":", 1);
+            }
+          snprintf(line, sizeof(line), "%ld\n", found);
+          put(&out, line, strlen(line));
+        }
+      if (out.failed)
+        break;
+    }
+  free(lens);
+  free(pats);
+  if (!flush(&out))
+    {
+      complain("grep", "write error", NULL);
+      status = 2;
+    }
+  return status;
+} /* RunGrepCmd */
+
+
+/*
+ * RunHeadCmd
+ *
+ * arguments:
+ *   commandT *cmd: the command
+ *
+ * returns: int: 0, or 1 if an operand could not be read
+ *
+ * Prints the first 10 lines, or as many as -n says, with a header for
+ * each file if there are several.
+ */
+int
+RunHeadCmd(commandT* cmd)
+{
+  long lines;
+  int first = BuiltinOptions(cmd, HEAD_OPTIONS, &lines);
+  int nfiles = cmd->argc - first;
+  int i, fd, status = 0;
+  const char* name;
+  outputT out;
+
+  fflush(stdout);
+  if (lines < 0)
+    lines = 10;
+  out.fd = StageOut();
+  out.used = 0;
+  out.failed = FALSE;
+  for (i = 0; i < nfiles || (nfiles == 0 && i == 0); i++)
+    {
+      name = (nfiles > 0 ? cmd->argv[first + i] : "-");
+      if ((fd = openarg(cmd->argv[0], name, &out)) < 0)
+        {
+          status = 1;
+          continue;
+        }
+      if (nfiles > 1)
+        {
+          put(&out, "\n==> " + (i == 0), 5 - (i == 0));
+          name = (strcmp(name, "-") == 0 ? "standard input" : name);
+          put(&out, name, strlen(name));
+          put(&out, " <==\n", 5);
+        }
+      if (!headfd(fd, lines, &out) && !out.failed)
+        {
+          complainof(cmd->argv[0], "error reading '%s'", name, &out);
+          status = 1;
+        }
+      closearg(fd);
+      if (out.failed)
+        break;
+    }
+  if (!flush(&out))
+    {
+      complain(cmd->argv[0], "write error", NULL);
+      status = 1;
+    }
+  return status;
+} /* RunHeadCmd */
+
+
+/*
+ * RunTailCmd
+ *
+ * arguments:
+ *   commandT *cmd: the command
+ *
+ * returns: int: 0, or 1 if an operand could not be read
+ *
+ * Prints the last 10 lines, or as many as -n says, with a header for
+ * each file if there are several.
+ */
+int
+RunTailCmd(commandT* cmd)
+{
+  long lines;
+  int first = BuiltinOptions(cmd, TAIL_OPTIONS, &lines);
+  int nfiles = cmd->argc - first;
+  int i, fd, status = 0;
+  const char* name;
+  outputT out;
+
+  fflush(stdout);
+  if (lines < 0)
+    lines = 10;
+  out.fd = StageOut();
+  out.used = 0;
+  out.failed = FALSE;
+  for (i = 0; i < nfiles || (nfiles == 0 && i == 0); i++)
+    {
+      name = (nfiles > 0 ? cmd->argv[first + i] : "-");
+      if ((fd = openarg(cmd->argv[0], name, &out)) < 0)
+        {
+          status = 1;
+          continue;
+        }
+      if (nfiles > 1)
+        {
+          put(&out, "\n==> " + (i == 0), 5 - (i == 0));
+          name = (strcmp(name, "-") == 0 ? "standard input" : name);
+          put(&out, name, strlen(name));
+          put(&out, " <==\n", 5);
+        }
+      if (!tailfd(fd, lines, &out) && !out.failed)
+        {
+          complainof(cmd->argv[0], "error reading '%s'", name, &out);
+          status = 1;
+        }
+      closearg(fd);
+      if (out.failed)
+        break;
+    }
+  if (!flush(&out))
+    {
+      complain(cmd->argv[0], "write error", NULL);
+      status = 1;
+    }
+  return status;
+} /* RunTailCmd */
+
+
+/*
+ * openarg
+ *
+ * arguments:
+ *   const char *tool, outputT *out: as for complain
+ *   const char *name: the operand
+ *
+ * returns: int: a descriptor to read it from, or -1
+ */
+static int
+openarg(const char* tool, const char* name, outputT* out)
+{
+  int fd;
+
+  if (strcmp(name, "-") == 0)
+    return StageIn();
+  if ((fd = open(name, O_RDONLY | O_CLOEXEC)) < 0)
+    {
+      if (strcmp(tool, "head") == 0 || strcmp(tool, "tail") == 0)
+        complainof(tool, "cannot open '%s' for reading", name, out);
+      else
+        complain(tool, name, out);
+    }
+  return fd;
+} /* openarg */
+
+
+/*
+ * closearg
+ *
+ * arguments:
+ *   int fd: what openarg returned
+ *
+ * returns: none
+ *
+ * stdin stays open.
+ */
+static void
+closearg(int fd)
+{
+  if (fd != StageIn())
+    close(fd);
+} /* closearg */
+
+
+/*
+ * complain
+ *
+ * arguments:
+ *   const char *tool: the tool the builtin stands in for
+ *   const char *what: the operand, or what failed
+ *   outputT *out: the output so far, or NULL
+ *
+ * returns: none
+ *
+ * Prints errno to stderr the way the tools do, after what they printed
+ * before. A pipe that nobody reads any more would have killed the
+ * tool without a word, so EPIPE is not reported.
+ */
+static void
+complain(const char* tool, const char* what, outputT* out)
+{
+  int err = errno;
+
+  if (out != NULL)
+    flush(out);
+  if (err == EPIPE)
+    return;
+  fprintf(stderr, "%s: %s: %s\n", tool, what, strerror(err));
+} /* complain */
+
+
+/*
+ * complainof
+ *
+ * arguments:
+ *   const char *tool, outputT *out: as for complain
+ *   const char *format: what went wrong, with a %s for the operand
+ *   const char *name: the operand
+ *
+ * returns: none
+ *
+ * head and tail do not start with the operand, but say what they could
+ * not do with it, as in "cannot open 'x' for reading".
+ */
+static void
+complainof(const char* tool, const char* format, const char* name,
+           outputT* out)
+{
+  char what[PATH_MAX + 64];
+  int err = errno;
+
+  snprintf(what, sizeof(what), format, name);
+  errno = err;
+  complain(tool, what, out);
+} /* complainof */
+
+
+/*
+ * writeall
+ *
+ * arguments:
+ *   int fd: where to write
+ *   const char *s: what to write
+ *   size_t len: its length
+ *
+ * returns: bool: whether it was all written
+ */
+static bool
+writeall(int fd, const char* s, size_t len)
+{
+  ssize_t n;
+
+  while (len > 0)
+    {
+      if ((n = StageWrite(fd, s, len)) < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          return FALSE;
+        }
+      s += n;
+      len -= n;
+    }
+  return TRUE;
+} /* writeall */
+
+
+/*
+ * put
+ *
+ * arguments:
+ *   outputT *out: the output
+ *   const char *s: what to add
+ *   size_t len: its length
+ *
+ * returns: none
+ *
+ * Once a write failed, nothing more is written, and the filters stop.
+ * What does not fit into the buffer is written right away.
+ */
+static void
+put(outputT* out, const char* s, size_t len)
+{
+  if (out->failed)
+    return;
+  if (out->used + len > BUFSIZE && !flush(out))
+    return;
+  if (len >= BUFSIZE)
+    out->failed = !writeall(out->fd, s, len);
+  else
+    {
+      memcpy(out->buf + out->used, s, len);
+      out->used += len;
+    }
+} /* put */
+
+
+/*
+ * flush
+ *
+ * arguments:
+ *   outputT *out: the output
+ *
+ * returns: bool: whether everything was written so far
+ */
+static bool
+flush(outputT* out)
+{
+  if (!out->failed && out->used > 0)
+    out->failed = !writeall(out->fd, out->buf, out->used);
+  out->used = 0;
+  return !out->failed;
+} /* flush */
+
+
+/*
+ * copyfd
+ *
+ * arguments:
+ *   int in: where to read
+ *   int out: where to write
+ *
+ * returns: int: 0 if all was copied, 1 if reading failed, 2 if
+ *               writing failed
+ *
+ * Between regular files, the data is copied with copy_file_range,
+ * which can share it on file systems that support that; to or from a
+ * pipe, it is spliced; otherwise, and if the kernel refuses either
+ * before anything was copied, it is read and written. Files that claim
+ * to be empty, like those in /proc, are always read.
+ */
+static int
+copyfd(int in, int out)
+{
+  struct stat ist, ost;
+  bool moved = FALSE;
+  int mode = COPY_RW;
+  char buf[BUFSIZE];
+  ssize_t n;
+
+  if (StageStat(in, &ist) == 0 && StageStat(out, &ost) == 0)
+    {
+      if (S_ISREG(ist.st_mode) && ist.st_size > 0 && S_ISREG(ost.st_mode))
+        mode = COPY_RANGE;
+      else if (S_ISFIFO(ist.st_mode) || S_ISFIFO(ost.st_mode))
+        mode = COPY_SPLICE;
+    }
+  for (;;)
+    {
+      if (mode == COPY_RANGE)
+        n = copy_file_range(in, NULL, out, NULL, COPYCHUNK, 0);
+      else if (mode == COPY_SPLICE)
+        n = splice(in, NULL, out, NULL, COPYCHUNK, SPLICE_F_MOVE);
+      else if ((n = StageRead(in, buf, sizeof(buf))) > 0 &&
+               !writeall(out, buf, n))
+        return 2;
+      if (n == 0)
+        return 0;
+      if (n > 0)
+        {
+          moved = TRUE;
+          continue;
+        }
+      if (errno == EINTR && !StageCancelled())
+        continue;
+      if (errno == EINTR)
+        {
+          errno = EPIPE;
+          return 2;
+        }
+      if (mode != COPY_RW && !moved &&
+          (errno == EINVAL || errno == EXDEV || errno == EBADF ||
+           errno == EOPNOTSUPP || errno == ENOSYS))
+        {
+          mode = COPY_RW;
+          continue;
+        }
+      return (mode != COPY_RW && (errno == EPIPE || errno == ENOSPC ||
+                                  errno == EDQUOT || errno == EFBIG) ? 2 : 1);
+    }
+} /* copyfd */
+
+
+/*
+ * countfd
+ *
+ * arguments:
+ *   int fd: where to read
+ *   bool lines: whether the lines have to be counted
+ *   unsigned long *nlines: set to the number of newlines
+ *   unsigned long *nbytes: set to the number of bytes
+ *
+ * returns: bool: FALSE if reading failed
+ *
+ * Only counting the bytes of a regular file does not need to read it.
+ */
+static bool
+countfd(int fd, bool lines, unsigned long* nlines, unsigned long* nbytes)
+{
+  char buf[BUFSIZE];
+  struct stat st;
+  off_t pos;
+  ssize_t n;
+
+  *nlines = *nbytes = 0;
+  if (!lines && StageStat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+      st.st_size > 0 && (pos = lseek(fd, 0, SEEK_CUR)) >= 0)
+    {
+      *nbytes = (pos < st.st_size ? st.st_size - pos : 0);
+      lseek(fd, 0, SEEK_END);
+      return TRUE;
+    }
+  while ((n = StageRead(fd, buf, sizeof(buf))) != 0)
+    {
+      if (n < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          return FALSE;
+        }
+      if (lines)
+        *nlines += ScanCount(buf, n, '\n');
+      *nbytes += n;
+    }
+  return TRUE;
+} /* countfd */
+
+
+/*
+ * findany
+ *
+ * arguments:
+ *   const char *s: the characters to search
+ *   size_t len: their number
+ *   char **pats: the strings to find
+ *   size_t *lens: their lengths
+ *   int npats: their number
+ *
+ * returns: const char*: the first occurrence of any of them, or NULL
+ */
+static const char*
+findany(const char* s, size_t len, char** pats, size_t* lens, int npats)
+{
+  const char* best = NULL;
+  const char* hit;
+  int i;
+
+  for (i = 0; i < npats; i++)
+    if ((hit = ScanFind(s, best != NULL ? best - s : len, pats[i],
+                        lens[i])) != NULL)
+      best = hit;
+  return best;
+} /* findany */
+
+
+/*
+ * grepbuf
+ *
+ * arguments:
+ *   const char *s: whole lines, the last of which may lack its newline
+ *   size_t len: their length
+ *   char **pats: the strings to find
+ *   size_t *lens: their lengths
+ *   int npats: their number
+ *   bool invert: whether the lines without any of them are selected
+ *   bool count: whether the lines are only counted
+ *   const char *name: what to print before each line, or NULL
+ *   outputT *out: where to print them
+ *
+ * returns: long: the number of lines selected
+ *
+ * Searches the whole buffer rather than line by line, so that lines
+ * that do not match cost nothing beyond the search itself; with
+ * -v every line has to be searched on its own.
+ */
+static long
+grepbuf(const char* s, size_t len, char** pats, size_t* lens, int npats,
+        bool invert, bool count, const char* name, outputT* out)
+{
+  const char* end = s + len;
+  const char* start;
+  const char* hit;
+  const char* nl;
+  long found = 0;
+
+  while (s < end && !out->failed)
+    {
+      if (invert)
+        {
+          start = s;
+          nl = memchr(s, '\n', end - s);
+          s = (nl != NULL ? nl + 1 : end);
+          if (findany(start, s - start - (nl != NULL), pats, lens,
+                      npats) != NULL)
+            continue;
+        }
+      else
+        {
+          if ((hit = findany(s, end - s, pats, lens, npats)) == NULL)
+            break;
+          start = memrchr(s, '\n', hit - s);
+          start = (start != NULL ? start + 1 : s);
+          nl = memchr(hit, '\n', end - hit);
+          s = (nl != NULL ? nl + 1 : end);
+        }
+      found++;
+      if (count)
+        continue;
+      if (name != NULL)
+        {
+          put(out, name, strlen(name));
+          put(out, ":", 1);
+        }
+      put(out, start, s - start);
+      if (nl == NULL)
+        put(out, "\n", 1);
+    }
+  return found;
+} /* grepbuf */
+
+
+/*
+ * grepfd
+ *
+ * arguments:
+ *   int fd: where to read
+ *   const char *name: the name of the file
+ *   bool prefix: whether it is printed before each line
+ *   char **pats, size_t *lens, int npats, bool invert, bool count,
+ *   outputT *out: as for grepbuf
+ *
+ * returns: long: the number of lines selected, or -1 if reading failed
+ *
+ * Reads a buffer at a time and hands the whole lines in it to
+ * grepbuf; a line longer than the buffer makes it grow. Once a NUL has
+ * been read, the file is binary, and the first line selected ends the
+ * search with a message instead.
+ */
+static long
+grepfd(int fd, const char* name, bool prefix, char** pats, size_t* lens,
+       int npats, bool invert, bool count, outputT* out)
+{
+  size_t size = BUFSIZE, have = 0, done;
+  bool binary = FALSE;
+  char* buf = (char*)malloc(size);
+  long found = 0, n;
+  char* nl;
+  ssize_t got;
+
+  for (;;)
+    {
+      if (have == size)
+        buf = (char*)realloc(buf, size *= 2);
+      if ((got = StageRead(fd, buf + have, size - have)) < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          complain("grep", name, out);
+          free(buf);
+          return -1;
+        }
+      binary |= (got > 0 && memchr(buf + have, '\0', got) != NULL);
+      have += got;
+      nl = memrchr(buf, '\n', have);
+      done = (got == 0 ? have : nl != NULL ? nl + 1 - buf : 0);
+      if (done > 0)
+        {
+          n = grepbuf(buf, done, pats, lens, npats, invert,
+                      count || binary, prefix ? name : NULL, out);
+          found += n;
+          if (binary && n > 0 && !count)
+            {
+              flush(out);
+              fprintf(stderr, "grep: %s: binary file matches\n", name);
+              break;
+            }
+          memmove(buf, buf + done, have - done);
+          have -= done;
+        }
+      if (got == 0 || out->failed)
+        break;
+    }
+  free(buf);
+  return found;
+} /* grepfd */
+
+
+/*
+ * headfd
+ *
+ * arguments:
+ *   int fd: where to read
+ *   long lines: how many lines to print
+ *   outputT *out: where to print them
+ *
+ * returns: bool: FALSE if reading failed
+ *
+ * What was read beyond the last line is given back by seeking, where
+ * the input allows it.
+ */
+static bool
+headfd(int fd, long lines, outputT* out)
+{
+  char buf[BUFSIZE];
+  char* end;
+  char* p;
+  ssize_t n;
+
+  while (lines > 0 && !out->failed)
+    {
+      if ((n = StageRead(fd, buf, sizeof(buf))) <= 0)
+        {
+          if (n < 0 && errno == EINTR)
+            continue;
+          return n == 0;
+        }
+      end = buf + n;
+      for (p = buf; lines > 0 && (p = memchr(p, '\n', end - p)) != NULL;
+           lines--)
+        p++;
+      if (p == NULL)
+        p = end;
+      put(out, buf, p - buf);
+      if (p < end)
+        lseek(fd, p - end, SEEK_CUR);
+    }
+  return TRUE;
+} /* headfd */
+
+
+/*
+ * tailfd
+ *
+ * arguments:
+ *   int fd: where to read
+ *   long lines: how many lines to print
+ *   outputT *out: where to print them
+ *
+ * returns: bool: FALSE if reading failed
+ *
+ * A regular file is mapped, from where fd is on, and its end is
+ * searched backwards; anything else has to be read to its end first.
+ */
+static bool
+tailfd(int fd, long lines, outputT* out)
+{
+  size_t size = BUFSIZE, have = 0;
+  struct stat st;
+  char* data;
+  char* map;
+  off_t pos;
+  ssize_t n;
+
+  if (StageStat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 &&
+      (pos = lseek(fd, 0, SEEK_CUR)) >= 0)
+    {
+      if (pos >= st.st_size)
+        return TRUE;
+      map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (map != MAP_FAILED)
+        {
+          data = (char*)lastlines(map + pos, st.st_size - pos, lines);
+          put(out, data, map + st.st_size - data);
+          munmap(map, st.st_size);
+          lseek(fd, 0, SEEK_END);
+          return TRUE;
+        }
+    }
+
+  data = (char*)malloc(size);
+  while ((n = StageRead(fd, data + have, size - have)) != 0)
+    {
+      if (n < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          free(data);
+          return FALSE;
+        }
+      if ((have += n) == size)
+        data = (char*)realloc(data, size *= 2);
+    }
+  map = (char*)lastlines(data, have, lines);
+  put(out, map, data + have - map);
+  free(data);
+  return TRUE;
+} /* tailfd */
+
+
+/*
+ * lastlines
+ *
+ * arguments:
+ *   const char *s: the characters
+ *   size_t len: their number
+ *   long lines: how many lines to keep
+ *
+ * returns: const char*: where the last lines start
+ *
+ * The last line counts even without a newline.
+ */
+static const char*
+lastlines(const char* s, size_t len, long lines)
+{
+  const char* p = s + len;
+  const char* nl;
+
+  if (lines == 0)
+    return p;
+  if (len > 0 && p[-1] == '\n')
+    p--;
+  while ((nl = memrchr(s, '\n', p - s)) != NULL)
+    {
+      if (--lines == 0)
+        return nl + 1;
+      p = nl;
+    }
+  return s;
+} /* lastlines */
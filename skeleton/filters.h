@@ -0,0 +1,106 @@
+/***************************************************************************
+ *  Title: Filters
+ * -------------------------------------------------------------------------
+ *    Purpose: cat, wc, fgrep, head and tail inside the shell
+ *    File: filters.h
+ ***************************************************************************/
+
+#ifndef __FILTERS_H__
+#define __FILTERS_H__
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/************System include***********************************************/
+
+/************Private include**********************************************/
+#include "interpreter.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#undef EXTERN
+#ifdef __FILTERS_IMPL__
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+/* the options each filter knows, as BuiltinOptions takes them; with
+ * any other option the real tool runs */
+#define CAT_OPTIONS   "u"
+#define WC_OPTIONS    "l!c!"
+#define FGREP_OPTIONS "cv"
+#define GREP_OPTIONS  "F!cv"
+#define HEAD_OPTIONS  "n#"
+#define TAIL_OPTIONS  "n#"
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: cat
+ * ---------------------------------------------------------------------
+ *    Purpose: Copies files, or stdin, to stdout, in the kernel where it
+ *    can.
+ *    Input: the command
+ *    Output: its exit status
+ ***********************************************************************/
+EXTERN int
+RunCatCmd(commandT*);
+
+/***********************************************************************
+ *  Title: wc
+ * ---------------------------------------------------------------------
+ *    Purpose: Counts the lines and bytes of files, or of stdin, like
+ *    wc -l and wc -c.
+ *    Input: the command
+ *    Output: its exit status
+ ***********************************************************************/
+EXTERN int
+RunWcCmd(commandT*);
+
+/***********************************************************************
+ *  Title: fgrep and grep -F
+ * ---------------------------------------------------------------------
+ *    Purpose: Prints the lines of files, or of stdin, that contain one
+ *    of a list of strings, or with -v those that do not, or with -c
+ *    how many there are.
+ *    Input: the command
+ *    Output: 0 if a line was selected, 1 if none was, 2 on an error
+ ***********************************************************************/
+EXTERN int
+RunGrepCmd(commandT*);
+
+/***********************************************************************
+ *  Title: head
+ * ---------------------------------------------------------------------
+ *    Purpose: Prints the first lines of files, or of stdin, and reads
+ *    no further.
+ *    Input: the command
+ *    Output: its exit status
+ ***********************************************************************/
+EXTERN int
+RunHeadCmd(commandT*);
+
+/***********************************************************************
+ *  Title: tail
+ * ---------------------------------------------------------------------
+ *    Purpose: Prints the last lines of files, or of stdin.
+ *    Input: the command
+ *    Output: its exit status
+ ***********************************************************************/
+EXTERN int
+RunTailCmd(commandT*);
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __FILTERS_H__ */
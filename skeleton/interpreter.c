@@ -44,6 +44,7 @@
 
 /************System include***********************************************/
 #include <assert.h>
+#include <ctype.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include "string.h"
@@ -51,7 +52,10 @@
 /************Private include**********************************************/
 #include "interpreter.h"
 #include "io.h"
+#include "parsecache.h"
 #include "runtime.h"
+#include "scan.h"
+#include "snapshot.h"
 
 /************Defines and Typedefs*****************************************/
 /*  #defines and typedefs should have their names in all caps.
@@ -65,10 +69,109 @@ typedef struct string_l
   struct string_l* next;
 } stringL;
 
-int BUFSIZE = 512;
-int MAXARGS = 100;
+/* the tokens of a line */
+#define TOK_END        0
+#define TOK_WORD       1
+#define TOK_PIPE       2   /* | */
+#define TOK_OR         3   /* || */
+#define TOK_AMP        4   /* & */
+#define TOK_AND        5   /* && */
+#define TOK_SEMI       6   /* ; */
+#define TOK_LPAREN     7   /* ( */
+#define TOK_RPAREN     8   /* ) */
+#define TOK_REDIR      9   /* < > >> &> &>> <& >& << <<- <<<, maybe after
+                              a number */
+#define TOK_PROCSUB   10   /* <( >( */
+
+/* whether a character of the given class is (part of) an operator */
+#define ISOPERATOR(c)  ((c) == SCAN_PIPE || (c) == SCAN_AMP || \
+                        (c) == SCAN_SEMI || (c) == SCAN_PAREN || \
+                        (c) == SCAN_REDIR)
+
+/* how deeply groups may be nested, which bounds the recursion */
+#define MAXNESTING     256
+
+/* the longest number before a redirection that is taken as a
+ * descriptor rather than a word */
+#define MAXFDDIGITS    9
+
+/* how much room the bodies of the here-documents of a line get at
+ * first */
+#define HEREDOCSIZE    4096
+
+typedef struct token_t
+{
+  int type;
+  char* word;       /* the unescaped text of a TOK_WORD */
+  redirType_t redir;/* TOK_REDIR: what it does, REDIR_DUP for <& and >&;
+                       TOK_PROCSUB: REDIR_IN for <(, REDIR_OUT for >( */
+  int fd;           /* TOK_REDIR: the descriptor it redirects */
+  size_t start;     /* where in the line the token starts and ends */
+  size_t end;
+} tokenT;
+
+/* the state of ParseLine; the nodes and commands are carved off the
+ * room reserved for them as they are parsed */
+typedef struct parser_t
+{
+  char* line;
+  tokenT* tok;
+  nodeT* nodes;
+  redirT* redirs;
+  char* cmds;
+  int depth;
+  int ndocs;
+  bool error;
+} parserT;
+
+/* the metacharacter masks of the line being parsed; they are kept
+ * between calls so that parsing does not allocate them every time */
+static uint64_t* gMasks = NULL;
+static size_t gMaskWords = 0;
+/* the tokens of the line being parsed, kept like the masks */
+static tokenT* gTokens = NULL;
+static size_t gTokenSize = 0;
 
 /**************Function Prototypes******************************************/
+/* scans a line for metacharacters */
+static uint64_t*
+scanline(char*, size_t);
+/* splits a line into tokens */
+static void
+lex(char*, size_t, uint64_t*, char*, char*, size_t);
+/* unescapes a word */
+static size_t
+lexword(char*, size_t, uint64_t*, size_t, char**, char*, size_t);
+/* parses a list of && / || lists */
+static nodeT*
+parselist(parserT*);
+/* parses a && / || list of pipelines */
+static nodeT*
+parseandor(parserT*);
+/* parses a pipeline */
+static nodeT*
+parsepipeline(parserT*);
+/* parses a simple command or a group */
+static nodeT*
+parsecommand(parserT*);
+/* parses a simple command */
+static nodeT*
+parsesimple(parserT*);
+/* parses the redirections at the current token */
+static bool
+parseredirs(parserT*, redirT**);
+/* where the text of a node that ends before the next token ends */
+static size_t
+textend(parserT*);
+/* makes a node */
+static nodeT*
+newnode(parserT*, nodeType_t, nodeT*, nodeT*);
+/* reports a syntax error at the next token */
+static nodeT*
+syntaxerror(parserT*);
+/* reads the bodies of the here-documents of a line */
+static heredocT*
+readheredocs(parseT*, char**);
 
 /**************Implementation***********************************************/
 
@@ -79,82 +182,971 @@ int MAXARGS = 100;
  * arguments:
  *   char *cmdLine: pointer to the command line string
  *
- * returns: none
+ * returns: int: the exit status of the line, 0 if there is nothing
+ *               to run
  *
  * This is the high-level function called by tsh's main to interpret a
- * command line.
+ * command line. Everything the line allocates while it runs comes from
+ * cmdArena, which is reset once it is done. The bodies of its
+ * here-documents follow the line in the input, and are read before it
+ * runs, which is why cmdLine is not used after it is parsed.
  */
-void
+int
 Interpret(char* cmdLine)
 {
 
-  commandT* cmd = getCommand(cmdLine);
-  cmd->cmdline = (char *)malloc(sizeof(char) * (strlen(cmdLine) + 1));
-  strcpy(cmd->cmdline, cmdLine); 
+  parseT* line = ParseCacheLookup(cmdLine, &cmdArena);
+  heredocT* docs = NULL;
+  char* bodies = NULL;
+  int status = 0;
+
+  if (line->ndocs > 0 && line->root != NULL)
+    docs = readheredocs(line, &bodies);
+  if (line->root != NULL)
+    status = RunCmd(line->root, docs);
+  else if (line->error)
+    SnapshotTaint();
 
-  RunCmd(cmd);
-  
-  freeCommand(cmd);
+  free(bodies);
+  FreeParse(line);
+  ArenaReset(&cmdArena);
+  return status;
 } /* Interpret */
 
 
+/*
+ * ParseLine
+ *
+ * arguments:
+ *   char *cmdLine: pointer to the command line string
+ *   arenaT *arena: the arena to allocate the line from, or NULL
+ *
+ * returns: parseT*: the parsed line, to be freed with FreeParse
+ *
+ * Parses a command line into a tree of lists (; &), && / || lists,
+ * pipelines, groups and simple commands with their redirections:
+ *
+ *   list     := andor ((';' | '&') andor)* [';' | '&']
+ *   andor    := pipeline (('&&' | '||') pipeline)*
+ *   pipeline := command ('|' command)*
+ *   command  := '(' list ')' redir* | (word | procsub | redir)+
+ *   procsub  := ('<(' | '>(') list ')'
+ *   redir    := [n] ('<' | '>' | '>>' | '<&' | '>&') word
+ *             | [n] ('<<' | '<<-' | '<<<') word
+ *             | ('&>' | '&>>') word
+ *
+ * Words are unescaped with the same rules as in getCommand, but also
+ * end at unquoted operators. The line is scanned once for
+ * metacharacters, split into tokens once and parsed by recursive
+ * descent without backtracking. Like getCommand, everything lives in a
+ * single allocation, sized from the metacharacters: every token but
+ * the last ends at a separator or an operator character, which may be
+ * a token itself. Every word and operator makes a node, and a & can
+ * make two, the NODE_BG and the NODE_SEQ after it. There are no more
+ * redirections than operator characters, and a process substitution
+ * fits into the room of the two tokens that enclose it.
+ */
+parseT*
+ParseLine(char* cmdLine, arenaT* arena)
+{
+  parseT* p;
+  parserT ps;
+  uint64_t* masks;
+  char* home = NULL;
+  size_t i, len, size, ntokens, nnodes, homelen = 0;
+  size_t nseps = 0, nops = 0, ntildes = 0;
+  int cls;
+
+  len = strlen(cmdLine);
+  masks = scanline(cmdLine, len);
+  for (i = ScanNext(masks, len, 0); i < len; i = ScanNext(masks, len, i + 1))
+    {
+      cls = kScanClass[(unsigned char)cmdLine[i]];
+      if (cls == SCAN_SPACE)
+        nseps++;
+      else if (ISOPERATOR(cls))
+        nops++;
+      else if (cls == SCAN_TILDE && cmdLine[i + 1] == '/')
+        ntildes++;
+    }
+  if (ntildes > 0 && (home = getenv("HOME")) != NULL)
+    homelen = strlen(home);
+  ntokens = nseps + 2 * nops + 1;
+  nnodes = nseps + 3 * nops + 1;
+  if (ntokens + 1 > gTokenSize)
+    {
+      gTokenSize = ntokens + 1 > 2 * gTokenSize ? ntokens + 1 : 2 * gTokenSize;
+      free(gTokens);
+      gTokens = malloc(sizeof(tokenT) * gTokenSize);
+    }
+
+  size = sizeof(parseT) + sizeof(nodeT) * nnodes + sizeof(redirT) * nops
+    + (sizeof(commandT) + 2 * sizeof(char*)) * ntokens
+    + (len + 1) + (len + ntokens + ntildes * homelen);
+  p = (arena != NULL ? ArenaAlloc(arena, size) : malloc(size));
+  p->inarena = (arena != NULL);
+  ps.nodes = (nodeT*)(p + 1);
+  ps.redirs = p->redirs = (redirT*)(ps.nodes + nnodes);
+  ps.cmds = (char*)(ps.redirs + nops);
+  p->line = ps.cmds + (sizeof(commandT) + 2 * sizeof(char*)) * ntokens;
+  memcpy(p->line, cmdLine, len + 1);
+  lex(p->line, len, masks, p->line + len + 1, home, homelen);
+
+  ps.line = p->line;
+  ps.tok = gTokens;
+  ps.depth = 0;
+  ps.ndocs = 0;
+  ps.error = FALSE;
+  p->root = NULL;
+  p->refs = 1;
+  if (ps.tok->type != TOK_END)
+    {
+      p->root = parselist(&ps);
+      if (p->root != NULL && ps.tok->type != TOK_END)
+        p->root = syntaxerror(&ps);
+    }
+  p->error = ps.error;
+  p->nredirs = ps.redirs - p->redirs;
+  p->ndocs = ps.ndocs;
+  fflush(stdout);
+  return p;
+} /* ParseLine */
+
+
+/*
+ * FreeParse
+ *
+ * arguments:
+ *   parseT *line: a line returned by ParseLine
+ *
+ * returns: none
+ *
+ * Drops a reference to the line, and frees it with all of its nodes
+ * and commands once there is none left. A line in an arena goes away
+ * with the arena.
+ */
+void
+FreeParse(parseT* line)
+{
+  if (--line->refs == 0 && !line->inarena)
+    free(line);
+} /* FreeParse */
+
+
+/*
+ * lex
+ *
+ * arguments:
+ *   char *line: the line
+ *   size_t len: its length
+ *   uint64_t *masks: its metacharacter masks
+ *   char *buf: where the unescaped words go
+ *   char *home: the value of HOME, for ~/
+ *   size_t homelen: its length
+ *
+ * returns: none
+ *
+ * Splits the line into gTokens, which ends with a TOK_END. A number
+ * right before a < or > is the descriptor the redirection applies to,
+ * which is part of its token. A < or > right before a ( starts a
+ * process substitution instead.
+ */
+static void
+lex(char* line, size_t len, uint64_t* masks, char* buf, char* home,
+    size_t homelen)
+{
+  tokenT* tok = gTokens;
+  size_t i = 0, j;
+
+  for (;; tok++)
+    {
+      while (i < len && kScanClass[(unsigned char)line[i]] == SCAN_SPACE)
+        i++;
+      tok->start = i;
+      tok->word = NULL;
+      tok->fd = -1;
+      if (i == len)
+        {
+          tok->type = TOK_END;
+          tok->end = i;
+          return;
+        }
+      for (j = i; j < len && j - i <= MAXFDDIGITS && isdigit((unsigned char)line[j]); j++)
+        ;
+      if (j > i && j - i <= MAXFDDIGITS && (line[j] == '<' || line[j] == '>'))
+        {
+          tok->fd = atoi(line + i);
+          i = j;
+        }
+      switch (line[i])
+        {
+        case '|':
+          tok->type = (line[i + 1] == '|' ? TOK_OR : TOK_PIPE);
+          break;
+        case '&':
+          if (line[i + 1] == '>')
+            {
+              tok->type = TOK_REDIR;
+              tok->fd = 1;
+              if (line[i + 2] == '>')
+                {
+                  tok->redir = REDIR_BOTHAPPEND;
+                  i++;
+                }
+              else
+                tok->redir = REDIR_BOTH;
+              i += 2;
+              tok->end = i;
+              continue;
+            }
+          tok->type = (line[i + 1] == '&' ? TOK_AND : TOK_AMP);
+          break;
+        case ';':
+          tok->type = TOK_SEMI;
+          break;
+        case '(':
+          tok->type = TOK_LPAREN;
+          break;
+        case ')':
+          tok->type = TOK_RPAREN;
+          break;
+        case '<':
+        case '>':
+          if (line[i + 1] == '(' && tok->fd < 0)
+            {
+              tok->type = TOK_PROCSUB;
+              tok->redir = (line[i] == '<' ? REDIR_IN : REDIR_OUT);
+              i += 2;
+              tok->end = i;
+              continue;
+            }
+          tok->type = TOK_REDIR;
+          if (tok->fd < 0)
+            tok->fd = (line[i] == '<' ? 0 : 1);
+          if (line[i + 1] == '&')
+            tok->redir = REDIR_DUP;
+          else if (line[i] == '>' && line[i + 1] == '>')
+            tok->redir = REDIR_APPEND;
+          else if (line[i] == '<' && line[i + 1] == '<')
+            {
+              tok->redir = (line[i + 2] == '<' ? REDIR_HERESTRING :
+                            line[i + 2] == '-' ? REDIR_HEREDOCTABS :
+                            REDIR_HEREDOC);
+              if (tok->redir != REDIR_HEREDOC)
+                i++;
+            }
+          else
+            tok->redir = (line[i] == '<' ? REDIR_IN : REDIR_OUT);
+          i += (tok->redir == REDIR_IN || tok->redir == REDIR_OUT ? 1 : 2);
+          tok->end = i;
+          continue;
+        default:
+          tok->type = TOK_WORD;
+          tok->word = buf;
+          i = lexword(line, len, masks, i, &buf, home, homelen);
+          tok->end = i;
+          continue;
+        }
+      i += (tok->type == TOK_OR || tok->type == TOK_AND ? 2 : 1);
+      tok->end = i;
+    }
+} /* lex */
+
+
+/*
+ * lexword
+ *
+ * arguments:
+ *   char *line: the line
+ *   size_t len: its length
+ *   uint64_t *masks: its metacharacter masks
+ *   size_t i: where the word starts
+ *   char **buf: where the word goes; advanced past its terminating 0
+ *   char *home: the value of HOME, for ~/
+ *   size_t homelen: its length
+ *
+ * returns: size_t: where the word ends
+ *
+ * Unescapes a word like getCommand does with an argument. The word
+ * ends at unquoted whitespace or an unquoted operator; either can be
+ * made part of the word with a backslash.
+ */
+static size_t
+lexword(char* line, size_t len, uint64_t* masks, size_t i, char** buf,
+        char* home, size_t homelen)
+{
+  char* out = *buf;
+  size_t next;
+  char quote = 0;
+  char escape = 0;
+  char ch;
+  int cls;
+
+  for (; i < len; i++)
+    {
+      next = ScanNext(masks, len, i);
+      if (next > i)
+        {
+          if (escape == '\\')
+            {
+              if (quote != 0)
+                *out++ = '\\';
+              escape = 0;
+            }
+          memcpy(out, line + i, next - i);
+          out += next - i;
+          if ((i = next) == len)
+            break;
+        }
+      ch = line[i];
+      cls = kScanClass[(unsigned char)ch];
+
+      if (quote == 0 && (cls == SCAN_SPACE || ISOPERATOR(cls)))
+        {
+          if (escape == 0)
+            break;
+          *out++ = ch;
+          escape = 0;
+          continue;
+        }
+
+      if (ch == '\'' || ch == '"')
+        {
+          if (escape != 0 && quote != 0 && ch == quote)
+            {
+              // Escaped quote. Add it to the argument.
+              *out++ = ch;
+              escape = 0;
+              continue;
+            }
+          if (quote == 0)
+            {
+              quote = ch;
+              continue;
+            }
+          else if (ch == quote)
+            {
+              quote = 0;
+              continue;
+            }
+        }
+
+      if (ch == '\\' && escape == '\\')
+        {
+          escape = 0;
+          *out++ = '\\';
+          continue;
+        }
+      if (escape == '\\')
+        {
+          if (quote != 0)
+            *out++ = '\\';
+          escape = 0;
+        }
+      if (ch == '\\')
+        {
+          escape = '\\';
+          continue;
+        }
+      // replace ~/ with $HOME/
+      if (ch == '~' && line[i + 1] == '/')
+        {
+          memcpy(out, home, homelen);
+          out += homelen;
+          continue;
+        }
+      *out++ = ch;
+    }
+  *out++ = 0;
+  *buf = out;
+  return i;
+} /* lexword */
+
+
+/*
+ * parselist
+ *
+ * arguments:
+ *   parserT *ps: the parser
+ *
+ * returns: nodeT*: the list, or NULL after a syntax error
+ *
+ * Parses && / || lists separated by ; or &, up to the end of the line
+ * or a ). A & puts only the && / || list before it in the background.
+ */
+static nodeT*
+parselist(parserT* ps)
+{
+  nodeT* list = parseandor(ps);
+  nodeT** last = &list;
+  nodeT* right;
+
+  while (list != NULL &&
+         (ps->tok->type == TOK_SEMI || ps->tok->type == TOK_AMP))
+    {
+      if (ps->tok->type == TOK_AMP)
+        *last = newnode(ps, NODE_BG, *last, NULL);
+      ps->tok++;
+      if (ps->tok->type == TOK_END || ps->tok->type == TOK_RPAREN)
+        break;
+      if ((right = parseandor(ps)) == NULL)
+        return NULL;
+      list = newnode(ps, NODE_SEQ, list, right);
+      last = &list->right;
+    }
+  return list;
+} /* parselist */
+
+
+/*
+ * parseandor
+ *
+ * arguments:
+ *   parserT *ps: the parser
+ *
+ * returns: nodeT*: the list, or NULL after a syntax error
+ *
+ * Parses pipelines joined by && and ||, which bind to the left.
+ */
+static nodeT*
+parseandor(parserT* ps)
+{
+  nodeT* node = parsepipeline(ps);
+  nodeT* right;
+  nodeType_t type;
+
+  while (node != NULL &&
+         (ps->tok->type == TOK_AND || ps->tok->type == TOK_OR))
+    {
+      type = (ps->tok->type == TOK_AND ? NODE_AND : NODE_OR);
+      ps->tok++;
+      if ((right = parsepipeline(ps)) == NULL)
+        return NULL;
+      node = newnode(ps, type, node, right);
+    }
+  return node;
+} /* parseandor */
+
+
+/*
+ * parsepipeline
+ *
+ * arguments:
+ *   parserT *ps: the parser
+ *
+ * returns: nodeT*: the pipeline, or NULL after a syntax error
+ *
+ * Parses commands joined by |. The pipeline is a chain of NODE_PIPEs
+ * down the right, with a stage on the left of each; it is built
+ * without recursion, so that long pipelines do not use up the stack.
+ */
+static nodeT*
+parsepipeline(parserT* ps)
+{
+  nodeT* node = parsecommand(ps);
+  nodeT** link = &node;
+  nodeT* right;
+  nodeT* pipe;
+  const char* end;
+
+  while (*link != NULL && ps->tok->type == TOK_PIPE)
+    {
+      ps->tok++;
+      if ((right = parsecommand(ps)) == NULL)
+        return NULL;
+      *link = newnode(ps, NODE_PIPE, *link, right);
+      link = &(*link)->right;
+    }
+  if (node != NULL && node->type == NODE_PIPE)
+    {
+      // every pipe stands for the rest of the pipeline
+      end = (*link)->text + (*link)->textlen;
+      for (pipe = node; pipe->type == NODE_PIPE; pipe = pipe->right)
+        pipe->textlen = end - pipe->text;
+    }
+  return node;
+} /* parsepipeline */
+
+
+/*
+ * parsecommand
+ *
+ * arguments:
+ *   parserT *ps: the parser
+ *
+ * returns: nodeT*: the group or command, or NULL after a syntax error
+ *
+ * Parses a list in parentheses, or a simple command.
+ */
+static nodeT*
+parsecommand(parserT* ps)
+{
+  tokenT* open = ps->tok;
+  nodeT* body;
+  nodeT* node;
+
+  if (open->type != TOK_LPAREN)
+    return parsesimple(ps);
+  if (++ps->depth > MAXNESTING)
+    return syntaxerror(ps);
+  ps->tok++;
+  if ((body = parselist(ps)) == NULL)
+    return NULL;
+  if (ps->tok->type != TOK_RPAREN)
+    return syntaxerror(ps);
+  ps->depth--;
+  node = newnode(ps, NODE_GROUP, body, NULL);
+  node->text = ps->line + open->start;
+  ps->tok++;
+  if (!parseredirs(ps, &node->redirs))
+    return NULL;
+  node->textlen = textend(ps) - open->start;
+  return node;
+} /* parsecommand */
+
+
+/*
+ * parsesimple
+ *
+ * arguments:
+ *   parserT *ps: the parser
+ *
+ * returns: nodeT*: the command, or NULL after a syntax error
+ *
+ * Parses words, process substitutions and redirections into a
+ * commandT. The arguments are counted first, so that argv can be
+ * carved off with the right size; the body of a process substitution
+ * is skipped there and parsed in place of its argument, whose word is
+ * left empty until the command runs. The redirections are applied in
+ * order, so a later redirection of the same descriptor replaces an
+ * earlier one.
+ */
+static nodeT*
+parsesimple(parserT* ps)
+{
+  tokenT* first = ps->tok;
+  tokenT* tok;
+  commandT* cmd;
+  nodeT* node;
+  redirT** link;
+  procsubT** sublink;
+  procsubT* sub;
+  int argc = 0, depth;
+
+  for (tok = first; ; tok++)
+    {
+      if (tok->type == TOK_WORD)
+        argc++;
+      else if (tok->type == TOK_PROCSUB)
+        {
+          // a missing ) is reported when the body is parsed
+          argc++;
+          for (depth = 1; depth > 0 && (tok + 1)->type != TOK_END; )
+            {
+              tok++;
+              if (tok->type == TOK_PROCSUB || tok->type == TOK_LPAREN)
+                depth++;
+              else if (tok->type == TOK_RPAREN)
+                depth--;
+            }
+        }
+      else if (tok->type == TOK_REDIR)
+        {
+          if ((tok + 1)->type != TOK_WORD)
+            {
+              ps->tok = tok + 1;
+              return syntaxerror(ps);
+            }
+          tok++;
+        }
+      else
+        break;
+    }
+  if (tok == first)
+    return syntaxerror(ps);
+
+  cmd = (commandT*)ps->cmds;
+  ps->cmds += sizeof(commandT) + sizeof(char*) * (argc + 1);
+  cmd->argc = 0;
+  cmd->path = NULL;
+  cmd->dirfd = -1;
+  cmd->redirs = NULL;
+  cmd->procsubs = NULL;
+  cmd->cmdline = NULL;
+  cmd->pipeTo = NULL;
+  link = &cmd->redirs;
+  sublink = &cmd->procsubs;
+  for (ps->tok = first; ps->tok->type == TOK_WORD ||
+         ps->tok->type == TOK_PROCSUB || ps->tok->type == TOK_REDIR; )
+    {
+      if (ps->tok->type == TOK_WORD)
+        cmd->argv[cmd->argc++] = ps->tok++->word;
+      else if (ps->tok->type == TOK_PROCSUB)
+        {
+          if (++ps->depth > MAXNESTING)
+            return syntaxerror(ps);
+          sub = (procsubT*)ps->cmds;
+          ps->cmds += sizeof(procsubT);
+          sub->arg = cmd->argc;
+          sub->out = (ps->tok->redir == REDIR_OUT);
+          sub->next = NULL;
+          cmd->argv[cmd->argc++] = "";
+          ps->tok++;
+          if ((sub->body = parselist(ps)) == NULL)
+            return NULL;
+          if (ps->tok->type != TOK_RPAREN)
+            return syntaxerror(ps);
+          ps->depth--;
+          ps->tok++;
+          *sublink = sub;
+          sublink = &sub->next;
+        }
+      else
+        {
+          parseredirs(ps, link);
+          while (*link != NULL)
+            link = &(*link)->next;
+        }
+    }
+  cmd->argv[cmd->argc] = NULL;
+  cmd->name = cmd->argv[0];
+
+  node = newnode(ps, NODE_CMD, NULL, NULL);
+  node->cmd = cmd;
+  node->text = ps->line + first->start;
+  node->textlen = textend(ps) - first->start;
+  return node;
+} /* parsesimple */
+
+
+/*
+ * parseredirs
+ *
+ * arguments:
+ *   parserT *ps: the parser
+ *   redirT **link: where the first redirection goes
+ *
+ * returns: bool: FALSE after a syntax error
+ *
+ * Parses the redirections from the current token on into a list. The
+ * word of <& and >& is a descriptor, or - to close it. Here-documents
+ * are numbered in the order their bodies follow the line.
+ */
+static bool
+parseredirs(parserT* ps, redirT** link)
+{
+  redirT* redir;
+  char* word;
+  char* end;
+  size_t i;
+
+  for (; ps->tok->type == TOK_REDIR; ps->tok += 2)
+    {
+      if ((ps->tok + 1)->type != TOK_WORD)
+        {
+          ps->tok++;
+          syntaxerror(ps);
+          return FALSE;
+        }
+      word = (ps->tok + 1)->word;
+      redir = ps->redirs++;
+      redir->type = ps->tok->redir;
+      redir->fd = ps->tok->fd;
+      redir->to = -1;
+      redir->file = word;
+      redir->quoted = FALSE;
+      for (i = (ps->tok + 1)->start; i < (ps->tok + 1)->end; i++)
+        if (ps->line[i] == '\'' || ps->line[i] == '"' || ps->line[i] == '\\')
+          redir->quoted = TRUE;
+      redir->next = NULL;
+      if (redir->type == REDIR_HEREDOC || redir->type == REDIR_HEREDOCTABS)
+        redir->to = ps->ndocs++;
+      else if (redir->type == REDIR_DUP)
+        {
+          if (strcmp(word, "-") == 0)
+            redir->type = REDIR_CLOSE;
+          else if (isdigit((unsigned char)word[0]) &&
+                   strlen(word) <= MAXFDDIGITS)
+            {
+              redir->to = strtol(word, &end, 10);
+              if (*end != '\0')
+                redir->to = -1;
+            }
+        }
+      *link = redir;
+      link = &redir->next;
+    }
+  return TRUE;
+} /* parseredirs */
+
+
+/*
+ * textend
+ *
+ * arguments:
+ *   parserT *ps: the parser, at the token after a command or group
+ *
+ * returns: size_t: where the text of the command or group ends
+ *
+ * The text of a job is shown by jobs; at the end of the line, it keeps
+ * the trailing whitespace, as the line itself is shown for a
+ * foreground job.
+ */
+static size_t
+textend(parserT* ps)
+{
+  if (ps->tok->type == TOK_END)
+    return ps->tok->start;
+  return (ps->tok - 1)->end;
+} /* textend */
+
+
+/*
+ * newnode
+ *
+ * arguments:
+ *   parserT *ps: the parser
+ *   nodeType_t type: what the node stands for
+ *   nodeT *left: its first operand, or NULL
+ *   nodeT *right: its second operand, or NULL
+ *
+ * returns: nodeT*: the node, whose text spans its operands
+ */
+static nodeT*
+newnode(parserT* ps, nodeType_t type, nodeT* left, nodeT* right)
+{
+  nodeT* node = ps->nodes++;
+
+  node->type = type;
+  node->cmd = NULL;
+  node->left = left;
+  node->right = right;
+  node->redirs = NULL;
+  node->text = NULL;
+  node->textlen = 0;
+  if (left != NULL)
+    {
+      node->text = left->text;
+      node->textlen = left->textlen;
+      if (right != NULL)
+        node->textlen = right->text + right->textlen - left->text;
+    }
+  return node;
+} /* newnode */
+
+
+/*
+ * syntaxerror
+ *
+ * arguments:
+ *   parserT *ps: the parser
+ *
+ * returns: nodeT*: NULL
+ *
+ * Complains about the next token like bash, once per line.
+ */
+static nodeT*
+syntaxerror(parserT* ps)
+{
+  if (!ps->error)
+    {
+      if (ps->tok->type == TOK_END)
+        printf("%s: syntax error near unexpected token `newline'\n",
+               SHELLNAME);
+      else
+        printf("%s: syntax error near unexpected token `%.*s'\n", SHELLNAME,
+               (int)(ps->tok->end - ps->tok->start),
+               ps->line + ps->tok->start);
+    }
+  ps->error = TRUE;
+  return NULL;
+} /* syntaxerror */
+
+
+/*
+ * readheredocs
+ *
+ * arguments:
+ *   parseT *line: a parsed line with here-documents
+ *   char **bodies: set to the buffer that holds the bodies, which the
+ *                  caller frees
+ *
+ * returns: heredocT*: the bodies, in cmdArena, in the order they are
+ *                     numbered
+ *
+ * Reads the lines that follow the line up to each delimiter, which is
+ * the word after the operator, taken as it is. Unless part of the
+ * delimiter was quoted, the variables in the body are expanded once
+ * it is read. <<- strips leading tabs, from the delimiter line as well.
+ * The input may end before the delimiter, as in bash, which then
+ * warns. All bodies go into a single buffer that grows as needed; as
+ * it may move, they are only pointed into it once they are all read.
+ */
+static heredocT*
+readheredocs(parseT* line, char** bodies)
+{
+  heredocT* docs;
+  size_t* starts;
+  redirT* redir;
+  char* text;
+  char* buf = NULL;
+  size_t size = 0, used = 0, len;
+  int i, doc = 0;
+
+  docs = ArenaAlloc(&cmdArena, sizeof(heredocT) * line->ndocs);
+  starts = ArenaAlloc(&cmdArena, sizeof(size_t) * (line->ndocs + 1));
+  for (i = 0; i < line->nredirs; i++)
+    {
+      redir = &line->redirs[i];
+      if (redir->type != REDIR_HEREDOC && redir->type != REDIR_HEREDOCTABS)
+        continue;
+      starts[doc++] = used;
+      for (;;)
+        {
+          if ((text = GetHereDocLine()) == NULL)
+            {
+              printf("%s: warning: here-document delimited by end-of-file "
+                     "(wanted `%s')\n", SHELLNAME, redir->file);
+              break;
+            }
+          if (redir->type == REDIR_HEREDOCTABS)
+            while (*text == '\t')
+              text++;
+          if (strcmp(text, redir->file) == 0)
+            break;
+          len = strlen(text);
+          if (used + len + 1 > size)
+            {
+              size = (used + len + 1 > 2 * size ? used + len + 1 : 2 * size);
+              if (size < HEREDOCSIZE)
+                size = HEREDOCSIZE;
+              buf = realloc(buf, size);
+            }
+          memcpy(buf + used, text, len);
+          buf[used + len] = '\n';
+          used += len + 1;
+        }
+    }
+  starts[doc] = used;
+  for (i = 0, doc = 0; i < line->nredirs; i++)
+    {
+      redir = &line->redirs[i];
+      if (redir->type != REDIR_HEREDOC && redir->type != REDIR_HEREDOCTABS)
+        continue;
+      docs[doc].body = (buf != NULL ? buf + starts[doc] : "");
+      docs[doc].len = starts[doc + 1] - starts[doc];
+      if (!redir->quoted)
+        docs[doc].body = ExpandVars(docs[doc].body, docs[doc].len,
+                                    &docs[doc].len);
+      doc++;
+    }
+  *bodies = buf;
+  return docs;
+} /* readheredocs */
+
+
 /*
  * getCommand
  *
  * arguments:
  *   char *cmdLine: pointer to the command line string
+ *   arenaT *arena: the arena to allocate the command from, or NULL
  *
  * returns: commandT*: pointer to the commandT struct generated by
  *                     parsing the cmdLine string
  *
  * This parses the command line string, and returns a commandT struct,
  * as defined in runtime.h.  You must free the memory used by commandT
- * using the freeCommand function after you are finished.
+ * using the freeCommand function after you are finished, unless it is
+ * in an arena.
  *
  * This function tokenizes the input, preserving quoted strings. It
  * supports escaping quotes and the escape character, '\'.
+ *
+ * The commandT, argv, a copy of the line (cmd->cmdline) and the
+ * unescaped arguments share a single allocation; argv[] points into
+ * it, so arguments must not be freed or grown in place. How much room
+ * is needed follows from the metacharacters: arguments end at a space,
+ * so there are at most one more than there are spaces, and unescaping
+ * only ever makes the text shorter, except for ~/. Only the
+ * metacharacters go through the state machine below; the text between
+ * them is copied as a whole.
  */
 commandT*
-getCommand(char* cmdLine)
+getCommand(char* cmdLine, arenaT* arena)
 {
-  commandT* cmd = malloc(sizeof(commandT) + sizeof(char*) * MAXARGS);
-  cmd->argv[0] = 0;
-  cmd->name = 0;
-  cmd->argc = 0;
-  cmd->pipeTo = NULL;
-  
-  int i, inArg = 0;
+  commandT* cmd;
+  uint64_t* masks;
+  char* home = NULL;
+  char* buf;
+  char* arg;
+  size_t i, next, len, size, homelen = 0;
+  int nspaces = 0, ntildes = 0;
+  int inArg = 0;
   char quote = 0;
   char escape = 0;
+  char ch;
+
+  len = strlen(cmdLine);
+  masks = scanline(cmdLine, len);
+  for (i = ScanNext(masks, len, 0); i < len; i = ScanNext(masks, len, i + 1))
+    {
+      if (cmdLine[i] == ' ')
+        nspaces++;
+      else if (cmdLine[i] == '~' && cmdLine[i + 1] == '/')
+        ntildes++;
+    }
+  if (ntildes > 0 && (home = getenv("HOME")) != NULL)
+    homelen = strlen(home);
+
+  size = sizeof(commandT) + sizeof(char*) * (nspaces + 2)
+    + (len + 1) + (len + 1 + ntildes * homelen);
+  cmd = (arena != NULL ? ArenaAlloc(arena, size) : malloc(size));
+  cmd->argc = 0;
+  cmd->pipeTo = NULL;
+  cmd->cmdline = (char*)(cmd->argv + nspaces + 2);
+  memcpy(cmd->cmdline, cmdLine, len + 1);
 
   // Set up the initial empty argument
-  char* tmp = malloc(sizeof(char*) * BUFSIZE);
-  int tmpLen = 0;
-  tmp[0] = 0;
+  buf = cmd->cmdline + len + 1;
+  arg = buf;
 
   //printf("parsing:%s\n", cmdLine);
 
-  for (i = 0; cmdLine[i] != 0; i++)
+  for (i = 0; i < len; i++)
     {
-      //printf("\tindex %d, char %c\n", i, cmdLine[i]);
+      next = ScanNext(masks, len, i);
+      if (next > i)
+        {
+          // plain text, which behaves like any other character below
+          inArg = 1;
+          if (escape == '\\')
+            {
+              if (quote != 0)
+                *buf++ = '\\';
+              escape = 0;
+            }
+          memcpy(buf, cmdLine + i, next - i);
+          buf += next - i;
+          if ((i = next) == len)
+            break;
+        }
+      ch = cmdLine[i];
+      //printf("\tindex %d, char %c\n", i, ch);
       
       // Check for whitespace
-      if (cmdLine[i] == ' ')
+      if (ch == ' ')
         {
           if (inArg == 0)
             continue;
           if (quote == 0)
             {
               // End of an argument
-              //printf("\t\tend of argument %d, got:%s\n", cmd.argc, tmp);
-              cmd->argv[cmd->argc] = malloc(sizeof(char) * (tmpLen + 1));
-              strcpy(cmd->argv[cmd->argc], tmp);
-
+              //printf("\t\tend of argument %d, got:%s\n", cmd.argc, arg);
+              *buf++ = 0;
+              cmd->argv[cmd->argc++] = arg;
+              arg = buf;
               inArg = 0;
-              tmp[0] = 0;
-              tmpLen = 0;
-              cmd->argc++;
-              cmd->argv[cmd->argc] = 0;
               continue;
             }
         }
@@ -163,26 +1155,25 @@ getCommand(char* cmdLine)
       inArg = 1;
 
       // Start or end quoting.
-      if (cmdLine[i] == '\'' || cmdLine[i] == '"')
+      if (ch == '\'' || ch == '"')
         {
-          if (escape != 0 && quote != 0 && cmdLine[i] == quote)
+          if (escape != 0 && quote != 0 && ch == quote)
             {
               // Escaped quote. Add it to the argument.
-              tmp[tmpLen++] = cmdLine[i];
-              tmp[tmpLen] = 0;
+              *buf++ = ch;
               escape = 0;
               continue;
             }
 
           if (quote == 0)
             {
-              //printf("\t\tstarting quote around %c\n", cmdLine[i]);
-              quote = cmdLine[i];
+              //printf("\t\tstarting quote around %c\n", ch);
+              quote = ch;
               continue;
             }
           else
             {
-              if (cmdLine[i] == quote)
+              if (ch == quote)
                 {
                   //printf("\t\tfound end quote %c\n", quote);
                   quote = 0;
@@ -192,11 +1183,10 @@ getCommand(char* cmdLine)
         }
 
       // Handle escape character repeat
-      if (cmdLine[i] == '\\' && escape == '\\')
+      if (ch == '\\' && escape == '\\')
         {
           escape = 0;
-          tmp[tmpLen++] = '\\';
-          tmp[tmpLen] = 0;
+          *buf++ = '\\';
           continue;
         }
 
@@ -204,50 +1194,71 @@ getCommand(char* cmdLine)
       if (escape == '\\')
         {
           if (quote != 0)
-            {
-              tmp[tmpLen++] = '\\';
-              tmp[tmpLen] = 0;
-            }
+            *buf++ = '\\';
           escape = 0;
         }
 
       // Set the escape flag if we have a new escape character sequence.
-      if (cmdLine[i] == '\\')
+      if (ch == '\\')
         {
           escape = '\\';
           continue;
         }
       // replace ~/ with $HOME/
-      if (cmdLine[i-1] == '~' && cmdLine[i] == '/') {
-        tmp[tmpLen-1] = '\0';
-        strcat(tmp,getenv("HOME"));
-        tmpLen = tmpLen+strlen(getenv("HOME"))-1;
-      }
-      tmp[tmpLen++] = cmdLine[i];
-      tmp[tmpLen] = 0;
+      if (ch == '~' && cmdLine[i + 1] == '/')
+        {
+          memcpy(buf, home, homelen);
+          buf += homelen;
+          continue;
+        }
+      *buf++ = ch;
     }
   // End the final argument, if any.
-  if (tmpLen > 0)
+  if (buf > arg)
     {
-      //printf("\t\tend of argument %d, got:%s\n", cmd.argc, tmp);
-      cmd->argv[cmd->argc] = malloc(sizeof(char) * (tmpLen + 1));
-      strcpy(cmd->argv[cmd->argc], tmp);
-
-      inArg = 0;
-      tmp[0] = 0;
-      tmpLen = 0;
-      cmd->argc++;
-      cmd->argv[cmd->argc] = 0;
+      //printf("\t\tend of argument %d, got:%s\n", cmd.argc, arg);
+      *buf = 0;
+      cmd->argv[cmd->argc++] = arg;
     }
+  cmd->argv[cmd->argc] = 0;
 
-  free(tmp);
   cmd->name = cmd->argv[0];
   cmd->path = NULL;
+  cmd->dirfd = -1;
+  cmd->redirs = NULL;
+  cmd->procsubs = NULL;
 
   return cmd;
 } /* getCommand */
 
 
+/*
+ * scanline
+ *
+ * arguments:
+ *   char *line: the line to scan
+ *   size_t len: its length
+ *
+ * returns: uint64_t*: the metacharacter masks of the line
+ *
+ * Runs ScanMeta on the line, growing the masks as needed.
+ */
+static uint64_t*
+scanline(char* line, size_t len)
+{
+  size_t words = (len + 63) / 64;
+
+  if (words > gMaskWords)
+    {
+      gMaskWords = words > 2 * gMaskWords ? words : 2 * gMaskWords;
+      free(gMasks);
+      gMasks = malloc(sizeof(uint64_t) * gMaskWords);
+    }
+  ScanMeta(line, len, gMasks);
+  return gMasks;
+} /* scanline */
+
+
 /*
  * freeCommand
  *
@@ -262,16 +1273,7 @@ getCommand(char* cmdLine)
 void
 freeCommand(commandT* cmd)
 {
-  int i;
-
-  cmd->name = 0;
-  for (i = 0; cmd->argv[i] != 0; i++)
-    {
-      free(cmd->argv[i]);
-      cmd->argv[i] = 0;
-    }
   if (cmd->path != NULL)
     free(cmd->path);
-  free(cmd->cmdline);
   free(cmd);
 } /* freeCommand */
@@ -33,6 +33,7 @@
 /************System include***********************************************/
 
 /************Private include**********************************************/
+#include "arena.h"
 
 /************Defines and Typedefs*****************************************/
 /*  #defines and typedefs should have their names in all caps.
@@ -48,16 +49,106 @@
 #define EXTERN extern
 #endif
 
+/* what a redirection does */
+typedef enum
+{
+  REDIR_IN,         /* fd < file */
+  REDIR_OUT,        /* fd > file, which is truncated */
+  REDIR_APPEND,     /* fd >> file */
+  REDIR_BOTH,       /* &> file: stdout and stderr */
+  REDIR_BOTHAPPEND, /* &>> file */
+  REDIR_DUP,        /* fd >& to, or fd <& to */
+  REDIR_CLOSE,      /* fd >&- or fd <&- */
+  REDIR_HEREDOC,    /* fd << word: the lines up to word */
+  REDIR_HEREDOCTABS,/* fd <<- word: the same without leading tabs */
+  REDIR_HERESTRING  /* fd <<< word: word and a newline */
+} redirType_t;
+
+/* a redirection of a command or group; they are applied in order */
+typedef struct redir_t
+{
+  redirType_t type;
+  int fd;           /* the descriptor that is redirected */
+  int to;           /* REDIR_DUP: what it becomes a copy of, or -1 if
+                       the word is not a descriptor; here-documents:
+                       which one of the line it is */
+  char* file;       /* the word after the operator */
+  bool quoted;      /* whether any of the word was quoted, which keeps
+                       a here-document from being expanded */
+  struct redir_t* next;
+} redirT;
+
+/* the body of a here-document, read after the line it is on */
+typedef struct heredoc_t
+{
+  char* body;
+  size_t len;
+} heredocT;
+
+/* a process substitution, <(list) or >(list), that is an argument of
+ * a command; the argument becomes the /dev/fd/N of a pipe to the list */
+typedef struct procsub_t
+{
+  int arg;          /* which argument of the command it is */
+  bool out;         /* >(list): the command writes to the list */
+  struct node_t* body;
+  struct procsub_t* next;
+} procsubT;
+
 typedef struct command_t
 {
   char* name;
   char* path;
+  int dirfd;
+  redirT* redirs;
+  procsubT* procsubs;
   char* cmdline;
   int argc;
   struct command_t* pipeTo;
   char* argv[];
 } commandT;
 
+/* what a node of a parsed line stands for */
+typedef enum
+{
+  NODE_CMD,     /* a simple command, in cmd */
+  NODE_PIPE,    /* left | right, where right may be another NODE_PIPE */
+  NODE_AND,     /* left && right */
+  NODE_OR,      /* left || right */
+  NODE_SEQ,     /* left ; right */
+  NODE_BG,      /* left & */
+  NODE_GROUP    /* ( left ) */
+} nodeType_t;
+
+typedef struct node_t
+{
+  nodeType_t type;
+  commandT* cmd;
+  struct node_t* left;
+  struct node_t* right;
+  /* NODE_GROUP: its redirections; those of a command are in cmd */
+  redirT* redirs;
+  /* the part of the line the node was parsed from, not terminated */
+  const char* text;
+  int textlen;
+} nodeT;
+
+/* a parsed line; the nodes, commands and words all live in the same
+ * allocation as this header. It is never changed once parsed, and
+ * freed when the last of its users calls FreeParse, unless it was
+ * parsed into an arena */
+typedef struct parse_t
+{
+  nodeT* root;
+  char* line;
+  int refs;
+  bool inarena;
+  bool error;       /* the line has a syntax error */
+  redirT* redirs;   /* all redirections of the line, in order */
+  int nredirs;
+  int ndocs;        /* how many of them are here-documents */
+} parseT;
+
 /************Global Variables*********************************************/
 
 /************Function Prototypes******************************************/
@@ -68,13 +159,37 @@ typedef struct command_t
  *    Purpose: Interprets a command line and executes the desired
  *    programs
  *    Input: a command line
+ *    Output: the exit status of the line
+ ***********************************************************************/
+EXTERN int
+Interpret(char*);
+
+/***********************************************************************
+ *  Title: Parse a command line
+ * ---------------------------------------------------------------------
+ *    Purpose: Builds the tree of pipelines, lists and groups of a line
+ *    in a single pass. Syntax errors are reported and leave the root
+ *    NULL, as does an empty line.
+ *    Input: a command line, and the arena to parse it into or NULL to
+ *    parse it into memory of its own
+ *    Output: the parsed line, to be freed with FreeParse
+ ***********************************************************************/
+EXTERN parseT*
+ParseLine(char*, arenaT*);
+
+/***********************************************************************
+ *  Title: Free a parsed line
+ * ---------------------------------------------------------------------
+ *    Purpose: Releases a reference to a line returned by ParseLine,
+ *    freeing it with the last one.
+ *    Input: the parsed line
  *    Output: void
  ***********************************************************************/
 EXTERN void
-Interpret(char*);
+FreeParse(parseT*);
 
 commandT*
-getCommand(char*);
+getCommand(char*, arenaT*);
 
 void
 freeCommand(commandT*);
@@ -35,6 +35,7 @@
  *
  ***************************************************************************/
 #define __IO_IMPL__
+#define _GNU_SOURCE
 
 /************System include***********************************************/
 #include <stdio.h>
@@ -44,10 +45,15 @@
 #include <unistd.h>
 #include <termios.h>
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 /************Private include**********************************************/
 #include "io.h"
 #include "runtime.h"
+#include "event.h"
 
 /************Defines and Typedefs*****************************************/
 /*  #defines and typedefs should have their names in all caps.
@@ -56,12 +62,76 @@
  *  structures and arrays, line everything up in neat columns.
  */
 
+/* how much of stdin is read at a time, at least */
+#define INCHUNK 65536
+
+/* how input that was read ahead is given back to a child that
+ * inherits stdin */
+#define IN_UNKNOWN  0
+#define IN_SEEK     1   /* a file: seek back over it */
+#define IN_PEEK     2   /* a pipe: it is peeked at with tee(), and only
+                           consumed up to the line handed out */
+#define IN_STREAM   3   /* anything else; a terminal returns no more
+                           than a line per read anyway */
+
+/* how much of a script is run before the pages it was read from are
+ * dropped again */
+#define SCRIPTDROP  (8 << 20)
+
 /************Global Variables*********************************************/
 
 /* indicates that the standard input stream is currently read  */
 bool isReading = FALSE;
 
+/* the input read ahead; lines are handed out from inhead on, and a
+ * newline is looked for from inscan on. With IN_PEEK, stdin still
+ * holds everything from inbase on */
+static char* inbuf = NULL;
+static size_t insize = 0;
+static size_t inbase = 0;
+static size_t inhead = 0;
+static size_t inscan = 0;
+static size_t intail = 0;
+static int inmode = IN_UNKNOWN;
+static bool ineof = FALSE;
+/* IN_PEEK: the pipe tee() copies stdin into */
+static int peekfd[2] = { -1, -1 };
+/* IN_PEEK: where consumed input goes */
+static char discard[INCHUNK];
+
+/* the script being run instead of stdin, mapped unless it is the
+ * string of -c; its lines are run from scriptpos on, and its pages
+ * before scriptdropped are dropped. It may be ~/.tshrc, which is
+ * never the last input */
+static char* script = NULL;
+static bool scriptmapped = FALSE;
+static bool scriptrc = FALSE;
+static size_t scriptlen = 0;
+static size_t scriptpos = 0;
+static size_t scriptdropped = 0;
+/* the line of the script being run */
+static char* scriptline = NULL;
+static size_t scriptlinesize = 0;
+
 /************Function Prototypes******************************************/
+/* sets up the input buffer */
+static void
+setupinput();
+/* reads more input */
+static bool
+fillinput();
+/* copies what is in the stdin pipe without consuming it */
+static ssize_t
+peekinput(size_t);
+/* consumes input that was peeked at */
+static void
+consumeinput(size_t);
+/* hands out the next line of the script */
+static char*
+nextscriptline(bool);
+/* maps a script */
+static bool
+openscript(char*);
 
 /************External Declaration*****************************************/
 
@@ -146,35 +216,466 @@ IsReading()
 /*
  * getCommandLine
  *
+ * arguments: none
+ *
+ * returns: char*: the line without its newline, valid until the next
+ *                 call, or NULL at the end of the input
+ *
+ * Reads stdin a large chunk at a time and hands out the lines in the
+ * buffer, where they are found with memchr, without copying them.
+ * Only a line that is not complete when the buffer runs dry is moved
+ * to its front. Whenever more input is needed, it waits in EventWait,
+ * so signals are handled while tsh is idle. Once OpenScript succeeded,
+ * the lines come from the script instead.
+ */
+char*
+getCommandLine()
+{
+  char* nl;
+  char* line;
+
+  if (script != NULL)
+    return nextscriptline(TRUE);
+  if (inbuf == NULL)
+    setupinput();
+  isReading = TRUE;
+  while ((nl = memchr(inbuf + inscan, '\n', intail - inscan)) == NULL)
+    {
+      inscan = intail;
+      if (ineof || !fillinput())
+        break;
+    }
+  isReading = FALSE;
+
+  line = inbuf + inhead;
+  if (nl == NULL)
+    {
+      // the last line may lack its newline; there is room for a '\0'
+      if (inhead == intail)
+        return NULL;
+      inbuf[intail] = '\0';
+      inhead = inscan = intail;
+      return line;
+    }
+  *nl = '\0';
+  inhead = inscan = nl + 1 - inbuf;
+  return line;
+} /* getCommandLine */
+
+
+/*
+ * GetHereDocLine
+ *
+ * arguments: none
+ *
+ * returns: char*: the line, as getCommandLine returns it
+ *
+ * Like getCommandLine, except that lines starting with '#' are part of
+ * a here-document even in a script.
+ */
+char*
+GetHereDocLine()
+{
+  if (script != NULL)
+    return nextscriptline(FALSE);
+  return getCommandLine();
+} /* GetHereDocLine */
+
+
+/*
+ * OpenScript
+ *
  * arguments:
- *   char **buf: pointer to a pointer to memory allocated for reading
-                 from stdin
- *   int size: bytes allocated at *buf
+ *   char *path: the script to run
+ *
+ * returns: bool: FALSE, with errno set, if it cannot be read
+ *
+ * Makes getCommandLine read the script instead of stdin.
+ */
+bool
+OpenScript(char* path)
+{
+  scriptrc = FALSE;
+  return openscript(path);
+} /* OpenScript */
+
+
+/*
+ * OpenRcFile
+ *
+ * arguments:
+ *   char *path: the rc file
+ *
+ * returns: bool: FALSE, with errno set, if it cannot be read
+ *
+ * Makes getCommandLine read the rc file like a script, until
+ * CloseScript is called.
+ */
+bool
+OpenRcFile(char* path)
+{
+  scriptrc = TRUE;
+  return openscript(path);
+} /* OpenRcFile */
+
+
+/*
+ * CloseScript
+ *
+ * arguments: none
  *
  * returns: none
  *
- * Reads from standard input until it sees a newline or EOF. Stores
- * the string that was read at *buf.
+ * Unmaps the script, after which getCommandLine reads stdin again.
  */
 void
-getCommandLine(char** buf, int size)
+CloseScript()
 {
-  char ch;
-  size_t used = 0;
-  char* cmd = *buf;
-  cmd[0] = '\0';
+  if (scriptmapped)
+    munmap(script, scriptlen);
+  script = NULL;
+  scriptmapped = FALSE;
+  scriptrc = FALSE;
+  scriptlen = scriptpos = scriptdropped = 0;
+  free(scriptline);
+  scriptline = NULL;
+  scriptlinesize = 0;
+} /* CloseScript */
 
-  isReading = TRUE;
-  while (((ch = getc(stdin)) != EOF) && (ch != '\n'))
+
+/*
+ * openscript
+ *
+ * arguments:
+ *   char *path: the script to run
+ *
+ * returns: bool: FALSE, with errno set, if it cannot be read
+ *
+ * Maps the script, which getCommandLine then reads instead of stdin.
+ * The mapping is read front to back, so the kernel is told to read
+ * ahead; as the pages that were run are dropped every SCRIPTDROP
+ * bytes, a script of any size takes as much memory as its longest line.
+ */
+static bool
+openscript(char* path)
+{
+  struct stat st;
+  int fd;
+
+  if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+    return FALSE;
+  if (fstat(fd, &st) < 0)
+    {
+      close(fd);
+      return FALSE;
+    }
+  scriptlen = st.st_size;
+  // an empty file cannot be mapped, and there is nothing to run
+  if (scriptlen == 0)
+    script = "";
+  else if ((script = mmap(NULL, scriptlen, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+    {
+      script = NULL;
+      close(fd);
+      return FALSE;
+    }
+  else
+    {
+      scriptmapped = TRUE;
+      madvise(script, scriptlen, MADV_SEQUENTIAL);
+    }
+  close(fd);
+  return TRUE;
+} /* openscript */
+
+
+/*
+ * OpenCommandString
+ *
+ * arguments:
+ *   char *command: the commands to run, which stay around
+ *
+ * returns: none
+ *
+ * Makes getCommandLine hand out the lines of the string given to -c
+ * like those of a script.
+ */
+void
+OpenCommandString(char* command)
+{
+  scriptrc = FALSE;
+  script = command;
+  scriptlen = strlen(command);
+  scriptmapped = FALSE;
+} /* OpenCommandString */
+
+
+/*
+ * AtLastLine
+ *
+ * arguments: none
+ *
+ * returns: bool: whether the script line being run is the last one
+ *
+ * Only looks as far as the next line that is not blank or a comment,
+ * which is usually the very next one. The rc file is followed by the
+ * actual input, so it is never the last line there.
+ */
+bool
+AtLastLine()
+{
+  size_t pos;
+  bool comment = FALSE;
+
+  if (script == NULL || scriptline == NULL || scriptrc)
+    return FALSE;
+  for (pos = scriptpos; pos < scriptlen; pos++)
+    {
+      if (script[pos] == '\n')
+        comment = FALSE;
+      else if (!comment && script[pos] == '#' &&
+               (pos == 0 || script[pos - 1] == '\n'))
+        comment = TRUE;
+      else if (!comment && script[pos] != ' ' && script[pos] != '\t')
+        return FALSE;
+    }
+  return TRUE;
+} /* AtLastLine */
+
+
+/*
+ * HandOffInput
+ *
+ * arguments: none
+ *
+ * returns: none
+ *
+ * Gives the input that was read ahead back to stdin, so that a child
+ * that reads stdin starts right after the line being run, as it would
+ * if the shell read a byte at a time. The shell reads on from wherever
+ * the child leaves off.
+ */
+void
+HandOffInput()
+{
+  switch (inmode)
     {
-      if (used == size)
+    case IN_SEEK:
+      if (intail > inhead &&
+          lseek(STDIN_FILENO, -(off_t)(intail - inhead), SEEK_CUR) >= 0)
         {
-          size *= 2;
-          cmd = realloc(cmd, sizeof(char) * (size + 1));
+          intail = inscan = inhead;
+          ineof = FALSE;
         }
-      cmd[used] = ch;
-      used++;
-      cmd[used] = '\0';
+      break;
+    case IN_PEEK:
+      consumeinput(inhead - inbase);
+      inbase = intail = inscan = inhead;
+      break;
     }
-  isReading = FALSE;
-} /* getCommandLine */
+} /* HandOffInput */
+
+
+/*
+ * setupinput
+ *
+ * arguments: none
+ *
+ * returns: none
+ *
+ * Allocates the buffer, with room for a '\0' after it, and picks how
+ * stdin is handed off by what it is.
+ */
+static void
+setupinput()
+{
+  struct stat st;
+
+  insize = INCHUNK;
+  inbuf = (char *)malloc(insize + 1);
+  inmode = IN_STREAM;
+  if (fstat(STDIN_FILENO, &st) < 0)
+    return;
+  if (S_ISREG(st.st_mode) && lseek(STDIN_FILENO, 0, SEEK_CUR) >= 0)
+    inmode = IN_SEEK;
+  else if (S_ISFIFO(st.st_mode) && pipe2(peekfd, O_CLOEXEC) == 0)
+    {
+      fcntl(peekfd[1], F_SETPIPE_SZ, INCHUNK);
+      inmode = IN_PEEK;
+    }
+} /* setupinput */
+
+
+/*
+ * fillinput
+ *
+ * arguments: none
+ *
+ * returns: bool: FALSE at the end of the input
+ *
+ * Moves the line that is not complete yet to the front of the buffer,
+ * growing it if the line fills all of it, and reads as much as fits
+ * after it. With IN_PEEK, the input handed out so far and the partial
+ * line are consumed first; nothing after the partial line is, so a
+ * child still gets all of the input after the line it is run for, and
+ * a pipe that is empty again can be waited for.
+ */
+static bool
+fillinput()
+{
+  ssize_t got;
+
+  if (inmode == IN_PEEK)
+    consumeinput(intail - inbase);
+  if (inhead > 0)
+    {
+      memmove(inbuf, inbuf + inhead, intail - inhead);
+      intail -= inhead;
+      inscan -= inhead;
+      inhead = 0;
+    }
+  inbase = intail;
+  if (intail == insize)
+    {
+      insize *= 2;
+      inbuf = (char *)realloc(inbuf, insize + 1);
+    }
+
+  for (;;)
+    {
+      while (!(EventWait(EVENT_INPUT) & EVENT_INPUT))
+        ;
+      if (inmode == IN_PEEK)
+        got = peekinput(insize - intail);
+      else
+        got = read(STDIN_FILENO, inbuf + intail, insize - intail);
+      if (got > 0)
+        {
+          intail += got;
+          return TRUE;
+        }
+      if (got == 0 || (errno != EINTR && errno != EAGAIN))
+        {
+          ineof = TRUE;
+          return FALSE;
+        }
+    }
+} /* fillinput */
+
+
+/*
+ * peekinput
+ *
+ * arguments:
+ *   size_t len: how much room there is after intail
+ *
+ * returns: ssize_t: the number of bytes copied to inbuf + intail, 0 at
+ *                   the end of the input, or -1 with errno set
+ *
+ * Duplicates what is in the stdin pipe into peekfd with tee(), which
+ * leaves it in stdin, and reads the copy into the buffer. If stdin
+ * turns out not to be a pipe after all, it is read like a stream.
+ */
+static ssize_t
+peekinput(size_t len)
+{
+  ssize_t n, got, r;
+
+  if (len > INCHUNK)
+    len = INCHUNK;
+  n = tee(STDIN_FILENO, peekfd[1], len, SPLICE_F_NONBLOCK);
+  if (n < 0 && errno == EINVAL)
+    {
+      close(peekfd[0]);
+      close(peekfd[1]);
+      inmode = IN_STREAM;
+      return read(STDIN_FILENO, inbuf + intail, len);
+    }
+  for (got = 0; got < n; got += r)
+    {
+      if ((r = read(peekfd[0], inbuf + intail + got, n - got)) <= 0)
+        break;
+    }
+  return n;
+} /* peekinput */
+
+
+/*
+ * consumeinput
+ *
+ * arguments:
+ *   size_t len: the number of bytes to consume
+ *
+ * returns: none
+ *
+ * Reads and drops input that is in the buffer already. It was peeked
+ * at, so it is in the pipe and the reads do not block.
+ */
+static void
+consumeinput(size_t len)
+{
+  ssize_t got;
+
+  while (len > 0)
+    {
+      got = read(STDIN_FILENO, discard, len < INCHUNK ? len : INCHUNK);
+      if (got <= 0)
+        {
+          if (got < 0 && errno == EINTR)
+            continue;
+          break;
+        }
+      len -= got;
+    }
+} /* consumeinput */
+
+
+/*
+ * nextscriptline
+ *
+ * arguments:
+ *   bool comments: whether lines starting with '#' are skipped
+ *
+ * returns: char*: the next line of the script, or NULL at its end
+ *
+ * Copies the line out of the mapping, which cannot be written to, so
+ * that it can be terminated. Lines starting with '#' are comments,
+ * which also skips a #! line, except in a here-document.
+ */
+static char*
+nextscriptline(bool comments)
+{
+  char* start;
+  char* nl;
+  size_t len, drop;
+
+  do
+    {
+      if (scriptpos >= scriptlen)
+        return NULL;
+      start = script + scriptpos;
+      nl = memchr(start, '\n', scriptlen - scriptpos);
+      len = (nl != NULL ? nl - start : scriptlen - scriptpos);
+      scriptpos += len + 1;
+    }
+  while (comments && start[0] == '#');
+
+  if (len >= scriptlinesize)
+    {
+      scriptlinesize = len + 1 > 2 * scriptlinesize ? len + 1 : 2 * scriptlinesize;
+      free(scriptline);
+      scriptline = (char *)malloc(scriptlinesize);
+    }
+  memcpy(scriptline, start, len);
+  scriptline[len] = '\0';
+
+  // the pages that were run are not needed again
+  if (scriptmapped && scriptpos - scriptdropped >= SCRIPTDROP &&
+      scriptpos < scriptlen)
+    {
+      drop = scriptpos & ~(size_t)(sysconf(_SC_PAGESIZE) - 1);
+      madvise(script + scriptdropped, drop - scriptdropped, MADV_DONTNEED);
+      scriptdropped = drop;
+    }
+  return scriptline;
+} /* nextscriptline */
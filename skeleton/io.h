@@ -103,11 +103,92 @@ IsReading();
  * ---------------------------------------------------------------------
  *    Purpose: Reads one command line from stdin and returns it to the
  *    callee.
- *    Input: pointer to the buffer (will be resized as necessary) & size
+ *    Input: void
+ *    Output: the line, valid until the next call, or NULL at the end
+ *    of the input
+ ***********************************************************************/
+EXTERN char*
+getCommandLine();
+
+/***********************************************************************
+ *  Title: Read a line of a here-document
+ * ---------------------------------------------------------------------
+ *    Purpose: Reads the next line like getCommandLine, but does not
+ *    skip the comments of a script.
+ *    Input: void
+ *    Output: the line, valid until the next call, or NULL at the end
+ *    of the input
+ ***********************************************************************/
+EXTERN char*
+GetHereDocLine();
+
+/***********************************************************************
+ *  Title: Run a script
+ * ---------------------------------------------------------------------
+ *    Purpose: Makes getCommandLine read the lines of a script instead
+ *    of stdin.
+ *    Input: the path of the script
+ *    Output: FALSE, with errno set, if it cannot be read
+ ***********************************************************************/
+EXTERN bool
+OpenScript(char*);
+
+/***********************************************************************
+ *  Title: Run the rc file
+ * ---------------------------------------------------------------------
+ *    Purpose: Makes getCommandLine read the lines of the rc file like
+ *    those of a script, until CloseScript is called.
+ *    Input: the path of the rc file
+ *    Output: FALSE, with errno set, if it cannot be read
+ ***********************************************************************/
+EXTERN bool
+OpenRcFile(char*);
+
+/***********************************************************************
+ *  Title: Stop running a script
+ * ---------------------------------------------------------------------
+ *    Purpose: Unmaps the script or rc file; getCommandLine reads stdin
+ *    again.
+ *    Input: void
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+CloseScript();
+
+/***********************************************************************
+ *  Title: Run a command string
+ * ---------------------------------------------------------------------
+ *    Purpose: Makes getCommandLine read the lines of the string given
+ *    to -c instead of stdin.
+ *    Input: the string
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+OpenCommandString(char*);
+
+/***********************************************************************
+ *  Title: Whether the line being run is the last one
+ * ---------------------------------------------------------------------
+ *    Purpose: Tells whether a line of a script or command string is
+ *    followed by nothing but blank lines and comments, so that the
+ *    shell has nothing left to do once it is done.
+ *    Input: void
+ *    Output: TRUE if it is the last line; always FALSE for stdin
+ ***********************************************************************/
+EXTERN bool
+AtLastLine();
+
+/***********************************************************************
+ *  Title: Hand stdin off to a child
+ * ---------------------------------------------------------------------
+ *    Purpose: Gives the input that getCommandLine read ahead back to
+ *    stdin where possible, to be called before starting children that
+ *    inherit it.
+ *    Input: void
  *    Output: void
  ***********************************************************************/
 EXTERN void
-getCommandLine(char**, int);
+HandOffInput();
 
 /************External Declaration*****************************************/
 
@@ -0,0 +1,306 @@
+/***************************************************************************
+ *  Title: Parse cache
+ * -------------------------------------------------------------------------
+ *    Purpose: Remembers the parsed form of recent command lines
+ *    File: parsecache.c
+ ***************************************************************************/
+/***************************************************************************
+ *  Scripts and ~/.tshrc files run the same lines over and over. The
+ *  cache maps the text of a line to the tree ParseLine built for it, in
+ *  a hash table keyed by the FNV-1a hash of the line, and drops the
+ *  least recently used line once it holds PARSECACHEVAR lines. The
+ *  trees are never changed by the runtime, which expands variables and
+ *  aliases in copies of the commands, so the same tree can be run any
+ *  number of times. A tree holds a reference for the cache and one for
+ *  every run, so dropping it from the cache while it runs is safe.
+ ***************************************************************************/
+#define __PARSECACHE_IMPL__
+
+/************System include***********************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/************Private include**********************************************/
+#include "parsecache.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/* environment variable with the number of lines to cache, 0 disables
+ * the cache */
+#define PARSECACHEVAR "TSHPARSECACHE"
+#define DEFAULTLINES  256
+/* longer lines are not worth keeping around */
+#define MAXLINELEN    4096
+
+/* a cached line; the text is the one in parsed->line */
+typedef struct parseent_t
+{
+  parseT* parsed;
+  size_t len;
+  unsigned long hash;
+  struct parseent_t* next;
+  struct parseent_t* newer;
+  struct parseent_t* older;
+} parseentT;
+
+/************Global Variables*********************************************/
+
+/* the hash table, and the lines from the most to the least recently
+ * used; limit is -1 until PARSECACHEVAR has been read */
+static parseentT** buckets = NULL;
+static int nbuckets = 0;
+static int nentries = 0;
+static int limit = -1;
+static parseentT* newest = NULL;
+static parseentT* oldest = NULL;
+static unsigned long hits = 0;
+static unsigned long misses = 0;
+
+/************Function Prototypes******************************************/
+/* reads the size of the cache */
+static void
+setup();
+/* hashes a line */
+static unsigned long
+hashline(char*, size_t);
+/* makes a line the most recently used one */
+static void
+touch(parseentT*);
+/* unlinks a line from the LRU list */
+static void
+detach(parseentT*);
+/* drops a line from the cache */
+static void
+drop(parseentT*);
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+
+/*
+ * ParseCacheLookup
+ *
+ * arguments:
+ *   char *line: the command line
+ *   arenaT *arena: where to parse lines that are not kept
+ *
+ * returns: parseT*: the parsed line, to be released with FreeParse
+ *
+ * Looks the line up, parsing it on a miss. A tree that is handed out
+ * gets a reference for the caller. Lines that are too long to be kept
+ * are parsed into the arena, as is everything while the cache is
+ * disabled.
+ */
+parseT*
+ParseCacheLookup(char* line, arenaT* arena)
+{
+  size_t len = strlen(line);
+  unsigned long hash;
+  parseentT* entry;
+  parseT* parsed;
+
+  if (limit < 0)
+    setup();
+  if (limit == 0 || len > MAXLINELEN)
+    return ParseLine(line, arena);
+
+  hash = hashline(line, len);
+  for (entry = buckets[hash & (nbuckets - 1)]; entry != NULL; entry = entry->next)
+    {
+      if (entry->hash == hash && entry->len == len &&
+          memcmp(entry->parsed->line, line, len) == 0)
+        {
+          hits++;
+          touch(entry);
+          entry->parsed->refs++;
+          return entry->parsed;
+        }
+    }
+
+  misses++;
+  parsed = ParseLine(line, NULL);
+  // errors must be reported again, and empty lines are cheap
+  if (parsed->root == NULL)
+    return parsed;
+  if (nentries == limit)
+    drop(oldest);
+  entry = (parseentT *)malloc(sizeof(parseentT));
+  entry->parsed = parsed;
+  entry->len = len;
+  entry->hash = hash;
+  entry->next = buckets[hash & (nbuckets - 1)];
+  buckets[hash & (nbuckets - 1)] = entry;
+  entry->newer = entry->older = NULL;
+  touch(entry);
+  nentries++;
+  parsed->refs++;
+  return parsed;
+} /* ParseCacheLookup */
+
+
+/*
+ * ParseCacheInvalidate
+ *
+ * arguments: none
+ *
+ * returns: none
+ *
+ * Drops every line. The hit and miss counts are kept.
+ */
+void
+ParseCacheInvalidate()
+{
+  while (oldest != NULL)
+    drop(oldest);
+} /* ParseCacheInvalidate */
+
+
+/*
+ * ParseCachePrint
+ *
+ * arguments: none
+ *
+ * returns: none
+ *
+ * Prints the number of cached lines and the hit and miss counts.
+ */
+void
+ParseCachePrint()
+{
+  if (limit < 0)
+    setup();
+  printf("parse cache: %d/%d lines, %lu hits, %lu misses\n", nentries, limit,
+         hits, misses);
+  fflush(stdout);
+} /* ParseCachePrint */
+
+
+/*
+ * setup
+ *
+ * arguments: none
+ *
+ * returns: none
+ *
+ * Reads the number of lines to cache from PARSECACHEVAR and makes a
+ * table with twice as many buckets, rounded up to a power of two.
+ */
+static void
+setup()
+{
+  char* value = getenv(PARSECACHEVAR);
+
+  limit = DEFAULTLINES;
+  if (value != NULL && *value >= '0' && *value <= '9')
+    limit = atoi(value);
+  for (nbuckets = 1; nbuckets < 2 * limit; nbuckets *= 2)
+    ;
+  buckets = (parseentT **)calloc(nbuckets, sizeof(parseentT*));
+} /* setup */
+
+
+/*
+ * hashline
+ *
+ * arguments:
+ *   char *line: the line
+ *   size_t len: its length
+ *
+ * returns: unsigned long: the FNV-1a hash of the line
+ */
+static unsigned long
+hashline(char* line, size_t len)
+{
+  unsigned long h = 2166136261UL;
+  size_t i;
+
+  for (i = 0; i < len; i++)
+    {
+      h ^= (unsigned char)line[i];
+      h *= 16777619UL;
+    }
+  return h;
+} /* hashline */
+
+
+/*
+ * touch
+ *
+ * arguments:
+ *   parseentT *entry: a cached line
+ *
+ * returns: none
+ *
+ * Moves the line to the front of the LRU list.
+ */
+static void
+touch(parseentT* entry)
+{
+  if (entry == newest)
+    return;
+  detach(entry);
+  entry->older = newest;
+  entry->newer = NULL;
+  if (newest != NULL)
+    newest->newer = entry;
+  newest = entry;
+  if (oldest == NULL)
+    oldest = entry;
+} /* touch */
+
+
+/*
+ * detach
+ *
+ * arguments:
+ *   parseentT *entry: a cached line, or a new one that is in no list
+ *
+ * returns: none
+ *
+ * Takes the line out of the LRU list.
+ */
+static void
+detach(parseentT* entry)
+{
+  if (entry->newer != NULL)
+    entry->newer->older = entry->older;
+  else if (newest == entry)
+    newest = entry->older;
+  if (entry->older != NULL)
+    entry->older->newer = entry->newer;
+  else if (oldest == entry)
+    oldest = entry->newer;
+  entry->newer = entry->older = NULL;
+} /* detach */
+
+
+/*
+ * drop
+ *
+ * arguments:
+ *   parseentT *entry: a cached line
+ *
+ * returns: none
+ *
+ * Removes the line from the cache and releases the cache's reference
+ * to its tree.
+ */
+static void
+drop(parseentT* entry)
+{
+  parseentT** link = &buckets[entry->hash & (nbuckets - 1)];
+
+  while (*link != entry)
+    link = &(*link)->next;
+  *link = entry->next;
+  detach(entry);
+  nentries--;
+  FreeParse(entry->parsed);
+  free(entry);
+} /* drop */
@@ -0,0 +1,77 @@
+/***************************************************************************
+ *  Title: Parse cache
+ * -------------------------------------------------------------------------
+ *    Purpose: Remembers the parsed form of recent command lines
+ *    File: parsecache.h
+ ***************************************************************************/
+
+#ifndef __PARSECACHE_H__
+#define __PARSECACHE_H__
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/************System include***********************************************/
+
+/************Private include**********************************************/
+#include "interpreter.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#undef EXTERN
+#ifdef __PARSECACHE_IMPL__
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: Parse a line through the cache
+ * ---------------------------------------------------------------------
+ *    Purpose: Returns the tree of a line that was parsed recently, or
+ *    parses it with ParseLine and remembers it. Lines with syntax
+ *    errors are parsed, and reported, every time.
+ *    Input: a command line, and the arena for lines that are not kept
+ *    Output: the parsed line, to be released with FreeParse
+ ***********************************************************************/
+EXTERN parseT*
+ParseCacheLookup(char*, arenaT*);
+
+/***********************************************************************
+ *  Title: Invalidate the cache
+ * ---------------------------------------------------------------------
+ *    Purpose: Forgets all parsed lines, to be called whenever something
+ *    the parser depends on changes. Lines that are running stay valid
+ *    until they are released.
+ *    Input: void
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+ParseCacheInvalidate();
+
+/***********************************************************************
+ *  Title: Print the cache statistics
+ * ---------------------------------------------------------------------
+ *    Purpose: Prints how many lines are cached, and how many lookups
+ *    hit and missed.
+ *    Input: void
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+ParseCachePrint();
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __PARSECACHE_H__ */
@@ -0,0 +1,1087 @@
+/***************************************************************************
+ *  Title: Path cache
+ * -------------------------------------------------------------------------
+ *    Purpose: Remembers where commands were found in the PATH
+ *    File: pathcache.c
+ ***************************************************************************/
+/***************************************************************************
+ *  The cache has two levels. Every shell keeps its own hash table, and
+ *  shells that have HASHFILEVAR set in their environment share a second
+ *  table through a file they all mmap. The shared table is keyed by the
+ *  PATH string and the command name. Every PATH directory gets a
+ *  generation number in the shared file that is bumped by whichever
+ *  shell first notices that the directory's mtime changed; a shared
+ *  entry records the sum of the generations of the directories it
+ *  depends on and is stale as soon as that sum differs.
+ *
+ *  Slots in the shared file are protected by sequence counters: a writer
+ *  makes the counter odd while it updates the slot, a reader copies the
+ *  slot and retries elsewhere if the counter moved. Readers never block
+ *  and never write.
+ ***************************************************************************/
+#define __PATHCACHE_IMPL__
+#define _GNU_SOURCE
+
+/************System include***********************************************/
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/************Private include**********************************************/
+#include "pathcache.h"
+#include "snapshot.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#define INITBUCKETS 64
+
+/* environment variable naming the shared cache file */
+#define HASHFILEVAR "TSHHASHFILE"
+
+#define SHMMAGIC    0x74736868
+#define SHMVERSION  1
+#define SHMDIRS     256
+#define SHMENTRIES  4096
+#define SHMPROBE    8
+#define SHMNAMELEN  64
+#define SHMPATHLEN  256
+
+/* a PATH directory in the shared file; name never changes once set */
+typedef struct shmdir_t
+{
+  uint32_t seq;
+  uint32_t gen;
+  uint64_t hash;
+  int64_t  sec;
+  int64_t  nsec;
+  char     name[SHMPATHLEN];
+} shmdirT;
+
+/* a command in the shared file; dir is -1 if it was not found */
+typedef struct shment_t
+{
+  uint32_t seq;
+  int32_t  dir;
+  uint64_t key;
+  uint64_t gensum;
+  char     name[SHMNAMELEN];
+  char     path[SHMPATHLEN];
+} shmentT;
+
+/* layout of the shared file */
+typedef struct shmcache_t
+{
+  uint32_t magic;
+  uint32_t version;
+  shmdirT  dirs[SHMDIRS];
+  shmentT  entries[SHMENTRIES];
+} shmcacheT;
+
+/* one directory of the PATH, with the mtime it had when last checked;
+ * fd is an O_PATH descriptor of the directory, -1 if it cannot be opened */
+typedef struct pathdir_t
+{
+  char* name;
+  int len;
+  int fd;
+  struct timespec mtime;
+  unsigned long checked;
+  int slot;
+} pathdirT;
+
+/* a remembered command; path is NULL if the command was not found */
+typedef struct pathent_t
+{
+  char* name;
+  char* path;
+  int dir;
+  int hits;
+  unsigned long hash;
+  struct pathent_t* next;
+} pathentT;
+
+/************Global Variables*********************************************/
+
+/* the PATH directories, ndirs is -1 until PATH has been read */
+static pathdirT* dirs = NULL;
+static int ndirs = -1;
+/* the hash table of remembered commands */
+static pathentT** buckets = NULL;
+static int nbuckets = 0;
+static int nentries = 0;
+/* bumped once per command line, see PathCacheTick */
+static unsigned long epoch = 1;
+/* the mapped shared cache, NULL if it is not used */
+static shmcacheT* shm = NULL;
+static bool shmtried = FALSE;
+/* hash of the PATH string the directories were read from */
+static unsigned long pathhash;
+
+/************Function Prototypes******************************************/
+/* reads the PATH directories */
+static void
+loaddirs();
+/* forgets the PATH directories */
+static void
+freedirs();
+/* checks whether any of the first directories changed */
+static bool
+dirschanged(int);
+/* gets the mtime of a directory, opening it if necessary */
+static void
+dirmtime(pathdirT*, struct timespec*);
+/* hashes a command name */
+static unsigned long
+hashname(char*);
+/* searches the PATH directories for a command */
+static char*
+searchdirs(char*, int*);
+/* finds or creates the cache entry for a command */
+static pathentT*
+resolve(char*);
+/* enters a command into the hash table */
+static pathentT*
+newentry(char*, unsigned long);
+/* maps the shared cache file */
+static void
+shmopen();
+/* starts writing a shared slot */
+static bool
+shmlock(uint32_t*);
+/* finishes writing a shared slot */
+static void
+shmunlock(uint32_t*);
+/* finds or claims the shared record of a directory */
+static int
+shmfinddir(char*);
+/* bumps a directory's generation if its mtime changed */
+static void
+shmcheckdir(int, struct timespec*);
+/* sums the generations of the first directories */
+static uint64_t
+shmgensum(int);
+/* computes the shared key of a command name */
+static uint64_t
+shmkey(char*);
+/* looks a command up in the shared cache */
+static bool
+shmlookup(char*, pathentT*);
+/* publishes a resolved command to the shared cache */
+static void
+shmpublish(pathentT*);
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+
+/*
+ * PathCacheLookup
+ *
+ * arguments:
+ *   char *name: the command name, without any '/'
+ *   int *dirfd: set to a descriptor of the directory the command is in
+ *
+ * returns: char*: the full path of the command, or NULL
+ *
+ * Resolves a command name through the cache. The returned string
+ * belongs to the cache and is only valid until the next lookup. The
+ * directory descriptor is close-on-exec and stays open until PATH
+ * changes; it is -1 if the command was not found.
+ */
+char*
+PathCacheLookup(char* name, int* dirfd)
+{
+  pathentT* entry = resolve(name);
+  *dirfd = -1;
+  if (entry->path != NULL)
+    {
+      entry->hits++;
+      *dirfd = dirs[entry->dir].fd;
+    }
+  return entry->path;
+} /* PathCacheLookup */
+
+
+/*
+ * PathCacheAdd
+ *
+ * arguments:
+ *   char *name: the command name, without any '/'
+ *
+ * returns: bool: whether the command was found
+ *
+ * Enters a command into the cache without counting a hit.
+ */
+bool
+PathCacheAdd(char* name)
+{
+  return resolve(name)->path != NULL;
+} /* PathCacheAdd */
+
+
+/*
+ * PathCacheClear
+ *
+ * arguments: none
+ *
+ * returns: none
+ *
+ * Frees all cache entries.
+ */
+void
+PathCacheClear()
+{
+  int i;
+  pathentT* entry;
+  pathentT* next;
+
+  for (i = 0; i < nbuckets; i++)
+    {
+      for (entry = buckets[i]; entry != NULL; entry = next)
+        {
+          next = entry->next;
+          free(entry->name);
+          free(entry->path);
+          free(entry);
+        }
+      buckets[i] = NULL;
+    }
+  nentries = 0;
+} /* PathCacheClear */
+
+
+/*
+ * PathCacheInvalidate
+ *
+ * arguments: none
+ *
+ * returns: none
+ *
+ * Clears the cache and forgets the PATH directories, so that they are
+ * read again on the next lookup.
+ */
+void
+PathCacheInvalidate()
+{
+  PathCacheClear();
+  freedirs();
+} /* PathCacheInvalidate */
+
+
+/*
+ * PathCacheTick
+ *
+ * arguments: none
+ *
+ * returns: none
+ *
+ * Starts a new epoch. Directory mtimes are checked at most once per
+ * epoch.
+ */
+void
+PathCacheTick()
+{
+  epoch++;
+} /* PathCacheTick */
+
+
+/*
+ * PathCachePrint
+ *
+ * arguments: none
+ *
+ * returns: none
+ *
+ * Prints the commands that were found, in the format of bash's hash.
+ */
+void
+PathCachePrint()
+{
+  int i;
+  bool empty = TRUE;
+  pathentT* entry;
+
+  for (i = 0; i < nbuckets; i++)
+    {
+      for (entry = buckets[i]; entry != NULL; entry = entry->next)
+        {
+          if (entry->path == NULL)
+            continue;
+          if (empty)
+            printf("hits\tcommand\n");
+          empty = FALSE;
+          printf("%4d\t%s\n", entry->hits, entry->path);
+        }
+    }
+  if (empty)
+    printf("hash: hash table empty\n");
+  fflush(stdout);
+} /* PathCachePrint */
+
+
+/*
+ * PathCacheSave
+ *
+ * arguments:
+ *   FILE *out: the snapshot being written
+ *
+ * returns: none
+ *
+ * Writes the PATH and the mtimes of its directories, as they were when
+ * the entries were last checked, and then the entries.
+ */
+void
+PathCacheSave(FILE* out)
+{
+  char* path = getenv("PATH");
+  pathentT* entry;
+  int i;
+
+  SnapshotPutString(out, path != NULL ? path : "");
+  SnapshotPutInt(out, ndirs);
+  for (i = 0; i < ndirs; i++)
+    {
+      SnapshotPutInt(out, dirs[i].mtime.tv_sec);
+      SnapshotPutInt(out, dirs[i].mtime.tv_nsec);
+    }
+  SnapshotPutInt(out, nentries);
+  for (i = 0; i < nbuckets; i++)
+    {
+      for (entry = buckets[i]; entry != NULL; entry = entry->next)
+        {
+          SnapshotPutString(out, entry->name);
+          SnapshotPutInt(out, entry->path != NULL ? entry->dir : -1);
+          SnapshotPutString(out, entry->path != NULL ? entry->path : "");
+        }
+    }
+} /* PathCacheSave */
+
+
+/*
+ * PathCacheRestore
+ *
+ * arguments:
+ *   snapshotT *snap: the snapshot being read
+ *
+ * returns: bool: FALSE if the snapshot is cut short
+ *
+ * The entries are taken over as they are if the PATH is the same and
+ * none of its directories changed since they were saved. Otherwise
+ * they are looked up again, as the hash builtin that made them would.
+ */
+bool
+PathCacheRestore(snapshotT* snap)
+{
+  char* path = getenv("PATH");
+  char* savedpath;
+  char* name;
+  char* found;
+  int64_t n, i, dir, sec, nsec;
+  struct timespec mtime;
+  pathentT* entry;
+  bool same;
+
+  if ((savedpath = SnapshotGetString(snap)) == NULL ||
+      !SnapshotGetInt(snap, &n))
+    return FALSE;
+  same = (strcmp(savedpath, path != NULL ? path : "") == 0 && n >= 0);
+  if (same && ndirs < 0)
+    loaddirs();
+  same = same && n == ndirs;
+  for (i = 0; i < n; i++)
+    {
+      if (!SnapshotGetInt(snap, &sec) || !SnapshotGetInt(snap, &nsec))
+        return FALSE;
+      if (!same)
+        continue;
+      dirmtime(&dirs[i], &mtime);
+      same = (mtime.tv_sec == sec && mtime.tv_nsec == nsec);
+    }
+
+  if (!SnapshotGetInt(snap, &n))
+    return FALSE;
+  for (i = 0; i < n; i++)
+    {
+      if ((name = SnapshotGetString(snap)) == NULL ||
+          !SnapshotGetInt(snap, &dir) || (found = SnapshotGetString(snap)) == NULL)
+        return FALSE;
+      if (!same || dir >= ndirs)
+        {
+          PathCacheAdd(name);
+          continue;
+        }
+      entry = newentry(name, hashname(name));
+      entry->dir = dir;
+      if (dir >= 0)
+        entry->path = strdup(found);
+    }
+  return TRUE;
+} /* PathCacheRestore */
+
+
+/*
+ * loaddirs
+ *
+ * arguments: none
+ *
+ * returns: none
+ *
+ * Splits PATH into its directories, opens them and records their
+ * mtimes.
+ */
+static void
+loaddirs()
+{
+  char* path = getenv("PATH");
+  char* start;
+  char* end;
+  int max = 1;
+
+  if (path == NULL)
+    path = "";
+  if (!shmtried)
+    shmopen();
+  pathhash = hashname(path);
+  for (start = path; *start != '\0'; start++)
+    if (*start == ':')
+      max++;
+  dirs = (pathdirT *)malloc(sizeof(pathdirT) * max);
+  ndirs = 0;
+
+  for (start = path; *start != '\0'; start = end)
+    {
+      end = strchr(start, ':');
+      if (end == NULL)
+        end = start + strlen(start);
+      if (end > start)
+        {
+          pathdirT* dir = &dirs[ndirs++];
+          dir->len = end - start;
+          dir->name = (char *)malloc(sizeof(char) * (dir->len + 1));
+          memcpy(dir->name, start, dir->len);
+          dir->name[dir->len] = '\0';
+          dir->checked = epoch;
+          dir->fd = -1;
+          dirmtime(dir, &dir->mtime);
+          dir->slot = shmfinddir(dir->name);
+          shmcheckdir(dir->slot, &dir->mtime);
+        }
+      if (*end == ':')
+        end++;
+    }
+} /* loaddirs */
+
+
+/*
+ * freedirs
+ *
+ * arguments: none
+ *
+ * returns: none
+ *
+ * Frees the PATH directories.
+ */
+static void
+freedirs()
+{
+  int i;
+  for (i = 0; i < ndirs; i++)
+    {
+      if (dirs[i].fd >= 0)
+        close(dirs[i].fd);
+      free(dirs[i].name);
+    }
+  free(dirs);
+  dirs = NULL;
+  ndirs = -1;
+} /* freedirs */
+
+
+/*
+ * dirschanged
+ *
+ * arguments:
+ *   int last: index of the last directory to check
+ *
+ * returns: bool: whether any directory up to last was modified
+ *
+ * Compares the directory mtimes with the recorded ones, statting each
+ * directory at most once per epoch.
+ */
+static bool
+dirschanged(int last)
+{
+  int i;
+  bool changed = FALSE;
+  struct timespec mtime;
+
+  for (i = 0; i <= last && i < ndirs; i++)
+    {
+      if (dirs[i].checked == epoch)
+        continue;
+      dirs[i].checked = epoch;
+      dirmtime(&dirs[i], &mtime);
+      if (mtime.tv_sec != dirs[i].mtime.tv_sec ||
+          mtime.tv_nsec != dirs[i].mtime.tv_nsec)
+        {
+          dirs[i].mtime = mtime;
+          changed = TRUE;
+        }
+      shmcheckdir(dirs[i].slot, &mtime);
+    }
+  return changed;
+} /* dirschanged */
+
+
+/*
+ * dirmtime
+ *
+ * arguments:
+ *   pathdirT *dir: a PATH directory
+ *   struct timespec *mtime: set to its mtime, or zero if it is missing
+ *
+ * returns: none
+ *
+ * Gets the mtime through the directory's descriptor, opening the
+ * directory first if it could not be opened before. A directory that
+ * is replaced by a new one under the same name is not noticed.
+ */
+static void
+dirmtime(pathdirT* dir, struct timespec* mtime)
+{
+  struct stat st;
+
+  memset(mtime, 0, sizeof(*mtime));
+  if (dir->fd < 0)
+    dir->fd = open(dir->name, O_PATH | O_DIRECTORY | O_CLOEXEC);
+  if (dir->fd >= 0 && fstat(dir->fd, &st) == 0)
+    *mtime = st.st_mtim;
+} /* dirmtime */
+
+
+/*
+ * hashname
+ *
+ * arguments:
+ *   char *name: the string to hash
+ *
+ * returns: unsigned long: the FNV-1a hash of name
+ */
+static unsigned long
+hashname(char* name)
+{
+  unsigned long h = 2166136261UL;
+  while (*name != '\0')
+    {
+      h ^= (unsigned char)*name++;
+      h *= 16777619UL;
+    }
+  return h;
+} /* hashname */
+
+
+/*
+ * searchdirs
+ *
+ * arguments:
+ *   char *name: the command name
+ *   int *dir: set to the index of the directory it was found in
+ *
+ * returns: char*: a newly allocated full path, or NULL
+ *
+ * Walks the PATH directories looking for an executable regular file.
+ * Each candidate is probed relative to the directory's descriptor, so
+ * only the name itself is looked up and the full path is only built
+ * for the directory it is found in.
+ */
+static char*
+searchdirs(char* name, int* dir)
+{
+  int i;
+  int namelen = strlen(name);
+  struct stat st;
+  char* path;
+
+  for (i = 0; i < ndirs; i++)
+    {
+      if (dirs[i].fd < 0)
+        continue;
+      if (fstatat(dirs[i].fd, name, &st, 0) == 0 &&
+          S_ISREG(st.st_mode) && (st.st_mode & 0111))
+        {
+          path = (char *)malloc(sizeof(char) * (dirs[i].len + namelen + 2));
+          memcpy(path, dirs[i].name, dirs[i].len);
+          path[dirs[i].len] = '/';
+          memcpy(path + dirs[i].len + 1, name, namelen + 1);
+          *dir = i;
+          return path;
+        }
+    }
+  *dir = -1;
+  return NULL;
+} /* searchdirs */
+
+
+/*
+ * resolve
+ *
+ * arguments:
+ *   char *name: the command name
+ *
+ * returns: pathentT*: the (possibly negative) cache entry for name
+ *
+ * Returns the cache entry for name if it is still valid. Otherwise the
+ * PATH is searched and the result entered into the cache. A hit is
+ * only valid if none of the directories it depends on changed: for a
+ * found command, those up to the one it was found in; for a missing
+ * command, all of them.
+ */
+static pathentT*
+resolve(char* name)
+{
+  unsigned long h = hashname(name);
+  pathentT* entry = NULL;
+
+  if (ndirs < 0)
+    loaddirs();
+
+  if (buckets != NULL)
+    {
+      for (entry = buckets[h & (nbuckets - 1)]; entry != NULL; entry = entry->next)
+        {
+          if (entry->hash == h && strcmp(entry->name, name) == 0)
+            break;
+        }
+    }
+  if (entry != NULL)
+    {
+      if (!dirschanged(entry->path != NULL ? entry->dir : ndirs - 1))
+        return entry;
+      PathCacheClear();
+    }
+  else if (dirschanged(ndirs - 1))
+    PathCacheClear();
+
+  entry = newentry(name, h);
+  // a fresh shell finds most commands in the shared cache
+  if (!shmlookup(name, entry))
+    {
+      entry->path = searchdirs(name, &entry->dir);
+      shmpublish(entry);
+    }
+  return entry;
+} /* resolve */
+
+
+/*
+ * newentry
+ *
+ * arguments:
+ *   char *name: the command name
+ *   unsigned long h: its hash
+ *
+ * returns: pathentT*: a new entry for name, without a path yet
+ *
+ * Enters the name into the hash table, which grows once it is as full
+ * as it is wide.
+ */
+static pathentT*
+newentry(char* name, unsigned long h)
+{
+  pathentT* entry;
+  int i;
+
+  if (buckets == NULL)
+    {
+      nbuckets = INITBUCKETS;
+      buckets = (pathentT **)calloc(nbuckets, sizeof(pathentT *));
+    }
+  if (nentries >= nbuckets)
+    {
+      int newsize = nbuckets * 2;
+      pathentT** newbuckets = (pathentT **)calloc(newsize, sizeof(pathentT *));
+      pathentT* next;
+      for (i = 0; i < nbuckets; i++)
+        {
+          for (entry = buckets[i]; entry != NULL; entry = next)
+            {
+              next = entry->next;
+              entry->next = newbuckets[entry->hash & (newsize - 1)];
+              newbuckets[entry->hash & (newsize - 1)] = entry;
+            }
+        }
+      free(buckets);
+      buckets = newbuckets;
+      nbuckets = newsize;
+    }
+
+  entry = (pathentT *)malloc(sizeof(pathentT));
+  entry->name = (char *)malloc(sizeof(char) * (strlen(name) + 1));
+  strcpy(entry->name, name);
+  entry->path = NULL;
+  entry->dir = -1;
+  entry->hits = 0;
+  entry->hash = h;
+  entry->next = buckets[h & (nbuckets - 1)];
+  buckets[h & (nbuckets - 1)] = entry;
+  nentries++;
+  return entry;
+} /* newentry */
+
+
+/*
+ * shmopen
+ *
+ * arguments: none
+ *
+ * returns: none
+ *
+ * Maps the file named by HASHFILEVAR, creating it if necessary. Any
+ * failure simply leaves the shared cache unused.
+ */
+static void
+shmopen()
+{
+  char* fname = getenv(HASHFILEVAR);
+  struct stat st;
+  uint32_t zero = 0;
+  void* map;
+  int fd;
+
+  shmtried = TRUE;
+  if (fname == NULL || fname[0] == '\0')
+    return;
+  fd = open(fname, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600);
+  if (fd < 0)
+    return;
+  // only trust a regular file of our own
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_uid != getuid() ||
+      (st.st_size < sizeof(shmcacheT) &&
+       ftruncate(fd, sizeof(shmcacheT)) != 0))
+    {
+      close(fd);
+      return;
+    }
+  map = mmap(NULL, sizeof(shmcacheT), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return;
+  shm = (shmcacheT *)map;
+
+  // the first shell to map a new file stamps it
+  if (__atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE) == 0)
+    {
+      shm->version = SHMVERSION;
+      __atomic_compare_exchange_n(&shm->magic, &zero, SHMMAGIC, FALSE,
+                                  __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+    }
+  if (__atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE) != SHMMAGIC ||
+      shm->version != SHMVERSION)
+    {
+      munmap(shm, sizeof(shmcacheT));
+      shm = NULL;
+    }
+} /* shmopen */
+
+
+/*
+ * shmlock
+ *
+ * arguments:
+ *   uint32_t *seq: the sequence counter of a shared slot
+ *
+ * returns: bool: whether the slot may be written
+ *
+ * Makes the counter odd. Fails rather than waits if another shell is
+ * writing the slot; a shell killed in the middle of a write leaves its
+ * slot unusable, which costs nothing but a cache slot.
+ */
+static bool
+shmlock(uint32_t* seq)
+{
+  uint32_t s = __atomic_load_n(seq, __ATOMIC_RELAXED);
+  if (s & 1)
+    return FALSE;
+  if (!__atomic_compare_exchange_n(seq, &s, s + 1, FALSE,
+                                   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    return FALSE;
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  return TRUE;
+} /* shmlock */
+
+
+/*
+ * shmunlock
+ *
+ * arguments:
+ *   uint32_t *seq: the sequence counter of a shared slot
+ *
+ * returns: none
+ *
+ * Makes the counter even again, publishing the new contents.
+ */
+static void
+shmunlock(uint32_t* seq)
+{
+  __atomic_add_fetch(seq, 1, __ATOMIC_RELEASE);
+} /* shmunlock */
+
+
+/*
+ * shmfinddir
+ *
+ * arguments:
+ *   char *name: a PATH directory
+ *
+ * returns: int: index of its shared record, or -1
+ *
+ * Finds the shared record of a directory, claiming an empty one if it
+ * has none yet. Directory records are never reused.
+ */
+static int
+shmfinddir(char* name)
+{
+  uint64_t h;
+  uint32_t s;
+  int i, p;
+  shmdirT* dir;
+
+  if (shm == NULL || strlen(name) >= SHMPATHLEN)
+    return -1;
+  h = hashname(name);
+  for (p = 0; p < SHMPROBE; p++)
+    {
+      i = (h + p) % SHMDIRS;
+      dir = &shm->dirs[i];
+      s = __atomic_load_n(&dir->seq, __ATOMIC_ACQUIRE);
+      if (s == 0)
+        {
+          if (shmlock(&dir->seq))
+            {
+              dir->hash = h;
+              strcpy(dir->name, name);
+              dir->gen = 1;
+              dir->sec = -1;
+              dir->nsec = -1;
+              shmunlock(&dir->seq);
+              return i;
+            }
+          s = __atomic_load_n(&dir->seq, __ATOMIC_ACQUIRE);
+        }
+      // the name is complete once the first write finished
+      if (s >= 2 && dir->hash == h && strcmp(dir->name, name) == 0)
+        return i;
+    }
+  return -1;
+} /* shmfinddir */
+
+
+/*
+ * shmcheckdir
+ *
+ * arguments:
+ *   int slot: index of the directory's shared record, or -1
+ *   struct timespec *mtime: the mtime the directory has now
+ *
+ * returns: none
+ *
+ * Bumps the generation of the directory if the shared record saw a
+ * different mtime, which invalidates the entries that depend on it.
+ */
+static void
+shmcheckdir(int slot, struct timespec* mtime)
+{
+  shmdirT* dir;
+  uint32_t s;
+  int64_t sec, nsec;
+
+  if (shm == NULL || slot < 0)
+    return;
+  dir = &shm->dirs[slot];
+  s = __atomic_load_n(&dir->seq, __ATOMIC_ACQUIRE);
+  sec = dir->sec;
+  nsec = dir->nsec;
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  if (!(s & 1) && s == __atomic_load_n(&dir->seq, __ATOMIC_RELAXED) &&
+      sec == mtime->tv_sec && nsec == mtime->tv_nsec)
+    return;
+  if (shmlock(&dir->seq))
+    {
+      if (dir->sec != mtime->tv_sec || dir->nsec != mtime->tv_nsec)
+        {
+          dir->sec = mtime->tv_sec;
+          dir->nsec = mtime->tv_nsec;
+          __atomic_add_fetch(&dir->gen, 1, __ATOMIC_RELAXED);
+        }
+      shmunlock(&dir->seq);
+    }
+} /* shmcheckdir */
+
+
+/*
+ * shmgensum
+ *
+ * arguments:
+ *   int last: index of the last directory to include
+ *
+ * returns: uint64_t: the sum of the generations, 0 if there is no sum
+ *
+ * Generations only grow, so the sum changes whenever any of the
+ * directories changes.
+ */
+static uint64_t
+shmgensum(int last)
+{
+  uint64_t sum = 0;
+  int i;
+
+  if (last < 0)
+    return 0;
+  for (i = 0; i <= last; i++)
+    {
+      if (dirs[i].slot < 0)
+        return 0;
+      sum += __atomic_load_n(&shm->dirs[dirs[i].slot].gen, __ATOMIC_ACQUIRE);
+    }
+  return sum;
+} /* shmgensum */
+
+
+/*
+ * shmkey
+ *
+ * arguments:
+ *   char *name: the command name
+ *
+ * returns: uint64_t: the shared key of name under the current PATH
+ */
+static uint64_t
+shmkey(char* name)
+{
+  return ((uint64_t)pathhash * 31) ^ hashname(name);
+} /* shmkey */
+
+
+/*
+ * shmlookup
+ *
+ * arguments:
+ *   char *name: the command name
+ *   pathentT *entry: filled in with the shared result
+ *
+ * returns: bool: whether a current shared entry was found
+ *
+ * Looks a command up in the shared cache without taking any lock.
+ */
+static bool
+shmlookup(char* name, pathentT* entry)
+{
+  uint64_t key, gensum;
+  uint32_t s;
+  int32_t dir;
+  int p;
+  shmentT* ent;
+  char ename[SHMNAMELEN];
+  char epath[SHMPATHLEN];
+
+  if (shm == NULL || strlen(name) >= SHMNAMELEN)
+    return FALSE;
+  key = shmkey(name);
+  for (p = 0; p < SHMPROBE; p++)
+    {
+      ent = &shm->entries[(key + p) % SHMENTRIES];
+      s = __atomic_load_n(&ent->seq, __ATOMIC_ACQUIRE);
+      if (s == 0 || (s & 1) || ent->key != key)
+        continue;
+      memcpy(ename, ent->name, SHMNAMELEN);
+      memcpy(epath, ent->path, SHMPATHLEN);
+      dir = ent->dir;
+      gensum = ent->gensum;
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      if (s != __atomic_load_n(&ent->seq, __ATOMIC_RELAXED))
+        continue;
+      ename[SHMNAMELEN - 1] = '\0';
+      epath[SHMPATHLEN - 1] = '\0';
+      if (strcmp(ename, name) != 0 || dir >= ndirs)
+        continue;
+      if (gensum == 0 || gensum != shmgensum(dir >= 0 ? dir : ndirs - 1))
+        return FALSE;
+      entry->dir = dir;
+      entry->path = NULL;
+      if (dir >= 0)
+        {
+          entry->path = (char *)malloc(sizeof(char) * (strlen(epath) + 1));
+          strcpy(entry->path, epath);
+        }
+      return TRUE;
+    }
+  return FALSE;
+} /* shmlookup */
+
+
+/*
+ * shmpublish
+ *
+ * arguments:
+ *   pathentT *entry: a freshly resolved command
+ *
+ * returns: none
+ *
+ * Stores a resolved command in the shared cache. The slot already
+ * holding the command is reused, then an empty one; if the probe
+ * sequence is full the first slot is overwritten.
+ */
+static void
+shmpublish(pathentT* entry)
+{
+  uint64_t key, gensum;
+  shmentT* ent;
+  shmentT* victim = NULL;
+  int p;
+
+  if (shm == NULL || strlen(entry->name) >= SHMNAMELEN ||
+      (entry->path != NULL && strlen(entry->path) >= SHMPATHLEN))
+    return;
+  gensum = shmgensum(entry->dir >= 0 ? entry->dir : ndirs - 1);
+  if (gensum == 0)
+    return;
+  key = shmkey(entry->name);
+  for (p = 0; p < SHMPROBE; p++)
+    {
+      ent = &shm->entries[(key + p) % SHMENTRIES];
+      if (__atomic_load_n(&ent->seq, __ATOMIC_ACQUIRE) == 0)
+        {
+          if (victim == NULL)
+            victim = ent;
+        }
+      else if (ent->key == key && strncmp(ent->name, entry->name, SHMNAMELEN) == 0)
+        {
+          victim = ent;
+          break;
+        }
+    }
+  if (victim == NULL)
+    victim = &shm->entries[key % SHMENTRIES];
+  if (!shmlock(&victim->seq))
+    return;
+  victim->key = key;
+  victim->dir = entry->dir;
+  victim->gensum = gensum;
+  strcpy(victim->name, entry->name);
+  if (entry->path != NULL)
+    strcpy(victim->path, entry->path);
+  else
+    victim->path[0] = '\0';
+  shmunlock(&victim->seq);
+} /* shmpublish */
@@ -0,0 +1,123 @@
+/***************************************************************************
+ *  Title: Path cache
+ * -------------------------------------------------------------------------
+ *    Purpose: Remembers where commands were found in the PATH
+ *    File: pathcache.h
+ ***************************************************************************/
+
+#ifndef __PATHCACHE_H__
+#define __PATHCACHE_H__
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/************System include***********************************************/
+#include <stdio.h>
+
+/************Private include**********************************************/
+#include "snapshot.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#undef EXTERN
+#ifdef __PATHCACHE_IMPL__
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: Resolve a command name
+ * ---------------------------------------------------------------------
+ *    Purpose: Looks a command name up in the cache, searching the PATH
+ *    directories on a miss. Misses are remembered as well.
+ *    Input: the command name, and where to store a descriptor of the
+ *    directory it was found in
+ *    Output: the full path (owned by the cache) or NULL if not found
+ ***********************************************************************/
+EXTERN char*
+PathCacheLookup(char*, int*);
+
+/***********************************************************************
+ *  Title: Seed the cache
+ * ---------------------------------------------------------------------
+ *    Purpose: Resolves a command name and enters it into the cache
+ *    without counting it as a use.
+ *    Input: the command name
+ *    Output: TRUE if the command was found
+ ***********************************************************************/
+EXTERN bool
+PathCacheAdd(char*);
+
+/***********************************************************************
+ *  Title: Clear the cache
+ * ---------------------------------------------------------------------
+ *    Purpose: Forgets all remembered command locations.
+ *    Input: void
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+PathCacheClear();
+
+/***********************************************************************
+ *  Title: Invalidate the cache
+ * ---------------------------------------------------------------------
+ *    Purpose: Clears the cache and rereads the PATH directories, to be
+ *    called whenever PATH is reassigned.
+ *    Input: void
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+PathCacheInvalidate();
+
+/***********************************************************************
+ *  Title: Start a new command
+ * ---------------------------------------------------------------------
+ *    Purpose: Marks the PATH directories for revalidation, so that
+ *    each directory is checked for changes at most once per command
+ *    line.
+ *    Input: void
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+PathCacheTick();
+
+/***********************************************************************
+ *  Title: Print the cache
+ * ---------------------------------------------------------------------
+ *    Purpose: Lists the remembered commands and their hit counts.
+ *    Input: void
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+PathCachePrint();
+
+/***********************************************************************
+ *  Title: Save and restore the cache
+ * ---------------------------------------------------------------------
+ *    Purpose: Writes the remembered commands to a snapshot, and enters
+ *    the commands read from one, looking them up again if the PATH
+ *    changed since.
+ *    Input: the snapshot
+ *    Output: for restoring, FALSE if the snapshot is cut short
+ ***********************************************************************/
+EXTERN void
+PathCacheSave(FILE*);
+EXTERN bool
+PathCacheRestore(snapshotT*);
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __PATHCACHE_H__ */
@@ -0,0 +1,187 @@
+/***************************************************************************
+ *  Title: Sample plugin
+ * -------------------------------------------------------------------------
+ *    Purpose: basename and dirname as builtins that enable -f loads
+ *    File: sample.c
+ ***************************************************************************/
+/***************************************************************************
+ *  Shows what a plugin looks like: it only knows the command and the
+ *  descriptors it was given, and writes its output there itself. Both
+ *  commands only take operands, so with an option the shell runs the
+ *  tools in the PATH instead. Built with
+ *
+ *      gcc -D HAVE_CONFIG_H -I.. -shared -fPIC -o sample.so sample.c
+ *
+ *  and loaded with enable -f ./sample.so basename dirname.
+ ***************************************************************************/
+
+#define _GNU_SOURCE
+
+/************System include***********************************************/
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/************Private include**********************************************/
+#include "tshplugin.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/************Function Prototypes******************************************/
+/* checks that a command has one operand, or up to max */
+static int
+operands(commandT*, int);
+/* writes a part of a path and a newline */
+static int
+writepath(int, const char*, size_t);
+/* strips a path down to its last component */
+static int
+runbasename(commandT*, int, int);
+/* strips the last component off a path */
+static int
+rundirname(commandT*, int, int);
+
+/************Global Variables*********************************************/
+
+static const tshbuiltinT kBuiltins[] = {
+  { "basename", runbasename, TSH_BUILTIN_PURE | TSH_BUILTIN_PIPE, "" },
+  { "dirname",  rundirname,  TSH_BUILTIN_PURE | TSH_BUILTIN_PIPE, "" },
+  { NULL }
+};
+
+const tshpluginT tsh_plugin = { TSH_PLUGIN_VERSION, kBuiltins };
+
+/**************Implementation***********************************************/
+
+/*
+ * operands
+ *
+ * arguments:
+ *   commandT *cmd: the command
+ *   int max: how many operands it takes at most
+ *
+ * returns: int: 0 if the number is right, 1 after complaining
+ *
+ * Complains like the GNU tools do.
+ */
+static int
+operands(commandT* cmd, int max)
+{
+  if (cmd->argc < 2)
+    dprintf(STDERR_FILENO, "%s: missing operand\n", cmd->argv[0]);
+  else if (cmd->argc > max + 1)
+    dprintf(STDERR_FILENO, "%s: extra operand '%s'\n", cmd->argv[0],
+            cmd->argv[max + 1]);
+  else
+    return 0;
+  dprintf(STDERR_FILENO, "Try '%s --help' for more information.\n",
+          cmd->argv[0]);
+  return 1;
+} /* operands */
+
+
+/*
+ * writepath
+ *
+ * arguments:
+ *   int out: the descriptor to write to
+ *   const char *path: the start of the part
+ *   size_t len: its length
+ *
+ * returns: int: 0, or 1 if it could not be written
+ *
+ * Writes the part and the newline at once, so that a reader of a pipe
+ * sees the whole line.
+ */
+static int
+writepath(int out, const char* path, size_t len)
+{
+  char line[len + 1];
+
+  memcpy(line, path, len);
+  line[len] = '\n';
+  return write(out, line, len + 1) != (ssize_t)(len + 1);
+} /* writepath */
+
+
+/*
+ * runbasename
+ *
+ * arguments:
+ *   commandT *cmd: basename PATH [SUFFIX]
+ *   int in: unused
+ *   int out: where the result goes
+ *
+ * returns: int: the exit status
+ *
+ * Trailing slashes are dropped first, and a path of slashes only is
+ * /. The suffix is then removed, unless it is all that is left.
+ */
+static int
+runbasename(commandT* cmd, int in, int out)
+{
+  const char* path;
+  const char* slash;
+  const char* suffix;
+  size_t len, slen;
+
+  if (operands(cmd, 2))
+    return 1;
+  path = cmd->argv[1];
+  len = strlen(path);
+  while (len > 1 && path[len - 1] == '/')
+    len--;
+  if (len == 1 && path[0] == '/')
+    return writepath(out, path, 1);
+  if ((slash = (const char *)memrchr(path, '/', len)) != NULL) {
+    len -= slash + 1 - path;
+    path = slash + 1;
+  }
+  if (cmd->argc == 3) {
+    suffix = cmd->argv[2];
+    slen = strlen(suffix);
+    if (slen < len && memcmp(path + len - slen, suffix, slen) == 0)
+      len -= slen;
+  }
+  return writepath(out, path, len);
+} /* runbasename */
+
+
+/*
+ * rundirname
+ *
+ * arguments:
+ *   commandT *cmd: dirname PATH
+ *   int in: unused
+ *   int out: where the result goes
+ *
+ * returns: int: the exit status
+ *
+ * The last component and the slashes around it are dropped; what has
+ * no slash is in ., and what is only left with slashes is /.
+ */
+static int
+rundirname(commandT* cmd, int in, int out)
+{
+  const char* path;
+  size_t len;
+
+  if (operands(cmd, 1))
+    return 1;
+  path = cmd->argv[1];
+  len = strlen(path);
+  while (len > 1 && path[len - 1] == '/')
+    len--;
+  while (len > 0 && path[len - 1] != '/')
+    len--;
+  if (len == 0)
+    return writepath(out, ".", 1);
+  while (len > 1 && path[len - 1] == '/')
+    len--;
+  return writepath(out, path, len);
+} /* rundirname */
@@ -41,10 +41,13 @@
  *
  ***************************************************************************/
 #define __RUNTIME_IMPL__
+#define _GNU_SOURCE
 
 /************System include***********************************************/
 #include <assert.h>
+#include <ctype.h>
 #include <errno.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -54,10 +57,24 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <sched.h>
+#include <sys/pidfd.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <dlfcn.h>
 
 /************Private include**********************************************/
 #include "runtime.h"
 #include "io.h"
+#include "pathcache.h"
+#include "parsecache.h"
+#include "event.h"
+#include "snapshot.h"
+#include "builtins.h"
+#include "filters.h"
+#include "tshplugin.h"
+#include "stage.h"
 
 /************Defines and Typedefs*****************************************/
 /*  #defines and typedefs should have their names in all caps.
@@ -68,14 +85,54 @@
 
 /************Global Variables*********************************************/
 
-#define NBUILTINCOMMANDS (sizeof BuiltInCommands / sizeof(char*))
+/* environment variable selecting how children are started; "fork"
+ * selects plain fork(), anything else the vfork-style clone() */
+#define SPAWNVAR "TSHSPAWN"
+#define SPAWNSTACK 65536
 
+/* everything a new child needs between its creation and exec */
+typedef struct spawn_t
+{
+  commandT* cmd;
+  int in;
+  int out;
+  pid_t pgid;
+  char* what;
+  int err;
+} spawnT;
+
+/* signals the process group of a pidfd's process (Linux 6.9) */
+#ifndef PIDFD_SIGNAL_PROCESS_GROUP
+#define PIDFD_SIGNAL_PROCESS_GROUP (1UL << 2)
+#endif
+
+/* one process of a job; pidfd is -1 if none could be opened */
+typedef struct proc_t
+{
+  pid_t pid;
+  int pidfd;
+  bool live;
+  int status;
+  struct bgjob_l* job;
+  struct proc_t* nextpid;
+} procT;
+
+/* a job is a process group; pid is the pgid, procs its processes,
+ * the first of them the group leader. Without job control the job
+ * shares the shell's group, and pid is just its first process. The
+ * procs and the cmdline follow the job in the same allocation, which
+ * is in cmdArena for a fg job until the command line is done */
 typedef struct bgjob_l
 {
   pid_t pid;
+  procT* procs;
+  int nprocs;
+  int nlive;
   int jobid;
   state_t state;
-  struct bgjob_l* next;
+  bool inarena;
+  struct bgjob_l* nextdone;
+  struct bgjob_l* nextcmd;
   char *cmdline;
 } bgjobL;
 
@@ -86,42 +143,267 @@ typedef struct alias_l
   struct alias_l* next;
 } aliasL;
 
-/* the pids of the background processes */
-bgjobL *bgjobs = NULL;
+/* what a builtin may do, which decides where it can run */
+#define BUILTIN_PURE   0x1  /* touches nothing of the shell, so it runs
+                               the same in a group run in the shell */
+#define BUILTIN_PIPE   0x2  /* only reads its arguments and stdin and
+                               writes stdout and stderr, so that a
+                               pipeline needs no subshell for it */
+#define BUILTIN_UNDO   0x4  /* only changes what a group run in the
+                               shell can put back */
+#define BUILTIN_PRINTS 0x8  /* only prints if given no arguments */
+#define BUILTIN_SAVED  0x10 /* with arguments, only changes what a
+                               snapshot of ~/.tshrc saves */
+#define BUILTIN_INPUT  0x20 /* reads stdin, which has to be handed off
+                               to it like to a child */
+
+/* how often a cancelled pipeline stage is interrupted again, in ns */
+#define STAGERETRY 10000000
+
+/* the slot of a builtin in builtintab, from the length and the first
+ * and last character of its name; the factors were picked so that no
+ * two builtins share a slot, which the compiler checks */
+#define NBUILTINSLOTS  64
+#define BUILTINSLOT(len, first, last) \
+  (((len) * 30 + (first) * 6 + (last)) & (NBUILTINSLOTS - 1))
+
+/* a builtin command and the function that runs it */
+typedef struct builtin_t
+{
+  const char* name;
+  int (*run)(commandT*);
+  int flags;
+  const char* opts;     /* the options it knows, for BuiltinOptions, or
+                           NULL if it takes anything */
+  const tshbuiltinT* plugin;    /* what it was loaded as, or NULL */
+} builtinT;
+
+/* a builtin that enable -f loaded, and the reference to the shared
+ * object it holds */
+typedef struct plugin_l
+{
+  builtinT builtin;
+  void* handle;
+  struct plugin_l* next;
+} pluginL;
+
+/* a descriptor that a redirection in the shell replaced, and the copy
+ * it is kept in, or -1 if it was not open */
+typedef struct savedfd_t
+{
+  int fd;
+  int copy;
+} savedfdT;
+
+/* the pipe of a process substitution of a command about to run; the
+ * shell holds both ends until the command and the list have started */
+typedef struct subpipe_t
+{
+  commandT* cmd;
+  procsubT* sub;
+  int fd;       /* the end the command gets, as /dev/fd/fd */
+  int other;    /* the end the list gets as its stdin or stdout */
+  struct subpipe_t* next;
+} subpipeT;
+
+/* what a variable or an alias was before a group run in the shell
+ * changed it; value is NULL if it was not set */
+typedef struct undo_l
+{
+  bool alias;
+  char* name;
+  char* value;
+  struct undo_l* next;
+} undoL;
+
+/* the jobs, indexed by job id; all ids above maxjobid are free */
+static bgjobL** jobtab = NULL;
+static int jobtabsize = 0;
+static int maxjobid = 0;
+/* the processes of all jobs, hashed by pid */
+static procT** pidtab = NULL;
+static int pidtabsize = 0;
+static int npids = 0;
+/* jobs that finished and are not deleted yet */
+static bgjobL* donejobs = NULL;
+/* the jobs of the current command line that are in cmdArena */
+static bgjobL* cmdjobs = NULL;
+/* room for sorting donejobs, kept between calls of CheckJobs */
+static bgjobL** donebuf = NULL;
+static int donebufsize = 0;
 /* list of user-defined command aliases */
 aliasL *aliasLst = NULL;
+/* stack the clone()d children run on until they exec */
+static char spawnstack[SPAWNSTACK] __attribute__((aligned(16)));
+/* processes that are reaped through SIGCHLD as they have no pidfd */
+static int nuntracked = 0;
+/* the exit status of the last command, for exit without a status */
+static int laststatus = 0;
+/* set by a SIGINT, for the waits that no fg job ends */
+static bool interrupted = FALSE;
+/* set by a SIGTSTP, for the threads of a pipeline */
+static bool suspended = FALSE;
+/* the positional parameters, $0 first */
+static char** args = NULL;
+static int nargs = 0;
+/* the descriptor limit tsh was started with, restored in children */
+static struct rlimit childnofile;
+static bool nofileraised = FALSE;
+/* how many redirections in the shell replace its stdin right now */
+static int stdinmoved = 0;
+/* how many children were started, and how many were not needed */
+static int nforks = 0;
+static int nforkssaved = 0;
+/* the groups being run in the shell instead of a subshell, and what
+ * they changed, latest first */
+static int ingroup = 0;
+static undoL* undolog = NULL;
+/* the bodies of the here-documents of the line being run */
+static heredocT* heredocs = NULL;
+/* the process substitutions the shell holds the pipes of */
+static subpipeT* subpipes = NULL;
+
+static pluginL* plugins = NULL;
 
 /************Function Prototypes******************************************/
-/* run command */
+/* runs a node of a parsed line */
+static int
+runnode(nodeT*, bool, bool);
+/* expands variables and aliases in a copy of a parsed command */
+static commandT*
+expandcmd(commandT*);
+/* the value of a $ argument */
+static char*
+lookupvar(char*);
+/* reads the name after a $ in a here-document */
+static char*
+varname(const char*, size_t, size_t*, char*, size_t);
+/* resolves the path and checks for exutable flag */
+static bool
+ResolveExternalCmd(commandT*);
+/* replaces the (child) process with a resolved command */
 static void
-RunCmdFork(commandT*, bool);
-/* runs an external program command after some checks */
+execcmd(commandT*);
+/* starts a child running a command */
+static pid_t
+spawncmd(commandT*, int, int, pid_t, int*);
+/* sets up a new child and execs its command */
 static void
-RunExternalCmd(commandT*, bool);
-/* resolves the path and checks for exutable flag */
+childsetup(spawnT*);
+/* applies redirections */
+static bool
+redirect(redirT*, char**);
+/* applies one redirection */
 static bool
-ResolveExternalCmd(commandT*, char**);
-/* forks and runs a external program */
+applyredir(redirT*, char**);
+/* makes a descriptor to read a here-document from */
+static int
+heredocfd(const char*, size_t, bool);
+/* applies redirections in the shell, keeping what they replace */
+static bool
+shellredirect(redirT*, savedfdT**, int*);
+/* puts back what shellredirect replaced */
 static void
-Exec(commandT*, bool, bool);
-/* runs a builtin command */
+restorefds(savedfdT*, int);
+/* hands off the input read ahead, if stdin is still the shell's */
+static void
+handoffinput(void);
+/* entry point of clone()d children */
+static int
+spawnchild(void*);
+/* starts a child shell running a group or a builtin */
+static pid_t
+spawnshell(nodeT*, commandT*, int, int, int, pid_t, int*);
+/* turns a forked child into a subshell */
+static void
+subshell();
+/* makes the pipe of a process substitution */
+static char*
+opensub(commandT*, procsubT*);
+/* starts the lists of the process substitutions of a command */
+static void
+startsubs(commandT*, pid_t, int);
+/* closes the pipes of the process substitutions of a command */
+static void
+closesubs(commandT*);
+/* closes the pipes a forked child does not use */
 static void
+dropsubs(commandT*);
+/* reaps the list of a process substitution */
+static void
+subexited(void*);
+/* runs a builtin command */
+static int
 RunBuiltInCmd(commandT*);
-/* runs a sequence of cmds piped together */
-void
-RunCmdPipe(commandT*, bool, bool);
-/* checks whether a command is a builtin command */
+/* runs a pipeline, a command or a group as a job */
+static int
+RunCmdPipe(nodeT*, bool, bool);
+/* sets up the builtins of a pipeline to run as threads */
+static stageT*
+fusestages(commandT**, int, bool);
+/* waits for the threads and the job of a pipeline */
+static int
+waitstages(stageT*, int, bgjobL*, pid_t);
+/* execs the last command of the shell in place of it */
+static void
+execlast(commandT*);
+/* tells whether a group only runs builtins that can be undone */
+static bool
+builtinsonly(nodeT*, bool*);
+/* runs a group in the shell, undoing what it changed */
+static int
+rungroup(nodeT*, bool, bool);
+/* remembers what a variable or alias was, while running a group */
+static void
+remember(bool, char*, char*);
+/* undoes the changes remembered since mark */
+static void
+undo(undoL*);
+/* checks whether a word is a variable assignment */
+static bool
+isassignment(char*);
+/* checks whether a command runs inside the shell */
 static bool
-IsBuiltIn(char*);
-/* returns an array with the path environment elements */
-static char** 
-getpath(char*);
-/* frees the above array */
-static void 
-freepath(char**);
+isbuiltincmd(commandT*);
 /* add a bg job to the list */
 static bgjobL*
-addbgjob(pid_t, commandT*, bool);
+addbgjob(pid_t, procT*, int, const char*, int, bool);
+/* allocates a job with room for its processes and command line */
+static bgjobL*
+allocjob(int, int, bool);
+/* deletes or moves out the jobs of a command line that is done */
+static void
+releasejobs();
+/* moves a job from cmdArena to the heap */
+static void
+keepjob(bgjobL*);
+/* the exit status of a job that finished or stopped */
+static int
+jobstatus(bgjobL*);
+/* records that a process of a job has stopped or finished */
+static void
+setprocstate(procT*, state_t);
+/* reaps a process whose pidfd became readable */
+static void
+procexited(void*);
+/* sends a signal to the process group of a job */
+static void
+signaljob(bgjobL*, int);
+/* finds the job with the given pgid */
+static bgjobL*
+findjob(pid_t);
+/* finds a process by pid */
+static procT*
+findproc(pid_t);
+/* enters a process into pidtab */
+static void
+addproc(procT*);
+/* removes a job from the job table and frees it */
+static void
+deljob(bgjobL*);
+/* orders jobs by job id */
+static int
+jobidcmp(const void*, const void*);
 /* display the jobs list */
 static void
 showjobs();
@@ -134,9 +416,100 @@ waitforfg();
 /* do bg built in command */
 static void
 dobg(int);
-/* forks and runs a command connected to one end of a pipe */
-void
-ExecPipe(commandT*, int[2], int[2], pipeop_t);
+/* defines an alias */
+static void
+setalias(char*, char*);
+/* removes an alias */
+static bool
+delalias(char*);
+/* handles the logic of the hash builtin */
+static int
+RunHashCmd(commandT*);
+/* handles the logic of the wait builtin */
+static int
+RunWaitCmd(commandT*);
+/* handles the logic of the kill builtin */
+static int
+RunKillCmd(commandT*);
+/* handles the logic of the sleep builtin */
+static int
+RunSleepCmd(commandT*);
+/* the number of a signal name or number */
+static int
+signum(const char*);
+/* handles kill -l */
+static int
+listsignals(commandT*);
+/* handles the logic of the enable builtin */
+static int
+RunEnableCmd(commandT*);
+/* loads builtins from a plugin */
+static int
+loadplugin(const char*, char**, int);
+/* handles the logic of the exit builtin */
+static int
+runexit(commandT*);
+/* runs the builtins that only call into the rest of the shell */
+static int
+runcd(commandT*);
+static int
+runjobs(commandT*);
+static int
+runfg(commandT*);
+static int
+runbg(commandT*);
+static int
+runparsecache(commandT*);
+static int
+runforks(commandT*);
+static int
+runalias(commandT*);
+static int
+rununalias(commandT*);
+/* finds a builtin by name */
+static const builtinT*
+findbuiltin(const char*);
+/* whether a wait for the given jobs is over */
+static bool
+waitdone(bgjobL**, int, bool, int*);
+/* finds the job a wait argument names */
+static bgjobL*
+jobarg(char*);
+/* the builtins, by slot. Assignments are builtins as well, but have
+ * no name of their own */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic error "-Woverride-init"
+static const builtinT builtintab[NBUILTINSLOTS] = {
+  [BUILTINSLOT(1, '[', '[')] =  { "[",          RunTestCmd,    BUILTIN_PURE | BUILTIN_PIPE },
+  [BUILTINSLOT(2, 'b', 'g')] =  { "bg",         runbg,         0 },
+  [BUILTINSLOT(2, 'c', 'd')] =  { "cd",         runcd,         BUILTIN_UNDO },
+  [BUILTINSLOT(2, 'f', 'g')] =  { "fg",         runfg,         0 },
+  [BUILTINSLOT(2, 'w', 'c')] =  { "wc",         RunWcCmd,      BUILTIN_PURE | BUILTIN_PIPE | BUILTIN_INPUT, WC_OPTIONS },
+  [BUILTINSLOT(3, 'c', 't')] =  { "cat",        RunCatCmd,     BUILTIN_PURE | BUILTIN_PIPE | BUILTIN_INPUT, CAT_OPTIONS },
+  [BUILTINSLOT(3, 'p', 'd')] =  { "pwd",        RunPwdCmd,     BUILTIN_PURE | BUILTIN_PIPE },
+  [BUILTINSLOT(4, 'e', 'o')] =  { "echo",       RunEchoCmd,    BUILTIN_PURE | BUILTIN_PIPE },
+  [BUILTINSLOT(4, 'e', 't')] =  { "exit",       runexit,       0 },
+  [BUILTINSLOT(4, 'g', 'p')] =  { "grep",       RunGrepCmd,    BUILTIN_PURE | BUILTIN_PIPE | BUILTIN_INPUT, GREP_OPTIONS },
+  [BUILTINSLOT(4, 'h', 'h')] =  { "hash",       RunHashCmd,    BUILTIN_PRINTS | BUILTIN_SAVED },
+  [BUILTINSLOT(4, 'h', 'd')] =  { "head",       RunHeadCmd,    BUILTIN_PURE | BUILTIN_PIPE | BUILTIN_INPUT, HEAD_OPTIONS },
+  [BUILTINSLOT(4, 'j', 's')] =  { "jobs",       runjobs,       0 },
+  [BUILTINSLOT(4, 'k', 'l')] =  { "kill",       RunKillCmd,    0 },
+  [BUILTINSLOT(4, 't', 'l')] =  { "tail",       RunTailCmd,    BUILTIN_PURE | BUILTIN_PIPE | BUILTIN_INPUT, TAIL_OPTIONS },
+  [BUILTINSLOT(4, 't', 't')] =  { "test",       RunTestCmd,    BUILTIN_PURE | BUILTIN_PIPE },
+  [BUILTINSLOT(4, 't', 'e')] =  { "true",       RunTrueCmd,    BUILTIN_PURE | BUILTIN_PIPE },
+  [BUILTINSLOT(4, 'w', 't')] =  { "wait",       RunWaitCmd,    0 },
+  [BUILTINSLOT(5, 'a', 's')] =  { "alias",      runalias,      BUILTIN_UNDO | BUILTIN_SAVED },
+  [BUILTINSLOT(5, 'f', 'e')] =  { "false",      RunFalseCmd,   BUILTIN_PURE | BUILTIN_PIPE },
+  [BUILTINSLOT(5, 'f', 'p')] =  { "fgrep",      RunGrepCmd,    BUILTIN_PURE | BUILTIN_PIPE | BUILTIN_INPUT, FGREP_OPTIONS },
+  [BUILTINSLOT(5, 'f', 's')] =  { "forks",      runforks,      BUILTIN_PRINTS },
+  [BUILTINSLOT(5, 's', 'p')] =  { "sleep",      RunSleepCmd,   BUILTIN_PURE },
+  [BUILTINSLOT(6, 'e', 'e')] =  { "enable",     RunEnableCmd,  BUILTIN_PRINTS },
+  [BUILTINSLOT(6, 'p', 'f')] =  { "printf",     RunPrintfCmd,  BUILTIN_PURE | BUILTIN_PIPE },
+  [BUILTINSLOT(7, 'u', 's')] =  { "unalias",    rununalias,    BUILTIN_UNDO | BUILTIN_SAVED },
+  [BUILTINSLOT(10, 'p', 'e')] = { "parsecache", runparsecache, BUILTIN_PRINTS },
+};
+#pragma GCC diagnostic pop
+
 /************External Declaration*****************************************/
 
 /**************Implementation***********************************************/
@@ -146,155 +519,87 @@ ExecPipe(commandT*, int[2], int[2], pipeop_t);
  * RunCmd
  *
  * arguments:
- *   commandT *cmd: the command to be run
+ *   nodeT *node: the root of a parsed line
+ *   heredocT *docs: the bodies of its here-documents, or NULL
  *
- * returns: none
+ * returns: int: its exit status
  *
- * Runs the given command.
+ * Runs the given command line. If it is the last line of a script or
+ * command string, its last command is exec'd instead of forked.
  */
-void
-RunCmd(commandT* cmd)
+int
+RunCmd(nodeT* node, heredocT* docs)
 {
-  RunCmdFork(cmd, TRUE);
+  int status;
+
+  PathCacheTick();
+  heredocs = docs;
+  status = runnode(node, FALSE, AtLastLine());
+  heredocs = NULL;
+  releasejobs();
+  return status;
 } /* RunCmd */
 
 
 /*
- * splitPipeCmd
+ * SetArgs
  *
  * arguments:
- *   char* cmdline: the command line to parse
- *
- * returns: the head of a linked list of cmd structs
+ *   int argc: the number of parameters, including $0
+ *   char **argv: the parameters, which stay around
  *
- * Parses a command line containing pipe symbols into a linked list of cmd structs
+ * returns: none
  */
-commandT*
-splitPipeCmd(char* cmdline) {
-  int i;
-  static bool pipeFound = FALSE;
-  for (i = 0; i < strlen(cmdline); i++) {
-    if (cmdline[i] == '|') {
-      pipeFound = TRUE;
-      // split cmd into two command structs
-      char* first = (char*)malloc(sizeof(char)*(i+1));
-      memset(first, '\0', (i+1)*sizeof(char));
-      strncpy(first,cmdline,i-1);
-      char* second = (char*)malloc(sizeof(char)*(strlen(cmdline)-i));
-      strncpy(first,cmdline,i);
-      strcpy(second,cmdline+i+1);
-      
-      commandT* pipeFrom = getCommand(first);
-      pipeFrom->cmdline = (char *)malloc(sizeof(char) * (strlen(first) + 1));
-      strcpy(pipeFrom->cmdline, first); 
-      pipeFrom->pipeTo = splitPipeCmd(second);
-      if (pipeFrom->pipeTo) {
-        pipeFrom->pipeTo->cmdline = (char *)malloc(sizeof(char) * (strlen(second) + 1));
-        strcpy(pipeFrom->pipeTo->cmdline, second);
-      }
-      free(first);
-      free(second);
-      return pipeFrom;
-    }
-  }
-  if (pipeFound) {
-    pipeFound = FALSE;
-    return getCommand(cmdline);
-  } else {
-    return NULL;
-  }
-}
+void
+SetArgs(int argc, char** argv)
+{
+  nargs = argc;
+  args = argv;
+} /* SetArgs */
+
+
 /*
- * RunCmdFork
+ * runnode
  *
  * arguments:
- *   commandT *cmd: the command to be run
- *   bool fork: whether to fork
+ *   nodeT *node: the node to run
+ *   bool bg: whether it is run in the background
+ *   bool tail: whether the shell exits once the node is done
  *
- * returns: none
+ * returns: int: its exit status
  *
- * Runs a command, switching between built-in and external mode
- * depending on cmd->argv[0].
+ * Runs lists and && / || in the shell, and everything else as a job.
+ * A list stops once a command of it is killed by SIGINT, as in bash,
+ * or once exit ran in the shell.
+ * Only the node run last can be the tail of the shell.
  */
-void
-RunCmdFork(commandT* cmd, bool fork)
+static int
+runnode(nodeT* node, bool bg, bool tail)
 {
-  int i;
-  aliasL* aliasIter;
-  char* newCmdline;
-  bool foundAlias = FALSE;
-  commandT* pipeFrom = NULL;
-  commandT* curCmd = NULL;
-  
-  if (cmd->argc <= 0)
-    return;
-  
-  // check to see if any parts of command are env vars
-  for (i = 0; i < cmd->argc; i++) {
-    if (cmd->argv[i][0] == '$') {
-      char *var = getenv(cmd->argv[i] + 1);
-      if (var != NULL) {
-	free(cmd->argv[i]);
-	cmd->argv[i] = (char *)malloc(sizeof(char) * (1 + strlen(var)));
-	strcpy(cmd->argv[i], var);
-      } else {
-	printf("%s: Undefined variable.\n", cmd->argv[i]);
-	return;
-      }
-    }
-  }
-  pipeFrom = splitPipeCmd(cmd->cmdline);
-  
-  if (IsBuiltIn(cmd->argv[0]))
-    {
-      RunBuiltInCmd(cmd);
-    }
-  else
+  int status;
+
+  switch (node->type)
     {
-      // check if any argv's are an alias
-      for (i = 0; i < cmd->argc; ++i) {
-        aliasIter = aliasLst;
-        while (aliasIter) {
-          if (strcmp(cmd->argv[i],aliasIter->name) == 0) {
-            strcpy(cmd->argv[i],aliasIter->value);
-            foundAlias = TRUE;
-          }
-          aliasIter = aliasIter->next;
-        }
-      }
-      if (foundAlias) {
-        // build new commandT
-        newCmdline = (char*)malloc(sizeof(char) * 128);
-        memset(newCmdline,'\0',128);
-        for (i = 0; i < cmd->argc; ++i) {
-          strcat(newCmdline,cmd->argv[i]);
-          strcat(newCmdline," ");
-        }
-        
-        cmd = getCommand(newCmdline);
-        cmd->cmdline = (char *)malloc(sizeof(char) * (strlen(newCmdline) + 1));
-        strcpy(cmd->cmdline, newCmdline); 
-      }
-      if (IsBuiltIn(cmd->argv[0]))
-      {
-        RunBuiltInCmd(cmd);
-      }
-      else {
-        if (pipeFrom) {
-          RunExternalCmd(pipeFrom, fork);
-          curCmd = pipeFrom;
-          // free all the commands in the linked list after RunExternalCmd is done using them
-          while (pipeFrom) {
-            curCmd = pipeFrom;
-            pipeFrom = pipeFrom->pipeTo;
-            freeCommand(curCmd);
-          }
-        } else {
-          RunExternalCmd(cmd, fork);
-        }
-      }
+    case NODE_SEQ:
+      status = runnode(node->left, FALSE, FALSE);
+      if (status == 128 + SIGINT || forceExit)
+        return status;
+      return runnode(node->right, FALSE, tail);
+    case NODE_AND:
+      status = runnode(node->left, FALSE, FALSE);
+      return status == 0 && !forceExit ? runnode(node->right, FALSE, tail) : status;
+    case NODE_OR:
+      status = runnode(node->left, FALSE, FALSE);
+      if (status == 0 || status == 128 + SIGINT || forceExit)
+        return status;
+      return runnode(node->right, FALSE, tail);
+    case NODE_BG:
+      // a whole && / || list in the background runs in a subshell
+      return laststatus = RunCmdPipe(node->left, TRUE, FALSE);
+    default:
+      return laststatus = RunCmdPipe(node, bg, tail);
     }
-} /* RunCmdFork */
+} /* runnode */
 
 
 /*
@@ -318,119 +623,552 @@ RunCmdBg(commandT* cmd)
  * RunCmdPipe
  *
  * arguments:
- *   commandT *cmd1: the commandT struct representing the left hand side of the first pipe
- *   bool forceFork: whether to fork
- *   bool bg: whether the cmd should be backgrounded
+ *   nodeT *node: a pipeline, or the only stage of one
+ *   bool bg: whether the job should be backgrounded
+ *   bool tail: whether the shell exits once it is done
  *
- * returns: none
+ * returns: int: the exit status of the last stage, 0 for a bg job
  *
  * Runs a sequence of commands, piping output from one to input of the next.
+ * All commands are started right after each other in the process group of
+ * the first one, and are then handled as a single job. A builtin on its
+ * own in the foreground runs in the shell; groups, and builtins that are
+ * part of a pipeline or in the background, run in a subshell. Forks
+ * that are not needed are left out: a command on its own that the shell
+ * would only wait for before exiting replaces the shell, a group on
+ * its own runs in the shell if nothing follows it or if it only runs
+ * builtins whose effects can be undone, and the builtins of a pipeline
+ * in the foreground run as threads if fusestages allows it. The lists
+ * of process substitutions are started right after the command they
+ * belong to.
  */
-void
-RunCmdPipe(commandT* cmd1, bool forceFork, bool bg)
+static int
+RunCmdPipe(nodeT* node, bool bg, bool tail)
 {
   int pipeID[2];
-  int pipeID2[2];
-  pipeop_t op = WRITE;
-  
-  commandT* curCmd;
-  
-  for (curCmd = cmd1; curCmd != NULL; ) {
-    if (op == WRITE) {
-      pipe(pipeID);
-      ExecPipe(curCmd, pipeID, pipeID2, WRITE);
-      sleep(1);
-      curCmd = curCmd->pipeTo;
-      if (curCmd->pipeTo) {
-        op = READWRITE;
-      } else {
-        op = READ;
+  int in = -1, out, next;
+  int i, n = 1, nprocs = 0, status = 0;
+  int pidfd;
+  pid_t pid, pgid, leader = 0;
+  nodeT* stage;
+  nodeT** stages;
+  commandT** cmds;
+  procT* procs;
+  bgjobL* job;
+  stageT* threads = NULL;
+  subpipeT* sp;
+  bool ok = TRUE;
+  bool cd = FALSE;
+  savedfdT* saved;
+  int nsaved;
+
+  for (stage = node; stage->type == NODE_PIPE; stage = stage->right)
+    n++;
+  stages = (nodeT **)ArenaAlloc(&cmdArena, sizeof(nodeT*) * n);
+  cmds = (commandT **)ArenaAlloc(&cmdArena, sizeof(commandT*) * n);
+  for (i = 0, stage = node; i < n; i++, stage = stage->right) {
+    stages[i] = (stage->type == NODE_PIPE ? stage->left : stage);
+    cmds[i] = NULL;
+  }
+
+  for (i = 0; i < n && ok; i++) {
+    if (stages[i]->type == NODE_CMD &&
+        (cmds[i] = expandcmd(stages[i]->cmd)) == NULL) {
+      status = 1;
+      ok = FALSE;
+    }
+  }
+  if (ok && n == 1 && cmds[0] != NULL && !bg && isbuiltincmd(cmds[0])) {
+    status = 1;
+    startsubs(cmds[0], getpgrp(), -1);
+    // a builtin reading <(list) only sees the end of it once the list
+    // holds the only other end of the pipe
+    for (sp = subpipes; sp != NULL; sp = sp->next)
+      if (sp->cmd == cmds[0]) {
+        close(sp->other);
+        sp->other = -1;
       }
-    } else if (op == READWRITE) {
-      pipe(pipeID2);
-      ExecPipe(curCmd, pipeID, pipeID2, READWRITE);
-      sleep(1);
-      fflush(stdout);
-      close(pipeID[0]);
-      close(pipeID[1]);
-      
-      pipeID[0] = pipeID2[0];
-      pipeID[1] = pipeID2[1];
-      curCmd = curCmd->pipeTo;
-      if (curCmd->pipeTo) {
-        op = READWRITE;
-      } else {
-        op = READ;
+    if (shellredirect(cmds[0]->redirs, &saved, &nsaved)) {
+      status = RunBuiltInCmd(cmds[0]);
+      restorefds(saved, nsaved);
+    }
+    closesubs(cmds[0]);
+    ok = FALSE;
+  } else
+    SnapshotTaint();
+  for (i = 0; i < n && ok; i++) {
+    if (cmds[i] != NULL && !isbuiltincmd(cmds[i]) &&
+        !ResolveExternalCmd(cmds[i])) {
+      printf("/bin/bash: line 6: %s: command not found\n", cmds[i]->argv[0]);
+      status = 127;
+      ok = FALSE;
+    }
+  }
+  if (ok && n == 1 && !bg) {
+    if (cmds[0] != NULL && tail) {
+      startsubs(cmds[0], getpgrp(), -1);
+      execlast(cmds[0]);
+    }
+    else if (stages[0]->type == NODE_GROUP &&
+             (tail || builtinsonly(stages[0]->left, &cd))) {
+      status = 1;
+      ok = FALSE;
+      if (shellredirect(stages[0]->redirs, &saved, &nsaved)) {
+        status = rungroup(stages[0]->left, tail, cd);
+        restorefds(saved, nsaved);
+      }
+      // it is forked after all if the directory cannot be kept
+      if (status < 0) {
+        status = 0;
+        ok = TRUE;
       }
-    } else if (op == READ) {
-      ExecPipe(curCmd, pipeID, pipeID2, READ);
-      sleep(1);
-      close(pipeID[0]);
-      close(pipeID[1]);
-      fflush(stdout);
-      break;
     }
   }
-  if (pipeID2[0] || pipeID2[1]) {
-    close(pipeID2[0]);
-    close(pipeID2[1]);
+
+  if (ok) {
+    procs = (procT *)ArenaAlloc(&cmdArena, sizeof(procT) * n);
+    pgid = (jobControl ? 0 : getpgrp());
+    // the children may read stdin, from right after this line
+    handoffinput();
+    if ((threads = fusestages(cmds, n, bg)) != NULL)
+      fflush(stdout);
+    // children are only reaped in EventWait, so the group leader stays
+    // around while the others join its group
+    for (i = 0; i < n; i++) {
+      out = next = -1;
+      if (threads != NULL) {
+        if (threads[i].run != NULL || threads[i].plugin != NULL) {
+          StageStart(&threads[i]);
+          nforkssaved++;
+          continue;
+        }
+        in = threads[i].in;
+        out = threads[i].out;
+      } else if (i + 1 < n) {
+        if (pipe2(pipeID, O_CLOEXEC) < 0) {
+          PrintPError("pipe");
+          break;
+        }
+        out = pipeID[1];
+        next = pipeID[0];
+      }
+      if (cmds[i] != NULL && !isbuiltincmd(cmds[i]))
+        pid = spawncmd(cmds[i], in, out, pgid, &pidfd);
+      else
+        pid = spawnshell(stages[i], cmds[i], in, out, next, pgid, &pidfd);
+      // the shell keeps neither end; the next stage gets the read end
+      if (in >= 0)
+        close(in);
+      if (out >= 0)
+        close(out);
+      in = next;
+      if (pid > 0) {
+        if (leader == 0)
+          leader = pid;
+        if (pgid == 0)
+          pgid = pid;
+        procs[nprocs].pid = pid;
+        procs[nprocs++].pidfd = pidfd;
+        if (cmds[i] != NULL)
+          startsubs(cmds[i], pgid, next);
+      }
+      if (cmds[i] != NULL)
+        closesubs(cmds[i]);
+    }
+    if (in >= 0)
+      close(in);
+
+    if (threads != NULL) {
+      job = NULL;
+      if (nprocs > 0) {
+        job = addbgjob(leader, procs, nprocs, node->text, node->textlen,
+                       TRUE);
+        fgpid = leader;
+        job->state = FG;
+      }
+      status = waitstages(threads, n, job, leader);
+    } else if (nprocs > 0) {
+      job = addbgjob(leader, procs, nprocs, node->text, node->textlen, !bg);
+      if (!bg) {
+        fgpid = leader;
+        job->state = FG;
+        waitforfg(leader);
+        status = jobstatus(job);
+      }
+    }
   }
+
+  for (i = 0; i < n; i++)
+    if (cmds[i] != NULL)
+      closesubs(cmds[i]);
   fflush(stdout);
+  return status;
 } /* RunCmdPipe */
 
+
 /*
- * ExecPipe
+ * fusestages
  *
  * arguments:
- *   commandT *cmd: the command to execute
- *   int pipeID: the first pipe
- *   int pipeID: the second pipe, if both input and output are going through pipes
- *   pipeop_t op: indicates what pipe ends should be used
+ *   commandT **cmds: the expanded commands of a pipeline
+ *   int n: their number
+ *   bool bg: whether it runs in the background
+ *
+ * returns: stageT*: one stage per command, in cmdArena, or NULL if the
+ *                   pipeline has to be forked
+ *
+ * The builtins of a pipeline in the foreground that only read stdin
+ * and write stdout, and have no redirections of their own, run as
+ * threads, unless another stage needs a subshell: a forked subshell
+ * would keep the pipes of the threads open. With job control, a
+ * command does too: the threads cannot be stopped along with it, so
+ * a job stopped with SIGTSTP would lose its readers and writers. Two
+ * builtins of the shell next to each other share a ring; everything
+ * else is connected by a pipe, whose ends are all made here, so that
+ * once a thread runs no stage is left without its input or output. A
+ * command gets a stage without a builtin, which only holds its
+ * descriptors. A background pipeline cannot be fused, as the shell
+ * would have to wait for it.
+ */
+static stageT*
+fusestages(commandT** cmds, int n, bool bg)
+{
+  const builtinT* builtin;
+  stageT* threads;
+  bool any = FALSE;
+  int fds[2];
+  int i;
+
+  if (bg || n < 2)
+    return NULL;
+  threads = (stageT *)ArenaAlloc(&cmdArena, sizeof(stageT) * n);
+  for (i = 0; i < n; i++) {
+    if (cmds[i] == NULL || cmds[i]->procsubs != NULL)
+      return NULL;
+    builtin = NULL;
+    if (isbuiltincmd(cmds[i])) {
+      builtin = (cmds[i]->argc > 0 ? findbuiltin(cmds[i]->argv[0]) : NULL);
+      if (builtin == NULL || !(builtin->flags & BUILTIN_PIPE) ||
+          cmds[i]->redirs != NULL)
+        return NULL;
+      any = TRUE;
+    } else if (jobControl)
+      return NULL;
+    threads[i].cmd = cmds[i];
+    threads[i].run = (builtin != NULL ? builtin->run : NULL);
+    threads[i].plugin = (builtin != NULL && builtin->plugin != NULL ?
+                         builtin->plugin->run : NULL);
+    threads[i].in = threads[i].out = -1;
+    threads[i].inring = threads[i].outring = NULL;
+  }
+  if (!any)
+    return NULL;
+
+  for (i = 0; i + 1 < n; i++) {
+    if (threads[i].run != NULL && threads[i + 1].run != NULL)
+      continue;
+    if (pipe2(fds, O_CLOEXEC) < 0) {
+      for (i--; i >= 0; i--)
+        if (threads[i].out >= 0) {
+          close(threads[i].out);
+          close(threads[i + 1].in);
+        }
+      return NULL;
+    }
+    threads[i].out = fds[1];
+    threads[i + 1].in = fds[0];
+  }
+  for (i = 0; i + 1 < n; i++)
+    if (threads[i].run != NULL && threads[i + 1].run != NULL)
+      threads[i].outring = threads[i + 1].inring = StageRing();
+  return threads;
+} /* fusestages */
+
+
+/*
+ * waitstages
  *
- * returns: none
+ * arguments:
+ *   stageT *threads: the stages of a fused pipeline
+ *   int n: their number
+ *   bgjobL *job: the job of its commands, or NULL if it has none
+ *   pid_t leader: the leader of the job
+ *
+ * returns: int: the exit status of the last stage
+ *
+ * Waits in the event loop until the threads are done and the job is
+ * done or stopped. A thread can be neither killed nor stopped, so
+ * SIGINT and SIGTSTP cancel the threads instead, again and again until
+ * they are gone. Commands only share a fused pipeline without job
+ * control, where they are stopped along with the shell.
+ */
+static int
+waitstages(stageT* threads, int n, bgjobL* job, pid_t leader)
+{
+  struct timespec retry = { 0, STAGERETRY };
+  bool running, cancelled = FALSE;
+  int i, status;
+
+  interrupted = suspended = FALSE;
+  for (;;) {
+    running = FALSE;
+    for (i = 0; i < n; i++)
+      if ((threads[i].run != NULL || threads[i].plugin != NULL) &&
+          !StageDone(&threads[i]))
+        running = TRUE;
+    if (!running && (job == NULL || fgpid != leader))
+      break;
+    if (running && (interrupted || suspended)) {
+      for (i = 0; i < n; i++)
+        if (threads[i].run != NULL || threads[i].plugin != NULL)
+          StageCancel(&threads[i]);
+      cancelled = TRUE;
+      EventTimer(&retry);
+      EventWait(EVENT_TIMER);
+    } else
+      EventWait(0);
+  }
+  if (cancelled)
+    EventTimer(NULL);
+
+  status = 0;
+  for (i = 0; i < n; i++)
+    if (threads[i].run != NULL || threads[i].plugin != NULL)
+      status = StageJoin(&threads[i]);
+  if (threads[n - 1].run == NULL && threads[n - 1].plugin == NULL)
+    status = jobstatus(job);
+  else if (cancelled)
+    status = 128 + (interrupted ? SIGINT : SIGTSTP);
+  return status;
+} /* waitstages */
+
+
+/*
+ * expandcmd
  *
- * Executes a command, redirecting input/output to pipes as necessary.
+ * arguments:
+ *   commandT *cmd: a command of a parsed line
+ *
+ * returns: commandT*: the command to run, in cmdArena, or NULL if a
+ *                     variable is undefined
+ *
+ * The parsed line is left alone; $VAR arguments are replaced in a copy
+ * of the command. Positional parameters that are not set expand to
+ * nothing, and the argument is dropped, as in bash. Process
+ * substitutions become the /dev/fd paths of their pipes, whose lists
+ * are only started along with the command. If an argument of
+ * a command that is not a builtin names an alias, the copy is built
+ * anew from the alias values, which may consist of several words.
  */
-void
-ExecPipe(commandT *cmd, int pipeID[2], int pipeID2[2], pipeop_t op)
+static commandT*
+expandcmd(commandT* cmd)
 {
-  int pid, status;
-  sigset_t mask;
-  sigemptyset(&mask);
-  sigaddset(&mask, SIGCHLD);
-  sigprocmask(SIG_BLOCK, &mask, NULL);
-  
-  pid = fork();
-  if (pid == 0) {
-    setpgid(0,0);
-    if (op == WRITE) {
-      close(pipeID[0]);
-      close(1);
-      dup(pipeID[1]);
-      close(pipeID[1]);
+  size_t size = sizeof(commandT) + sizeof(char*) * (cmd->argc + 1);
+  commandT* copy = (commandT *)ArenaAlloc(&cmdArena, size);
+  commandT* aliased;
+  redirT** link;
+  procsubT* sub = cmd->procsubs;
+  subpipeT* sp;
+  aliasL* aliasIter;
+  char* newCmdline;
+  char* var;
+  size_t len = 0;
+  bool foundAlias = FALSE;
+  int i, n;
+
+  memcpy(copy, cmd, size);
+  copy->path = NULL;
+  copy->dirfd = -1;
+  // check to see if any parts of command are env vars
+  for (i = 0, n = 0; i < cmd->argc; i++) {
+    if (sub != NULL && sub->arg == i) {
+      if ((copy->argv[n++] = opensub(copy, sub)) == NULL) {
+        closesubs(copy);
+        return NULL;
+      }
+      sub = sub->next;
+      continue;
     }
-    else if (op == READ) { // read end of pipe
-      close(pipeID[1]);
-      close(0);
-      dup(pipeID[0]);
-      close(pipeID[0]);
-    } else if (op == READWRITE) {
-      close(pipeID2[0]); // stdin of right pipe
-      close(pipeID[1]); // stdout of left pipe
-      close(0); // stdin
-      dup(pipeID[0]);
-      close(pipeID[0]);
-      close(1); // stdout
-      dup(pipeID2[1]);
-      close(pipeID2[1]);
+    copy->argv[n] = cmd->argv[i];
+    if (cmd->argv[i][0] == '$') {
+      // the line depends on the environment it runs in
+      SnapshotTaint();
+      if ((var = lookupvar(cmd->argv[i] + 1)) == NULL) {
+        printf("%s: Undefined variable.\n", cmd->argv[i]);
+        closesubs(copy);
+        return NULL;
+      }
+      if (var[0] == '\0' && isdigit((unsigned char)cmd->argv[i][1]))
+        continue;
+      // the environment is not changed before the command is done
+      copy->argv[n] = var;
     }
-    execv(cmd->path,cmd->argv);
-    
-  } else {
-    sigprocmask(SIG_UNBLOCK, &mask, NULL);
-    waitpid(pid,&status,WNOHANG);
+    n++;
+  }
+  copy->argv[n] = NULL;
+  copy->argc = n;
+  if (isbuiltincmd(copy))
+    return copy;
+
+  // check if any argv's are an alias
+  for (i = 0; i < copy->argc; ++i) {
+    for (aliasIter = aliasLst; aliasIter != NULL; aliasIter = aliasIter->next) {
+      if (strcmp(copy->argv[i], aliasIter->name) == 0) {
+        copy->argv[i] = aliasIter->value;
+        foundAlias = TRUE;
+      }
+    }
+    len += strlen(copy->argv[i]) + 1;
+  }
+  if (!foundAlias)
+    return copy;
+
+  // build new commandT
+  newCmdline = (char *)ArenaAlloc(&cmdArena, len + 1);
+  for (i = 0, len = 0; i < copy->argc; ++i) {
+    strcpy(newCmdline + len, copy->argv[i]);
+    len += strlen(copy->argv[i]);
+    newCmdline[len++] = ' ';
+  }
+  newCmdline[len] = '\0';
+  aliased = getCommand(newCmdline, &cmdArena);
+  RedirIO(aliased);
+  // those of the line come last, so they win over those of the alias
+  for (link = &aliased->redirs; *link != NULL; link = &(*link)->next)
+    ;
+  *link = cmd->redirs;
+  aliased->procsubs = cmd->procsubs;
+  for (sp = subpipes; sp != NULL; sp = sp->next)
+    if (sp->cmd == copy)
+      sp->cmd = aliased;
+  return aliased;
+} /* expandcmd */
+
+
+/*
+ * lookupvar
+ *
+ * arguments:
+ *   char *name: what follows the $ of an argument
+ *
+ * returns: char*: its value, or NULL if it is not defined
+ *
+ * Digits name a positional parameter, which is empty if it is not
+ * set, and # the number of them; anything else is looked up in the
+ * environment.
+ */
+static char*
+lookupvar(char* name)
+{
+  static char count[16];
+  char* end;
+  long i;
+
+  if (name[0] == '#' && name[1] == '\0') {
+    snprintf(count, sizeof(count), "%d", nargs > 0 ? nargs - 1 : 0);
+    return count;
   }
-} /* ExecPipe */
+  if (isdigit((unsigned char)name[0])) {
+    i = strtol(name, &end, 10);
+    if (*end == '\0')
+      return (i < nargs ? args[i] : "");
+  }
+  return getenv(name);
+} /* lookupvar */
+
+
+/*
+ * ExpandVars
+ *
+ * arguments:
+ *   const char *text: the body of a here-document
+ *   size_t len: its length
+ *   size_t *outlen: set to the length of the result
+ *
+ * returns: char*: the expanded body, in cmdArena
+ *
+ * A name is a single digit, #, or a letter or _ followed by letters,
+ * digits and _, as in bash; a $ that starts none stays as it is. A
+ * variable that is not defined expands to nothing. The values are
+ * looked up once to size the result, and again to copy them, as
+ * lookupvar may return a static buffer.
+ */
+char*
+ExpandVars(const char* text, size_t len, size_t* outlen)
+{
+  char name[256];
+  char* value;
+  char* out = NULL;
+  size_t i, n, size = 0;
+  int pass;
+
+  for (pass = 0; pass < 2; pass++) {
+    if (pass == 1)
+      out = ArenaAlloc(&cmdArena, size + 1);
+    for (i = 0, n = 0; i < len; i++) {
+      if (text[i] == '\\' && i + 1 < len && strchr("$`\\\n", text[i + 1])) {
+        if (text[++i] != '\n') {
+          if (out != NULL)
+            out[n] = text[i];
+          n++;
+        }
+        continue;
+      }
+      if (text[i] == '$' && (value = varname(text, len, &i, name, sizeof(name))) != NULL) {
+        if (out != NULL)
+          memcpy(out + n, value, strlen(value));
+        n += strlen(value);
+        continue;
+      }
+      if (out != NULL)
+        out[n] = text[i];
+      n++;
+    }
+    size = n;
+  }
+  out[size] = '\0';
+  *outlen = size;
+  return out;
+} /* ExpandVars */
+
+
+/*
+ * varname
+ *
+ * arguments:
+ *   const char *text: the text a $ is in
+ *   size_t len: its length
+ *   size_t *i: where the $ is; moved to the last character of the name
+ *   char *name: where the name goes
+ *   size_t size: the room for it
+ *
+ * returns: char*: the value of the variable, "" if it is not defined,
+ *                 or NULL if no name follows the $
+ */
+static char*
+varname(const char* text, size_t len, size_t* i, char* name, size_t size)
+{
+  size_t start = *i + 1, end;
+  bool braces = (start < len && text[start] == '{');
+  char* value;
+
+  if (braces)
+    start++;
+  end = start;
+  if (end < len && (isdigit((unsigned char)text[end]) || text[end] == '#'))
+    end++;
+  else
+    while (end < len && (isalnum((unsigned char)text[end]) || text[end] == '_') &&
+           (end > start || !isdigit((unsigned char)text[end])))
+      end++;
+  if (end == start || end - start >= size || (braces && (end >= len || text[end] != '}')))
+    return NULL;
+  memcpy(name, text + start, end - start);
+  name[end - start] = '\0';
+  *i = (braces ? end : end - 1);
+  value = lookupvar(name);
+  return (value != NULL ? value : "");
+} /* varname */
 
 
 /*
@@ -441,20 +1179,32 @@ ExecPipe(commandT *cmd, int pipeID[2], int pipeID2[2], pipeop_t op)
  *
  * returns: none
  *
- * Extracts redirection operators from argv[] and adjusts input/output files accordingly
+ * Extracts <, > and >> operators from argv[] and appends them to
+ * cmd->redirs, in cmdArena. A later redirection of the same stream
+ * replaces an earlier one.
  */
 void
 RedirIO(commandT* cmd)
 {
-  int i, j, fid;
-  char* file;
-  char redirOp;
+  int i, j;
+  redirT** link;
+  redirT* redir;
+
+  for (link = &cmd->redirs; *link != NULL; link = &(*link)->next)
+    ;
   // check argv for '<' or '>' operators
   for (i=0; i < (cmd->argc - 1); i++) {
-    if ((strcmp(cmd->argv[i],">") == 0) || (strcmp(cmd->argv[i],"<") == 0)) {
-      redirOp = cmd->argv[i][0];
-      file = malloc(sizeof(char*)*strlen(cmd->argv[i+1])+1);
-      strcpy(file,cmd->argv[i+1]);
+    if ((strcmp(cmd->argv[i],">") == 0) || (strcmp(cmd->argv[i],"<") == 0) ||
+        (strcmp(cmd->argv[i],">>") == 0)) {
+      redir = (redirT *)ArenaAlloc(&cmdArena, sizeof(redirT));
+      redir->type = (cmd->argv[i][0] == '<' ? REDIR_IN :
+                     cmd->argv[i][1] == '>' ? REDIR_APPEND : REDIR_OUT);
+      redir->fd = (redir->type == REDIR_IN ? 0 : 1);
+      redir->to = -1;
+      redir->file = cmd->argv[i+1];
+      redir->next = NULL;
+      *link = redir;
+      link = &redir->next;
       // remove the redirection from argv[]
       for (j = i; (j+2) < (cmd->argc); j++) {
         cmd->argv[j] = cmd->argv[j+2];
@@ -463,22 +1213,6 @@ RedirIO(commandT* cmd)
       cmd->argv[j+1] = NULL;
       cmd->argc -= 2;
       i -= 1;
-      // redirect stream to file*
-      if (redirOp == '<') {
-        fid = open(file, O_RDONLY);
-        close(0);
-        dup(fid);
-        close(fid);
-      } else if (redirOp == '>') {
-        fid = open(file, O_WRONLY | O_CREAT);
-        close(1);
-        dup(fid);
-        close(fid);
-      }
-      else {
-        printf("%s: can't redirect to this file.",file);
-      }
-      free(file);
     }
   }
   return;
@@ -498,62 +1232,12 @@ IntFgProc()
 {
   if (fgpid != -1) 
     {
-      kill(-fgpid, SIGINT);
+      signaljob(findjob(fgpid), SIGINT);
     }
+  // the threads of a pipeline end on it as well
+  interrupted = TRUE;
 }
 
-/*
- * RunExternalCmd
- *
- * arguments:
- *   commandT *cmd: the command to be run
- *   bool fork: whether to fork
- *
- * returns: none
- *
- * Tries to run an external command.
- */
-static void
-RunExternalCmd(commandT* cmd, bool fork)
-{
-  char** path = getpath(cmd->argv[0]);
-  bool bg = 0;
-  bool allCmdsResolved = TRUE;
-  if (strcmp(cmd->argv[cmd->argc - 1],"&") == 0) {
-    free(cmd->argv[cmd->argc - 1]);
-    cmd->argv[cmd->argc - 1] = NULL;
-    cmd->argc = cmd->argc - 1;
-    bg = 1;
-  }
-  if (ResolveExternalCmd(cmd, path))
-    {
-      if (cmd->pipeTo) {
-        commandT* cmdCpy = cmd->pipeTo;
-        while (cmdCpy != NULL) {
-          freepath(path);
-          path = getpath(cmdCpy->argv[0]);
-          if (ResolveExternalCmd(cmdCpy, path) == FALSE) {
-            allCmdsResolved = FALSE;
-            break;
-          }
-          cmdCpy = cmdCpy->pipeTo;
-        }
-        if (allCmdsResolved) {
-          RunCmdPipe(cmd, fork, bg);
-        }
-      }
-      else {
-        Exec(cmd, fork, bg);
-      }
-    }
-  else
-    {
-      printf("/bin/bash: line 6: %s: command not found\n", cmd->argv[0]);
-    }
-  freepath(path);
-}  /* RunExternalCmd */
-
-
 /*
  * ResolveExternalCmd
  *
@@ -562,245 +1246,1972 @@ RunExternalCmd(commandT* cmd, bool fork)
  *
  * returns: bool: whether the given command exists
  *
- * Determines whether the command to be run actually exists.
+ * Determines whether the command to be run actually exists. Names
+ * without a '/' are looked up in the PATH through the path cache.
  */
 static bool
-ResolveExternalCmd(commandT* cmd, char** path)
+ResolveExternalCmd(commandT* cmd)
 {
   struct stat buf;
-  int stres;
-  int i = 0;
+  char* path = NULL;
   // look through paths to find an existing file,
   // then set the path field in cmd if successful
-  while(path[i] != NULL) 
+  if (strchr(cmd->argv[0], '/') == NULL)
+    path = PathCacheLookup(cmd->argv[0], &cmd->dirfd);
+  if (path != NULL)
     {
-      stres = stat(path[i], &buf);
-      if (stres == 0) {
-	cmd->path = malloc(sizeof(char) * (1 + strlen(path[i])));
-	strcpy(cmd->path, path[i]);
-	return 1;
-      }
-      i++;
-    }   
+      cmd->path = ArenaStrdup(&cmdArena, path);
+      return 1;
+    }
   // failed to find anything in paths, so try relative path
-  cmd->path = malloc(sizeof(char) * (1 + strlen(cmd->argv[0])));
-  strcpy(cmd->path, cmd->argv[0]);
+  cmd->path = cmd->argv[0];
   return(stat(cmd->argv[0], &buf) == 0);
 } /* ResolveExternalCmd */
 
 /*
- * Exec
+ * execcmd
  *
  * arguments:
- *   commandT *cmd: the command to be run
- *   bool forceFork: whether to fork
- *   bool bg: run in bg or not
+ *   commandT *cmd: the resolved command to run
  *
- * returns: none
+ * returns: none, and only if the exec failed
  *
- * Executes an external command.
+ * Execs the command in the current process. Commands found in the
+ * PATH are exec'd relative to the descriptor of their directory, so
+ * that the kernel only has to look up the last path component.
  */
-
 static void
-Exec(commandT* cmd, bool forceFork, bool bg)
+execcmd(commandT* cmd)
 {
-  int pid;
-  sigset_t mask;
-  sigemptyset(&mask);
-  sigaddset(&mask, SIGCHLD);
+  extern char** environ;
 
-  // block sigchld signals until recording the new process id,
-  // and then fork the foreground process
-  sigprocmask(SIG_BLOCK, &mask, NULL);
-  pid = fork();
+  if (cmd->dirfd >= 0)
+    execveat(cmd->dirfd, strrchr(cmd->path, '/') + 1, cmd->argv, environ, 0);
+  execv(cmd->path, cmd->argv);
+} /* execcmd */
 
-  if (pid == 0) {
-    // child process (change pg id so int signals are only sent to the shell)
-    setpgid(0,0);
-    // redirect I/O if necessary
-    RedirIO(cmd);
-    
-    // exec the command
-    execv(cmd->path, cmd->argv);
-  } else {
-    // parent process
-    // add the job to the bg job list
-    if (bg) {
-      addbgjob(pid, cmd, TRUE);
-      sigprocmask(SIG_UNBLOCK, &mask, NULL);
-    } else {
-      // record that this is a fg job
-      fgpid = pid;
-      (addbgjob(pid, cmd, FALSE))->state = FG;
-      sigprocmask(SIG_UNBLOCK, &mask, NULL);
-      waitforfg(pid);
-    }
+
+/*
+ * execlast
+ *
+ * arguments:
+ *   commandT *cmd: the resolved command to run
+ *
+ * returns: none, it exits if the exec fails
+ *
+ * Runs the last command of the shell, or of a subshell, in place of
+ * it, as dash does. The command is set up like any child, except that
+ * it stays in the shell's process group, which job control being off
+ * would have put it in anyway; its exit status becomes the shell's.
+ */
+static void
+execlast(commandT* cmd)
+{
+  spawnT spec;
+
+  spec.cmd = cmd;
+  spec.in = -1;
+  spec.out = -1;
+  spec.pgid = getpgrp();
+  spec.what = cmd->argv[0];
+  spec.err = 0;
+  nforkssaved++;
+  handoffinput();
+  fflush(stdout);
+  childsetup(&spec);
+  PrintPError(spec.what);
+  _exit(127);
+} /* execlast */
+
+
+/*
+ * spawncmd
+ *
+ * arguments:
+ *   commandT *cmd: the resolved command to run
+ *   int in: descriptor to become the child's stdin, or -1
+ *   int out: descriptor to become the child's stdout, or -1
+ *   pid_t pgid: process group to join, 0 for a new one
+ *   int *pidfd: where to store a pidfd of the child, or -1
+ *
+ * returns: pid_t: the pid of the child, or -1
+ *
+ * Starts a child in process group pgid that runs cmd. By default
+ * the child is created with clone(CLONE_VM | CLONE_VFORK), which does
+ * not copy the shell's address space and resumes the shell once the
+ * child has exec'd. Setting SPAWNVAR to "fork" selects plain fork().
+ * Either way the child runs childsetup(); a clone()d child reports a
+ * failure back through the shared spawnT, a forked one prints it.
+ * The pidfd comes from CLONE_PIDFD or pidfd_open(); as the child is
+ * not reaped before its job is recorded, neither can race with the
+ * pid being reused.
+ */
+static pid_t
+spawncmd(commandT* cmd, int in, int out, pid_t pgid, int* pidfd)
+{
+  spawnT spec;
+  sigset_t all, old;
+  pid_t pid;
+  char* backend = getenv(SPAWNVAR);
+
+  spec.cmd = cmd;
+  spec.in = in;
+  spec.out = out;
+  spec.pgid = pgid;
+  spec.what = cmd->argv[0];
+  spec.err = 0;
+  *pidfd = -1;
+
+  if (backend != NULL && strcmp(backend, "fork") == 0) {
+    pid = fork();
+    if (pid == 0) {
+      childsetup(&spec);
+      PrintPError(spec.what);
+      _exit(127);
+    }
+    if (pid > 0)
+      *pidfd = pidfd_open(pid, 0);
+  } else {
+    // no handler may run in the child while it shares our memory
+    sigfillset(&all);
+    sigprocmask(SIG_SETMASK, &all, &old);
+    pid = clone(spawnchild, spawnstack + SPAWNSTACK,
+                CLONE_VM | CLONE_VFORK | CLONE_PIDFD | SIGCHLD, &spec, pidfd);
+    sigprocmask(SIG_SETMASK, &old, NULL);
+    if (pid > 0 && spec.err != 0) {
+      errno = spec.err;
+      PrintPError(spec.what);
+    }
+  }
+
+  if (pid < 0)
+    PrintPError("fork");
+  else {
+    nforks++;
+    // also set the group here, so it exists before we signal it
+    setpgid(pid, pgid != 0 ? pgid : pid);
+  }
+  return pid;
+} /* spawncmd */
+
+
+/*
+ * childsetup
+ *
+ * arguments:
+ *   spawnT *spec: what the child should run and with which descriptors
+ *
+ * returns: none, and only on failure with errno set and spec->what
+ *          naming what failed
+ *
+ * Runs in the new child: restores the default signal dispositions and
+ * an empty signal mask, moves the child into its process group, marks
+ * all descriptors but stdin, stdout, stderr and the pipes of its
+ * process substitutions close-on-exec, connects stdin and stdout and
+ * applies the redirections, whose descriptors are kept open, and execs
+ * the command. Only async-signal-safe calls are made, as the child may
+ * share the shell's memory.
+ */
+static void
+childsetup(spawnT* spec)
+{
+  commandT* cmd = spec->cmd;
+  subpipeT* sp;
+  struct sigaction sa;
+  sigset_t none;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = SIG_DFL;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTSTP, &sa, NULL);
+  sigaction(SIGCHLD, &sa, NULL);
+  sigaction(SIGPIPE, &sa, NULL);
+  sigemptyset(&none);
+  sigprocmask(SIG_SETMASK, &none, NULL);
+  if (nofileraised)
+    setrlimit(RLIMIT_NOFILE, &childnofile);
+
+  // change pg id so int signals are only sent to the shell
+  setpgid(0, spec->pgid);
+  // pipe ends and our own descriptors must not leak into the command,
+  // but for the pipes of its process substitutions
+  close_range(3, ~0U, CLOSE_RANGE_CLOEXEC);
+  for (sp = subpipes; sp != NULL; sp = sp->next)
+    if (sp->cmd == cmd)
+      fcntl(sp->fd, F_SETFD, 0);
+  if (spec->in >= 0)
+    dup2(spec->in, 0);
+  if (spec->out >= 0)
+    dup2(spec->out, 1);
+  if (!redirect(cmd->redirs, &spec->what))
+    return;
+
+  spec->what = cmd->argv[0];
+  execcmd(cmd);
+} /* childsetup */
+
+
+/*
+ * spawnchild
+ *
+ * arguments:
+ *   void *arg: the spawnT describing the child
+ *
+ * returns: int: never returns
+ *
+ * Entry point of a clone()d child. The shell is suspended until the
+ * child execs or exits, so the errno of a failure can be handed back
+ * through spec->err.
+ */
+static int
+spawnchild(void* arg)
+{
+  spawnT* spec = (spawnT *)arg;
+
+  childsetup(spec);
+  spec->err = errno;
+  _exit(127);
+} /* spawnchild */
+
+
+/*
+ * redirect
+ *
+ * arguments:
+ *   redirT *redirs: the redirections of a command or group
+ *   char **what: set to the word of the one that failed
+ *
+ * returns: bool: whether all of them could be applied
+ *
+ * Applies the redirections in order, in the child that runs the
+ * command or group. Like childsetup, it only makes async-signal-safe
+ * calls.
+ */
+static bool
+redirect(redirT* redirs, char** what)
+{
+  for (; redirs != NULL; redirs = redirs->next)
+    if (!applyredir(redirs, what))
+      return FALSE;
+  return TRUE;
+} /* redirect */
+
+
+/*
+ * applyredir
+ *
+ * arguments:
+ *   redirT *redir: the redirection
+ *   char **what: set to its word if it fails, with errno set
+ *
+ * returns: bool: whether it could be applied
+ *
+ * Files are opened close-on-exec and moved to their descriptor with
+ * dup3, which leaves the copy open across exec, so descriptors that
+ * are not meant for the command never lose the flag. Output files are truncated unless
+ * they are appended to.
+ */
+static bool
+applyredir(redirT* redir, char** what)
+{
+  int fd, flags;
+
+  *what = redir->file;
+  switch (redir->type)
+    {
+    case REDIR_CLOSE:
+      close(redir->fd);
+      return TRUE;
+    case REDIR_DUP:
+      // the shell's own descriptors are all close-on-exec, and are not
+      // there as far as the command is concerned
+      flags = (redir->to >= 0 ? fcntl(redir->to, F_GETFD) : -1);
+      if (flags < 0 || (redir->to > 2 && (flags & FD_CLOEXEC))) {
+        errno = EBADF;
+        return FALSE;
+      }
+      // dup3 refuses to copy a descriptor onto itself
+      if (redir->to == redir->fd)
+        return fcntl(redir->fd, F_SETFD, 0) == 0;
+      return dup3(redir->to, redir->fd, 0) >= 0;
+    case REDIR_HEREDOC:
+    case REDIR_HEREDOCTABS:
+    case REDIR_HERESTRING:
+      if (redir->type == REDIR_HERESTRING)
+        fd = heredocfd(redir->file, strlen(redir->file), TRUE);
+      else
+        fd = heredocfd(heredocs[redir->to].body, heredocs[redir->to].len,
+                       FALSE);
+      if (fd < 0)
+        return FALSE;
+      flags = -1;
+      break;
+    case REDIR_IN:
+      flags = O_RDONLY;
+      break;
+    case REDIR_APPEND:
+    case REDIR_BOTHAPPEND:
+      flags = O_WRONLY | O_CREAT | O_APPEND;
+      break;
+    default:
+      flags = O_WRONLY | O_CREAT | O_TRUNC;
+      break;
+    }
+  if (flags >= 0 && (fd = open(redir->file, flags | O_CLOEXEC, 0666)) < 0)
+    return FALSE;
+  if (fd == redir->fd)
+    fcntl(fd, F_SETFD, 0);
+  else {
+    if (dup3(fd, redir->fd, 0) < 0) {
+      close(fd);
+      return FALSE;
+    }
+    close(fd);
+  }
+  if (redir->type == REDIR_BOTH || redir->type == REDIR_BOTHAPPEND)
+    dup3(redir->fd, 2, 0);
+  return TRUE;
+} /* applyredir */
+
+
+/*
+ * heredocfd
+ *
+ * arguments:
+ *   const char *text: the body of a here-document, or a here-string
+ *   size_t len: its length
+ *   bool newline: whether a newline is added, for a here-string
+ *
+ * returns: int: a close-on-exec descriptor the text can be read from,
+ *               or -1 with errno set
+ *
+ * A body that fits into a pipe is written into one, all at once, as
+ * nothing reads it yet. A larger one goes into a memfd, which is
+ * sealed, so that the command reads, or even maps, the very pages it
+ * was written to. Neither touches the filesystem. Like applyredir, it
+ * only makes async-signal-safe calls.
+ */
+static int
+heredocfd(const char* text, size_t len, bool newline)
+{
+  struct iovec iov[2];
+  int fds[2];
+  int fd, capacity;
+  ssize_t n;
+
+  iov[0].iov_base = (void *)text;
+  iov[0].iov_len = len;
+  iov[1].iov_base = "\n";
+  iov[1].iov_len = (newline ? 1 : 0);
+  if (pipe2(fds, O_CLOEXEC) < 0)
+    return -1;
+  capacity = fcntl(fds[1], F_GETPIPE_SZ);
+  if (capacity >= 0 && len + 1 <= (size_t)capacity) {
+    n = writev(fds[1], iov, 2);
+    close(fds[1]);
+    if (n < 0) {
+      close(fds[0]);
+      return -1;
+    }
+    return fds[0];
+  }
+  close(fds[0]);
+  close(fds[1]);
+
+  if ((fd = memfd_create(SHELLNAME " here-document",
+                         MFD_CLOEXEC | MFD_ALLOW_SEALING)) < 0)
+    return -1;
+  while (iov[0].iov_len + iov[1].iov_len > 0) {
+    if ((n = writev(fd, iov, 2)) < 0) {
+      close(fd);
+      return -1;
+    }
+    if ((size_t)n >= iov[0].iov_len) {
+      n -= iov[0].iov_len;
+      iov[0].iov_len = 0;
+      iov[1].iov_len -= n;
+    } else {
+      iov[0].iov_base = (char *)iov[0].iov_base + n;
+      iov[0].iov_len -= n;
+    }
+  }
+  fcntl(fd, F_ADD_SEALS,
+        F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+  lseek(fd, 0, SEEK_SET);
+  return fd;
+} /* heredocfd */
+
+
+/*
+ * shellredirect
+ *
+ * arguments:
+ *   redirT *redirs: the redirections of a builtin or group run in the
+ *                   shell
+ *   savedfdT **saved: set to what they replace, in cmdArena
+ *   int *nsaved: set to how many descriptors were saved
+ *
+ * returns: bool: whether all of them could be applied; if not, the
+ *                failure is reported and nothing is left changed
+ *
+ * Every descriptor is copied above 10, close-on-exec, before a
+ * redirection first replaces it. Builtins print through stdout, which
+ * is flushed first so that what they printed before still goes where
+ * it belongs; whoever restores the descriptors flushes it again.
+ * While stdin is replaced, the input the shell read ahead is not
+ * handed off to it.
+ */
+static bool
+shellredirect(redirT* redirs, savedfdT** saved, int* nsaved)
+{
+  redirT* redir;
+  char* what;
+  int fds[2];
+  int n = 0, i, j, k;
+
+  *saved = NULL;
+  *nsaved = 0;
+  if (redirs == NULL)
+    return TRUE;
+  fflush(stdout);
+  for (redir = redirs; redir != NULL; redir = redir->next)
+    n += 2;
+  *saved = (savedfdT *)ArenaAlloc(&cmdArena, sizeof(savedfdT) * n);
+  for (redir = redirs; redir != NULL; redir = redir->next) {
+    fds[0] = redir->fd;
+    fds[1] = (redir->type == REDIR_BOTH || redir->type == REDIR_BOTHAPPEND
+              ? 2 : -1);
+    for (i = 0; i < 2 && fds[i] >= 0; i++) {
+      for (j = 0; j < *nsaved && (*saved)[j].fd != fds[i]; j++)
+        ;
+      if (j < *nsaved)
+        continue;
+      k = (*nsaved)++;
+      (*saved)[k].fd = fds[i];
+      (*saved)[k].copy = fcntl(fds[i], F_DUPFD_CLOEXEC, 10);
+      if (fds[i] == STDIN_FILENO)
+        stdinmoved++;
+    }
+    if (!applyredir(redir, &what)) {
+      PrintPError(what);
+      restorefds(*saved, *nsaved);
+      *nsaved = 0;
+      return FALSE;
+    }
+  }
+  return TRUE;
+} /* shellredirect */
+
+
+/*
+ * restorefds
+ *
+ * arguments:
+ *   savedfdT *saved: what shellredirect saved
+ *   int nsaved: how many descriptors it saved
+ *
+ * returns: none
+ */
+static void
+restorefds(savedfdT* saved, int nsaved)
+{
+  int i;
+
+  fflush(stdout);
+  for (i = nsaved - 1; i >= 0; i--) {
+    if (saved[i].copy < 0)
+      close(saved[i].fd);
+    else {
+      dup3(saved[i].copy, saved[i].fd, 0);
+      close(saved[i].copy);
+    }
+    if (saved[i].fd == STDIN_FILENO)
+      stdinmoved--;
+  }
+} /* restorefds */
+
+
+/*
+ * handoffinput
+ *
+ * arguments: none
+ *
+ * returns: none
+ *
+ * Calls HandOffInput unless a redirection in the shell replaced stdin,
+ * as the input read ahead belongs to the shell's own stdin, and giving
+ * it back would consume or rewind the file redirected to instead.
+ */
+static void
+handoffinput()
+{
+  if (stdinmoved == 0)
+    HandOffInput();
+} /* handoffinput */
+
+
+/*
+ * spawnshell
+ *
+ * arguments:
+ *   nodeT *node: the group or other node to run, if cmd is NULL
+ *   commandT *cmd: the builtin to run, or NULL
+ *   int in: descriptor to become the child's stdin, or -1
+ *   int out: descriptor to become the child's stdout, or -1
+ *   int other: the read end of the child's stdout pipe, or -1
+ *   pid_t pgid: process group to join, 0 for a new one
+ *   int *pidfd: where to store a pidfd of the child, or -1
+ *
+ * returns: pid_t: the pid of the child, or -1
+ *
+ * Forks a subshell that runs a builtin or the body of a group, and
+ * exits with its status. The subshell execs the last command of the
+ * group instead of forking it. Unlike spawncmd, the child needs a copy of the
+ * shell's memory, so it is always forked. The subshell keeps no pipe
+ * end it does not use, so that its children get SIGPIPE, including
+ * those of process substitutions that are not its own.
+ */
+static pid_t
+spawnshell(nodeT* node, commandT* cmd, int in, int out, int other,
+           pid_t pgid, int* pidfd)
+{
+  pid_t pid;
+  char* what;
+  int status;
+
+  *pidfd = -1;
+  // what is buffered would be written twice otherwise
+  fflush(stdout);
+  pid = fork();
+  if (pid == 0) {
+    setpgid(0, pgid);
+    subshell();
+    if (in >= 0) {
+      dup2(in, 0);
+      close(in);
+    }
+    if (out >= 0) {
+      dup2(out, 1);
+      close(out);
+    }
+    if (other >= 0)
+      close(other);
+    dropsubs(cmd);
+    if (!redirect(cmd != NULL ? cmd->redirs : node->redirs, &what)) {
+      PrintPError(what);
+      _exit(1);
+    }
+    if (cmd != NULL)
+      status = RunBuiltInCmd(cmd);
+    else
+      status = runnode(node->type == NODE_GROUP ? node->left : node, FALSE,
+                       TRUE);
+    fflush(stdout);
+    _exit(status);
+  }
+
+  if (pid < 0)
+    PrintPError("fork");
+  else {
+    nforks++;
+    *pidfd = pidfd_open(pid, 0);
+    setpgid(pid, pgid != 0 ? pgid : pid);
+  }
+  return pid;
+} /* spawnshell */
+
+
+/*
+ * subshell
+ *
+ * arguments: none
+ *
+ * returns: none
+ *
+ * Runs in a forked child: forgets the jobs of the parent, gives the
+ * child its own event loop and turns job control off, so that SIGINT
+ * and SIGTSTP act on the subshell and its children, which all stay in
+ * its process group, like any other job. Like a child, it is killed by
+ * SIGPIPE, which ends the builtins in it the way it would end the
+ * commands they stand in for.
+ */
+static void
+subshell()
+{
+  int id;
+
+  EventFork();
+  StageFork();
+  signal(SIGPIPE, SIG_DFL);
+  for (id = maxjobid; id > 0; id--)
+    if (jobtab[id] != NULL)
+      deljob(jobtab[id]);
+  donejobs = NULL;
+  cmdjobs = NULL;
+  nuntracked = 0;
+  fgpid = -1;
+  DisableJobControl();
+} /* subshell */
+
+
+/*
+ * opensub
+ *
+ * arguments:
+ *   commandT *cmd: the expanded command
+ *   procsubT *sub: one of its process substitutions
+ *
+ * returns: char*: the argument naming the pipe, in cmdArena, or NULL
+ *                 if the pipe cannot be made
+ *
+ * Makes the pipe between the command and the list of a process
+ * substitution. The shell keeps both ends close-on-exec, so that no
+ * other child that execs gets them; the forked ones close them.
+ */
+static char*
+opensub(commandT* cmd, procsubT* sub)
+{
+  subpipeT* sp;
+  int fds[2];
+  char* path;
+
+  // the list is a process of its own
+  SnapshotTaint();
+  if (pipe2(fds, O_CLOEXEC) < 0) {
+    PrintPError("pipe");
+    return NULL;
+  }
+  sp = (subpipeT *)ArenaAlloc(&cmdArena, sizeof(subpipeT));
+  sp->cmd = cmd;
+  sp->sub = sub;
+  sp->fd = fds[sub->out ? 1 : 0];
+  sp->other = fds[sub->out ? 0 : 1];
+  sp->next = subpipes;
+  subpipes = sp;
+  path = (char *)ArenaAlloc(&cmdArena, sizeof("/dev/fd/") + 10);
+  sprintf(path, "/dev/fd/%d", sp->fd);
+  return path;
+} /* opensub */
+
+
+/*
+ * startsubs
+ *
+ * arguments:
+ *   commandT *cmd: a command that has been started, or is about to
+ *                  replace the shell or run in it
+ *   pid_t pgid: the process group of its job
+ *   int other: a pipe end of the pipeline the lists must not keep, or -1
+ *
+ * returns: none
+ *
+ * Forks a subshell for the list of each process substitution of cmd,
+ * which runs concurrently with it, in its process group, reading or
+ * writing the other end of the pipe. It closes every other pipe the
+ * shell holds, so that neither end of a pipe is left open anywhere but
+ * in the command and its list, and both see the end of it. The lists
+ * are not part of the job, which does not wait for them, as in bash;
+ * they are reaped through their pidfds whenever they finish. As with
+ * any child, the input the shell read ahead is handed off first, even
+ * when cmd runs in the shell.
+ */
+static void
+startsubs(commandT* cmd, pid_t pgid, int other)
+{
+  subpipeT* sp;
+  pid_t pid;
+  int pidfd, status;
+
+  fflush(stdout);
+  for (sp = subpipes; sp != NULL; sp = sp->next) {
+    if (sp->cmd != cmd)
+      continue;
+    // the list may read stdin, or hand it off itself, which must not
+    // consume what the shell read ahead
+    handoffinput();
+    pid = fork();
+    if (pid == 0) {
+      setpgid(0, pgid);
+      subshell();
+      dup2(sp->other, sp->sub->out ? 0 : 1);
+      dropsubs(NULL);
+      if (other >= 0)
+        close(other);
+      status = runnode(sp->sub->body, FALSE, TRUE);
+      fflush(stdout);
+      _exit(status);
+    }
+    if (pid < 0) {
+      PrintPError("fork");
+      return;
+    }
+    nforks++;
+    setpgid(pid, pgid);
+    // one that cannot be watched stays a zombie until the shell exits
+    if ((pidfd = pidfd_open(pid, 0)) >= 0 &&
+        !EventWatch(pidfd, subexited, (void *)(intptr_t)pidfd))
+      close(pidfd);
+  }
+} /* startsubs */
+
+
+/*
+ * closesubs
+ *
+ * arguments:
+ *   commandT *cmd: an expanded command
+ *
+ * returns: none
+ *
+ * Closes the shell's ends of the pipes of the process substitutions of
+ * cmd, once it and their lists have started or cannot be.
+ */
+static void
+closesubs(commandT* cmd)
+{
+  subpipeT** link = &subpipes;
+  subpipeT* sp;
+
+  while ((sp = *link) != NULL) {
+    if (sp->cmd != cmd) {
+      link = &sp->next;
+      continue;
+    }
+    close(sp->fd);
+    if (sp->other >= 0)
+      close(sp->other);
+    *link = sp->next;
+  }
+} /* closesubs */
+
+
+/*
+ * dropsubs
+ *
+ * arguments:
+ *   commandT *keep: the builtin a forked child runs, or NULL
+ *
+ * returns: none
+ *
+ * Runs in a forked child, which gets all the pipes of process
+ * substitutions the shell holds: closes all of them but the ends the
+ * builtin it runs is given as arguments.
+ */
+static void
+dropsubs(commandT* keep)
+{
+  subpipeT** link = &subpipes;
+  subpipeT* sp;
+
+  while ((sp = *link) != NULL) {
+    close(sp->other);
+    sp->other = -1;
+    if (keep != NULL && sp->cmd == keep) {
+      link = &sp->next;
+      continue;
+    }
+    close(sp->fd);
+    *link = sp->next;
+  }
+} /* dropsubs */
+
+
+/*
+ * subexited
+ *
+ * arguments:
+ *   void *arg: the pidfd of the list of a process substitution
+ *
+ * returns: none
+ *
+ * Reaps the list once its pidfd becomes readable, and closes the pidfd.
+ */
+static void
+subexited(void* arg)
+{
+  int pidfd = (int)(intptr_t)arg;
+  siginfo_t info;
+
+  memset(&info, 0, sizeof(info));
+  if (waitid(P_PIDFD, pidfd, &info, WEXITED | WNOHANG) == 0 &&
+      info.si_pid == 0)
+    return;
+  EventUnwatch(pidfd);
+  close(pidfd);
+} /* subexited */
+
+
+/*
+ * builtinsonly
+ *
+ * arguments:
+ *   nodeT *node: the body of a group
+ *   bool *cd: set if it changes the directory
+ *
+ * returns: bool: whether it can be run in the shell instead
+ *
+ * A subshell is only needed to keep what its body does from the
+ * shell. Variables, aliases and the directory can be put back, so
+ * lists of assignments, alias, unalias and cd, of builtins that touch
+ * nothing of the shell, such as echo and test, and of builtins that
+ * only print, such as hash without arguments, do not need one, and
+ * neither do redirections, which builtins undo anyway. The first word
+ * must not be a $ parameter, which could name anything. Pipelines and
+ * background jobs fork anyway, and the job builtins act on the jobs a
+ * subshell does not have, so they need one.
+ */
+static bool
+builtinsonly(nodeT* node, bool* cd)
+{
+  const builtinT* builtin;
+  commandT* cmd;
+
+  switch (node->type)
+    {
+    case NODE_SEQ:
+    case NODE_AND:
+    case NODE_OR:
+      return builtinsonly(node->left, cd) && builtinsonly(node->right, cd);
+    case NODE_GROUP:
+      return builtinsonly(node->left, cd);
+    case NODE_CMD:
+      cmd = node->cmd;
+      if (cmd->argc == 0)
+        return TRUE;
+      if (cmd->argv[0][0] == '$')
+        return FALSE;
+      if ((builtin = findbuiltin(cmd->argv[0])) == NULL)
+        return isassignment(cmd->argv[0]);
+      if (builtin->opts != NULL && BuiltinOptions(cmd, builtin->opts, NULL) < 0)
+        return FALSE;
+      if (builtin->run == runcd)
+        *cd = TRUE;
+      if (builtin->flags & (BUILTIN_UNDO | BUILTIN_PURE))
+        return TRUE;
+      return (builtin->flags & BUILTIN_PRINTS) && cmd->argc == 1;
+    default:
+      return FALSE;
+    }
+} /* builtinsonly */
+
+
+/*
+ * rungroup
+ *
+ * arguments:
+ *   nodeT *node: the body of a group
+ *   bool tail: whether the shell exits once it is done
+ *   bool cd: whether it changes the directory
+ *
+ * returns: int: its exit status, or -1 if the directory could not be
+ *               kept and it needs a subshell after all
+ *
+ * Runs the body of a group in the shell instead of a subshell. At the
+ * tail of the shell there is nothing left that it could affect, so it
+ * just runs, and its own last command may replace the shell. Otherwise
+ * the variables and aliases it changes are remembered and put back,
+ * as is the directory.
+ */
+static int
+rungroup(nodeT* node, bool tail, bool cd)
+{
+  undoL* mark = undolog;
+  int dir = -1;
+  int status;
+
+  if (tail) {
+    nforkssaved++;
+    return runnode(node, FALSE, TRUE);
+  }
+  if (cd && (dir = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+    return -1;
+  nforkssaved++;
+  ingroup++;
+  status = runnode(node, FALSE, FALSE);
+  ingroup--;
+  undo(mark);
+  if (dir >= 0) {
+    if (fchdir(dir) < 0)
+      PrintPError("cd");
+    close(dir);
+  }
+  return status;
+} /* rungroup */
+
+
+/*
+ * DisableJobControl
+ *
+ * arguments: none
+ *
+ * returns: none
+ *
+ * SIGINT and SIGTSTP are unblocked again, so that they act on the
+ * shell and its children, which all stay in the shell's process group.
+ * Stopped children are not tracked anymore then, as the shell stops
+ * along with them.
+ */
+void
+DisableJobControl()
+{
+  sigset_t mask;
+
+  jobControl = FALSE;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGINT);
+  sigaddset(&mask, SIGTSTP);
+  sigprocmask(SIG_UNBLOCK, &mask, NULL);
+} /* DisableJobControl */
+
+
+/*
+ * findbuiltin
+ *
+ * arguments:
+ *   const char *name: a command name
+ *
+ * returns: const builtinT*: the builtin of that name, or NULL
+ *
+ * The name is hashed into its slot the same way the table was laid
+ * out, so finding a builtin, or telling that there is none, takes a
+ * single comparison and no allocation. Only then are the builtins of
+ * plugins looked at, of which there are none unless enable -f loaded
+ * some.
+ */
+static const builtinT*
+findbuiltin(const char* name)
+{
+  size_t len = strlen(name);
+  const builtinT* builtin;
+  pluginL* plugin;
+
+  if (len == 0)
+    return NULL;
+  builtin = &builtintab[BUILTINSLOT(len, (unsigned char)name[0],
+                                    (unsigned char)name[len - 1])];
+  if (builtin->name != NULL && strcmp(builtin->name, name) == 0)
+    return builtin;
+  for (plugin = plugins; plugin != NULL; plugin = plugin->next)
+    if (strcmp(plugin->builtin.name, name) == 0)
+      return &plugin->builtin;
+  return NULL;
+} /* findbuiltin */
+
+
+/*
+ * runcd
+ *
+ * arguments:
+ *   commandT *cmd: the cd command
+ *
+ * returns: int: 1 if the directory could not be changed, 0 otherwise
+ *
+ * Changes to the directory given, or to HOME without one.
+ */
+static int
+runcd(commandT* cmd)
+{
+  if (cmd->argc > 1)
+    return (chdir(cmd->argv[1]) < 0);
+  return (chdir(getenv("HOME")) < 0);
+} /* runcd */
+
+
+/*
+ * runexit
+ *
+ * arguments:
+ *   commandT *cmd: the exit command
+ *
+ * returns: int: the status given, or that of the last command
+ *
+ * Makes the shell exit once the command is done, with the status given
+ * or else that of the last command, as in bash. A status that is not a
+ * number is an error, but the shell still exits. In a subshell, only
+ * the subshell exits.
+ */
+static int
+runexit(commandT* cmd)
+{
+  char* end;
+  long n;
+
+  forceExit = TRUE;
+  if (cmd->argc < 2)
+    return laststatus;
+  n = strtol(cmd->argv[1], &end, 10);
+  if (end == cmd->argv[1] || *end != '\0')
+    {
+      printf("%s: exit: %s: numeric argument required\n", SHELLNAME,
+             cmd->argv[1]);
+      return 2;
+    }
+  return n & 0xff;
+} /* runexit */
+
+
+/*
+ * runjobs, runfg, runbg, runparsecache, runforks, runalias, rununalias
+ *
+ * arguments:
+ *   commandT *cmd: the command
+ *
+ * returns: int: 0
+ *
+ * Hand the builtins over to the functions that carry them out.
+ */
+static int
+runjobs(commandT* cmd)
+{
+  showjobs();
+  return 0;
+} /* runjobs */
+
+static int
+runfg(commandT* cmd)
+{
+  foregroundjob(cmd->argc > 1 ? atoi(cmd->argv[1]) : 0);
+  return 0;
+} /* runfg */
+
+static int
+runbg(commandT* cmd)
+{
+  dobg(cmd->argc > 1 ? atoi(cmd->argv[1]) : 0);
+  return 0;
+} /* runbg */
+
+static int
+runparsecache(commandT* cmd)
+{
+  if (cmd->argc > 1 && strcmp(cmd->argv[1], "-r") == 0)
+    ParseCacheInvalidate();
+  else
+    ParseCachePrint();
+  return 0;
+} /* runparsecache */
+
+static int
+runforks(commandT* cmd)
+{
+  printf("forks: %d started, %d saved\n", nforks, nforkssaved);
+  return 0;
+} /* runforks */
+
+static int
+runalias(commandT* cmd)
+{
+  RunAliasCmd(cmd, FALSE);
+  return 0;
+} /* runalias */
+
+static int
+rununalias(commandT* cmd)
+{
+  RunAliasCmd(cmd, TRUE);
+  return 0;
+} /* rununalias */
+
+
+/*
+ * isassignment
+ *
+ * arguments:
+ *   char *word: the first word of a command
+ *
+ * returns: bool: TRUE if the word is of the form NAME=VALUE
+ *
+ * Like splitting the word with strtok at '=', which RunBuiltInCmd
+ * does to carry out the assignment, gives exactly two parts, so runs
+ * of '=' count as one.
+ */
+static bool
+isassignment(char* word)
+{
+  int parts = 0;
+
+  for (; *word != '\0'; word++)
+    if (*word != '=' && (word[1] == '=' || word[1] == '\0'))
+      parts++;
+  return parts == 2;
+} /* isassignment */
+
+
+/*
+ * isbuiltincmd
+ *
+ * arguments:
+ *   commandT *cmd: a command
+ *
+ * returns: bool: TRUE if the command runs inside the shell
+ *
+ * A command that consists of redirections only does nothing, like a
+ * builtin. A builtin that stands in for a tool is only used with the
+ * options it knows.
+ */
+static bool
+isbuiltincmd(commandT* cmd)
+{
+  const builtinT* builtin;
+
+  if (cmd->argc == 0)
+    return TRUE;
+  if ((builtin = findbuiltin(cmd->argv[0])) == NULL)
+    return isassignment(cmd->argv[0]);
+  return builtin->opts == NULL || BuiltinOptions(cmd, builtin->opts, NULL) >= 0;
+} /* isbuiltincmd */
+
+
+/*
+ * RunBuiltInCmd
+ *
+ * arguments:
+ *   commandT *cmd: the command to be run
+ *
+ * returns: int: its exit status
+ *
+ * Runs a built-in command through the table; anything else that is a
+ * builtin is an assignment. A builtin of a plugin writes to stdout
+ * itself, so what the shell buffered goes out first.
+ */
+static int
+RunBuiltInCmd(commandT* cmd)
+{
+  const builtinT* builtin;
+  char *cmdtoks;
+  char *envvar;
+
+  if (cmd->argc == 0)
+    return 0;
+  builtin = findbuiltin(cmd->argv[0]);
+  // only variables, aliases and remembered commands are saved
+  if (builtin != NULL &&
+      ((builtin->flags & BUILTIN_SAVED) == 0 || cmd->argc == 1))
+    SnapshotTaint();
+  if (builtin != NULL && (builtin->flags & BUILTIN_INPUT))
+    handoffinput();
+  if (builtin != NULL && builtin->plugin != NULL) {
+    fflush(stdout);
+    return builtin->plugin->run(cmd, STDIN_FILENO, STDOUT_FILENO);
+  }
+  if (builtin != NULL)
+    return builtin->run(cmd);
+
+  // do environment update if it has the right form
+  cmdtoks = ArenaStrdup(&cmdArena, cmd->argv[0]);
+  envvar = strtok(cmdtoks, "=");
+  if (envvar != NULL && strcmp(envvar,cmd->argv[0]))
+    SetVar(envvar, strtok(NULL, "="));
+  return 0;
+} /* RunBuiltInCmd */
+
+void
+RunAliasCmd(commandT* cmd, bool unalias)
+{
+  aliasL *curAlias;
+  char* cmdtoks;
+  char* name;
+  
+  // parsed lines are cached under their text, whatever the aliases
+  if (unalias || cmd->argc > 1)
+    ParseCacheInvalidate();
+  if (unalias) {
+    if (delalias(cmd->argv[1]))
+      return;
+    SnapshotTaint();
+    printf("/bin/bash: line %d: unalias: %s: not found\n",3,cmd->argv[1]);
+    return;
+  }
+  else if (cmd->argc > 1) {
+    cmdtoks = ArenaStrdup(&cmdArena, cmd->argv[1]);
+    name = strtok(cmdtoks,"=");
+    setalias(name, strtok(NULL,"="));
+  }
+  else {  // print out list of aliases
+    for (curAlias = aliasLst; curAlias != NULL; curAlias = curAlias->next) {
+      printf("alias %s='%s'\n",curAlias->name,curAlias->value);
+    }
+  }
+} /* RunAliasCmd */
+
+/*
+ * setalias
+ *
+ * arguments:
+ *   char *name: the name of the alias
+ *   char *value: what it stands for
+ *
+ * returns: none
+ *
+ * Defines an alias, or redefines it if it exists.
+ */
+static void
+setalias(char* name, char* value)
+{
+  aliasL *curAlias, *prevAlias, *newAlias;
+
+  // aliases outlive the command and the snapshot, so they are copied
+  newAlias = (aliasL *)malloc(sizeof(aliasL));
+  newAlias->name = strdup(name);
+  newAlias->value = strdup(value);
+  newAlias->next = NULL;
+  
+  // check if the alias exists already; aliasLst is sorted alphabetically
+  curAlias = aliasLst;
+  prevAlias = NULL;
+  while (curAlias) {
+    if (strcmp(newAlias->name,curAlias->name) == 0) {
+      remember(TRUE, name, curAlias->value);
+      if (prevAlias) {
+        prevAlias->next = newAlias;
+      } else {
+        aliasLst = newAlias;
+      }
+        newAlias->next = curAlias->next;
+      free(curAlias->name);
+      free(curAlias->value);
+      free(curAlias);
+      return;
+    }
+    // alias doesn't exist yet, so insert it at the correct position
+    else if (strcmp(newAlias->name,curAlias->name) < 0) {
+      remember(TRUE, name, NULL);
+      if (prevAlias) {
+        prevAlias->next = newAlias;
+      } else {
+        aliasLst = newAlias;
+      }
+      newAlias->next = curAlias;
+      return;
+    }
+      prevAlias = curAlias;
+      curAlias = curAlias->next;
+  }
+  // if alias doesn't exist yet, insert it in the list in alphabetical order
+  remember(TRUE, name, NULL);
+  if (prevAlias) {
+    prevAlias->next = newAlias;
+  } else {
+    aliasLst = newAlias;
+  }
+} /* setalias */
+
+/*
+ * delalias
+ *
+ * arguments:
+ *   char *name: the name of the alias
+ *
+ * returns: bool: FALSE if there is no such alias
+ */
+static bool
+delalias(char* name)
+{
+  aliasL *curAlias, *prevAlias = NULL;
+
+  for (curAlias = aliasLst; curAlias != NULL; curAlias = curAlias->next) {
+    if (strcmp(name,curAlias->name) == 0) {
+      remember(TRUE, name, curAlias->value);
+      if (prevAlias) {
+        prevAlias->next = curAlias->next;
+      } else {
+        aliasLst = curAlias->next;
+      }
+      free(curAlias->name);
+      free(curAlias->value);
+      free(curAlias);
+      return TRUE;
+    }
+    prevAlias = curAlias;
+  }
+  return FALSE;
+} /* delalias */
+
+/*
+ * SaveAliases
+ *
+ * arguments:
+ *   FILE *out: the snapshot being written
+ *
+ * returns: none
+ *
+ * Writes the number of aliases and their names and values, in order.
+ */
+void
+SaveAliases(FILE* out)
+{
+  aliasL* curAlias;
+  int64_t n = 0;
+
+  for (curAlias = aliasLst; curAlias != NULL; curAlias = curAlias->next)
+    n++;
+  SnapshotPutInt(out, n);
+  for (curAlias = aliasLst; curAlias != NULL; curAlias = curAlias->next) {
+    SnapshotPutString(out, curAlias->name);
+    SnapshotPutString(out, curAlias->value);
+  }
+} /* SaveAliases */
+
+/*
+ * RestoreAliases
+ *
+ * arguments:
+ *   snapshotT *snap: the snapshot being read
+ *
+ * returns: bool: FALSE if the snapshot is cut short
+ *
+ * The aliases come in order, so each one is appended to the list
+ * instead of being searched for, unless it has to go elsewhere.
+ */
+bool
+RestoreAliases(snapshotT* snap)
+{
+  aliasL *tail, *newAlias;
+  char *name, *value;
+  int64_t n, i;
+
+  if (!SnapshotGetInt(snap, &n))
+    return FALSE;
+  for (tail = aliasLst; tail != NULL && tail->next != NULL; tail = tail->next)
+    ;
+  for (i = 0; i < n; i++) {
+    if ((name = SnapshotGetString(snap)) == NULL ||
+        (value = SnapshotGetString(snap)) == NULL)
+      return FALSE;
+    if (tail != NULL && strcmp(tail->name, name) >= 0) {
+      setalias(name, value);
+      continue;
+    }
+    newAlias = (aliasL *)malloc(sizeof(aliasL));
+    newAlias->name = strdup(name);
+    newAlias->value = strdup(value);
+    newAlias->next = NULL;
+    if (tail != NULL)
+      tail->next = newAlias;
+    else
+      aliasLst = newAlias;
+    tail = newAlias;
+  }
+  return TRUE;
+} /* RestoreAliases */
+
+/*
+ * SetVar
+ *
+ * arguments:
+ *   char *name: the variable
+ *   char *value: its new value, or NULL to unset it
+ *
+ * returns: none
+ */
+void
+SetVar(char* name, char* value)
+{
+  remember(FALSE, name, getenv(name));
+  if (value != NULL)
+    setenv(name, value, TRUE);
+  else
+    unsetenv(name);
+  SnapshotNoteVar(name);
+  // a new PATH makes all remembered locations stale
+  if (strcmp(name, "PATH") == 0)
+    PathCacheInvalidate();
+  // ~/ is replaced with HOME while parsing
+  if (strcmp(name, "HOME") == 0)
+    ParseCacheInvalidate();
+} /* SetVar */
+
+/*
+ * remember
+ *
+ * arguments:
+ *   bool alias: whether an alias is changed, rather than a variable
+ *   char *name: its name
+ *   char *value: its value before the change, or NULL if it is not set
+ *
+ * returns: none
+ *
+ * Only does anything while a group is run in the shell.
+ */
+static void
+remember(bool alias, char* name, char* value)
+{
+  undoL* entry;
+
+  if (ingroup == 0)
+    return;
+  entry = (undoL *)malloc(sizeof(undoL));
+  entry->alias = alias;
+  entry->name = strdup(name);
+  entry->value = (value != NULL ? strdup(value) : NULL);
+  entry->next = undolog;
+  undolog = entry;
+} /* remember */
+
+/*
+ * undo
+ *
+ * arguments:
+ *   undoL *mark: where the undo log stood when the group started
+ *
+ * returns: none
+ *
+ * Puts back the variables and aliases that were changed since, latest
+ * first, so that each ends up as it was at the mark. Nothing is
+ * remembered while undoing, not even for an outer group, which the
+ * changes only take back to where it left off.
+ */
+static void
+undo(undoL* mark)
+{
+  undoL* entry;
+  int saved = ingroup;
+
+  ingroup = 0;
+  while (undolog != mark) {
+    entry = undolog;
+    undolog = entry->next;
+    if (!entry->alias)
+      SetVar(entry->name, entry->value);
+    else {
+      ParseCacheInvalidate();
+      if (entry->value != NULL)
+        setalias(entry->name, entry->value);
+      else
+        delalias(entry->name);
+    }
+    free(entry->name);
+    free(entry->value);
+    free(entry);
+  }
+  ingroup = saved;
+} /* undo */
+
+/*
+ * RunHashCmd
+ *
+ * arguments:
+ *   commandT *cmd: the hash command
+ *
+ * returns: int: 1 if a name was not found, 0 otherwise
+ *
+ * Lists the path cache without arguments, clears it for -r, and
+ * enters every other argument into it.
+ */
+static int
+RunHashCmd(commandT* cmd)
+{
+  int i, status = 0;
+
+  if (cmd->argc == 1) {
+    PathCachePrint();
+    return 0;
+  }
+  for (i = 1; i < cmd->argc; i++) {
+    if (strcmp(cmd->argv[i], "-r") == 0)
+      PathCacheClear();
+    // names with a '/' are never looked up in the PATH
+    else if (strchr(cmd->argv[i], '/') == NULL && !PathCacheAdd(cmd->argv[i])) {
+      SnapshotTaint();
+      printf("%s: hash: %s: not found\n", SHELLNAME, cmd->argv[i]);
+      status = 1;
+    }
+  }
+  fflush(stdout);
+  return status;
+} /* RunHashCmd */
+
+/*
+ * RunWaitCmd
+ *
+ * arguments:
+ *   commandT *cmd: the wait command
+ *
+ * returns: int: the exit status of the job that finished for -n, or
+ *               of the job the last argument names, 127 if there is
+ *               no such job, 0 without arguments, 130 if interrupted
+ *
+ * Waits until the given jobs, or all running ones, have finished.
+ * Jobs are given as %jobid or by the pid of one of their processes.
+ * With -n, waits until one of them has finished instead. The jobs
+ * waited for are not reported as done later. SIGINT ends the wait.
+ */
+static int
+RunWaitCmd(commandT* cmd)
+{
+  bool any = FALSE;
+  int i, first = 1, njobs = 0, next = 0;
+  bgjobL** jobs;
+  bgjobL* job = NULL;
+
+  if (cmd->argc > 1 && strcmp(cmd->argv[1], "-n") == 0) {
+    any = TRUE;
+    first = 2;
+  }
+  // jobs are only freed while the shell reads a command line, so the
+  // pointers stay valid for the whole wait
+  jobs = (bgjobL **)ArenaAlloc(&cmdArena, sizeof(bgjobL*) * (maxjobid + cmd->argc));
+  if (first == cmd->argc) {
+    for (i = 1; i <= maxjobid; i++)
+      if (jobtab[i] != NULL &&
+          (jobtab[i]->state == RUNNING || jobtab[i]->state == DONE))
+        jobs[njobs++] = jobtab[i];
+  }
+  for (i = first; i < cmd->argc; i++) {
+    if ((job = jobarg(cmd->argv[i])) != NULL)
+      jobs[njobs++] = job;
+  }
+
+  interrupted = FALSE;
+  // every process of a job has its pidfd in the epoll set, so each
+  // one that finishes wakes us up
+  while (!waitdone(jobs, njobs, any, &next) && !interrupted)
+    EventWait(0);
+  fflush(stdout);
+  if (interrupted)
+    return 128 + SIGINT;
+  if (any)
+    return (next < njobs ? jobstatus(jobs[next]) : 127);
+  if (first < cmd->argc)
+    return (job != NULL ? jobstatus(job) : 127);
+  return 0;
+} /* RunWaitCmd */
+
+/*
+ * waitdone
+ *
+ * arguments:
+ *   bgjobL **jobs: the jobs waited for
+ *   int njobs: their number
+ *   bool any: whether one finished job is enough
+ *   int *next: the first job that may still be running; with any,
+ *              set to the job that finished once the wait is over,
+ *              or to njobs if none did
+ *
+ * returns: bool: whether the wait is over
+ *
+ * Finished jobs are marked as collected, so that they are neither
+ * reported as done nor picked up by the next wait -n. Without -n, the
+ * jobs before *next are over and not looked at again, so waiting for
+ * n jobs takes O(n) overall.
+ */
+static bool
+waitdone(bgjobL** jobs, int njobs, bool any, int* next)
+{
+  int i;
+  bool running = FALSE;
+
+  for (i = *next; i < njobs; i++) {
+    if (jobs[i]->state == DONE) {
+      jobs[i]->state = FGDONE;
+      if (any) {
+        *next = i;
+        return TRUE;
+      }
+    } else if (jobs[i]->state == RUNNING) {
+      running = TRUE;
+      if (!any)
+        break;
+    }
+  }
+  if (!any || !running)
+    *next = i;
+  return !running;
+} /* waitdone */
+
+/*
+ * jobarg
+ *
+ * arguments:
+ *   char *arg: %jobid or the pid of a process
+ *
+ * returns: bgjobL*: the job, or NULL if there is none
+ *
+ * Looks up the job a wait argument names, complaining like bash if
+ * there is none.
+ */
+static bgjobL*
+jobarg(char* arg)
+{
+  bgjobL* job = NULL;
+  procT* proc;
+  int id;
+
+  if (arg[0] == '%') {
+    id = atoi(arg + 1);
+    if (id > 0 && id <= maxjobid)
+      job = jobtab[id];
+  } else if ((proc = findproc(atoi(arg))) != NULL)
+    job = proc->job;
+  if (job != NULL && job->state != FGDONE)
+    return job;
+  if (arg[0] == '%')
+    printf("%s: wait: %s: no such job\n", SHELLNAME, arg);
+  else
+    printf("%s: wait: pid %s is not a child of this shell\n", SHELLNAME, arg);
+  return NULL;
+} /* jobarg */
+
+
+/*
+ * RunKillCmd
+ *
+ * arguments:
+ *   commandT *cmd: the kill command
+ *
+ * returns: int: 0 if every process or job could be signaled, 1
+ *               otherwise, 2 if the arguments are malformed
+ *
+ * Sends SIGTERM, or the signal given as -s name, -n number, -name or
+ * -number, to pids and %jobs, or lists signals with -l. A job is
+ * signaled like fg and bg do, through the pidfd of its leader, and so
+ * is a pid of one of the shell's children; continuing a stopped job
+ * puts it in the background.
+ */
+static int
+RunKillCmd(commandT* cmd)
+{
+  int i = 1, signo = SIGTERM, status = 0, id;
+  bgjobL* job;
+  procT* proc;
+  char* end;
+  long pid;
+
+  if (cmd->argc > 1 && strcmp(cmd->argv[1], "-l") == 0)
+    return listsignals(cmd);
+  if (i < cmd->argc && strcmp(cmd->argv[i], "--") == 0)
+    i++;
+  else if (i < cmd->argc && cmd->argv[i][0] == '-' &&
+           cmd->argv[i][1] != '\0') {
+    if (strcmp(cmd->argv[i], "-s") == 0 || strcmp(cmd->argv[i], "-n") == 0)
+      i++;
+    if (i == cmd->argc ||
+        (signo = signum(cmd->argv[i] + (cmd->argv[i][0] == '-'))) < 0) {
+      printf("%s: kill: %s: invalid signal specification\n", SHELLNAME,
+             i < cmd->argc ? cmd->argv[i] : "");
+      return 1;
+    }
+    i++;
+  }
+  if (i == cmd->argc) {
+    printf("%s: kill: usage: kill [-s sigspec | -n signum | -sigspec] "
+           "pid | %%job ... or kill -l\n", SHELLNAME);
+    return 2;
+  }
+
+  for (; i < cmd->argc; i++) {
+    if (cmd->argv[i][0] == '%') {
+      id = atoi(cmd->argv[i] + 1);
+      job = (id > 0 && id <= maxjobid ? jobtab[id] : NULL);
+      if (job == NULL || job->state == DONE || job->state == FGDONE) {
+        printf("%s: kill: %s: no such job\n", SHELLNAME, cmd->argv[i]);
+        status = 1;
+        continue;
+      }
+      signaljob(job, signo);
+      if (signo == SIGCONT && job->state == STOPPED)
+        job->state = RUNNING;
+      continue;
+    }
+    pid = strtol(cmd->argv[i], &end, 10);
+    if (*end != '\0' || end == cmd->argv[i]) {
+      printf("%s: kill: %s: arguments must be process or job IDs\n",
+             SHELLNAME, cmd->argv[i]);
+      status = 1;
+      continue;
+    }
+    // a child that is not reaped yet has a pidfd that cannot be reused
+    if (pid > 0 && (proc = findproc(pid)) != NULL && proc->live &&
+        proc->pidfd >= 0) {
+      if (pidfd_send_signal(proc->pidfd, signo, NULL, 0) == 0)
+        continue;
+    } else if (kill(pid, signo) == 0)
+      continue;
+    printf("%s: kill: (%ld) - %s\n", SHELLNAME, pid, strerror(errno));
+    status = 1;
+  }
+  fflush(stdout);
+  return status;
+} /* RunKillCmd */
+
+
+/*
+ * signum
+ *
+ * arguments:
+ *   const char *name: a signal number, or name with or without SIG
+ *
+ * returns: int: the signal, or -1 if there is none of that name
+ *
+ * Names are compared without regard to case, like in bash.
+ */
+static int
+signum(const char* name)
+{
+  char* end;
+  long n;
+  int i;
+
+  if (isdigit((unsigned char)name[0])) {
+    n = strtol(name, &end, 10);
+    return (*end == '\0' && n < NSIG ? (int)n : -1);
+  }
+  if (strncasecmp(name, "SIG", 3) == 0)
+    name += 3;
+  for (i = 1; i < NSIG; i++)
+    if (sigabbrev_np(i) != NULL && strcasecmp(sigabbrev_np(i), name) == 0)
+      return i;
+  return -1;
+} /* signum */
+
+
+/*
+ * listsignals
+ *
+ * arguments:
+ *   commandT *cmd: the kill -l command
+ *
+ * returns: int: 0, or 1 if an argument names no signal
+ *
+ * Lists all signals without arguments. Otherwise prints the name of
+ * every signal given by number and the number of every one given by
+ * name, like bash; a number above 128 is taken as the exit status of
+ * a command the signal ended.
+ */
+static int
+listsignals(commandT* cmd)
+{
+  int i = 2, status = 0, signo;
+  char* end;
+  long n;
+
+  if (i < cmd->argc && strcmp(cmd->argv[i], "--") == 0)
+    i++;
+  if (i == cmd->argc) {
+    for (signo = 1; signo < NSIG; signo++)
+      if (sigabbrev_np(signo) != NULL)
+        printf("%d) SIG%s\n", signo, sigabbrev_np(signo));
+  }
+  for (; i < cmd->argc; i++) {
+    if (isdigit((unsigned char)cmd->argv[i][0])) {
+      n = strtol(cmd->argv[i], &end, 10);
+      if (n > 128)
+        n -= 128;
+      if (*end == '\0' && n > 0 && n < NSIG && sigabbrev_np(n) != NULL) {
+        printf("%s\n", sigabbrev_np(n));
+        continue;
+      }
+    } else if ((signo = signum(cmd->argv[i])) > 0) {
+      printf("%d\n", signo);
+      continue;
+    }
+    printf("%s: kill: %s: invalid signal specification\n", SHELLNAME,
+           cmd->argv[i]);
+    status = 1;
+  }
+  fflush(stdout);
+  return status;
+} /* listsignals */
+
+
+/*
+ * RunSleepCmd
+ *
+ * arguments:
+ *   commandT *cmd: the sleep command
+ *
+ * returns: int: 0, 128 + SIGINT or 128 + SIGTSTP if it was
+ *               interrupted, 1 if an interval is malformed
+ *
+ * Sleeps for the sum of the intervals, which are numbers of seconds,
+ * minutes, hours or days with a suffix s, m, h or d, like GNU sleep.
+ * The shell waits on its timer in the event loop, so that SIGINT ends
+ * the sleep like it would end /bin/sleep, and children that finish in
+ * the meantime are reaped. SIGTSTP cannot stop the shell, so it ends
+ * the sleep as well, rather than keep the shell from reading the next
+ * line until the time is up.
+ */
+static int
+RunSleepCmd(commandT* cmd)
+{
+  struct timespec ts;
+  double secs = 0, n;
+  char* end;
+  int i;
+
+  if (cmd->argc < 2) {
+    printf("%s: sleep: missing operand\n", SHELLNAME);
+    return 1;
+  }
+  for (i = 1; i < cmd->argc; i++) {
+    n = strtod(cmd->argv[i], &end);
+    switch (*end) {
+    case 'd':
+      n *= 24;
+      /* fall through */
+    case 'h':
+      n *= 60;
+      /* fall through */
+    case 'm':
+      n *= 60;
+      /* fall through */
+    case 's':
+      end++;
+    }
+    if (*end != '\0' || end == cmd->argv[i] || !(n >= 0)) {
+      printf("%s: sleep: invalid time interval `%s'\n", SHELLNAME,
+             cmd->argv[i]);
+      return 1;
+    }
+    secs += n;
   }
-} /* Exec */
+  // about three million years is as good as forever
+  if (secs > 1e14)
+    secs = 1e14;
+  ts.tv_sec = (time_t)secs;
+  ts.tv_nsec = (long)((secs - ts.tv_sec) * 1e9);
+
+  interrupted = suspended = FALSE;
+  EventTimer(&ts);
+  while (!(EventWait(EVENT_TIMER) & EVENT_TIMER))
+    if (interrupted || suspended) {
+      EventTimer(NULL);
+      return 128 + (interrupted ? SIGINT : SIGTSTP);
+    }
+  return 0;
+} /* RunSleepCmd */
 
 
 /*
- * IsBuiltIn
+ * RunEnableCmd
  *
  * arguments:
- *   char *cmd: a command string (e.g. the first token of the command line)
+ *   commandT *cmd: the enable command
  *
- * returns: bool: TRUE if the command string corresponds to a built-in
- *                command, else FALSE.
+ * returns: int: 0 if every name could be loaded or removed, 1
+ *               otherwise, 2 if the arguments are malformed
  *
- * Checks whether the given string corresponds to a supported built-in
- * command.
+ * Lists the builtins without arguments, loads the builtins named from
+ * a plugin with -f file, and removes builtins that were loaded with
+ * -d. A builtin that is loaded holds its own reference to the plugin,
+ * so the plugin is unloaded once its last builtin is removed.
  */
-static bool
-IsBuiltIn(char* cmd)
+static int
+RunEnableCmd(commandT* cmd)
 {
-  char *cmdtoks;
-  if (strcmp(cmd, "cd") == 0)
-    return TRUE;
-  if (strcmp(cmd, "jobs") == 0)
-    return TRUE;
-  if (strcmp(cmd, "fg") == 0)
-    return TRUE;
-  if (strcmp(cmd, "bg") == 0)
-    return TRUE;
-  cmdtoks = (char *)malloc(sizeof(char) * (1 + strlen(cmd)));
-  strcpy(cmdtoks, cmd);
-  if (strtok(cmdtoks, "=") != NULL &&
-      strtok(NULL, "=") != NULL &&
-      strtok(NULL, "=") == NULL) {
-    free(cmdtoks);
-    return TRUE;
+  pluginL** prev;
+  pluginL* plugin;
+  int i, status = 0;
+
+  if (cmd->argc == 1) {
+    for (i = 0; i < NBUILTINSLOTS; i++)
+      if (builtintab[i].name != NULL)
+        printf("enable %s\n", builtintab[i].name);
+    for (plugin = plugins; plugin != NULL; plugin = plugin->next)
+      printf("enable %s\n", plugin->builtin.name);
+    fflush(stdout);
+    return 0;
   }
-  free(cmdtoks);
-  if ((strcmp(cmd,"alias") == 0) || (strcmp(cmd,"unalias") == 0)) {
-    return TRUE;
+  if (strcmp(cmd->argv[1], "-f") == 0 && cmd->argc > 3)
+    return loadplugin(cmd->argv[2], cmd->argv + 3, cmd->argc - 3);
+  if (strcmp(cmd->argv[1], "-d") != 0 || cmd->argc == 2) {
+    printf("%s: enable: usage: enable [-f filename name ...] "
+           "[-d name ...]\n", SHELLNAME);
+    return 2;
   }
-  return FALSE;
-} /* IsBuiltIn */
+
+  for (i = 2; i < cmd->argc; i++) {
+    for (prev = &plugins; *prev != NULL; prev = &(*prev)->next)
+      if (strcmp((*prev)->builtin.name, cmd->argv[i]) == 0)
+        break;
+    if ((plugin = *prev) == NULL) {
+      printf("%s: enable: %s: not dynamically loaded\n", SHELLNAME,
+             cmd->argv[i]);
+      status = 1;
+      continue;
+    }
+    *prev = plugin->next;
+    dlclose(plugin->handle);
+    free(plugin);
+  }
+  fflush(stdout);
+  return status;
+} /* RunEnableCmd */
 
 
 /*
- * RunBuiltInCmd
+ * loadplugin
  *
  * arguments:
- *   commandT *cmd: the command to be run
+ *   const char *file: the shared object, found like dlopen finds it
+ *   char **names: the builtins to load from it
+ *   int n: how many there are
  *
- * returns: none
+ * returns: int: 0 if all of them were loaded, 1 otherwise
  *
- * Runs a built-in command.
+ * The plugin has to export a tshpluginT of the version the shell was
+ * built with. A name that is already a builtin is refused, so that a
+ * plugin cannot change what the shell's own builtins do.
  */
-static void
-RunBuiltInCmd(commandT* cmd)
+static int
+loadplugin(const char* file, char** names, int n)
 {
-  char *cmdtoks = (char *)malloc(sizeof(char) * (1 + strlen(cmd->argv[0])));
-  strcpy(cmdtoks, cmd->argv[0]);
-  char *envvar;
-  // cd command - defaults to homedir
-  if (strcmp(cmd->argv[0], "cd") == 0) {
-      if (cmd->argc > 1)
-	chdir(cmd->argv[1]);
-      else
-	chdir(getenv("HOME"));
-  }
-  // jobs command
-  if (strcmp(cmd->argv[0], "jobs") == 0)
-    showjobs();
-  if (strcmp(cmd->argv[0], "fg") == 0)
-    foregroundjob(atoi(cmd->argv[1]));
-  if (strcmp(cmd->argv[0], "bg") == 0)
-    dobg(atoi(cmd->argv[1]));
+  const tshpluginT* desc;
+  const tshbuiltinT* entry;
+  pluginL* plugin;
+  pluginL** last;
+  void* handle;
+  int i, status = 0;
 
-  // do environment update if it has the right form
-  envvar = strtok(cmdtoks, "=");
-  if (envvar != NULL && strcmp(envvar,cmd->argv[0])) {
-    setenv(envvar, strtok(NULL, "="), TRUE);
-  }
-  if (strcmp(cmd->argv[0], "alias") == 0) {
-    RunAliasCmd(cmd,FALSE);
+  if ((handle = dlopen(file, RTLD_NOW | RTLD_LOCAL)) == NULL) {
+    printf("%s: enable: cannot open shared object %s: %s\n", SHELLNAME,
+           file, dlerror());
+    return 1;
   }
-  if (strcmp(cmd->argv[0],"unalias") == 0) {
-    RunAliasCmd(cmd,TRUE);
+  desc = (const tshpluginT *)dlsym(handle, TSH_PLUGIN_SYMBOL);
+  if (desc == NULL || desc->version != TSH_PLUGIN_VERSION) {
+    if (desc == NULL)
+      printf("%s: enable: %s: not a %s plugin\n", SHELLNAME, file,
+             SHELLNAME);
+    else
+      printf("%s: enable: %s: plugin version %d, %s needs %d\n",
+             SHELLNAME, file, desc->version, SHELLNAME, TSH_PLUGIN_VERSION);
+    dlclose(handle);
+    return 1;
   }
-  free(cmdtoks);
-} /* RunBuiltInCmd */
 
-void
-RunAliasCmd(commandT* cmd, bool unalias)
-{
-  aliasL *curAlias, *prevAlias, *newAlias;
-  char* cmdtoks;
-  
-  if (unalias) {
-    prevAlias = NULL;
-    for (curAlias = aliasLst; curAlias != NULL; curAlias = curAlias->next) {
-      if (strcmp(cmd->argv[1],curAlias->name) == 0) {
-        if (prevAlias) {
-          prevAlias->next = curAlias->next;
-        } else {
-          aliasLst = curAlias->next;
-        }
-        free(curAlias);
-        return;
-      }
-      prevAlias = curAlias;
-    }
-    printf("/bin/bash: line %d: unalias: %s: not found\n",3,cmd->argv[1]);
-    return;
-  }
-  else if (cmd->argc > 1) {
-    cmdtoks = (char *)malloc(sizeof(char) * (1 + strlen(cmd->argv[1])));
-    strcpy(cmdtoks, cmd->argv[1]);
-    
-    newAlias = (aliasL *)malloc(sizeof(aliasL));
-    newAlias->name = (char*)malloc(sizeof(char) * 80);
-    newAlias->value = (char*)malloc(sizeof(char) * 80);
-    strcpy(newAlias->name,strtok(cmdtoks,"="));
-    strcpy(newAlias->value,strtok(NULL,"="));
-    newAlias->next = NULL;
-    free(cmdtoks);
-    
-    // check if the alias exists already; aliasLst is sorted alphabetically
-    curAlias = aliasLst;
-    prevAlias = NULL;
-    while (curAlias) {
-      if (strcmp(newAlias->name,curAlias->name) == 0) {
-        if (prevAlias) {
-          prevAlias->next = newAlias;
-        } else {
-          aliasLst = newAlias;
-        }
-          newAlias->next = curAlias->next;
-        free(curAlias->name);
-        free(curAlias->value);
-        free(curAlias);
-        return;
-      }
-      // alias doesn't exist yet, so insert it at the correct position
-      else if (strcmp(newAlias->name,curAlias->name) < 0) {
-        if (prevAlias) {
-          prevAlias->next = newAlias;
-        } else {
-          aliasLst = newAlias;
-        }
-        newAlias->next = curAlias;
-        return;
-      }
-        prevAlias = curAlias;
-        curAlias = curAlias->next;
-    }
-    // if alias doesn't exist yet, insert it in the list in alphabetical order
-    if (prevAlias) {
-      prevAlias->next = newAlias;
-    } else {
-      aliasLst = newAlias;
-    }
-  }
-  else {  // print out list of aliases
-    for (curAlias = aliasLst; curAlias != NULL; curAlias = curAlias->next) {
-      printf("alias %s='%s'\n",curAlias->name,curAlias->value);
+  for (i = 0; i < n; i++) {
+    for (entry = desc->builtins; entry->name != NULL; entry++)
+      if (strcmp(entry->name, names[i]) == 0)
+        break;
+    if (entry->name == NULL || entry->run == NULL)
+      printf("%s: enable: %s: not found in %s\n", SHELLNAME, names[i], file);
+    else if (findbuiltin(names[i]) != NULL)
+      printf("%s: enable: %s: already a builtin\n", SHELLNAME, names[i]);
+    else {
+      plugin = (pluginL *)malloc(sizeof(pluginL));
+      plugin->builtin.name = entry->name;
+      plugin->builtin.run = NULL;
+      plugin->builtin.flags =
+        ((entry->flags & TSH_BUILTIN_PURE) ? BUILTIN_PURE : 0) |
+        ((entry->flags & TSH_BUILTIN_PIPE) ? BUILTIN_PIPE : 0) |
+        ((entry->flags & TSH_BUILTIN_INPUT) ? BUILTIN_INPUT : 0);
+      plugin->builtin.opts = entry->opts;
+      plugin->builtin.plugin = entry;
+      // the same object again, which only counts another reference
+      plugin->handle = dlopen(file, RTLD_NOW | RTLD_LOCAL);
+      plugin->next = NULL;
+      for (last = &plugins; *last != NULL; last = &(*last)->next)
+        ;
+      *last = plugin;
+      continue;
     }
+    status = 1;
   }
-} /* RunAliasCmd */
+  dlclose(handle);
+  fflush(stdout);
+  return status;
+} /* loadplugin */
 
 /*
  * CheckJobs
@@ -810,136 +3221,318 @@ RunAliasCmd(commandT* cmd, bool unalias)
  * returns: none
  *
  * Checks the status of running jobs, and delete jobs from the list if necessary.
+ * Only the jobs that finished since the last call are looked at; they
+ * are reported in order of their job ids.
  */
 void
 CheckJobs()
 {
   bgjobL *current;
-  bgjobL *prev;
-  bgjobL *temp;
-  current = bgjobs;
-  prev = NULL;
-  while (current != NULL) {
-    // delete bg and fg jbos that have finished
-    if (current->state == DONE || current->state == FGDONE) {
-      if (prev == NULL) {
-	bgjobs = current->next;
-      } else {
-	prev->next = current->next;
-      }
-      temp = current->next;
-      // if it was a bg job, report it finished
-      if (current->state == DONE) 
-	printf("[%d]   %-24s%s\n", current->jobid, "Done", current->cmdline);
-      fflush(stdout);
-      free(current->cmdline);
-      free(current);
-      current = temp;
-    } else {
-      prev = current;
-      current = current->next;
-    }
+  bgjobL **done;
+  int i, n = 0;
+
+  if (donejobs == NULL)
+    return;
+  for (current = donejobs; current != NULL; current = current->nextdone)
+    n++;
+  if (n > donebufsize) {
+    donebufsize = n > 2 * donebufsize ? n : 2 * donebufsize;
+    free(donebuf);
+    donebuf = (bgjobL **)malloc(sizeof(bgjobL*) * donebufsize);
   }
+  done = donebuf;
+  for (i = 0, current = donejobs; current != NULL; current = current->nextdone)
+    done[i++] = current;
+  donejobs = NULL;
+  qsort(done, n, sizeof(bgjobL*), jobidcmp);
+  for (i = 0; i < n; i++) {
+    // if it was a bg job, report it finished
+    if (done[i]->state == DONE && jobControl)
+      printf("[%d]   %-24s%s\n", done[i]->jobid, "Done", done[i]->cmdline);
+    deljob(done[i]);
+  }
+  fflush(stdout);
 } /* CheckJobs */
 
 /*
- * getpath
+ * jobidcmp
+ *
+ * arguments: two pointers to bgjobL pointers
+ *
+ * returns: int: how the job ids compare, for qsort
+ */
+static int
+jobidcmp(const void* a, const void* b)
+{
+  return (*(bgjobL **)a)->jobid - (*(bgjobL **)b)->jobid;
+}
+
+/*
+ * addbgjob
  *
- * arguments: cmd, the command to exectue (appended to all path elements)
+ * arguments: process group id, its processes and their number,
+ *            the command line of the job and its length, and
+ *            whether it is a fg job
  *
- * returns: an array of path elements with cmd appended
+ * returns: pointer to a bgjobL
  *
- * Returns an array of path strings, with cmd pasted on the end.
+ * adds the job to the job table under the next job id, records
+ * necessary info and watches the pidfds of its processes, so that
+ * they are reaped as they finish. A fg job is allocated from
+ * cmdArena, as it is usually done with the command line.
  */
-char**
-getpath(char* cmd)
+bgjobL *
+addbgjob(pid_t pid, procT* procs, int nprocs, const char* text, int textlen,
+         bool fg)
 {
   int i;
-  char* d; 
-  char* path;
-  char* mypath;
-
-  path = getenv("PATH");
-  // copy it to avoid clobbering path when tokenizing
-  mypath = (char *)malloc(sizeof(char) * (1 + strlen(path)));  
-  strcpy(mypath, path);
-  char** paths = (char**)malloc(sizeof(char *) * 100);
-
-  // tokenize the path by ":" and build an array
-  d = strtok(mypath, ":");
-  i = 0;
-  while (d != NULL && i < 100) {
-    paths[i] = (char *)malloc(sizeof(char) * (2 + strlen(d) + strlen(cmd)));
-    strcpy(paths[i], d);
-    strcat(paths[i], "/");
-    strcat(paths[i], cmd);
-    i++;
-    d = strtok(NULL, ":");
+  bgjobL *newjob = allocjob(nprocs, textlen, fg);
+  // like bash, a new job gets the id after the highest one in use
+  if (++maxjobid >= jobtabsize) {
+    jobtabsize = jobtabsize > 0 ? 2 * jobtabsize : 64;
+    jobtab = (bgjobL **)realloc(jobtab, sizeof(bgjobL*) * jobtabsize);
+  }
+  jobtab[maxjobid] = newjob;
+  newjob->nextdone = NULL;
+  if (fg) {
+    newjob->nextcmd = cmdjobs;
+    cmdjobs = newjob;
+  }
+  // record everying in newjob and return it
+  newjob->pid = pid;
+  for (i = 0; i < nprocs; i++) {
+    newjob->procs[i].pid = procs[i].pid;
+    newjob->procs[i].pidfd = procs[i].pidfd;
+    newjob->procs[i].live = TRUE;
+    newjob->procs[i].status = 0;
+    newjob->procs[i].job = newjob;
+    addproc(&newjob->procs[i]);
+    // without a pidfd, the exit is picked up by ReapUntracked
+    if (procs[i].pidfd < 0 ||
+        !EventWatch(procs[i].pidfd, procexited, &newjob->procs[i])) {
+      if (procs[i].pidfd >= 0)
+        close(procs[i].pidfd);
+      newjob->procs[i].pidfd = -1;
+      nuntracked++;
+    }
   }
-  paths[i] = NULL;
+  newjob->nprocs = nprocs;
+  newjob->nlive = nprocs;
+  newjob->state = RUNNING;
+  newjob->jobid = maxjobid;
+  // the parser leaves out the " &" of a bg job
+  memcpy(newjob->cmdline, text, textlen);
+  newjob->cmdline[textlen] = '\0';
+  return newjob;
+}
 
-  free(mypath);
-  return paths;
+/*
+ * allocjob
+ *
+ * arguments: the number of processes, the length of the command line
+ *            and whether to allocate from cmdArena
+ *
+ * returns: the job, with procs and cmdline pointing to their room
+ */
+static bgjobL*
+allocjob(int nprocs, int textlen, bool inarena)
+{
+  size_t size = sizeof(bgjobL) + sizeof(procT) * nprocs + textlen + 1;
+  bgjobL *job = (bgjobL *)(inarena ? ArenaAlloc(&cmdArena, size) : malloc(size));
+  job->procs = (procT *)(job + 1);
+  job->nprocs = nprocs;
+  job->cmdline = (char *)(job->procs + nprocs);
+  job->inarena = inarena;
+  return job;
 }
 
 /*
- * freepath
+ * releasejobs
  *
- * arguments: path, a string array
+ * arguments: none
  *
  * returns: void
  *
- * frees the strings in path and path
+ * called once a command line is done, before cmdArena is reset. Its fg
+ * jobs that finished are deleted right away instead of by CheckJobs,
+ * which would not report them anyway; those that stopped, or were put
+ * in the bg, are moved to the heap.
  */
-void
-freepath(char** path)
+static void
+releasejobs()
 {
-  int i = 0;
-  while (path[i] != NULL)
-    free(path[i++]);
-  free(path);
+  bgjobL *job, *next, **link;
+  for (job = cmdjobs; job != NULL; job = next) {
+    next = job->nextcmd;
+    if (job->state == FGDONE) {
+      for (link = &donejobs; *link != NULL; link = &(*link)->nextdone) {
+        if (*link == job) {
+          *link = job->nextdone;
+          break;
+        }
+      }
+      deljob(job);
+    } else
+      keepjob(job);
+  }
+  cmdjobs = NULL;
 }
 
 /*
- * addbgjob
+ * keepjob
  *
- * arguments: process id, command struct, boolean
+ * arguments: a job in cmdArena
  *
- * returns: pointer to a bgjobL
+ * returns: void
  *
- * adds the job to the bgjobs list, records necessary info
+ * copy the job to the heap, and point the job table, pidtab, donejobs
+ * and the watches of its pidfds at the copy
  */
-bgjobL *
-addbgjob(pid_t pid, commandT* cmd, bool isbg)
-{
-  bgjobL *lastbgjob = bgjobs;
-  bgjobL *newjob = (bgjobL *)malloc(sizeof(bgjobL));
-  newjob->next = NULL;
-  int maxjobid = 0;
-  // add the job to the beginning of the list
-  // (bg jobs is in descending order of age)
-  if (lastbgjob == NULL) {
-    bgjobs = newjob;
-  } else {
-    maxjobid = lastbgjob->jobid;
-    while (lastbgjob->next != NULL) {
-      if (lastbgjob->jobid > maxjobid)
-	maxjobid = lastbgjob->jobid;
-      lastbgjob = lastbgjob->next;
+static void
+keepjob(bgjobL* job)
+{
+  bgjobL *copy = allocjob(job->nprocs, strlen(job->cmdline), FALSE);
+  procT *proc, **link;
+  bgjobL **done;
+  int i;
+  copy->pid = job->pid;
+  copy->nlive = job->nlive;
+  copy->jobid = job->jobid;
+  copy->state = job->state;
+  copy->nextdone = job->nextdone;
+  strcpy(copy->cmdline, job->cmdline);
+  for (i = 0; i < job->nprocs; i++) {
+    proc = &copy->procs[i];
+    *proc = job->procs[i];
+    proc->job = copy;
+    link = &pidtab[proc->pid & (pidtabsize - 1)];
+    while (*link != &job->procs[i])
+      link = &(*link)->nextpid;
+    *link = proc;
+    // the watch of a live process is handed the old procT
+    if (proc->live && proc->pidfd >= 0) {
+      EventUnwatch(proc->pidfd);
+      if (!EventWatch(proc->pidfd, procexited, proc)) {
+        close(proc->pidfd);
+        proc->pidfd = -1;
+        nuntracked++;
+      }
     }
-    lastbgjob->next = newjob;
   }
-  // record everying in newjob and return it
-  newjob->pid = pid;
-  newjob->state = RUNNING;
-  newjob->jobid = maxjobid + 1;
-  newjob->cmdline = (char *)malloc(sizeof(char) * (1 + strlen(cmd->cmdline)));
-  strcpy(newjob->cmdline, cmd->cmdline);
-  int cmdlinelen = strlen(newjob->cmdline);
-  // drop the " &" if it's a bg jobx
-  if (isbg)
-    newjob->cmdline[cmdlinelen - 2] = '\0';
-  return newjob;
+  jobtab[job->jobid] = copy;
+  for (done = &donejobs; *done != NULL; done = &(*done)->nextdone) {
+    if (*done == job) {
+      *done = copy;
+      break;
+    }
+  }
+}
+
+/*
+ * jobstatus
+ *
+ * arguments: a job that finished or stopped
+ *
+ * returns: the exit status of its last process, like bash
+ */
+static int
+jobstatus(bgjobL* job)
+{
+  if (job->state == STOPPED)
+    return 128 + SIGTSTP;
+  return job->procs[job->nprocs - 1].status;
+}
+
+/*
+ * deljob
+ *
+ * arguments: a finished job
+ *
+ * returns: void
+ *
+ * remove a job from the job table and pidtab, and free it. Once the
+ * highest job id is free, the ids below it that are free as well
+ * become available again.
+ */
+static void
+deljob(bgjobL* job)
+{
+  procT **link;
+  int i;
+  jobtab[job->jobid] = NULL;
+  while (maxjobid > 0 && jobtab[maxjobid] == NULL)
+    maxjobid--;
+  for (i = 0; i < job->nprocs; i++) {
+    link = &pidtab[job->procs[i].pid & (pidtabsize - 1)];
+    while (*link != &job->procs[i])
+      link = &(*link)->nextpid;
+    *link = job->procs[i].nextpid;
+    npids--;
+    if (job->procs[i].pidfd >= 0)
+      close(job->procs[i].pidfd);
+  }
+  if (!job->inarena)
+    free(job);
+}
+
+/*
+ * addproc
+ *
+ * arguments: a process of a new job
+ *
+ * returns: void
+ *
+ * enter a process into pidtab, doubling the table once there are as
+ * many processes as buckets
+ */
+static void
+addproc(procT* proc)
+{
+  procT **newtab, *cur, *next;
+  int i, newsize;
+  if (npids >= pidtabsize) {
+    newsize = pidtabsize > 0 ? 2 * pidtabsize : 64;
+    newtab = (procT **)calloc(newsize, sizeof(procT*));
+    for (i = 0; i < pidtabsize; i++) {
+      for (cur = pidtab[i]; cur != NULL; cur = next) {
+        next = cur->nextpid;
+        cur->nextpid = newtab[cur->pid & (newsize - 1)];
+        newtab[cur->pid & (newsize - 1)] = cur;
+      }
+    }
+    free(pidtab);
+    pidtab = newtab;
+    pidtabsize = newsize;
+  }
+  proc->nextpid = pidtab[proc->pid & (pidtabsize - 1)];
+  pidtab[proc->pid & (pidtabsize - 1)] = proc;
+  npids++;
+}
+
+/*
+ * findproc
+ *
+ * arguments: a process id
+ *
+ * returns: the process with that pid, or NULL
+ *
+ * A finished process whose job is not deleted yet may share its pid
+ * with a newer one; the live process is preferred.
+ */
+static procT*
+findproc(pid_t pid)
+{
+  procT *proc, *found = NULL;
+  if (pidtabsize == 0)
+    return NULL;
+  for (proc = pidtab[pid & (pidtabsize - 1)]; proc != NULL; proc = proc->nextpid) {
+    if (proc->pid != pid)
+      continue;
+    if (proc->live)
+      return proc;
+    found = proc;
+  }
+  return found;
 }
 
 /*
@@ -949,26 +3542,187 @@ addbgjob(pid_t pid, commandT* cmd, bool isbg)
  *
  * returns: void
  *
- * update the state of a job in the bgjobs list
+ * update the state of the job a process belongs to
  */
 void
 updatebgjob(pid_t pid, state_t newstate)
 {
-  bgjobL *current;
-  current = bgjobs;
-  while (current != NULL) {
-    if (current->pid == pid) {
-      // fg jobs are special
-      if (current->state == FG && newstate == DONE) {
-	current->state = FGDONE;
-      } else {
-	current->state = newstate;
+  procT *proc = findproc(pid);
+  if (proc != NULL && proc->live)
+    setprocstate(proc, newstate);
+}
+
+/*
+ * setprocstate
+ *
+ * arguments: a process of a job, its new state
+ *
+ * returns: void
+ *
+ * A job is done once all of its processes are, and stopped as soon as
+ * one of them is. If the foreground job stops or finishes, fgpid is
+ * reset.
+ */
+static void
+setprocstate(procT* proc, state_t newstate)
+{
+  bgjobL *job = proc->job;
+  if (newstate == DONE) {
+    proc->live = FALSE;
+    if (--job->nlive > 0)
+      return;
+  }
+  // fg jobs are special
+  if (job->state == FG && newstate == DONE) {
+    job->state = FGDONE;
+  } else {
+    job->state = newstate;
+  }
+  // leave it for CheckJobs to report and delete
+  if (newstate == DONE) {
+    job->nextdone = donejobs;
+    donejobs = job;
+  }
+  if (job->pid == fgpid)
+    fgpid = -1;
+}
+
+/*
+ * procexited
+ *
+ * arguments: the procT whose pidfd became readable
+ *
+ * returns: void
+ *
+ * reap a finished process of a job through its pidfd. The pidfd is
+ * kept until the job is deleted, as the one of the group leader still
+ * names the process group.
+ */
+static void
+procexited(void* arg)
+{
+  procT *proc = (procT *)arg;
+  siginfo_t info;
+
+  memset(&info, 0, sizeof(info));
+  if (waitid(P_PIDFD, proc->pidfd, &info, WEXITED | WNOHANG) == 0 &&
+      info.si_pid == 0)
+    return;
+  EventUnwatch(proc->pidfd);
+  proc->status = (info.si_code == CLD_EXITED ? info.si_status : 128 + info.si_status);
+  setprocstate(proc, DONE);
+  // report bg jobs that finish while the shell waits for input
+  if (IsReading())
+    CheckJobs();
+}
+
+/*
+ * RaiseFdLimit
+ *
+ * arguments: none
+ *
+ * returns: void
+ *
+ * raise the soft descriptor limit to the hard one
+ */
+void
+RaiseFdLimit()
+{
+  struct rlimit nofile;
+  if (getrlimit(RLIMIT_NOFILE, &childnofile) < 0)
+    return;
+  nofile = childnofile;
+  nofile.rlim_cur = nofile.rlim_max;
+  nofileraised = (setrlimit(RLIMIT_NOFILE, &nofile) == 0);
+}
+
+/*
+ * ReapUntracked
+ *
+ * arguments: none
+ *
+ * returns: void
+ *
+ * reap the finished processes that have no pidfd
+ */
+void
+ReapUntracked()
+{
+  bgjobL *job;
+  int i, id, status;
+  if (nuntracked == 0)
+    return;
+  for (id = 1; id <= maxjobid; id++) {
+    if ((job = jobtab[id]) == NULL)
+      continue;
+    for (i = 0; i < job->nprocs; i++) {
+      if (job->procs[i].pidfd >= 0 || !job->procs[i].live)
+        continue;
+      if (waitpid(job->procs[i].pid, &status, WNOHANG) > 0) {
+        nuntracked--;
+        job->procs[i].status = (WIFEXITED(status) ? WEXITSTATUS(status) :
+                                128 + WTERMSIG(status));
+        setprocstate(&job->procs[i], DONE);
       }
     }
-    current = current->next;
   }
 }
 
+/*
+ * signaljob
+ *
+ * arguments: the job, the signal
+ *
+ * returns: void
+ *
+ * send a signal to the process group of a job. The pidfd of the group
+ * leader names the group even after the leader is reaped, so the
+ * signal cannot hit a group that reused the pgid. Without job control
+ * the job shares the shell's group, and each process is signaled.
+ */
+static void
+signaljob(bgjobL* job, int signo)
+{
+  int i;
+  if (job == NULL)
+    return;
+  if (!jobControl) {
+    for (i = 0; i < job->nprocs; i++) {
+      if (!job->procs[i].live)
+        continue;
+      if (job->procs[i].pidfd < 0 ||
+          pidfd_send_signal(job->procs[i].pidfd, signo, NULL, 0) < 0)
+        kill(job->procs[i].pid, signo);
+    }
+    return;
+  }
+  if (job->procs[0].pidfd >= 0) {
+    if (pidfd_send_signal(job->procs[0].pidfd, signo, NULL,
+                          PIDFD_SIGNAL_PROCESS_GROUP) == 0 || errno == ESRCH)
+      return;
+  }
+  // kernels before 6.9 cannot signal a group through a pidfd; while a
+  // process of the job is unreaped, its pgid cannot be reused either
+  if (job->nlive > 0)
+    kill(-job->pid, signo);
+}
+
+/*
+ * findjob
+ *
+ * arguments: a process group id
+ *
+ * returns: the job of that process group, or NULL
+ */
+static bgjobL*
+findjob(pid_t pgid)
+{
+  procT *proc = findproc(pgid);
+  if (proc != NULL && proc->job->pid == pgid)
+    return proc->job;
+  return NULL;
+}
+
 /*
  * showjobs
  *
@@ -981,9 +3735,11 @@ updatebgjob(pid_t pid, state_t newstate)
 static void
 showjobs()
 {
-  bgjobL *job = bgjobs;
-  while (job != NULL) {
-    if (job->state != FGDONE) {
+  bgjobL *job;
+  int i;
+  for (i = 1; i <= maxjobid; i++) {
+    job = jobtab[i];
+    if (job != NULL && job->state != FGDONE) {
       state_t state = job->state;
       const char* msg =
 	(state == DONE ? "Done" :
@@ -995,7 +3751,6 @@ showjobs()
 	     job->cmdline,
 	     (job->state == RUNNING ? " &" : ""));
     }
-    job = job->next;
   }
   fflush(stdout);
 }
@@ -1012,17 +3767,17 @@ showjobs()
 static void
 foregroundjob(int jobid)
 {
-  bgjobL *job = bgjobs;
-  while (job != NULL) {
-    if (job->jobid == jobid) {
-      // update state, send continue signal, and wait
-      fgpid = job->pid;
-      job->state = FG;
-      kill(-fgpid, SIGCONT);
-      waitforfg(job->pid);
-    }
-    job = job->next;
-  }
+  bgjobL *job;
+  if (jobid <= 0 || jobid > maxjobid || (job = jobtab[jobid]) == NULL)
+    return;
+  // a finished job cannot be continued
+  if (job->state == DONE || job->state == FGDONE)
+    return;
+  // update state, send continue signal, and wait
+  fgpid = job->pid;
+  job->state = FG;
+  signaljob(job, SIGCONT);
+  waitforfg(job->pid);
 }
 
 /*
@@ -1037,21 +3792,30 @@ foregroundjob(int jobid)
 static void
 dobg(int jobid)
 {
-  bgjobL *job = bgjobs;
-  while (job != NULL) {
-    if (job->state == STOPPED && job->jobid == jobid) {
-      kill(job->pid, SIGCONT);
-      job->state = RUNNING;
-    }
-    job = job->next;
+  bgjobL *job;
+  if (jobid <= 0 || jobid > maxjobid || (job = jobtab[jobid]) == NULL)
+    return;
+  if (job->state == STOPPED) {
+    signaljob(job, SIGCONT);
+    job->state = RUNNING;
   }
 }
 
-/* wait for the fg job to finish */
+/*
+ * waitforfg
+ *
+ * arguments: the pgid of the fg job
+ *
+ * returns: void
+ *
+ * wait for the fg job to finish or stop; the SIGCHLD that ends it
+ * wakes up EventWait immediately
+ */
 static void
 waitforfg(pid_t id)
 {
-  while(fgpid ==id) sleep(1);
+  while (fgpid == id)
+    EventWait(0);
 }
 
 /*
@@ -1066,16 +3830,13 @@ waitforfg(pid_t id)
 void
 StopFgProc()
 {
+  // the threads of a pipeline cannot stop, so they end
+  suspended = TRUE;
   if (fgpid == -1)
     return;
-  bgjobL *job = bgjobs;
-  while (job != NULL) {
-    if (job->pid == fgpid)
-      break;
-    job = job->next;
-  }
+  bgjobL *job = findjob(fgpid);
   job->state = STOPPED;
-  kill(-fgpid, SIGTSTP);
+  signaljob(job, SIGTSTP);
   fgpid = -1; 
   printf("[%d]   %-24s%s\n", job->jobid, "Stopped", job->cmdline);
 }
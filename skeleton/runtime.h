@@ -37,8 +37,10 @@
 #endif
 
 /************System include***********************************************/
+#include <stdio.h>
 #include "interpreter.h"
 /************Private include**********************************************/
+#include "snapshot.h"
 
 /************Defines and Typedefs*****************************************/
 /*  #defines and typedefs should have their names in all caps.
@@ -57,10 +59,15 @@
 #endif
 
 typedef enum { RUNNING, DONE, FG, FGDONE, STOPPED } state_t;
-typedef enum { READ, WRITE, READWRITE } pipeop_t;
 /************Global Variables*********************************************/
 
-pid_t fgpid;
+/***********************************************************************
+ *  Title: The foreground process group
+ * ---------------------------------------------------------------------
+ *    Purpose: pid of the current foreground job, -1 if there is none
+ ***********************************************************************/
+VAREXTERN(pid_t fgpid, -1)
+;
 
 /***********************************************************************
  *  Title: Force a program exit
@@ -70,17 +77,96 @@ pid_t fgpid;
 VAREXTERN(bool forceExit, FALSE)
 ;
 
+/***********************************************************************
+ *  Title: Job control
+ * ---------------------------------------------------------------------
+ *    Purpose: Whether every job gets a process group of its own; off
+ *    in subshells, whose children stay in the subshell's group
+ ***********************************************************************/
+VAREXTERN(bool jobControl, TRUE)
+;
+
+/***********************************************************************
+ *  Title: The command arena
+ * ---------------------------------------------------------------------
+ *    Purpose: Holds what the command line being run allocates; it is
+ *    reset once the line is done, so nothing in it may be kept longer
+ ***********************************************************************/
+VAREXTERN(arenaT cmdArena, {0})
+;
+
 /************Function Prototypes******************************************/
 
 /***********************************************************************
- *  Title: Runs a command
+ *  Title: Runs a command line
  * ---------------------------------------------------------------------
- *    Purpose: Runs a command.
- *    Input: a command structure
+ *    Purpose: Runs the lists, pipelines and groups of a parsed line.
+ *    Input: the root of the tree ParseLine built, and the bodies of
+ *    its here-documents or NULL
+ *    Output: the exit status of the line
+ ***********************************************************************/
+EXTERN int
+RunCmd(nodeT*, heredocT*);
+
+/***********************************************************************
+ *  Title: Set the positional parameters
+ * ---------------------------------------------------------------------
+ *    Purpose: Sets what $0, $1, ... and $# expand to; $0 is the script
+ *    or the shell.
+ *    Input: the number of parameters, including $0, and the parameters
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+SetArgs(int, char**);
+
+/***********************************************************************
+ *  Title: Turn off job control
+ * ---------------------------------------------------------------------
+ *    Purpose: Makes jobs run in the shell's own process group, and
+ *    leaves SIGINT and SIGTSTP to act on the shell like on its
+ *    children, as in a script or a subshell. Finished jobs are not
+ *    reported either.
+ *    Input: void
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+DisableJobControl();
+
+/***********************************************************************
+ *  Title: Set a variable
+ * ---------------------------------------------------------------------
+ *    Purpose: Sets an environment variable like an assignment does,
+ *    and drops what the caches derived from its old value.
+ *    Input: the name and the value
  *    Output: void
  ***********************************************************************/
 EXTERN void
-RunCmd(commandT*);
+SetVar(char*, char*);
+
+/***********************************************************************
+ *  Title: Expand the variables of a here-document
+ * ---------------------------------------------------------------------
+ *    Purpose: Replaces $NAME and ${NAME} in the body of a here-document
+ *    whose delimiter is not quoted with their values, and removes the
+ *    backslash before $, `, \ and a newline, as bash does.
+ *    Input: the body and its length, and where to put the new length
+ *    Output: the expanded body, in cmdArena
+ ***********************************************************************/
+EXTERN char*
+ExpandVars(const char*, size_t, size_t*);
+
+/***********************************************************************
+ *  Title: Save and restore the aliases
+ * ---------------------------------------------------------------------
+ *    Purpose: Writes the aliases to a snapshot, and defines the
+ *    aliases read from one.
+ *    Input: the snapshot
+ *    Output: for restoring, FALSE if the snapshot is cut short
+ ***********************************************************************/
+EXTERN void
+SaveAliases(FILE*);
+EXTERN bool
+RestoreAliases(snapshotT*);
 
 /***********************************************************************
  *  Title: Runs a command in background
@@ -93,10 +179,12 @@ EXTERN void
 RunCmdBg(commandT*);
 
 /***********************************************************************
- *  Title: Redirects I/O if necessary
+ *  Title: Extracts I/O redirections
  * ---------------------------------------------------------------------
- *    Purpose: Reads cmd->argv, redirecting I/O if a redirection operator is found,
-               and removes the redirection from cmd->argv.
+ *    Purpose: Reads cmd->argv, appends any <, > and >> operators
+               and their files to cmd->redirs, and removes them from
+               cmd->argv. The files are opened by whoever runs the
+               command.
  *    Input: a commandT structure
  *    Output: void
  ***********************************************************************/
@@ -183,6 +271,30 @@ IntFgProc();
 EXTERN void
 updatebgjob(pid_t, state_t);
 
+/***********************************************************************
+ *  Title: Make room for pidfds
+ * ---------------------------------------------------------------------
+ *    Purpose: Raises the shell's descriptor limit, as every process of
+ *    a job holds a pidfd until the job is reported. Children get the
+ *    original limit back.
+ *    Input: void
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+RaiseFdLimit();
+
+/***********************************************************************
+ *  Title: Reap processes without a pidfd
+ * ---------------------------------------------------------------------
+ *    Purpose: Jobs are normally reaped through the pidfds of their
+ *    processes; this reaps the finished ones no pidfd could be opened
+ *    for.
+ *    Input: void
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+ReapUntracked();
+
 // handles the logic of the alias builtin
 void
 RunAliasCmd(commandT*, bool);
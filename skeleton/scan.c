@@ -0,0 +1,603 @@
+/***************************************************************************
+ *  Title: Line scanner
+ * -------------------------------------------------------------------------
+ *    Purpose: Finds the characters of a command line that mean something
+ *    to the shell
+ *    File: scan.c
+ ***************************************************************************/
+#define __SCAN_IMPL__
+#define _GNU_SOURCE
+
+/************System include***********************************************/
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/************Private include**********************************************/
+#include "scan.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/* GCC can compile AVX2 code into a binary that is built for plain
+ * x86-64, and pick it at run time */
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define HAVE_AVX2
+#endif
+
+/************Global Variables*********************************************/
+
+const unsigned char kScanClass[256] = {
+  [' ']  = SCAN_SPACE,
+  ['\t'] = SCAN_SPACE,
+  ['\n'] = SCAN_SPACE,
+  ['\''] = SCAN_QUOTE,
+  ['"']  = SCAN_QUOTE,
+  ['\\'] = SCAN_ESCAPE,
+  ['|']  = SCAN_PIPE,
+  ['$']  = SCAN_DOLLAR,
+  ['~']  = SCAN_TILDE,
+  ['<']  = SCAN_REDIR,
+  ['>']  = SCAN_REDIR,
+  ['&']  = SCAN_AMP,
+  [';']  = SCAN_SEMI,
+  ['(']  = SCAN_PAREN,
+  [')']  = SCAN_PAREN,
+};
+
+/* the ScanMeta implementation in use, NULL until one is picked */
+static void (*scanimpl)(const char*, size_t, uint64_t*) = NULL;
+/* the ScanCount and ScanFind implementations, picked along with it */
+static size_t (*countimpl)(const char*, size_t, char) = NULL;
+static const char* (*findimpl)(const char*, size_t, const char*, size_t) = NULL;
+
+/************Function Prototypes******************************************/
+/* scans a byte at a time */
+static void
+scanscalar(const char*, size_t, uint64_t*);
+/* scans the characters from the given index on a byte at a time */
+static void
+scantail(const char*, size_t, uint64_t*, size_t);
+/* counts a byte at a time */
+static size_t
+countscalar(const char*, size_t, char);
+/* finds a string with memmem */
+static const char*
+findscalar(const char*, size_t, const char*, size_t);
+#ifdef __SSE2__
+/* scans 16 bytes at a time */
+static void
+scansse2(const char*, size_t, uint64_t*);
+/* counts 16 bytes at a time */
+static size_t
+countsse2(const char*, size_t, char);
+/* tests 16 positions at a time */
+static const char*
+findsse2(const char*, size_t, const char*, size_t);
+#endif
+#ifdef HAVE_AVX2
+/* scans 32 bytes at a time */
+static void
+scanavx2(const char*, size_t, uint64_t*);
+/* counts 32 bytes at a time */
+static size_t
+countavx2(const char*, size_t, char);
+/* tests 32 positions at a time */
+static const char*
+findavx2(const char*, size_t, const char*, size_t);
+#endif
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+
+/*
+ * ScanMeta
+ *
+ * arguments:
+ *   const char *s: the characters to scan
+ *   size_t len: their number
+ *   uint64_t *masks: (len + 63) / 64 words for the result
+ *
+ * returns: none
+ *
+ * Marks the metacharacters of s, with the fastest implementation the
+ * CPU supports unless ScanUse picked another one.
+ */
+void
+ScanMeta(const char* s, size_t len, uint64_t* masks)
+{
+  if (scanimpl == NULL)
+    ScanUse(SCAN_AUTO);
+  scanimpl(s, len, masks);
+} /* ScanMeta */
+
+
+/*
+ * ScanNext
+ *
+ * arguments:
+ *   const uint64_t *masks: the masks ScanMeta filled in
+ *   size_t len: the number of characters scanned
+ *   size_t from: where to start looking
+ *
+ * returns: size_t: the index of the next metacharacter, or len
+ *
+ * Skips over words without metacharacters, and finds the first one in
+ * a word by counting trailing zeros.
+ */
+size_t
+ScanNext(const uint64_t* masks, size_t len, size_t from)
+{
+  size_t w = from / 64;
+  uint64_t word;
+
+  if (from >= len)
+    return len;
+  word = masks[w] & (~(uint64_t)0 << (from % 64));
+  while (word == 0)
+    {
+      if (++w * 64 >= len)
+        return len;
+      word = masks[w];
+    }
+  return w * 64 + __builtin_ctzll(word);
+} /* ScanNext */
+
+
+/*
+ * ScanCount
+ *
+ * arguments:
+ *   const char *s: the characters to search
+ *   size_t len: their number
+ *   char c: the character to count
+ *
+ * returns: size_t: how often c occurs in s
+ */
+size_t
+ScanCount(const char* s, size_t len, char c)
+{
+  if (countimpl == NULL)
+    ScanUse(SCAN_AUTO);
+  return countimpl(s, len, c);
+} /* ScanCount */
+
+
+/*
+ * ScanFind
+ *
+ * arguments:
+ *   const char *s: the characters to search
+ *   size_t len: their number
+ *   const char *str: the string to find
+ *   size_t n: its length
+ *
+ * returns: const char*: the first occurrence of str in s, or NULL
+ *
+ * The empty string occurs at the start.
+ */
+const char*
+ScanFind(const char* s, size_t len, const char* str, size_t n)
+{
+  if (findimpl == NULL)
+    ScanUse(SCAN_AUTO);
+  if (n <= 1 || n > len)
+    return (n == 0 ? s : n > len ? NULL : memchr(s, str[0], len));
+  return findimpl(s, len, str, n);
+} /* ScanFind */
+
+
+/*
+ * ScanUse
+ *
+ * arguments:
+ *   int impl: SCAN_AUTO, SCAN_SCALAR, SCAN_SSE2 or SCAN_AVX2
+ *
+ * returns: bool: whether the implementation could be selected
+ *
+ * Selects the implementations ScanMeta, ScanCount and ScanFind use.
+ */
+bool
+ScanUse(int impl)
+{
+  switch (impl)
+    {
+    case SCAN_AUTO:
+#ifdef HAVE_AVX2
+      if (ScanUse(SCAN_AVX2))
+        return TRUE;
+#endif
+      if (ScanUse(SCAN_SSE2))
+        return TRUE;
+      return ScanUse(SCAN_SCALAR);
+    case SCAN_SCALAR:
+      scanimpl = scanscalar;
+      countimpl = countscalar;
+      findimpl = findscalar;
+      return TRUE;
+#ifdef __SSE2__
+    case SCAN_SSE2:
+      scanimpl = scansse2;
+      countimpl = countsse2;
+      findimpl = findsse2;
+      return TRUE;
+#endif
+#ifdef HAVE_AVX2
+    case SCAN_AVX2:
+      __builtin_cpu_init();
+      if (!__builtin_cpu_supports("avx2"))
+        return FALSE;
+      scanimpl = scanavx2;
+      countimpl = countavx2;
+      findimpl = findavx2;
+      return TRUE;
+#endif
+    }
+  return FALSE;
+} /* ScanUse */
+
+
+/*
+ * scanscalar
+ *
+ * arguments:
+ *   const char *s: the characters to scan
+ *   size_t len: their number
+ *   uint64_t *masks: (len + 63) / 64 words for the result
+ *
+ * returns: none
+ *
+ * Looks every character up in kScanClass.
+ */
+static void
+scanscalar(const char* s, size_t len, uint64_t* masks)
+{
+  scantail(s, len, masks, 0);
+} /* scanscalar */
+
+
+/*
+ * scantail
+ *
+ * arguments:
+ *   const char *s: the characters to scan
+ *   size_t len: their number
+ *   uint64_t *masks: (len + 63) / 64 words for the result
+ *   size_t from: the first character to scan, a multiple of 64
+ *
+ * returns: none
+ *
+ * Fills in the words from from / 64 on a character at a time; the
+ * vectorized scanners use it for the last, partial word.
+ */
+static void
+scantail(const char* s, size_t len, uint64_t* masks, size_t from)
+{
+  uint64_t word = 0;
+  size_t i;
+
+  for (i = from; i < len; i++)
+    {
+      word |= (uint64_t)(kScanClass[(unsigned char)s[i]] != SCAN_NONE) << (i % 64);
+      if (i % 64 == 63)
+        {
+          masks[i / 64] = word;
+          word = 0;
+        }
+    }
+  if (len % 64 != 0)
+    masks[len / 64] = word;
+} /* scantail */
+
+
+/*
+ * countscalar
+ *
+ * arguments:
+ *   const char *s: the characters to search
+ *   size_t len: their number
+ *   char c: the character to count
+ *
+ * returns: size_t: how often c occurs in s
+ */
+static size_t
+countscalar(const char* s, size_t len, char c)
+{
+  size_t i, n = 0;
+
+  for (i = 0; i < len; i++)
+    n += (s[i] == c);
+  return n;
+} /* countscalar */
+
+
+/*
+ * findscalar
+ *
+ * arguments:
+ *   const char *s: the characters to search
+ *   size_t len: their number
+ *   const char *str: the string to find
+ *   size_t n: its length
+ *
+ * returns: const char*: the first occurrence of str in s, or NULL
+ *
+ * The vectorized finders use it for the positions at the end, where a
+ * whole vector no longer fits.
+ */
+static const char*
+findscalar(const char* s, size_t len, const char* str, size_t n)
+{
+  return memmem(s, len, str, n);
+} /* findscalar */
+
+
+#ifdef __SSE2__
+/*
+ * scansse2
+ *
+ * arguments:
+ *   const char *s: the characters to scan
+ *   size_t len: their number
+ *   uint64_t *masks: (len + 63) / 64 words for the result
+ *
+ * returns: none
+ *
+ * Compares 16 characters at a time against every metacharacter and
+ * collects the matches with movemask, four vectors per word.
+ */
+static void
+scansse2(const char* s, size_t len, uint64_t* masks)
+{
+  const __m128i space = _mm_set1_epi8(' '), tab = _mm_set1_epi8('\t');
+  const __m128i nl = _mm_set1_epi8('\n'), squote = _mm_set1_epi8('\'');
+  const __m128i dquote = _mm_set1_epi8('"'), bslash = _mm_set1_epi8('\\');
+  const __m128i pipe = _mm_set1_epi8('|'), dollar = _mm_set1_epi8('$');
+  const __m128i tilde = _mm_set1_epi8('~'), lt = _mm_set1_epi8('<');
+  const __m128i gt = _mm_set1_epi8('>'), amp = _mm_set1_epi8('&');
+  const __m128i semi = _mm_set1_epi8(';'), lparen = _mm_set1_epi8('(');
+  const __m128i rparen = _mm_set1_epi8(')');
+  size_t full = len & ~(size_t)63;
+  size_t i, j;
+  uint64_t word;
+  __m128i v, m;
+
+  for (i = 0; i < full; i += 64)
+    {
+      word = 0;
+      for (j = 0; j < 64; j += 16)
+        {
+          v = _mm_loadu_si128((const __m128i*)(s + i + j));
+          m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, space),
+                                        _mm_cmpeq_epi8(v, tab)),
+                           _mm_or_si128(_mm_cmpeq_epi8(v, nl),
+                                        _mm_cmpeq_epi8(v, squote)));
+          m = _mm_or_si128(m, _mm_or_si128(_mm_cmpeq_epi8(v, dquote),
+                                           _mm_cmpeq_epi8(v, bslash)));
+          m = _mm_or_si128(m, _mm_or_si128(_mm_cmpeq_epi8(v, pipe),
+                                           _mm_cmpeq_epi8(v, dollar)));
+          m = _mm_or_si128(m, _mm_or_si128(_mm_cmpeq_epi8(v, tilde),
+                                           _mm_cmpeq_epi8(v, lt)));
+          m = _mm_or_si128(m, _mm_or_si128(_mm_cmpeq_epi8(v, gt),
+                                           _mm_cmpeq_epi8(v, amp)));
+          m = _mm_or_si128(m, _mm_or_si128(_mm_cmpeq_epi8(v, semi),
+                                           _mm_cmpeq_epi8(v, lparen)));
+          m = _mm_or_si128(m, _mm_cmpeq_epi8(v, rparen));
+          word |= (uint64_t)(uint16_t)_mm_movemask_epi8(m) << j;
+        }
+      masks[i / 64] = word;
+    }
+  scantail(s, len, masks, full);
+} /* scansse2 */
+
+
+/*
+ * countsse2
+ *
+ * arguments:
+ *   const char *s: the characters to search
+ *   size_t len: their number
+ *   char c: the character to count
+ *
+ * returns: size_t: how often c occurs in s
+ *
+ * Subtracts the result of a comparison, -1 for every match, from 16
+ * byte counters, which are summed with psadbw before they can
+ * overflow.
+ */
+static size_t
+countsse2(const char* s, size_t len, char c)
+{
+  const __m128i needle = _mm_set1_epi8(c), zero = _mm_setzero_si128();
+  __m128i counts, sums = zero;
+  size_t i = 0, j;
+
+  while (i + 16 <= len)
+    {
+      counts = zero;
+      for (j = 0; j < 255 && i + 16 <= len; j++, i += 16)
+        counts = _mm_sub_epi8(counts, _mm_cmpeq_epi8(
+            _mm_loadu_si128((const __m128i*)(s + i)), needle));
+      sums = _mm_add_epi64(sums, _mm_sad_epu8(counts, zero));
+    }
+  return (size_t)_mm_cvtsi128_si64(sums) +
+    (size_t)_mm_cvtsi128_si64(_mm_unpackhi_epi64(sums, sums)) +
+    countscalar(s + i, len - i, c);
+} /* countsse2 */
+
+
+/*
+ * findsse2
+ *
+ * arguments:
+ *   const char *s: the characters to search
+ *   size_t len: their number
+ *   const char *str: the string to find, at least 2 characters long
+ *   size_t n: its length, at most len
+ *
+ * returns: const char*: the first occurrence of str in s, or NULL
+ *
+ * Compares 16 positions at a time with the first and the last
+ * character of str and only compares the rest where both match, which
+ * in text is rare.
+ */
+static const char*
+findsse2(const char* s, size_t len, const char* str, size_t n)
+{
+  const __m128i first = _mm_set1_epi8(str[0]);
+  const __m128i last = _mm_set1_epi8(str[n - 1]);
+  unsigned int mask;
+  size_t i;
+
+  for (i = 0; i + n - 1 + 16 <= len; i += 16)
+    {
+      mask = _mm_movemask_epi8(_mm_and_si128(
+          _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(s + i)), first),
+          _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(s + i + n - 1)),
+                         last)));
+      for (; mask != 0; mask &= mask - 1)
+        if (memcmp(s + i + __builtin_ctz(mask) + 1, str + 1, n - 2) == 0)
+          return s + i + __builtin_ctz(mask);
+    }
+  return findscalar(s + i, len - i, str, n);
+} /* findsse2 */
+#endif
+
+
+#ifdef HAVE_AVX2
+/*
+ * scanavx2
+ *
+ * arguments:
+ *   const char *s: the characters to scan
+ *   size_t len: their number
+ *   uint64_t *masks: (len + 63) / 64 words for the result
+ *
+ * returns: none
+ *
+ * Like scansse2, with 32 characters per vector.
+ */
+__attribute__((target("avx2")))
+static void
+scanavx2(const char* s, size_t len, uint64_t* masks)
+{
+  const __m256i space = _mm256_set1_epi8(' '), tab = _mm256_set1_epi8('\t');
+  const __m256i nl = _mm256_set1_epi8('\n'), squote = _mm256_set1_epi8('\'');
+  const __m256i dquote = _mm256_set1_epi8('"'), bslash = _mm256_set1_epi8('\\');
+  const __m256i pipe = _mm256_set1_epi8('|'), dollar = _mm256_set1_epi8('$');
+  const __m256i tilde = _mm256_set1_epi8('~'), lt = _mm256_set1_epi8('<');
+  const __m256i gt = _mm256_set1_epi8('>'), amp = _mm256_set1_epi8('&');
+  const __m256i semi = _mm256_set1_epi8(';'), lparen = _mm256_set1_epi8('(');
+  const __m256i rparen = _mm256_set1_epi8(')');
+  size_t full = len & ~(size_t)63;
+  size_t i, j;
+  uint64_t word;
+  __m256i v, m;
+
+  for (i = 0; i < full; i += 64)
+    {
+      word = 0;
+      for (j = 0; j < 64; j += 32)
+        {
+          v = _mm256_loadu_si256((const __m256i*)(s + i + j));
+          m = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, space),
+                                              _mm256_cmpeq_epi8(v, tab)),
+                              _mm256_or_si256(_mm256_cmpeq_epi8(v, nl),
+                                              _mm256_cmpeq_epi8(v, squote)));
+          m = _mm256_or_si256(m, _mm256_or_si256(_mm256_cmpeq_epi8(v, dquote),
+                                                 _mm256_cmpeq_epi8(v, bslash)));
+          m = _mm256_or_si256(m, _mm256_or_si256(_mm256_cmpeq_epi8(v, pipe),
+                                                 _mm256_cmpeq_epi8(v, dollar)));
+          m = _mm256_or_si256(m, _mm256_or_si256(_mm256_cmpeq_epi8(v, tilde),
+                                                 _mm256_cmpeq_epi8(v, lt)));
+          m = _mm256_or_si256(m, _mm256_or_si256(_mm256_cmpeq_epi8(v, gt),
+                                                 _mm256_cmpeq_epi8(v, amp)));
+          m = _mm256_or_si256(m, _mm256_or_si256(_mm256_cmpeq_epi8(v, semi),
+                                                 _mm256_cmpeq_epi8(v, lparen)));
+          m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, rparen));
+          word |= (uint64_t)(uint32_t)_mm256_movemask_epi8(m) << j;
+        }
+      masks[i / 64] = word;
+    }
+  scantail(s, len, masks, full);
+} /* scanavx2 */
+
+
+/*
+ * countavx2
+ *
+ * arguments:
+ *   const char *s: the characters to search
+ *   size_t len: their number
+ *   char c: the character to count
+ *
+ * returns: size_t: how often c occurs in s
+ *
+ * Like countsse2, with 32 counters.
+ */
+__attribute__((target("avx2")))
+static size_t
+countavx2(const char* s, size_t len, char c)
+{
+  const __m256i needle = _mm256_set1_epi8(c), zero = _mm256_setzero_si256();
+  __m256i counts, sums = zero;
+  size_t i = 0, j;
+
+  while (i + 32 <= len)
+    {
+      counts = zero;
+      for (j = 0; j < 255 && i + 32 <= len; j++, i += 32)
+        counts = _mm256_sub_epi8(counts, _mm256_cmpeq_epi8(
+            _mm256_loadu_si256((const __m256i*)(s + i)), needle));
+      sums = _mm256_add_epi64(sums, _mm256_sad_epu8(counts, zero));
+    }
+  return (size_t)_mm256_extract_epi64(sums, 0) +
+    (size_t)_mm256_extract_epi64(sums, 1) +
+    (size_t)_mm256_extract_epi64(sums, 2) +
+    (size_t)_mm256_extract_epi64(sums, 3) +
+    countscalar(s + i, len - i, c);
+} /* countavx2 */
+
+
+/*
+ * findavx2
+ *
+ * arguments:
+ *   const char *s: the characters to search
+ *   size_t len: their number
+ *   const char *str: the string to find, at least 2 characters long
+ *   size_t n: its length, at most len
+ *
+ * returns: const char*: the first occurrence of str in s, or NULL
+ *
+ * Like findsse2, with 32 positions at a time.
+ */
+__attribute__((target("avx2")))
+static const char*
+findavx2(const char* s, size_t len, const char* str, size_t n)
+{
+  const __m256i first = _mm256_set1_epi8(str[0]);
+  const __m256i last = _mm256_set1_epi8(str[n - 1]);
+  unsigned int mask;
+  size_t i;
+
+  for (i = 0; i + n - 1 + 32 <= len; i += 32)
+    {
+      mask = _mm256_movemask_epi8(_mm256_and_si256(
+          _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(s + i)),
+                            first),
+          _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(s + i + n - 1)),
+                            last)));
+      for (; mask != 0; mask &= mask - 1)
+        if (memcmp(s + i + __builtin_ctz(mask) + 1, str + 1, n - 2) == 0)
+          return s + i + __builtin_ctz(mask);
+    }
+  return findscalar(s + i, len - i, str, n);
+} /* findavx2 */
+#endif
@@ -0,0 +1,131 @@
+/***************************************************************************
+ *  Title: Line scanner
+ * -------------------------------------------------------------------------
+ *    Purpose: Finds the characters of a command line that mean something
+ *    to the shell
+ *    File: scan.h
+ ***************************************************************************/
+
+#ifndef __SCAN_H__
+#define __SCAN_H__
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/************System include***********************************************/
+#include <stddef.h>
+#include <stdint.h>
+
+/************Private include**********************************************/
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#undef EXTERN
+#ifdef __SCAN_IMPL__
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+/* what kScanClass says about a character */
+#define SCAN_NONE      0
+#define SCAN_SPACE     1   /* ' ', '\t', '\n' */
+#define SCAN_QUOTE     2   /* '\'', '"' */
+#define SCAN_ESCAPE    3   /* '\\' */
+#define SCAN_PIPE      4   /* '|' */
+#define SCAN_DOLLAR    5   /* '$' */
+#define SCAN_TILDE     6   /* '~' */
+#define SCAN_REDIR     7   /* '<', '>' */
+#define SCAN_AMP       8   /* '&' */
+#define SCAN_SEMI      9   /* ';' */
+#define SCAN_PAREN     10  /* '(', ')' */
+
+/* ScanMeta, ScanCount and ScanFind implementations, for ScanUse */
+#define SCAN_AUTO      0
+#define SCAN_SCALAR    1
+#define SCAN_SSE2      2
+#define SCAN_AVX2      3
+
+/************Global Variables*********************************************/
+
+/***********************************************************************
+ *  Title: Character classes
+ * ---------------------------------------------------------------------
+ *    Purpose: The SCAN_* class of every character; a character has a
+ *    bit in the masks of ScanMeta exactly if its class is not SCAN_NONE
+ ***********************************************************************/
+EXTERN const unsigned char kScanClass[256];
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: Scan a line
+ * ---------------------------------------------------------------------
+ *    Purpose: Sets bit i % 64 of word i / 64 for every character s[i]
+ *    that is not of class SCAN_NONE, 16 or 32 characters at a time
+ *    where the CPU allows.
+ *    Input: the characters, their number, and (len + 63) / 64 words
+ *    for the masks
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+ScanMeta(const char*, size_t, uint64_t*);
+
+/***********************************************************************
+ *  Title: Find the next metacharacter
+ * ---------------------------------------------------------------------
+ *    Purpose: Walks the masks of ScanMeta.
+ *    Input: the masks, the number of characters and where to start
+ *    Output: the index of the first metacharacter at or after the
+ *    start, or the number of characters if there is none
+ ***********************************************************************/
+EXTERN size_t
+ScanNext(const uint64_t*, size_t, size_t);
+
+/***********************************************************************
+ *  Title: Count a character
+ * ---------------------------------------------------------------------
+ *    Purpose: Counts the occurrences of a character, such as the
+ *    newlines of a buffer, 16 or 32 characters at a time where the
+ *    CPU allows.
+ *    Input: the characters, their number and the character to count
+ *    Output: how often it occurs
+ ***********************************************************************/
+EXTERN size_t
+ScanCount(const char*, size_t, char);
+
+/***********************************************************************
+ *  Title: Find a string
+ * ---------------------------------------------------------------------
+ *    Purpose: Finds the first occurrence of a string, testing 16 or 32
+ *    positions at a time for its first and last character where the
+ *    CPU allows.
+ *    Input: the characters, their number, the string and its length
+ *    Output: where the string starts, or NULL if it does not occur
+ ***********************************************************************/
+EXTERN const char*
+ScanFind(const char*, size_t, const char*, size_t);
+
+/***********************************************************************
+ *  Title: Select the scanner
+ * ---------------------------------------------------------------------
+ *    Purpose: Forces one implementation of ScanMeta, ScanCount and
+ *    ScanFind, for testing and benchmarking; SCAN_AUTO picks the
+ *    fastest one the CPU supports.
+ *    Input: a SCAN_* implementation
+ *    Output: FALSE if the CPU does not support it
+ ***********************************************************************/
+EXTERN bool
+ScanUse(int);
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __SCAN_H__ */
@@ -0,0 +1,620 @@
+/***************************************************************************
+ *  Title: Snapshot
+ * -------------------------------------------------------------------------
+ *    Purpose: Saves what ~/.tshrc did, so that it need not be run again
+ *    File: snapshot.c
+ ***************************************************************************/
+/***************************************************************************
+ *  Most rc files only set variables, define aliases and hash commands.
+ *  While the rc file runs, the runtime reports every variable it sets,
+ *  and anything else it does, such as running a program or printing,
+ *  taints the run. An untainted run is saved to a snapshot next to the
+ *  rc file: the values of the variables it set, followed by the alias
+ *  list and the path cache, which save and restore themselves. The
+ *  snapshot records the mtime, size and FNV-1a hash of the rc file it
+ *  was taken of; on the next startup it is mapped and restored instead
+ *  of running the rc file, as long as the rc file still matches.
+ ***************************************************************************/
+#define __SNAPSHOT_IMPL__
+
+/************System include***********************************************/
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/************Private include**********************************************/
+#include "snapshot.h"
+#include "parsecache.h"
+#include "pathcache.h"
+#include "runtime.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/* environment variable that turns snapshots off if set to 0 */
+#define SNAPSHOTVAR  "TSHSNAPSHOT"
+/* the snapshot of an rc file is the rc file's path with this appended */
+#define SNAPSUFFIX   ".snap"
+
+#define SNAPMAGIC    0x74736873
+#define SNAPVERSION  1
+
+#define FNVBASIS     14695981039346656037ULL
+#define FNVPRIME     1099511628211ULL
+
+/* the start of a snapshot */
+typedef struct snaphdr_t
+{
+  uint32_t magic;
+  uint32_t version;
+  int64_t  sec;      /* the mtime, size and hash of the rc file */
+  int64_t  nsec;
+  int64_t  size;
+  uint64_t rchash;
+  uint64_t len;      /* the length and hash of the rest */
+  uint64_t hash;
+} snaphdrT;
+
+/************Global Variables*********************************************/
+
+/* whether the rc file is running, and did something that cannot be
+ * restored */
+static bool recording = FALSE;
+static bool tainted = FALSE;
+/* the names of the variables it set */
+static char** vars = NULL;
+static int nvars = 0;
+static int varssize = 0;
+/* the environment made from a snapshot */
+static char** snapenv = NULL;
+
+/************Function Prototypes******************************************/
+/* whether snapshots are turned on */
+static bool
+enabled();
+/* makes the path of the snapshot of an rc file */
+static char*
+snappath(char*);
+/* hashes a piece of memory */
+static uint64_t
+hashbytes(const char*, size_t);
+/* hashes the rc file, if it has not changed */
+static bool
+hashfile(char*, struct stat*, uint64_t*);
+/* restores what a snapshot holds */
+static bool
+restore(snapshotT*, bool*);
+/* adds variables to the environment */
+static void
+setvars(char**, int);
+/* forgets the variables that were set */
+static void
+forgetvars();
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+
+/*
+ * SnapshotLoad
+ *
+ * arguments:
+ *   char *rcpath: the rc file
+ *   struct stat *st: its stat
+ *
+ * returns: bool: TRUE if the snapshot was restored
+ *
+ * The snapshot is only used if it belongs to the user, like the rc
+ * file it stands for, and if it is intact and was taken of an rc file
+ * with the same mtime, size and content. The content is only hashed
+ * once everything else matches. If it sets variables, it stays mapped,
+ * as the environment points into it.
+ */
+bool
+SnapshotLoad(char* rcpath, struct stat* st)
+{
+  char* path;
+  char* map;
+  int fd;
+  struct stat snapst;
+  snaphdrT* hdr;
+  snapshotT snap;
+  uint64_t rchash;
+  bool ok = FALSE;
+  bool keep = FALSE;
+
+  if (!enabled())
+    return FALSE;
+  path = snappath(rcpath);
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  free(path);
+  if (fd < 0)
+    return FALSE;
+  if (fstat(fd, &snapst) < 0 || !S_ISREG(snapst.st_mode) ||
+      snapst.st_uid != getuid() || (snapst.st_mode & 022) != 0 ||
+      snapst.st_size < (off_t)sizeof(snaphdrT))
+    {
+      close(fd);
+      return FALSE;
+    }
+  map = mmap(NULL, snapst.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return FALSE;
+
+  hdr = (snaphdrT *)map;
+  snap.next = map + sizeof(snaphdrT);
+  snap.end = map + snapst.st_size;
+  if (hdr->magic == SNAPMAGIC && hdr->version == SNAPVERSION &&
+      hdr->sec == st->st_mtim.tv_sec && hdr->nsec == st->st_mtim.tv_nsec &&
+      hdr->size == st->st_size && hdr->len == (uint64_t)(snap.end - snap.next) &&
+      hdr->hash == hashbytes(snap.next, hdr->len) &&
+      hashfile(rcpath, st, &rchash) && rchash == hdr->rchash)
+    ok = restore(&snap, &keep);
+  if (!keep)
+    munmap(map, snapst.st_size);
+  return ok;
+} /* SnapshotLoad */
+
+
+/*
+ * SnapshotRecord
+ *
+ * arguments: none
+ *
+ * returns: none
+ */
+void
+SnapshotRecord()
+{
+  recording = TRUE;
+  tainted = FALSE;
+  forgetvars();
+} /* SnapshotRecord */
+
+
+/*
+ * SnapshotSave
+ *
+ * arguments:
+ *   char *rcpath: the rc file
+ *   struct stat *st: its stat from before it ran
+ *
+ * returns: none
+ *
+ * Writes the snapshot to a temporary file that replaces the old one,
+ * so that a shell starting meanwhile never maps half a snapshot. If
+ * the run was tainted, an old snapshot is removed, as it would never
+ * match again.
+ */
+void
+SnapshotSave(char* rcpath, struct stat* st)
+{
+  char* path;
+  char* tmp;
+  char* payload = NULL;
+  size_t len = 0;
+  char* entry;
+  char* value;
+  FILE* out;
+  snaphdrT hdr;
+  int64_t n;
+  int i, fd;
+  bool ok;
+
+  recording = FALSE;
+  if (!enabled())
+    {
+      forgetvars();
+      return;
+    }
+  memset(&hdr, 0, sizeof(hdr));
+  path = snappath(rcpath);
+  if (tainted || !hashfile(rcpath, st, &hdr.rchash))
+    {
+      unlink(path);
+      free(path);
+      forgetvars();
+      return;
+    }
+
+  out = open_memstream(&payload, &len);
+  for (i = 0, n = 0; i < nvars; i++)
+    if (getenv(vars[i]) != NULL)
+      n++;
+  SnapshotPutInt(out, n);
+  // variables are saved the way they are kept in the environment
+  for (i = 0; i < nvars; i++)
+    {
+      if ((value = getenv(vars[i])) == NULL)
+        continue;
+      entry = (char *)malloc(strlen(vars[i]) + strlen(value) + 2);
+      sprintf(entry, "%s=%s", vars[i], value);
+      SnapshotPutString(out, entry);
+      free(entry);
+    }
+  SaveAliases(out);
+  PathCacheSave(out);
+  fclose(out);
+  forgetvars();
+
+  hdr.magic = SNAPMAGIC;
+  hdr.version = SNAPVERSION;
+  hdr.sec = st->st_mtim.tv_sec;
+  hdr.nsec = st->st_mtim.tv_nsec;
+  hdr.size = st->st_size;
+  hdr.len = len;
+  hdr.hash = hashbytes(payload, len);
+
+  tmp = (char *)malloc(strlen(path) + sizeof(".XXXXXX"));
+  strcpy(tmp, path);
+  strcat(tmp, ".XXXXXX");
+  // mkstemp creates the file readable by the user only
+  if ((fd = mkstemp(tmp)) >= 0)
+    {
+      ok = write(fd, &hdr, sizeof(hdr)) == (ssize_t)sizeof(hdr) &&
+        write(fd, payload, len) == (ssize_t)len;
+      close(fd);
+      if (!ok || rename(tmp, path) < 0)
+        unlink(tmp);
+    }
+  free(tmp);
+  free(payload);
+  free(path);
+} /* SnapshotSave */
+
+
+/*
+ * SnapshotTaint
+ *
+ * arguments: none
+ *
+ * returns: none
+ */
+void
+SnapshotTaint()
+{
+  if (recording)
+    tainted = TRUE;
+} /* SnapshotTaint */
+
+
+/*
+ * SnapshotNoteVar
+ *
+ * arguments:
+ *   char *name: the variable that was set
+ *
+ * returns: none
+ */
+void
+SnapshotNoteVar(char* name)
+{
+  int i;
+
+  if (!recording)
+    return;
+  for (i = 0; i < nvars; i++)
+    if (strcmp(vars[i], name) == 0)
+      return;
+  if (nvars == varssize)
+    {
+      varssize = (varssize == 0 ? 16 : 2 * varssize);
+      vars = (char **)realloc(vars, sizeof(char*) * varssize);
+    }
+  vars[nvars++] = strdup(name);
+} /* SnapshotNoteVar */
+
+
+/*
+ * SnapshotPutInt
+ *
+ * arguments:
+ *   FILE *out: the snapshot being written
+ *   int64_t n: the number
+ *
+ * returns: none
+ */
+void
+SnapshotPutInt(FILE* out, int64_t n)
+{
+  fwrite(&n, sizeof(n), 1, out);
+} /* SnapshotPutInt */
+
+
+/*
+ * SnapshotPutString
+ *
+ * arguments:
+ *   FILE *out: the snapshot being written
+ *   const char *s: the string
+ *
+ * returns: none
+ *
+ * Writes the length of the string and the string with its '\0', so
+ * that it can be used where it is mapped.
+ */
+void
+SnapshotPutString(FILE* out, const char* s)
+{
+  int64_t len = strlen(s);
+
+  SnapshotPutInt(out, len);
+  fwrite(s, sizeof(char), len + 1, out);
+} /* SnapshotPutString */
+
+
+/*
+ * SnapshotGetInt
+ *
+ * arguments:
+ *   snapshotT *snap: the snapshot being read
+ *   int64_t *n: set to the number
+ *
+ * returns: bool: FALSE if the snapshot ends early
+ */
+bool
+SnapshotGetInt(snapshotT* snap, int64_t* n)
+{
+  if (snap->end - snap->next < (ptrdiff_t)sizeof(*n))
+    return FALSE;
+  memcpy(n, snap->next, sizeof(*n));
+  snap->next += sizeof(*n);
+  return TRUE;
+} /* SnapshotGetInt */
+
+
+/*
+ * SnapshotGetString
+ *
+ * arguments:
+ *   snapshotT *snap: the snapshot being read
+ *
+ * returns: char*: the string, in the mapping, or NULL if the snapshot
+ *                 ends early
+ */
+char*
+SnapshotGetString(snapshotT* snap)
+{
+  int64_t len;
+  char* s;
+
+  if (!SnapshotGetInt(snap, &len) || len < 0 ||
+      len >= snap->end - snap->next || snap->next[len] != '\0')
+    return NULL;
+  s = snap->next;
+  snap->next += len + 1;
+  return s;
+} /* SnapshotGetString */
+
+
+/*
+ * enabled
+ *
+ * arguments: none
+ *
+ * returns: bool: FALSE if SNAPSHOTVAR is 0
+ */
+static bool
+enabled()
+{
+  char* value = getenv(SNAPSHOTVAR);
+
+  return value == NULL || strcmp(value, "0") != 0;
+} /* enabled */
+
+
+/*
+ * snappath
+ *
+ * arguments:
+ *   char *rcpath: the rc file
+ *
+ * returns: char*: a newly allocated path of its snapshot
+ */
+static char*
+snappath(char* rcpath)
+{
+  char* path = (char *)malloc(strlen(rcpath) + sizeof(SNAPSUFFIX));
+
+  strcpy(path, rcpath);
+  strcat(path, SNAPSUFFIX);
+  return path;
+} /* snappath */
+
+
+/*
+ * hashbytes
+ *
+ * arguments:
+ *   const char *p: the memory
+ *   size_t len: its length
+ *
+ * returns: uint64_t: its 64-bit FNV-1a hash
+ */
+static uint64_t
+hashbytes(const char* p, size_t len)
+{
+  uint64_t h = FNVBASIS;
+  size_t i;
+
+  for (i = 0; i < len; i++)
+    {
+      h ^= (unsigned char)p[i];
+      h *= FNVPRIME;
+    }
+  return h;
+} /* hashbytes */
+
+
+/*
+ * hashfile
+ *
+ * arguments:
+ *   char *rcpath: the rc file
+ *   struct stat *st: the stat it should still have
+ *   uint64_t *hash: set to the hash of its content
+ *
+ * returns: bool: FALSE if it cannot be read or its mtime or size
+ *                changed
+ */
+static bool
+hashfile(char* rcpath, struct stat* st, uint64_t* hash)
+{
+  struct stat now;
+  char* map;
+  int fd;
+
+  if ((fd = open(rcpath, O_RDONLY | O_CLOEXEC)) < 0)
+    return FALSE;
+  if (fstat(fd, &now) < 0 || now.st_size != st->st_size ||
+      now.st_mtim.tv_sec != st->st_mtim.tv_sec ||
+      now.st_mtim.tv_nsec != st->st_mtim.tv_nsec)
+    {
+      close(fd);
+      return FALSE;
+    }
+  // an empty file cannot be mapped
+  if (now.st_size == 0)
+    {
+      close(fd);
+      *hash = hashbytes("", 0);
+      return TRUE;
+    }
+  map = mmap(NULL, now.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return FALSE;
+  *hash = hashbytes(map, now.st_size);
+  munmap(map, now.st_size);
+  return TRUE;
+} /* hashfile */
+
+
+/*
+ * restore
+ *
+ * arguments:
+ *   snapshotT *snap: the snapshot, after its header
+ *   bool *keep: set to TRUE if the snapshot must stay mapped
+ *
+ * returns: bool: FALSE if it is cut short
+ *
+ * Sets the variables first, as the path cache depends on PATH.
+ */
+static bool
+restore(snapshotT* snap, bool* keep)
+{
+  int64_t n, i;
+  char** entries;
+
+  if (!SnapshotGetInt(snap, &n) || n < 0 || n > snap->end - snap->next)
+    return FALSE;
+  if (n > 0)
+    {
+      entries = (char **)malloc(sizeof(char*) * n);
+      for (i = 0; i < n; i++)
+        {
+          if ((entries[i] = SnapshotGetString(snap)) == NULL ||
+              strchr(entries[i], '=') == NULL)
+            {
+              free(entries);
+              return FALSE;
+            }
+        }
+      setvars(entries, n);
+      free(entries);
+      *keep = TRUE;
+    }
+  return RestoreAliases(snap) && PathCacheRestore(snap);
+} /* restore */
+
+
+/*
+ * setvars
+ *
+ * arguments:
+ *   char **entries: NAME=VALUE strings, each with a different name
+ *   int n: their number
+ *
+ * returns: none
+ *
+ * Builds a new environment from the entries and the variables they
+ * do not replace, which are found through a hash table of the new
+ * names. Calling setenv for each of them would search and copy the
+ * whole environment every time. The entries themselves become part of
+ * the environment, so they must stay around.
+ */
+static void
+setvars(char** entries, int n)
+{
+  extern char** environ;
+  char** env;
+  char** old;
+  int* table;
+  int size, nold = 0, m = 0, i;
+  size_t len, j;
+
+  for (size = 1; size < 2 * n; size *= 2)
+    ;
+  table = (int *)malloc(sizeof(int) * size);
+  memset(table, -1, sizeof(int) * size);
+  for (i = 0; i < n; i++)
+    {
+      len = strchr(entries[i], '=') - entries[i];
+      for (j = hashbytes(entries[i], len) & (size - 1); table[j] >= 0;
+           j = (j + 1) & (size - 1))
+        ;
+      table[j] = i;
+    }
+
+  for (old = environ; old != NULL && *old != NULL; old++)
+    nold++;
+  env = (char **)malloc(sizeof(char*) * (nold + n + 1));
+  for (old = environ; old != NULL && *old != NULL; old++)
+    {
+      len = strcspn(*old, "=");
+      for (j = hashbytes(*old, len) & (size - 1); table[j] >= 0;
+           j = (j + 1) & (size - 1))
+        if (strncmp(entries[table[j]], *old, len + 1) == 0)
+          break;
+      if (table[j] < 0)
+        env[m++] = *old;
+    }
+  memcpy(env + m, entries, sizeof(char*) * n);
+  env[m + n] = NULL;
+  // the old environment is ours if it was made here and kept by setenv
+  if (snapenv != NULL && snapenv != environ)
+    free(snapenv);
+  environ = snapenv = env;
+  free(table);
+
+  // as SetVar does, in case PATH or HOME were among them
+  PathCacheInvalidate();
+  ParseCacheInvalidate();
+} /* setvars */
+
+
+/*
+ * forgetvars
+ *
+ * arguments: none
+ *
+ * returns: none
+ */
+static void
+forgetvars()
+{
+  int i;
+
+  for (i = 0; i < nvars; i++)
+    free(vars[i]);
+  nvars = 0;
+} /* forgetvars */
@@ -0,0 +1,135 @@
+/***************************************************************************
+ *  Title: Snapshot
+ * -------------------------------------------------------------------------
+ *    Purpose: Saves what ~/.tshrc did, so that it need not be run again
+ *    File: snapshot.h
+ ***************************************************************************/
+
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/************System include***********************************************/
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+/************Private include**********************************************/
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#undef EXTERN
+#ifdef __SNAPSHOT_IMPL__
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+/* a snapshot being read, from next up to end */
+typedef struct snapshot_t
+{
+  char* next;
+  char* end;
+} snapshotT;
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: Load the snapshot of an rc file
+ * ---------------------------------------------------------------------
+ *    Purpose: Maps the snapshot next to the rc file and, if it was
+ *    taken of the rc file as it is now, restores the variables,
+ *    aliases and remembered commands from it.
+ *    Input: the path of the rc file, and its stat
+ *    Output: TRUE if the rc file does not need to be run
+ ***********************************************************************/
+EXTERN bool
+SnapshotLoad(char*, struct stat*);
+
+/***********************************************************************
+ *  Title: Start recording
+ * ---------------------------------------------------------------------
+ *    Purpose: Called before the rc file is run; from then on the
+ *    runtime reports the variables it sets and anything it does that
+ *    a snapshot cannot restore.
+ *    Input: none
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+SnapshotRecord();
+
+/***********************************************************************
+ *  Title: Save the snapshot of an rc file
+ * ---------------------------------------------------------------------
+ *    Purpose: Ends recording and writes the snapshot, unless the rc
+ *    file did something it cannot restore or changed meanwhile.
+ *    Input: the path of the rc file, and its stat from before it ran
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+SnapshotSave(char*, struct stat*);
+
+/***********************************************************************
+ *  Title: Note that a snapshot would not do
+ * ---------------------------------------------------------------------
+ *    Purpose: Called for anything other than setting variables,
+ *    aliases and remembered commands, such as running a program,
+ *    printing or expanding a variable. Does nothing unless recording.
+ *    Input: none
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+SnapshotTaint();
+
+/***********************************************************************
+ *  Title: Note a variable
+ * ---------------------------------------------------------------------
+ *    Purpose: Remembers that a variable was set, so that its value is
+ *    saved. Does nothing unless recording.
+ *    Input: the name of the variable
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+SnapshotNoteVar(char*);
+
+/***********************************************************************
+ *  Title: Write to a snapshot
+ * ---------------------------------------------------------------------
+ *    Purpose: Used by the modules whose state is saved.
+ *    Input: the stream, and a number or a string
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+SnapshotPutInt(FILE*, int64_t);
+EXTERN void
+SnapshotPutString(FILE*, const char*);
+
+/***********************************************************************
+ *  Title: Read from a snapshot
+ * ---------------------------------------------------------------------
+ *    Purpose: Used by the modules whose state is restored. Strings
+ *    point into the mapped snapshot and only stay valid while it is
+ *    being loaded.
+ *    Input: the snapshot, and where to store a number
+ *    Output: FALSE or NULL if the snapshot ends early
+ ***********************************************************************/
+EXTERN bool
+SnapshotGetInt(snapshotT*, int64_t*);
+EXTERN char*
+SnapshotGetString(snapshotT*);
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __SNAPSHOT_H__ */
@@ -0,0 +1,731 @@
+/***************************************************************************
+ *  Title: Pipeline stages
+ * -------------------------------------------------------------------------
+ *    Purpose: Runs the builtins of a pipeline as threads of the shell
+ *    File: stage.c
+ ***************************************************************************/
+/***************************************************************************
+ *  A pipeline such as echo ... | fgrep x | wc -l used to fork a
+ *  subshell for each builtin in it, which costs far more than the
+ *  builtins themselves. Instead, each builtin that only reads stdin and
+ *  writes stdout runs in a thread of the shell. Next to a command, a
+ *  builtin reads or writes a pipe, as the command would; between two
+ *  builtins, the data goes through a ring in memory. A ring has one
+ *  reader and one writer, which move the head and the tail with atomic
+ *  stores only, so that neither makes a system call as long as there
+ *  is data and room; only when one has to wait for the other does it
+ *  sleep on the condition variable of the ring, after spinning a
+ *  little, and only then is it woken. A thread has no stdin and stdout
+ *  of its own, so the builtins read and write through StageRead and
+ *  StageWrite, which know the descriptors and rings of the stage of
+ *  the thread they run in. When a stage is done, it writes to an
+ *  eventfd that the event loop watches, so that the shell waits for
+ *  the stages and the commands of a pipeline in one place. Threads
+ *  block every signal but SIGURG, which only interrupts them.
+ ***************************************************************************/
+#define __STAGE_IMPL__
+#define _GNU_SOURCE
+
+/************System include***********************************************/
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/************Private include**********************************************/
+#include "stage.h"
+#include "event.h"
+#include "io.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/* the size of a ring; a power of two, and a few times the chunks the
+ * filters write, so that the two sides do not take turns */
+#define RINGSIZE (256 << 10)
+
+/* how often a side of a ring looks again before it goes to sleep */
+#define SPINS 1000
+
+/* tells the CPU that a thread spins */
+#if defined(__x86_64__) || defined(__i386__)
+#define SPINPAUSE() _mm_pause()
+#else
+#define SPINPAUSE()
+#endif
+
+/* the signal that interrupts a cancelled stage */
+#define STAGESIG SIGURG
+
+/* the head and the tail only ever grow, and are taken modulo RINGSIZE;
+ * each is written by one side only, on a cache line of its own */
+struct ring_t
+{
+  _Alignas(64) atomic_size_t head;      /* bytes written so far */
+  _Alignas(64) atomic_size_t tail;      /* bytes read so far */
+  _Alignas(64) atomic_bool rclosed;     /* the reader is done */
+  atomic_bool wclosed;                  /* the writer is done */
+  atomic_int sleepers;                  /* sides waiting on wake */
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  char buf[RINGSIZE];
+};
+
+/************Global Variables*********************************************/
+
+/* the stage of the thread, NULL in the shell itself */
+static __thread stageT* current = NULL;
+
+/* written by each stage that is done, and watched by the event loop */
+static int donefd = -1;
+
+/* whether the handler of STAGESIG is set */
+static bool handled = FALSE;
+
+/************Function Prototypes******************************************/
+/* the thread of a stage */
+static void*
+stagemain(void*);
+/* closes the descriptors and rings of a stage */
+static void
+closestage(stageT*);
+/* the write function of the stdio stream of a stage */
+static ssize_t
+cookiewrite(void*, const char*, size_t);
+/* empties donefd */
+static void
+stagesdone(void*);
+/* interrupts a system call */
+static void
+interrupt(int);
+/* whether a side of a ring can go on */
+static bool
+ringready(ringT*, bool);
+/* waits until a side of a ring can go on */
+static void
+ringwait(ringT*, bool);
+/* wakes the side of a ring that waits */
+static void
+ringwake(ringT*);
+/* reads from a ring */
+static ssize_t
+ringread(ringT*, char*, size_t);
+/* writes to a ring */
+static ssize_t
+ringwrite(ringT*, const char*, size_t);
+/* closes a side of a ring */
+static void
+ringclose(ringT*, bool);
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+
+/*
+ * StageRing
+ *
+ * arguments: none
+ *
+ * returns: ringT*: an empty ring
+ */
+ringT*
+StageRing()
+{
+  ringT* ring = (ringT*)aligned_alloc(_Alignof(ringT), sizeof(ringT));
+
+  atomic_init(&ring->head, 0);
+  atomic_init(&ring->tail, 0);
+  atomic_init(&ring->rclosed, FALSE);
+  atomic_init(&ring->wclosed, FALSE);
+  atomic_init(&ring->sleepers, 0);
+  pthread_mutex_init(&ring->lock, NULL);
+  pthread_cond_init(&ring->wake, NULL);
+  return ring;
+} /* StageRing */
+
+
+/*
+ * StageStart
+ *
+ * arguments:
+ *   stageT *stage: the stage
+ *
+ * returns: bool: FALSE if no thread could be started
+ *
+ * The thread is started with every signal but STAGESIG blocked, so
+ * that SIGINT, SIGTSTP and SIGCHLD keep going to the event loop, and a
+ * write to a pipe nobody reads fails with EPIPE instead of killing a
+ * subshell the stage runs in.
+ */
+bool
+StageStart(stageT* stage)
+{
+  struct sigaction sa;
+  sigset_t mask, old;
+  int err;
+
+  if (!handled)
+    {
+      memset(&sa, 0, sizeof(sa));
+      sa.sa_handler = interrupt;
+      sigaction(STAGESIG, &sa, NULL);
+      handled = TRUE;
+    }
+  if (donefd < 0)
+    {
+      donefd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+      if (donefd >= 0 && !EventWatch(donefd, stagesdone, NULL))
+        {
+          close(donefd);
+          donefd = -1;
+        }
+    }
+
+  stage->status = 1;
+  stage->file = NULL;
+  atomic_init(&stage->done, FALSE);
+  atomic_init(&stage->cancelled, FALSE);
+  sigfillset(&mask);
+  sigdelset(&mask, STAGESIG);
+  pthread_sigmask(SIG_SETMASK, &mask, &old);
+  err = (donefd < 0 ? errno :
+         pthread_create(&stage->thread, NULL, stagemain, stage));
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  stage->started = (err == 0);
+  if (!stage->started)
+    {
+      errno = err;
+      PrintPError("pthread_create");
+      closestage(stage);
+      atomic_store(&stage->done, TRUE);
+    }
+  return stage->started;
+} /* StageStart */
+
+
+/*
+ * StageDone
+ *
+ * arguments:
+ *   stageT *stage: the stage
+ *
+ * returns: bool: whether it is done
+ */
+bool
+StageDone(stageT* stage)
+{
+  return atomic_load(&stage->done);
+} /* StageDone */
+
+
+/*
+ * StageCancel
+ *
+ * arguments:
+ *   stageT *stage: the stage
+ *
+ * returns: none
+ *
+ * Both sides of its rings are closed, so that whichever of them waits
+ * wakes up; the stage next to it is cancelled as well anyway.
+ */
+void
+StageCancel(stageT* stage)
+{
+  if (atomic_load(&stage->done))
+    return;
+  atomic_store(&stage->cancelled, TRUE);
+  if (stage->inring != NULL)
+    {
+      ringclose(stage->inring, TRUE);
+      ringclose(stage->inring, FALSE);
+    }
+  if (stage->outring != NULL)
+    {
+      ringclose(stage->outring, TRUE);
+      ringclose(stage->outring, FALSE);
+    }
+  pthread_kill(stage->thread, STAGESIG);
+} /* StageCancel */
+
+
+/*
+ * StageJoin
+ *
+ * arguments:
+ *   stageT *stage: the stage
+ *
+ * returns: int: its exit status
+ */
+int
+StageJoin(stageT* stage)
+{
+  if (stage->started)
+    pthread_join(stage->thread, NULL);
+  if (stage->inring != NULL)
+    {
+      pthread_cond_destroy(&stage->inring->wake);
+      pthread_mutex_destroy(&stage->inring->lock);
+      free(stage->inring);
+      stage->inring = NULL;
+    }
+  return stage->status;
+} /* StageJoin */
+
+
+/*
+ * StageFork
+ *
+ * arguments: none
+ *
+ * returns: none
+ *
+ * EventFork already stopped watching donefd in the child.
+ */
+void
+StageFork()
+{
+  if (donefd >= 0)
+    close(donefd);
+  donefd = -1;
+} /* StageFork */
+
+
+/*
+ * StageIn, StageOut
+ *
+ * arguments: none
+ *
+ * returns: int: what the builtin of this thread reads or writes
+ */
+int
+StageIn()
+{
+  if (current == NULL || (current->in < 0 && current->inring == NULL))
+    return STDIN_FILENO;
+  return (current->inring != NULL ? STAGE_RING : current->in);
+} /* StageIn */
+
+int
+StageOut()
+{
+  if (current == NULL || (current->out < 0 && current->outring == NULL))
+    return STDOUT_FILENO;
+  return (current->outring != NULL ? STAGE_RING : current->out);
+} /* StageOut */
+
+
+/*
+ * StageStdout
+ *
+ * arguments: none
+ *
+ * returns: FILE*: where the builtin of this thread prints
+ */
+FILE*
+StageStdout()
+{
+  return (current != NULL && current->file != NULL ? current->file :
+          stdout);
+} /* StageStdout */
+
+
+/*
+ * StageRead
+ *
+ * arguments:
+ *   int fd: a descriptor or STAGE_RING
+ *   void *buf: where to read to
+ *   size_t len: how much to read at most
+ *
+ * returns: ssize_t: how much was read, 0 at the end, or -1
+ */
+ssize_t
+StageRead(int fd, void* buf, size_t len)
+{
+  ssize_t n;
+
+  if (current == NULL)
+    return read(fd, buf, len);
+  if (atomic_load(&current->cancelled))
+    return 0;
+  if (fd == STAGE_RING)
+    return ringread(current->inring, (char*)buf, len);
+  n = read(fd, buf, len);
+  if (n < 0 && errno == EINTR && atomic_load(&current->cancelled))
+    return 0;
+  return n;
+} /* StageRead */
+
+
+/*
+ * StageWrite
+ *
+ * arguments:
+ *   int fd: a descriptor or STAGE_RING
+ *   const void *buf: what to write
+ *   size_t len: its size
+ *
+ * returns: ssize_t: how much was written, or -1
+ */
+ssize_t
+StageWrite(int fd, const void* buf, size_t len)
+{
+  ssize_t n;
+
+  if (current == NULL)
+    return write(fd, buf, len);
+  if (!atomic_load(&current->cancelled))
+    {
+      if (fd == STAGE_RING)
+        return ringwrite(current->outring, (const char*)buf, len);
+      n = write(fd, buf, len);
+      if (n >= 0 || errno != EINTR || !atomic_load(&current->cancelled))
+        return n;
+    }
+  errno = EPIPE;
+  return -1;
+} /* StageWrite */
+
+
+/*
+ * StageStat
+ *
+ * arguments:
+ *   int fd: a descriptor or STAGE_RING
+ *   struct stat *st: where to put its status
+ *
+ * returns: int: 0, or -1
+ */
+int
+StageStat(int fd, struct stat* st)
+{
+  if (fd != STAGE_RING)
+    return fstat(fd, st);
+  memset(st, 0, sizeof(*st));
+  st->st_mode = S_IFIFO | 0600;
+  st->st_blksize = RINGSIZE;
+  return 0;
+} /* StageStat */
+
+
+/*
+ * StageCancelled
+ *
+ * arguments: none
+ *
+ * returns: bool: whether the stage of this thread was cancelled
+ */
+bool
+StageCancelled()
+{
+  return current != NULL && atomic_load(&current->cancelled);
+} /* StageCancelled */
+
+
+/*
+ * stagemain
+ *
+ * arguments:
+ *   void *arg: the stage
+ *
+ * returns: void*: NULL
+ *
+ * A plugin is handed the descriptors; a builtin of the shell finds
+ * them, and its stream, through current. The stage is only done once
+ * its descriptors are closed, so that the stage after it has seen the
+ * end of its input by the time the shell joins it.
+ */
+static void*
+stagemain(void* arg)
+{
+  static cookie_io_functions_t io = { NULL, cookiewrite, NULL, NULL };
+  stageT* stage = (stageT*)arg;
+  uint64_t one = 1;
+
+  current = stage;
+  if (stage->plugin != NULL)
+    stage->status = stage->plugin(stage->cmd, StageIn(), StageOut());
+  else
+    {
+      stage->file = fopencookie(stage, "w", io);
+      stage->status = stage->run(stage->cmd);
+      if (stage->file != NULL)
+        fclose(stage->file);
+      stage->file = NULL;
+    }
+  closestage(stage);
+  atomic_store(&stage->done, TRUE);
+  while (write(donefd, &one, sizeof(one)) < 0 && errno == EINTR)
+    ;
+  return NULL;
+} /* stagemain */
+
+
+/*
+ * closestage
+ *
+ * arguments:
+ *   stageT *stage: the stage
+ *
+ * returns: none
+ */
+static void
+closestage(stageT* stage)
+{
+  if (stage->in >= 0)
+    close(stage->in);
+  if (stage->out >= 0)
+    close(stage->out);
+  if (stage->inring != NULL)
+    ringclose(stage->inring, TRUE);
+  if (stage->outring != NULL)
+    ringclose(stage->outring, FALSE);
+} /* closestage */
+
+
+/*
+ * cookiewrite
+ *
+ * arguments:
+ *   void *cookie: the stage
+ *   const char *buf: what stdio writes
+ *   size_t len: its size
+ *
+ * returns: ssize_t: how much was written, or -1
+ */
+static ssize_t
+cookiewrite(void* cookie, const char* buf, size_t len)
+{
+  return StageWrite(StageOut(), buf, len);
+} /* cookiewrite */
+
+
+/*
+ * stagesdone
+ *
+ * arguments:
+ *   void *arg: unused
+ *
+ * returns: none
+ *
+ * Only wakes up the event loop, whose caller looks at the stages.
+ */
+static void
+stagesdone(void* arg)
+{
+  uint64_t n;
+
+  while (read(donefd, &n, sizeof(n)) == sizeof(n))
+    ;
+} /* stagesdone */
+
+
+/*
+ * interrupt
+ *
+ * arguments:
+ *   int signo: STAGESIG
+ *
+ * returns: none
+ *
+ * Does nothing; being set without SA_RESTART, it makes the system call
+ * the thread is blocked in fail with EINTR.
+ */
+static void
+interrupt(int signo)
+{
+} /* interrupt */
+
+
+/*
+ * ringready
+ *
+ * arguments:
+ *   ringT *ring: the ring
+ *   bool reader: which side asks
+ *
+ * returns: bool: TRUE if the reader has data or the writer room, or if
+ *                the other side is done
+ */
+static bool
+ringready(ringT* ring, bool reader)
+{
+  size_t used = atomic_load(&ring->head) - atomic_load(&ring->tail);
+
+  if (reader)
+    return used > 0 || atomic_load(&ring->wclosed) ||
+           atomic_load(&ring->rclosed);
+  return used < RINGSIZE || atomic_load(&ring->rclosed);
+} /* ringready */
+
+
+/*
+ * ringwait
+ *
+ * arguments:
+ *   ringT *ring: the ring
+ *   bool reader: which side waits
+ *
+ * returns: none
+ *
+ * The other side might be about to go on, so it spins first. A side
+ * that sleeps counts itself in sleepers before it looks again, and the
+ * other side looks at sleepers after it moved the head or the tail;
+ * both are sequentially consistent, so that at least one of them sees
+ * what the other did, and no wakeup is lost.
+ */
+static void
+ringwait(ringT* ring, bool reader)
+{
+  int i;
+
+  for (i = 0; i < SPINS; i++)
+    {
+      if (ringready(ring, reader))
+        return;
+      SPINPAUSE();
+    }
+  pthread_mutex_lock(&ring->lock);
+  atomic_fetch_add(&ring->sleepers, 1);
+  while (!ringready(ring, reader))
+    pthread_cond_wait(&ring->wake, &ring->lock);
+  atomic_fetch_sub(&ring->sleepers, 1);
+  pthread_mutex_unlock(&ring->lock);
+} /* ringwait */
+
+
+/*
+ * ringwake
+ *
+ * arguments:
+ *   ringT *ring: the ring
+ *
+ * returns: none
+ *
+ * Costs nothing but a load if nobody sleeps.
+ */
+static void
+ringwake(ringT* ring)
+{
+  if (atomic_load(&ring->sleepers) == 0)
+    return;
+  pthread_mutex_lock(&ring->lock);
+  pthread_cond_broadcast(&ring->wake);
+  pthread_mutex_unlock(&ring->lock);
+} /* ringwake */
+
+
+/*
+ * ringread
+ *
+ * arguments:
+ *   ringT *ring: the ring
+ *   char *buf: where to read to
+ *   size_t len: how much to read at most
+ *
+ * returns: ssize_t: how much was read, or 0 once the writer is done
+ *                   and everything was read
+ *
+ * Like a pipe, it returns what there is rather than waiting for more.
+ */
+static ssize_t
+ringread(ringT* ring, char* buf, size_t len)
+{
+  size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  size_t head, at, n;
+
+  while ((head = atomic_load(&ring->head)) == tail)
+    {
+      if (atomic_load(&ring->rclosed))
+        return 0;
+      if (atomic_load(&ring->wclosed))
+        {
+          // what was written before it closed has to be read still
+          if (atomic_load(&ring->head) == tail)
+            return 0;
+          continue;
+        }
+      ringwait(ring, TRUE);
+    }
+  if (len > head - tail)
+    len = head - tail;
+  at = tail & (RINGSIZE - 1);
+  n = (len < RINGSIZE - at ? len : RINGSIZE - at);
+  memcpy(buf, ring->buf + at, n);
+  memcpy(buf + n, ring->buf, len - n);
+  atomic_store(&ring->tail, tail + len);
+  ringwake(ring);
+  return len;
+} /* ringread */
+
+
+/*
+ * ringwrite
+ *
+ * arguments:
+ *   ringT *ring: the ring
+ *   const char *buf: what to write
+ *   size_t len: its size
+ *
+ * returns: ssize_t: len, or -1 with EPIPE once the reader is done
+ */
+static ssize_t
+ringwrite(ringT* ring, const char* buf, size_t len)
+{
+  size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  size_t left = len, room, at, n, m;
+
+  while (left > 0)
+    {
+      if (atomic_load(&ring->rclosed))
+        {
+          errno = EPIPE;
+          return -1;
+        }
+      if ((room = RINGSIZE - (head - atomic_load(&ring->tail))) == 0)
+        {
+          ringwait(ring, FALSE);
+          continue;
+        }
+      m = (left < room ? left : room);
+      at = head & (RINGSIZE - 1);
+      n = (m < RINGSIZE - at ? m : RINGSIZE - at);
+      memcpy(ring->buf + at, buf, n);
+      memcpy(ring->buf, buf + n, m - n);
+      head += m;
+      buf += m;
+      left -= m;
+      atomic_store(&ring->head, head);
+      ringwake(ring);
+    }
+  return len;
+} /* ringwrite */
+
+
+/*
+ * ringclose
+ *
+ * arguments:
+ *   ringT *ring: the ring
+ *   bool reader: which side is done
+ *
+ * returns: none
+ */
+static void
+ringclose(ringT* ring, bool reader)
+{
+  atomic_store(reader ? &ring->rclosed : &ring->wclosed, TRUE);
+  ringwake(ring);
+} /* ringclose */
@@ -0,0 +1,213 @@
+/***************************************************************************
+ *  Title: Pipeline stages
+ * -------------------------------------------------------------------------
+ *    Purpose: Runs the builtins of a pipeline as threads of the shell
+ *    File: stage.h
+ ***************************************************************************/
+
+#ifndef __STAGE_H__
+#define __STAGE_H__
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/************System include***********************************************/
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+/************Private include**********************************************/
+#include "interpreter.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#undef EXTERN
+#ifdef __STAGE_IMPL__
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+/* what StageIn and StageOut return for a ring; it is above any limit
+ * on descriptors, so any system call on it fails with EBADF, but it is
+ * not negative, which would look like an error */
+#define STAGE_RING INT_MAX
+
+/* a pipe in memory between two builtins of a pipeline */
+typedef struct ring_t ringT;
+
+/* a builtin of a pipeline that runs as a thread. The descriptors it is
+ * given are its own, and are closed as soon as it is done */
+typedef struct stage_t
+{
+  commandT* cmd;
+  int (*run)(commandT*);               /* a builtin of the shell, */
+  int (*plugin)(commandT*, int, int);  /* or one of a plugin */
+  int in;               /* what it reads, -1 for stdin of the shell */
+  int out;              /* what it writes, -1 for stdout of the shell */
+  ringT* inring;        /* the ring it reads instead, or NULL */
+  ringT* outring;       /* the ring it writes instead, or NULL */
+  /* the rest is set by StageStart and the thread */
+  int status;
+  bool started;
+  pthread_t thread;
+  FILE* file;           /* its stdout, for the builtins that use stdio */
+  atomic_bool done;
+  atomic_bool cancelled;
+} stageT;
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: Make a ring
+ * ---------------------------------------------------------------------
+ *    Purpose: Makes the ring between two stages, which the one reading
+ *    it frees when it is joined.
+ *    Input: void
+ *    Output: the ring
+ ***********************************************************************/
+EXTERN ringT*
+StageRing();
+
+/***********************************************************************
+ *  Title: Start a stage
+ * ---------------------------------------------------------------------
+ *    Purpose: Starts a thread running the builtin with the descriptors
+ *    and rings of the stage. If no thread can be started, the stage is
+ *    done right away, with status 1.
+ *    Input: the stage, with the fields before status filled in
+ *    Output: FALSE if it could not be started
+ ***********************************************************************/
+EXTERN bool
+StageStart(stageT*);
+
+/***********************************************************************
+ *  Title: Whether a stage is done
+ * ---------------------------------------------------------------------
+ *    Purpose: Tells whether the builtin returned and its descriptors
+ *    and rings are closed. EventWait returns whenever a stage is done.
+ *    Input: the stage
+ *    Output: TRUE if it is done
+ ***********************************************************************/
+EXTERN bool
+StageDone(stageT*);
+
+/***********************************************************************
+ *  Title: Cancel a stage
+ * ---------------------------------------------------------------------
+ *    Purpose: Makes the stage find its input at an end and its output
+ *    closed, and interrupts the system call it may be blocked in.
+ *    Threads cannot be stopped or killed like processes, so this is
+ *    how SIGINT ends them. As a signal may come just before the call
+ *    that blocks, it is sent again until the stage is done.
+ *    Input: the stage
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+StageCancel(stageT*);
+
+/***********************************************************************
+ *  Title: Join a stage
+ * ---------------------------------------------------------------------
+ *    Purpose: Waits for the thread of the stage and frees the ring it
+ *    read. The stages are joined in order, so that the stage writing a
+ *    ring is gone before it is freed.
+ *    Input: the stage
+ *    Output: its exit status
+ ***********************************************************************/
+EXTERN int
+StageJoin(stageT*);
+
+/***********************************************************************
+ *  Title: Forget the stages of the parent
+ * ---------------------------------------------------------------------
+ *    Purpose: A forked subshell has none of the threads of the shell
+ *    and an event loop of its own, so it starts afresh.
+ *    Input: void
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+StageFork();
+
+/***********************************************************************
+ *  Title: The stdin and stdout of a builtin
+ * ---------------------------------------------------------------------
+ *    Purpose: In a stage, the descriptors or rings it was given, else
+ *    STDIN_FILENO and STDOUT_FILENO. A builtin that reads or writes
+ *    them has to go through StageRead and StageWrite, and look at them
+ *    with StageStat.
+ *    Input: void
+ *    Output: a descriptor or STAGE_RING
+ ***********************************************************************/
+EXTERN int
+StageIn();
+
+EXTERN int
+StageOut();
+
+/***********************************************************************
+ *  Title: The stdout of a builtin for stdio
+ * ---------------------------------------------------------------------
+ *    Purpose: In a stage, a stream of its own that writes through
+ *    StageWrite, else stdout.
+ *    Input: void
+ *    Output: the stream
+ ***********************************************************************/
+EXTERN FILE*
+StageStdout();
+
+/***********************************************************************
+ *  Title: Read and write like a builtin
+ * ---------------------------------------------------------------------
+ *    Purpose: Like read(2) and write(2), but STAGE_RING reads and
+ *    writes the rings of the stage, without a system call unless one
+ *    side has to wait for the other. A cancelled stage reads nothing
+ *    more, and its writes fail with EPIPE, which a builtin does not
+ *    complain about. Unlike write(2), StageWrite writes all of a
+ *    buffer to a ring.
+ *    Input: a descriptor or STAGE_RING, the buffer and its size
+ *    Output: what read(2) and write(2) return
+ ***********************************************************************/
+EXTERN ssize_t
+StageRead(int, void*, size_t);
+
+EXTERN ssize_t
+StageWrite(int, const void*, size_t);
+
+/***********************************************************************
+ *  Title: Look at what a builtin reads or writes
+ * ---------------------------------------------------------------------
+ *    Purpose: Like fstat(2), but a ring looks like a pipe.
+ *    Input: a descriptor or STAGE_RING, and where to put its status
+ *    Output: what fstat(2) returns
+ ***********************************************************************/
+EXTERN int
+StageStat(int, struct stat*);
+
+/***********************************************************************
+ *  Title: Whether a builtin was cancelled
+ * ---------------------------------------------------------------------
+ *    Purpose: For the system calls a builtin makes itself, which fail
+ *    with EINTR when the stage is cancelled.
+ *    Input: void
+ *    Output: TRUE if the stage of this thread was cancelled
+ ***********************************************************************/
+EXTERN bool
+StageCancelled();
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __STAGE_H__ */
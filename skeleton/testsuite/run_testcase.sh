@@ -48,6 +48,7 @@ sh ${TC_DIR}/setup.sh;
 cp ${TC_DIR}/${SDRIVER} .;
 cp ${TC_DIR}/${ORIG} .;
 gcc ${TC_DIR}/myspin.c -o myspin
+gcc -D HAVE_CONFIG_H -I${SRCDIR} -shared -fPIC -o sample.so ${TC_DIR}/../plugins/sample.c
 
 # Compile the code
 echo "COMPILE"
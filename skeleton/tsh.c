@@ -19,12 +19,15 @@
 #include <sys/wait.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 
 /************Private include**********************************************/
 #include "tsh.h"
 #include "io.h"
 #include "interpreter.h"
 #include "runtime.h"
+#include "event.h"
+#include "snapshot.h"
 
 /************Defines and Typedefs*****************************************/
 /*  #defines and typedefs should have their names in all caps.
@@ -33,12 +36,25 @@
  *  structures and arrays, line everything up in neat columns.
  */
 
-#define BUFSIZE 80
+/* the most phases --startup-profile reports */
+#define MAXPHASES 8
+
+/* the end of a phase of the startup */
+typedef struct phase_t
+{
+  const char* name;
+  struct timespec at;
+} phaseT;
 
 /************Global Variables*********************************************/
 
+/* whether --startup-profile was given, and the phases timed so far */
+static bool profiling = FALSE;
+static phaseT phases[MAXPHASES];
+static int nphases = 0;
+
 /************Function Prototypes******************************************/
-/* handles SIGINT and SIGSTOP signals */
+/* handles the signals EventWait reads */
 static void 
 sig(int);
 /* reaps all finished child processes */
@@ -47,6 +63,12 @@ reap_children();
 /* processes the tshrc file */
 static void 
 process_tshrc();
+/* marks the end of a phase of the startup */
+static void
+phase(const char*);
+/* prints how long each phase of the startup took */
+static void
+printprofile();
 /************External Declaration*****************************************/
 
 /**************Implementation***********************************************/
@@ -58,57 +80,106 @@ process_tshrc();
  *   int argc: the number of arguments provided on the command line
  *   char *argv[]: array of strings provided on the command line
  *
- * returns: int: 0 = OK, else error
+ * returns: int: the exit status of the last command line
  *
  * This sets up signal handling and implements the main loop of tsh.
+ * Given a script and its arguments, or -c and a command string, tsh
+ * runs those lines instead of reading stdin, like a non-interactive
+ * bash: without job control and without ~/.tshrc, unless --rc is
+ * given. Everything else is set up once it is needed, so that such a
+ * shell starts quickly.
  */
 int
 main(int argc, char *argv[])
 {
-  /* Initialize command buffer */
-  char* cmdLine = malloc(sizeof(char*) * BUFSIZE);
+  /* the line being run, in the input buffer */
+  char* cmdLine;
+  char* command = NULL;
+  int status = 0;
+  int arg;
+  bool fromstdin;
+  bool rc = FALSE;
+
+  phase(NULL);
+  for (arg = 1; arg < argc && argv[arg][0] == '-' && command == NULL; arg++)
+    {
+      if (strcmp(argv[arg], "--startup-profile") == 0)
+        profiling = TRUE;
+      else if (strcmp(argv[arg], "--rc") == 0)
+        rc = TRUE;
+      else if (strcmp(argv[arg], "-c") == 0 && arg + 1 < argc)
+        command = argv[++arg];
+      else
+        {
+          fprintf(stderr, "%s: %s: %s\n", SHELLNAME, argv[arg],
+                  strcmp(argv[arg], "-c") == 0 ? "option requires an argument"
+                  : "invalid option");
+          fprintf(stderr, "usage: %s [--rc] [--startup-profile] "
+                  "[-c command [name [arg ...]] | script [arg ...]]\n",
+                  SHELLNAME);
+          return 2;
+        }
+    }
+  phase("options");
+
+  fromstdin = (command == NULL && arg == argc);
+  // as in sh -c, the first argument after the command is $0
+  if (arg < argc)
+    SetArgs(argc - arg, argv + arg);
+  else
+    SetArgs(1, argv);
 
   /* shell initialization */
-  if (signal(SIGINT, sig) == SIG_ERR)
-    PrintPError("SIGINT");
-  if (signal(SIGTSTP, sig) == SIG_ERR)
-    PrintPError("SIGTSTP");
-  if (signal(SIGCHLD, sig) == SIG_ERR)
-    PrintPError("SIGCHLD");
+  EventInit(sig);
+  if (!fromstdin)
+    DisableJobControl();
+  phase("signals");
+
+  RaiseFdLimit();
+  phase("fd limit");
 
   fgpid = -1;
 
-  process_tshrc();
+  // the rc file is read through the same input as the script, and so
+  // has to come first
+  if (fromstdin || rc)
+    process_tshrc();
+  phase("rc");
+
+  if (command != NULL)
+    OpenCommandString(command);
+  else if (!fromstdin && !OpenScript(argv[arg]))
+    {
+      PrintPError(argv[arg]);
+      return 127;
+    }
+  phase("input");
+
+  if (profiling)
+    printprofile();
 
   while (!forceExit) /* repeat forever */
     {
       /* print prompt */
       //printf("tsh>");
       
-      /* read command line */
-      getCommandLine(&cmdLine, BUFSIZE);
-
+      /* read command line; the end of the input is like exit */
+      if ((cmdLine = getCommandLine()) == NULL)
+        break;
 
-      if (strcmp(cmdLine, "exit") == 0) {
-	//printf("quitting...\n");
-        forceExit = TRUE;
-	fflush(stdout);
-	continue;
-      }
 
-      /* checks the status of background jobs */
-      CheckJobs();
+      /* checks the status of background jobs, except on the way out */
+      if (strcmp(cmdLine, "exit") != 0)
+        CheckJobs();
  
       /* interpret command and line
        * includes executing of commands */
-      Interpret(cmdLine);
+      status = Interpret(cmdLine);
 
     }
 
   /* shell termination */
-  free(cmdLine);
-  
-  return 0;
+  return status;
 } /* main */
 
 /*
@@ -119,7 +190,9 @@ main(int argc, char *argv[])
  *
  * returns: none
  *
- * This should handle signals sent to tsh.
+ * This should handle signals sent to tsh. It is called from EventWait,
+ * never asynchronously. Jobs that finish while the shell is waiting for
+ * input are reported right away.
  */
 static void
 sig(int signo)
@@ -128,8 +201,11 @@ sig(int signo)
     IntFgProc();
   if (signo == SIGTSTP)
     StopFgProc();
-  if (signo == SIGCHLD)
+  if (signo == SIGCHLD) {
     reap_children();
+    if (IsReading())
+      CheckJobs();
+  }
 } /* sig */
 
 /*
@@ -139,27 +215,73 @@ sig(int signo)
  *
  * returns: none
  *
- * Reap all stoped child processes.
+ * Reap all stoped child processes. Finished ones are reaped through
+ * their pidfds, except for those that have none.
  */
 static void
 reap_children()
 {
-  int status = 0;
-  int pid = 0;
-  do 
+  siginfo_t info;
+  // without job control, the shell stops along with its children
+  while (jobControl)
     {
-      pid = waitpid(-1, &status, WNOHANG | WUNTRACED);
-      // if fg process has stopped, update fgpid
-      if (pid == fgpid)
-	fgpid = -1;
-      if (WIFSTOPPED(status)) {
-	updatebgjob(pid, STOPPED);
-      }
-      else
-	updatebgjob(pid, DONE);
-    } while (pid > 0);
+      // WSTOPPED without WEXITED leaves finished children alone
+      memset(&info, 0, sizeof(info));
+      if (waitid(P_ALL, 0, &info, WSTOPPED | WNOHANG) < 0 ||
+	  info.si_pid == 0)
+	break;
+      // updatebgjob resets fgpid once the fg job stops
+      updatebgjob(info.si_pid, STOPPED);
+    }
+  ReapUntracked();
 } /*reap_children */
 
+/*
+ * phase
+ *
+ * arguments:
+ *   const char *name: the phase that just ended, NULL at the start
+ *
+ * returns: none
+ *
+ * Phases are timed whether or not --startup-profile was given, which
+ * is only known once the options are read; reading the clock costs
+ * next to nothing.
+ */
+static void
+phase(const char* name)
+{
+  if (nphases == MAXPHASES)
+    return;
+  phases[nphases].name = name;
+  clock_gettime(CLOCK_MONOTONIC, &phases[nphases].at);
+  nphases++;
+} /* phase */
+
+/*
+ * printprofile
+ *
+ * arguments: none
+ *
+ * returns: none
+ *
+ * Prints the time each phase of the startup took to stderr, in
+ * microseconds.
+ */
+static void
+printprofile()
+{
+  int i;
+
+  for (i = 1; i < nphases; i++)
+    fprintf(stderr, "%-10s %8.1f us\n", phases[i].name,
+            (phases[i].at.tv_sec - phases[i - 1].at.tv_sec) * 1e6 +
+            (phases[i].at.tv_nsec - phases[i - 1].at.tv_nsec) / 1e3);
+  fprintf(stderr, "%-10s %8.1f us\n", "total",
+          (phases[nphases - 1].at.tv_sec - phases[0].at.tv_sec) * 1e6 +
+          (phases[nphases - 1].at.tv_nsec - phases[0].at.tv_nsec) / 1e3);
+} /* printprofile */
+
 /*
  * process_tshrc
  *
@@ -174,8 +296,8 @@ process_tshrc()
 {
   char *homedir;
   char *fpath;
+  char *line;
   struct stat st;
-  FILE *tshrc_file;
   const char *fname = ".tshrc";
 
   // set up path to ~/.tshrc
@@ -185,16 +307,15 @@ process_tshrc()
   strcat(fpath, "/");
   strcat(fpath, fname);
 
-  // if ~/.tshrc exists, read it and interpret non-comment lines
-  if (stat(fpath, &st) == 0) {
-    tshrc_file = fopen(fpath, "r");
-    char line[128];
-    while (fgets(line, sizeof(line), tshrc_file) != NULL) {
-      if (line[0] != '#') {
-	Interpret(line);
-      }
-    }
-    fclose(tshrc_file);
+  // if ~/.tshrc exists, read it and interpret non-comment lines, unless
+  // a snapshot of what it did last time can be restored instead
+  if (stat(fpath, &st) == 0 && !SnapshotLoad(fpath, &st) &&
+      OpenRcFile(fpath)) {
+    SnapshotRecord();
+    while ((line = getCommandLine()) != NULL)
+      Interpret(line);
+    CloseScript();
+    SnapshotSave(fpath, &st);
   }
   free(fpath);
 }
@@ -0,0 +1,100 @@
+/***************************************************************************
+ *  Title: Plugins
+ * -------------------------------------------------------------------------
+ *    Purpose: What a shared object has to export so that enable -f can
+ *    load builtins from it
+ *    File: tshplugin.h
+ ***************************************************************************/
+/***************************************************************************
+ *  A plugin exports a tshpluginT named tsh_plugin, whose version is the
+ *  TSH_PLUGIN_VERSION it was built with, and which lists its builtins:
+ *
+ *      static int
+ *      runhello(commandT* cmd, int in, int out)
+ *      {
+ *        dprintf(out, "hello, %s\n", cmd->argc > 1 ? cmd->argv[1] : "world");
+ *        return 0;
+ *      }
+ *
+ *      static const tshbuiltinT builtins[] = {
+ *        { "hello", runhello, TSH_BUILTIN_PURE | TSH_BUILTIN_PIPE, NULL },
+ *        { NULL }
+ *      };
+ *
+ *      const tshpluginT tsh_plugin = { TSH_PLUGIN_VERSION, builtins };
+ *
+ *  It is built against the headers of the shell, with the same flags:
+ *
+ *      gcc -D HAVE_CONFIG_H -I. -shared -fPIC -o hello.so hello.c
+ *
+ *  A builtin with TSH_BUILTIN_PIPE may run in a thread of the shell, next
+ *  to the other builtins of a pipeline, so it must be reentrant and only
+ *  use in and out. When the pipeline is ended by SIGINT or SIGTSTP, what
+ *  it is blocked in fails with EINTR, and it is expected to return.
+ *
+ *  The version changes whenever commandT or these structures change, so
+ *  that the shell refuses a plugin that would read them wrong.
+ ***************************************************************************/
+
+#ifndef __TSHPLUGIN_H__
+#define __TSHPLUGIN_H__
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/************System include***********************************************/
+
+/************Private include**********************************************/
+#include "interpreter.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/* the version of this interface */
+#define TSH_PLUGIN_VERSION 2
+
+/* the name of the tshpluginT a plugin exports */
+#define TSH_PLUGIN_SYMBOL  "tsh_plugin"
+
+/* what a builtin of a plugin may do */
+#define TSH_BUILTIN_PURE   0x1  /* changes nothing of the shell, such as
+                                   its directory, environment or signals */
+#define TSH_BUILTIN_PIPE   0x2  /* only reads in, writes out and stderr,
+                                   and keeps no state of its own, so that
+                                   a pipeline can run it in a thread */
+#define TSH_BUILTIN_INPUT  0x4  /* reads in */
+
+/* a builtin of a plugin. run gets the expanded command, whose argv[0]
+ * is the name, and the descriptors to read and write instead of stdin
+ * and stdout; it returns the exit status. With opts, the builtin only
+ * runs with the options listed there, each a letter followed by # if
+ * it takes a number, and the command in the PATH runs with any other */
+typedef struct tshbuiltin_t
+{
+  const char* name;
+  int (*run)(commandT*, int, int);
+  int flags;
+  const char* opts;
+} tshbuiltinT;
+
+/* what a plugin exports as TSH_PLUGIN_SYMBOL */
+typedef struct tshplugin_t
+{
+  int version;                  /* TSH_PLUGIN_VERSION */
+  const tshbuiltinT* builtins;  /* ended by one without a name */
+} tshpluginT;
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __TSHPLUGIN_H__ */